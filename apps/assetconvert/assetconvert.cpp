@@ -0,0 +1,160 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgDB/ReadFile>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+
+#include <backdropFX/AssetLoader.h>
+
+#include <iostream>
+
+
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " converts a texture image to a backdropFX AssetLoader container." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " -i <file> [options]" );
+    usage->addCommandLineOption( "-i <file>", "Image to convert." );
+    usage->addCommandLineOption( "-o <file>", "Container to write. Default: input name with .bdfxtex extension." );
+    usage->addCommandLineOption( "--normal <scale>", "Write a normal map derived from the image as height." );
+    usage->addCommandLineOption( "--nocompress", "Don't DXT compress." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    std::string inFile;
+    arguments.read( "-i", inFile );
+    std::string outFile;
+    arguments.read( "-o", outFile );
+    float normalScale( 0.f );
+    const bool normalMap( arguments.read( "--normal", normalScale ) );
+    const bool noCompress( arguments.read( "--nocompress" ) );
+
+    if( inFile.empty() )
+    {
+        std::cerr << "Specify an image with -i." << std::endl;
+        usage->write( std::cerr );
+        return( 1 );
+    }
+    if( outFile.empty() )
+        outFile = backdropFX::AssetLoader::getContainerFileName( inFile );
+
+    osg::Timer timer;
+    timer.setStartTick();
+    osg::ref_ptr< osg::Image > image( osgDB::readImageFile( inFile ) );
+    if( !( image.valid() ) )
+    {
+        std::cerr << "Can't read " << inFile << std::endl;
+        return( 1 );
+    }
+    const double decodeTime( timer.time_m() );
+
+    // Normal maps are never compressed; DXT1 blocks distort normals.
+    timer.setStartTick();
+    osg::ref_ptr< osg::Image > converted;
+    if( normalMap )
+        converted = backdropFX::AssetLoader::createNormalMap( image.get(), normalScale );
+    else
+        converted = backdropFX::AssetLoader::convertImage( image.get(), !noCompress );
+    if( !( converted.valid() ) )
+    {
+        std::cerr << "Can't convert " << inFile << std::endl;
+        return( 1 );
+    }
+    const double convertTime( timer.time_m() );
+
+    if( !( backdropFX::AssetLoader::writeContainer( converted.get(), outFile ) ) )
+    {
+        std::cerr << "Can't write " << outFile << std::endl;
+        return( 1 );
+    }
+    std::cout << "Wrote " << outFile << ": " << converted->s() << "x" << converted->t() <<
+        ", " << converted->getNumMipmapLevels() << " levels, converted in " <<
+        convertTime << " ms." << std::endl;
+
+    // Compare load times.
+    timer.setStartTick();
+    osg::ref_ptr< osg::Image > loaded( backdropFX::AssetLoader::readContainer( outFile ) );
+    const double loadTime( timer.time_m() );
+    if( !( loaded.valid() ) )
+    {
+        std::cerr << "Can't read back " << outFile << std::endl;
+        return( 1 );
+    }
+    std::cout << "  " << inFile << " decode: " << decodeTime << " ms (without mipmaps)." << std::endl;
+    std::cout << "  " << outFile << " load: " << loadTime << " ms." << std::endl;
+
+    return( 0 );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page assetconvertapp App: assetconvert
+
+Converts a texture image to an AssetLoader container: a complete, box
+filtered mipmap chain, DXT1 compressed (DXT5 for images with alpha) unless
+--nocompress is specified. Place the container next to the original image in
+the data path. AssetLoader::readImage() then loads it instead of decoding the
+original. The app prints the time to decode the original and to load the
+container.
+
+The Moon uses two containers. Convert its texture and normal map with:
+
+\code
+assetconvert -i moon.jpg
+assetconvert -i moon.jpg -o moon-normal.bdfxtex --normal 2
+\endcode
+
+Convert the SurfaceUtils textures with:
+
+\code
+assetconvert -i ConcreteDarken.png
+assetconvert -i ConcreteBump.png --nocompress
+\endcode
+
+The concrete shader differentiates the heights in ConcreteBump.png, which
+needs exact texel values. Don't convert permTexture.png, the lookup table for
+the noise shaders. SurfaceUtils always reads it from the original file.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-i <file></b></td>
+    <td>Image to convert. Must be an 8-bit luminance, luminance alpha, RGB, or RGBA image.</td>
+  </tr>
+  <tr>
+    <td><b>-o <file></b></td>
+    <td>Container to write. Default: the input name with a .bdfxtex extension.</td>
+  </tr>
+  <tr>
+    <td><b>--normal <scale></b></td>
+    <td>Write an uncompressed tangent space normal map derived from the image as
+    height instead (see AssetLoader::createNormalMap()).</td>
+  </tr>
+  <tr>
+    <td><b>--nocompress</b></td>
+    <td>Store mipmaps without DXT compression.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+*/
+
+
+// backdropFX
+}
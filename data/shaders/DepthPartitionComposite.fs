@@ -0,0 +1,28 @@
+#extension GL_EXT_texture_array : enable
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+
+uniform sampler2DArray bdfx_partitionColor;
+uniform sampler2DArray bdfx_partitionDepth;
+uniform int bdfx_partitionCount;
+varying vec2 oTC;
+
+void main( void )
+{
+    // Layer 0 is the farthest partition. Composite each
+    // nearer layer over the accumulated result.
+    vec4 result = vec4( 0. );
+    for( int idx=0; idx<bdfx_partitionCount; idx++ )
+    {
+        vec4 color = texture2DArray( bdfx_partitionColor, vec3( oTC, float( idx ) ) );
+        result = vec4( color.rgb * color.a, color.a ) + result * ( 1. - color.a );
+    }
+
+    // Premultiplied alpha. Blended with ONE, ONE_MINUS_SRC_ALPHA.
+    gl_FragColor = result;
+
+    // Leave the nearest partition's depth in the destination, as the
+    // last of multiple passes would.
+    gl_FragDepth = texture2DArray( bdfx_partitionDepth,
+        vec3( oTC, float( bdfx_partitionCount - 1 ) ) ).r;
+}
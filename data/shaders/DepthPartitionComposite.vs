@@ -0,0 +1,11 @@
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+
+varying vec2 oTC;
+
+void main( void )
+{
+    // Create tex coords in the range 0 to 1.
+    oTC = (gl_Vertex.xy + 1.0) * 0.5;
+
+    gl_Position = gl_Vertex;
+}
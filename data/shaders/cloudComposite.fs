@@ -0,0 +1,63 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Upsamples the reduced resolution CloudStage texture over the sky.
+// Each of the four nearest texels is weighted by its bilinear weight and
+// by how close its distance to the cloud plane is to this pixel's, so
+// texels across the horizon, or much nearer or farther, don't bleed in.
+
+uniform mat4 invViewProj;
+uniform vec3 up;
+
+uniform sampler2D bdfx_cloudMap;
+// Width, height, 1/width, 1/height.
+uniform vec4 bdfx_cloudMapSize;
+
+varying vec2 ndc;
+
+const float sharpness = 4.0;
+
+// Sine of the elevation of the view direction at v.
+float elevation( vec2 v )
+{
+    vec4 p = invViewProj * vec4( v, 1.0, 1.0 );
+    return( dot( normalize( p.xyz / p.w ), up ) );
+}
+
+// The distance to the cloud plane is proportional to 1/elevation,
+// so the difference of logs is the log of the distance ratio.
+void tap( vec2 texel, float bilinear, float logMu, inout vec4 sum, inout float weightSum )
+{
+    texel = clamp( texel, vec2( 0.0 ), bdfx_cloudMapSize.xy - 1.0 );
+    vec2 uv = ( texel + 0.5 ) * bdfx_cloudMapSize.zw;
+    float mu = max( elevation( uv * 2.0 - 1.0 ), 0.001 );
+    float w = bilinear * ( exp( -sharpness * abs( log( mu ) - logMu ) ) + 0.001 );
+    sum += w * texture2D( bdfx_cloudMap, uv );
+    weightSum += w;
+}
+
+void main()
+{
+    float mu = elevation( ndc );
+    if( mu < 0.01 )
+    {
+        // Premultiplied alpha, so transparent black leaves the sky unchanged.
+        gl_FragColor = vec4( 0.0 );
+        return;
+    }
+    float logMu = log( mu );
+
+    vec2 texel = ( ndc * 0.5 + 0.5 ) * bdfx_cloudMapSize.xy - 0.5;
+    vec2 base = floor( texel );
+    vec2 f = texel - base;
+
+    vec4 sum = vec4( 0.0 );
+    float weightSum = 0.0;
+    tap( base, ( 1.0 - f.x ) * ( 1.0 - f.y ), logMu, sum, weightSum );
+    tap( base + vec2( 1.0, 0.0 ), f.x * ( 1.0 - f.y ), logMu, sum, weightSum );
+    tap( base + vec2( 0.0, 1.0 ), ( 1.0 - f.x ) * f.y, logMu, sum, weightSum );
+    tap( base + vec2( 1.0, 1.0 ), f.x * f.y, logMu, sum, weightSum );
+
+    // Premultiplied alpha.
+    // TBD GL3
+    gl_FragColor = sum / max( weightSum, 1e-6 );
+}
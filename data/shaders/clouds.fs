@@ -0,0 +1,62 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Cloud layer, rendered at reduced resolution into the CloudStage
+// texture. Color is premultiplied by alpha. cloudComposite.fs
+// upsamples the result over the sky.
+
+uniform mat4 invViewProj;
+uniform vec3 up;
+uniform vec3 bdfx_east;
+uniform vec3 bdfx_north;
+uniform vec3 bdfx_sunPosition;
+
+uniform sampler2D bdfx_cloudNoise;
+uniform float bdfx_cloudCoverage;
+// Altitude of the cloud plane, and wind advection, in noise tiles.
+uniform float bdfx_cloudHeight;
+uniform vec2 bdfx_cloudOffset;
+
+varying vec2 ndc;
+
+void main()
+{
+    // World direction of this pixel. viewProj has no translation.
+    vec4 p = invViewProj * vec4( ndc, 1.0, 1.0 );
+    vec3 dir = normalize( p.xyz / p.w );
+
+    // The view ray never reaches the cloud plane at or below the horizon.
+    float mu = dot( dir, up );
+    if( mu < 0.01 )
+    {
+        gl_FragColor = vec4( 0.0 );
+        return;
+    }
+
+    // Where the view ray meets the cloud plane.
+    vec2 tc = vec2( dot( dir, bdfx_east ), dot( dir, bdfx_north ) ) *
+        ( bdfx_cloudHeight / mu ) + bdfx_cloudOffset;
+
+    // Three octaves, one noise channel each. Integer frequencies keep
+    // the sum periodic in whole tiles, so SkyDome can wrap the offset.
+    float n = 0.571 * texture2D( bdfx_cloudNoise, tc ).r +
+        0.286 * texture2D( bdfx_cloudNoise, tc * 2.0 + vec2( 0.37, 0.71 ) ).g +
+        0.143 * texture2D( bdfx_cloudNoise, tc * 4.0 + vec2( 0.53, 0.19 ) ).b;
+
+    float density = clamp( ( n - ( 1.0 - bdfx_cloudCoverage ) ) / 0.3, 0.0, 1.0 );
+    density = density * density * ( 3.0 - 2.0 * density );
+
+    // Fade distant clouds into the horizon.
+    float alpha = density * smoothstep( 0.01, 0.15, mu );
+
+    // Sunlight is white by day, reddened near the horizon, and dim at
+    // night. Thick cloud is darker; thin cloud toward the Sun is brighter.
+    float sunElevation = dot( bdfx_sunPosition, up );
+    vec3 sunColor = mix( vec3( 1.0, 0.55, 0.35 ), vec3( 1.0 ),
+        smoothstep( 0.0, 0.3, sunElevation ) );
+    float light = mix( 0.08, 1.0, smoothstep( -0.15, 0.1, sunElevation ) );
+    float forward = pow( max( dot( dir, bdfx_sunPosition ), 0.0 ), 8.0 ) * ( 1.0 - density );
+    vec3 color = sunColor * light * ( 1.0 - 0.45 * density + 0.5 * forward );
+
+    // TBD GL3
+    gl_FragColor = vec4( color * alpha, alpha );
+}
@@ -0,0 +1,16 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/alphaBlend-pointwise.fs
+
+// Pointwise form of alphaBlend.fs. EffectGraph fuses it with adjacent
+// pointwise Effects; color is input 0 at tc.
+
+vec4 pointwise( vec4 color, vec2 tc )
+{
+    vec4 color1 = texture2D( inputTexture1, tc );
+    float aVal = texture2D( inputTexture2, tc ).r;
+
+    vec3 blend = mix( color1.rgb, color.rgb, aVal );
+    return( vec4( blend, 1.0 ) );
+}
+
+// effects/alphaBlend-pointwise.fs
@@ -0,0 +1,47 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/bilateralUpsample.fs
+
+// Upsamples the reduced resolution input 0. Each of the four nearest
+// texels is weighted by its bilinear weight and by how close the guide
+// (red channel of input 1) at the texel is to the guide at this pixel, so
+// texels across an edge in the guide don't bleed in.
+
+
+// Width, height, 1/width, 1/height of input 0.
+uniform vec4 inputSize;
+
+const float sharpness = 16.0;
+
+void tap( vec2 texel, float bilinear, float guide, inout vec4 sum, inout float weightSum )
+{
+    // Stay inside the area that was rendered.
+    texel = clamp( texel, vec2( 0.0 ), texturePercent * inputSize.xy - 1.0 );
+    vec2 uv = ( texel + 0.5 ) * inputSize.zw;
+    float texelGuide = texture2D( inputTexture1, uv ).r;
+    float w = bilinear * ( exp( -sharpness * abs( texelGuide - guide ) ) + 0.001 );
+    sum += w * texture2D( inputTexture0, uv );
+    weightSum += w;
+}
+
+void main( void )
+{
+    float guide = texture2D( inputTexture1, oTC ).r;
+
+    vec2 texel = oTC * inputSize.xy - 0.5;
+    vec2 base = floor( texel );
+    vec2 f = texel - base;
+
+    vec4 sum = vec4( 0.0 );
+    float weightSum = 0.0;
+    tap( base, ( 1.0 - f.x ) * ( 1.0 - f.y ), guide, sum, weightSum );
+    tap( base + vec2( 1.0, 0.0 ), f.x * ( 1.0 - f.y ), guide, sum, weightSum );
+    tap( base + vec2( 0.0, 1.0 ), ( 1.0 - f.x ) * f.y, guide, sum, weightSum );
+    tap( base + vec2( 1.0, 1.0 ), f.x * f.y, guide, sum, weightSum );
+
+    gl_FragColor = sum / max( weightSum, 1e-6 );
+}
+
+// effects/bilateralUpsample.fs
@@ -0,0 +1,18 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/bilateralUpsample.vs
+
+
+void main( void )
+{
+    // Create tex coords in the range 0 to 1.
+    oTC = (gl_Vertex.xy + 1.0) * 0.5;
+    // Limit tex coords by the visible area of the texture.
+    oTC *= texturePercent;
+
+    gl_Position = gl_Vertex;
+}
+
+// effects/bilateralUpsample.vs
@@ -0,0 +1,13 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/combine-pointwise.fs
+
+// Pointwise form of combine.fs. EffectGraph fuses it with adjacent
+// pointwise Effects; color is input 0 at tc.
+
+vec4 pointwise( vec4 color, vec2 tc )
+{
+    vec4 color1 = texture2D( inputTexture1, tc );
+    return( color + color1 );
+}
+
+// effects/combine-pointwise.fs
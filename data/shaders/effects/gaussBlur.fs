@@ -0,0 +1,32 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/gaussBlur.fs
+
+// One pass of a separable Gaussian blur. getGaussianBlurProgram() defines
+// GAUSS_TAPS and GAUSS_MAX_TAPS ahead of this source, and GaussianKernel
+// sets the uniforms.
+
+// ( offset, weight ) of each tap, from computeGaussianKernel(). Tap 0 is the
+// center. The others fall between two texels, so one bilinear fetch on each
+// side reads two texels.
+uniform vec2 gaussKernel[ GAUSS_MAX_TAPS ];
+// Texture coordinate offset of one texel along the pass axis.
+uniform vec2 gaussStep;
+
+
+void main( void )
+{
+    vec4 result = texture2D( inputTexture0, oTC ) * gaussKernel[ 0 ].y;
+
+    int idx;
+    for( idx=1; idx<GAUSS_TAPS; idx++ )
+    {
+        vec2 offset = gaussStep * gaussKernel[ idx ].x;
+        result += ( texture2D( inputTexture0, oTC + offset ) +
+            texture2D( inputTexture0, oTC - offset ) ) * gaussKernel[ idx ].y;
+    }
+
+    gl_FragData[ 0 ] = result;
+}
@@ -0,0 +1,21 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/glowCombine-pointwise.fs
+
+// Pointwise form of glowCombine.fs. EffectGraph fuses it with adjacent
+// pointwise Effects; color is input 0 at tc.
+
+vec4 pointwise( vec4 color, vec2 tc )
+{
+    const float glowStrength = 6.0;
+
+    vec3 glow = texture2D( inputTexture1, tc ).rgb;
+    glow *= glowStrength;
+
+    vec3 stencil = texture2D( inputTexture2, tc ).rgb;
+    float stencilGlowValue = clamp( length( stencil ), 0.0, 1.0 ) * 0.95;
+    glow = ( 1.0 - stencilGlowValue ) * glow;
+
+    return( vec4( color.rgb + glow, 1.0 ) );
+}
+
+// effects/glowCombine-pointwise.fs
@@ -0,0 +1,14 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/scaleBias-pointwise.fs
+
+// Pointwise form of scaleBias.fs. EffectGraph fuses it with adjacent
+// pointwise Effects; color is input 0 at tc.
+
+uniform vec2 scaleBias;
+
+vec4 pointwise( vec4 color, vec2 tc )
+{
+    return( vec4( color.rgb * scaleBias.x + scaleBias.y, color.a ) );
+}
+
+// effects/scaleBias-pointwise.fs
@@ -0,0 +1,17 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/scaleBias.fs
+
+
+// x is the scale, y is the bias.
+uniform vec2 scaleBias;
+
+void main( void )
+{
+    vec4 color = texture2D( inputTexture0, oTC );
+    gl_FragColor = vec4( color.rgb * scaleBias.x + scaleBias.y, color.a );
+}
+
+// effects/scaleBias.fs
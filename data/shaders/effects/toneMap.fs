@@ -0,0 +1,30 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/toneMap.fs
+
+// Reinhard's operator. Scales input 0 so the adapted average luminance
+// maps to toneMapKey, then compresses it so the adapted maximum maps to
+// white. Scenes whose scaled maximum is below 1.0 stay linear.
+
+
+// 1x1: mean log luminance in red, maximum log luminance in green.
+uniform sampler2D adaptedLuminance;
+uniform float toneMapKey;
+
+const vec3 lumWeights = vec3( 0.2126, 0.7152, 0.0722 );
+
+
+void main( void )
+{
+    vec4 color = texture2D( inputTexture0, oTC );
+    vec2 logLum = texture2D( adaptedLuminance, vec2( 0.5 ) ).rg;
+
+    float scale = toneMapKey / exp( logLum.r );
+    float white = max( exp( logLum.g ) * scale, 1.0 );
+    float lum = dot( color.rgb, lumWeights ) * scale;
+    float mapped = lum * ( 1.0 + lum / ( white * white ) ) / ( 1.0 + lum );
+
+    gl_FragData[ 0 ] = vec4( color.rgb * scale * ( mapped / max( lum, 0.0001 ) ), color.a );
+}
@@ -1,8 +1,8 @@
 
 BDFX INCLUDE shaders/effects/declarations.common
 
-// Copyright (c) 2010 Skew Matrix Software. All rights reserved.
-// effects/glow0a.vs
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/toneMap.vs
 
 
 void main( void )
@@ -0,0 +1,58 @@
+
+BDFX INCLUDE shaders/effects/declarations.common
+
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+// effects/toneMapReduce.fs
+
+// Luminance reduction for EffectToneMapping. Writes the mean log luminance
+// to red and the maximum log luminance to green.
+//   Mode 0: Samples a 4x4 grid of input 0 over this texel's footprint.
+//   Mode 1: Reduces the 4x4 block of input 0 under this texel.
+//   Mode 2: Same as mode 1, then blends with the previous frame's
+//           adapted luminance.
+
+
+uniform int reduceMode;
+// Mode 0: size of the texture this pass renders. Otherwise, size of input 0.
+uniform vec2 reduceSize;
+
+uniform sampler2D previousLuminance;
+// Fraction of the way to move from the previous luminance. 1.0 ignores it.
+uniform float adaptBlend;
+
+const vec3 lumWeights = vec3( 0.2126, 0.7152, 0.0722 );
+
+
+void main( void )
+{
+    float sum = 0.0;
+    float maximum = -100.0;
+
+    vec2 cell = texturePercent / reduceSize;
+    vec2 base = floor( gl_FragCoord.xy ) * 4.0;
+    int x, y;
+    for( y=0; y<4; y++ )
+    {
+        for( x=0; x<4; x++ )
+        {
+            vec2 offset = vec2( float( x ), float( y ) );
+            vec2 value;
+            if( reduceMode == 0 )
+            {
+                vec2 tc = oTC + cell * ( offset - 1.5 ) * 0.25;
+                float lum = log( dot( texture2D( inputTexture0, tc ).rgb, lumWeights ) + 0.0001 );
+                value = vec2( lum );
+            }
+            else
+                value = texture2D( inputTexture0, ( base + offset + 0.5 ) / reduceSize ).rg;
+            sum += value.x;
+            maximum = max( maximum, value.y );
+        }
+    }
+
+    vec2 result = vec2( sum / 16.0, maximum );
+    if( ( reduceMode == 2 ) && ( adaptBlend < 1.0 ) )
+        result = mix( texture2D( previousLuminance, vec2( 0.5 ) ).rg, result, adaptBlend );
+
+    gl_FragData[ 0 ] = vec4( result, 0.0, 1.0 );
+}
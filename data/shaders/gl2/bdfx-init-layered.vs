@@ -0,0 +1,25 @@
+
+BDFX INCLUDE shaders/gl2/bdfx-declarations.common
+BDFX INCLUDE shaders/gl2/ffp-declarations.common
+BDFX INCLUDE shaders/gl2/ffp-declarations.vs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/bdfx-init-layered.vs
+
+
+void init()
+{
+    bdfx_processedColor = bdfx_color;
+
+    // Single-pass depth partitioning. The vertex shader outputs eye
+    // coordinates, and the partition geometry shader transforms into
+    // clip coordinates with the matrix for each partition. Points and
+    // lines bypass the geometry shader and are drawn once per partition.
+#ifdef BDFX_PARTITION_PASS
+    bdfx_projection = bdfx_partitionMatrix;
+#else
+    bdfx_projection = mat4( 1.0 );
+#endif
+}
+
+// END gl2/bdfx-init-layered.vs
@@ -33,9 +33,9 @@ void main()
     // This is a stub / no-op when performing per-vertex lighting.
     computePerPixelLighting();
 
+    // Partially lit when only some of the shadowed lights reach the fragment.
     float fullyLit = computeShadowDepthTest();
-    if( fullyLit != 1.0 )
-        bdfx_processedColor.rgb *= 0.2;
+    bdfx_processedColor.rgb *= mix( 0.2, 1.0, fullyLit );
 
     if( bdfx_texture2dEnable0 > 0 ) // should test all units, but this is faster
         computeTexture();
@@ -0,0 +1,58 @@
+#extension GL_EXT_geometry_shader4 : enable
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/bdfx-partition-layered.gs
+
+// Single-pass depth partitioning. Input vertices are in eye coordinates
+// (see bdfx-init-layered.vs). Each triangle is transformed by the matrix
+// for each partition, and emitted to that partition's texture array layer
+// unless it lies entirely in front of the near plane or behind the far plane.
+// Layer 0 is the farthest partition.
+
+uniform mat4 bdfx_partitionMatrices[ BDFX_MAX_PARTITIONS ];
+uniform int bdfx_partitionCount;
+
+// Generated by RebuildShaderModules. Copies the vertex shader
+// varyings for the given input vertex to the geometry shader outputs.
+void bdfx_copyVaryings( in int idx );
+
+// Depth peeling uses clip coordinates as depth map coordinates. The
+// vertex shader outputs eye coordinates, so replace them.
+varying out vec4 bdfx_depthTC;
+
+
+void main()
+{
+    for( int layer=0; layer<bdfx_partitionCount; layer++ )
+    {
+        vec4 cc0 = bdfx_partitionMatrices[ layer ] * gl_PositionIn[ 0 ];
+        vec4 cc1 = bdfx_partitionMatrices[ layer ] * gl_PositionIn[ 1 ];
+        vec4 cc2 = bdfx_partitionMatrices[ layer ] * gl_PositionIn[ 2 ];
+
+        if( ( ( cc0.z < -cc0.w ) && ( cc1.z < -cc1.w ) && ( cc2.z < -cc2.w ) ) ||
+            ( ( cc0.z > cc0.w ) && ( cc1.z > cc1.w ) && ( cc2.z > cc2.w ) ) )
+            continue;
+
+        gl_Position = cc0;
+        gl_Layer = layer;
+        bdfx_copyVaryings( 0 );
+        bdfx_depthTC = cc0;
+        EmitVertex();
+
+        gl_Position = cc1;
+        gl_Layer = layer;
+        bdfx_copyVaryings( 1 );
+        bdfx_depthTC = cc1;
+        EmitVertex();
+
+        gl_Position = cc2;
+        gl_Layer = layer;
+        bdfx_copyVaryings( 2 );
+        bdfx_depthTC = cc2;
+        EmitVertex();
+
+        EndPrimitive();
+    }
+}
+
+// END gl2/bdfx-partition-layered.gs
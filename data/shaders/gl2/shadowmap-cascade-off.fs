@@ -0,0 +1,16 @@
+#version 120
+
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/shadowmap-cascade-off.fs
+
+
+// No Sun cascades. The Sun, if shadowed, is one of the atlas lights.
+float computeSunCascadeShadow()
+{
+    return( -1.0 );
+}
+
+// END gl2/shadowmap-cascade-off.fs
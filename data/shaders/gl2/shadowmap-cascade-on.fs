@@ -0,0 +1,61 @@
+#version 120
+#extension GL_EXT_texture_array : enable
+#extension GL_EXT_gpu_shader4 : enable
+
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/shadowmap-cascade-on.fs
+
+
+// Sun shadow cascades, see ShadowMap::setNumSunCascades().
+// Each matrix transforms eye coordinates to [0,1] shadow map coordinates.
+uniform sampler2DArrayShadow bdfx_shadowCascadeMap;
+uniform mat4 bdfx_shadowCascadeMatrices[ BDFX_MAX_SHADOW_CASCADES ];
+// Eye distance to the far plane of each cascade, nearest cascade first.
+uniform vec4 bdfx_shadowCascadeSplits;
+uniform int bdfx_shadowCascadeCount;
+
+
+// Returns 1.0 if fully illuminated, 0.0 if fully shadowed,
+// or in range 0.0,1.0 for partial shadowing.
+float computeSunCascadeShadow()
+{
+    float dist = -bdfx_outShadowEyeVertex.z;
+    int idx;
+    for( idx=0; idx<bdfx_shadowCascadeCount; idx++ )
+    {
+        if( dist <= bdfx_shadowCascadeSplits[ idx ] )
+        {
+            // Orthographic light projection, so no divide by q.
+            vec4 tc = bdfx_shadowCascadeMatrices[ idx ] * bdfx_outShadowEyeVertex;
+            if( bdfx_shadowKernelTaps == 0 )
+                // SHADOW_HARD or SHADOW_PCF, selected by the texture filter.
+                return( shadow2DArray( bdfx_shadowCascadeMap,
+                    vec4( tc.s, tc.t, float( idx ), tc.p ) ).r );
+
+            // SHADOW_PCF_KERNEL, as in shadowmap-filter-kernel.fs. The
+            // layers clamp to edge, so no tile clamping is needed.
+            vec2 scale = vec2( bdfx_shadowFilterRadius * bdfx_shadowTexelSize.y );
+            float lit = 0.0;
+            int tap;
+            for( tap=0; tap<8; tap++ )
+            {
+                vec4 offsets = texture2D( bdfx_shadowKernelMap,
+                    vec2( ( float( tap ) + .5 ) / 8., .5 ) ) * 2. - 1.;
+                vec2 st = tc.st + offsets.xy * scale;
+                lit += shadow2DArray( bdfx_shadowCascadeMap,
+                    vec4( st.s, st.t, float( idx ), tc.p ) ).r;
+                st = tc.st + offsets.zw * scale;
+                lit += shadow2DArray( bdfx_shadowCascadeMap,
+                    vec4( st.s, st.t, float( idx ), tc.p ) ).r;
+            }
+            return( lit / 16.0 );
+        }
+    }
+    // Beyond the Sun shadow distance.
+    return( 1.0 );
+}
+
+// END gl2/shadowmap-cascade-on.fs
@@ -6,6 +6,20 @@
 //
 // Input uniforms
 uniform sampler2DShadow bdfx_shadowDepthMap;
+// Per shadowed light (BDFX_MAX_SHADOW_LIGHTS): eye coordinates to light
+// clip coordinates, and the light's tile within the shadow atlas as
+// offset (xy) and scale (zw).
+uniform mat4 bdfx_shadowMatrices[ BDFX_MAX_SHADOW_LIGHTS ];
+uniform vec4 bdfx_shadowTiles[ BDFX_MAX_SHADOW_LIGHTS ];
+uniform int bdfx_shadowCount;
+// Soft shadow filtering, see ShadowMap::setSoftShadowMode().
+// Texel size of the shadow atlas (x) and of the Sun cascades (y).
+uniform vec2 bdfx_shadowTexelSize;
+// Kernel radius in texels, and kernel taps (0 unless SHADOW_PCF_KERNEL).
+uniform float bdfx_shadowFilterRadius;
+uniform int bdfx_shadowKernelTaps;
+// Two kernel offsets per texel, mapped from [-1,1] to [0,1].
+uniform sampler2D bdfx_shadowKernelMap;
 
 
 //
@@ -15,6 +29,14 @@ uniform sampler2DShadow bdfx_shadowDepthMap;
 // or in range 0.0,1.0 for partial shadowing.
 float computeShadowDepthTest();
 
+// Returns the filtered visibility at shadow atlas coordinate 'tc',
+// staying within the light's atlas 'tile' (offset xy, scale zw).
+float sampleShadowAtlas( in vec3 tc, in vec4 tile );
+
+// Returns Sun cascade visibility as for computeShadowDepthTest(),
+// or a negative value if there are no Sun cascades.
+float computeSunCascadeShadow();
+
 
 // END gl2/shadowmap-declarations.fs
 
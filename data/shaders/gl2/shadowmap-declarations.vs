@@ -3,11 +3,6 @@
 // gl2/shadowmap-declarations.vs
 
 
-//
-// Input uniforms
-uniform mat4 bdfx_shadowViewProj;
-
-
 //
 // Function declarations
 void computeShadowTexCoords();
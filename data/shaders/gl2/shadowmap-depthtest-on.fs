@@ -1,5 +1,3 @@
-//#version 120
-
 BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
 BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
 
@@ -7,14 +5,45 @@ BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
 // gl2/shadowmap-depthtest-on.fs
 
 
+// Visibility of the eye coordinate vertex in the shadow map of light 'idx'.
+float lightShadow( in int idx )
+{
+    vec4 clip = bdfx_shadowMatrices[ idx ] * bdfx_outShadowEyeVertex;
+    // Light clip coordinates to [0,1] within the light's tile.
+    vec3 tc = ( clip.stp / clip.q ) * .5 + .5;
+    if( (clip.q>0.) && (tc.s>0.) && (tc.t>0.) && (tc.s<1.) && (tc.t<1.) )
+    {
+        // Offset and scale into the shadow atlas.
+        tc.st = tc.st * bdfx_shadowTiles[ idx ].zw + bdfx_shadowTiles[ idx ].xy;
+        return( sampleShadowAtlas( tc, bdfx_shadowTiles[ idx ] ) );
+    }
+    else
+        return( 1.0 );
+}
+
 // Returns 1.0 if fully illuminated, 0.0 if fully shadowed,
 // or in range 0.0,1.0 for partial shadowing.
+// This is the average visibility over all shadowed lights.
 float computeShadowDepthTest()
 {
-    vec3 tc = bdfx_outShadowTexCoord.stp + bdfx_outShadowTexCoord.q;
-    tc *= .5;
-    if( (tc.s>0.) && (tc.t>0.) && (tc.s<bdfx_outShadowTexCoord.q) && (tc.t<bdfx_outShadowTexCoord.q) )
-        return( shadow2DProj( bdfx_shadowDepthMap, vec4( tc, bdfx_outShadowTexCoord.q ) ).a );
+    float lit = 0.0;
+    float count = 0.0;
+    int idx;
+    for( idx=0; idx<bdfx_shadowCount; idx++ )
+    {
+        lit += lightShadow( idx );
+        count += 1.0;
+    }
+
+    float sun = computeSunCascadeShadow();
+    if( sun >= 0.0 )
+    {
+        lit += sun;
+        count += 1.0;
+    }
+
+    if( count > 0.0 )
+        return( lit / count );
     else
         return( 1.0 );
 }
@@ -0,0 +1,18 @@
+#version 120
+
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/shadowmap-filter-hard.fs
+
+
+// ShadowMap::SHADOW_HARD. The atlas uses NEAREST filtering, so this is
+// a single depth compare. The tile test in the caller keeps the lookup
+// within the tile.
+float sampleShadowAtlas( in vec3 tc, in vec4 tile )
+{
+    return( shadow2D( bdfx_shadowDepthMap, tc ).r );
+}
+
+// END gl2/shadowmap-filter-hard.fs
@@ -0,0 +1,35 @@
+#version 120
+
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/shadowmap-filter-kernel.fs
+
+
+// ShadowMap::SHADOW_PCF_KERNEL. Averages hardware PCF lookups at each
+// Poisson disk kernel offset, scaled by the soft shadow radius. Each
+// kernel texel holds two offsets. Lookups are clamped half a texel
+// inside the tile so they don't reach a neighboring tile.
+float sampleShadowAtlas( in vec3 tc, in vec4 tile )
+{
+    vec2 inset = vec2( .5 * bdfx_shadowTexelSize.x );
+    vec2 lo = tile.xy + inset;
+    vec2 hi = tile.xy + tile.zw - inset;
+    vec2 scale = vec2( bdfx_shadowFilterRadius * bdfx_shadowTexelSize.x );
+
+    float lit = 0.0;
+    int idx;
+    for( idx=0; idx<8; idx++ )
+    {
+        vec4 offsets = texture2D( bdfx_shadowKernelMap,
+            vec2( ( float( idx ) + .5 ) / 8., .5 ) ) * 2. - 1.;
+        lit += shadow2D( bdfx_shadowDepthMap,
+            vec3( clamp( tc.st + offsets.xy * scale, lo, hi ), tc.p ) ).r;
+        lit += shadow2D( bdfx_shadowDepthMap,
+            vec3( clamp( tc.st + offsets.zw * scale, lo, hi ), tc.p ) ).r;
+    }
+    return( lit / 16.0 );
+}
+
+// END gl2/shadowmap-filter-kernel.fs
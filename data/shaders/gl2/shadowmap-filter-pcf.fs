@@ -0,0 +1,20 @@
+#version 120
+
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.common
+BDFX INCLUDE shaders/gl2/shadowmap-declarations.fs
+
+// Copyright (c) 2011 Skew Matrix Software. All rights reserved.
+// gl2/shadowmap-filter-pcf.fs
+
+
+// ShadowMap::SHADOW_PCF. The atlas uses LINEAR filtering, so the hardware
+// compares the 2x2 nearest texels and blends the results. Clamp half a
+// texel inside the tile so the footprint doesn't reach a neighboring tile.
+float sampleShadowAtlas( in vec3 tc, in vec4 tile )
+{
+    vec2 inset = vec2( .5 * bdfx_shadowTexelSize.x );
+    vec2 st = clamp( tc.st, tile.xy + inset, tile.xy + tile.zw - inset );
+    return( shadow2D( bdfx_shadowDepthMap, vec3( st, tc.p ) ).r );
+}
+
+// END gl2/shadowmap-filter-pcf.fs
@@ -14,8 +14,9 @@ BDFX INCLUDE shaders/gl2/shadowmap-declarations.vs
 
 void main()
 {
-    mat4 modelMatrix = osg_ViewMatrixInverse * gl_ModelViewMatrix;
-    gl_Position = bdfx_shadowViewProj * modelMatrix * gl_Vertex;
+    // ShadowMap culls the scene once per light, with the light view and
+    // projection matrices in place of the camera view and projection.
+    gl_Position = bdfx_projectionMatrix * bdfx_modelViewMatrix * gl_Vertex;
 }
 
 // END gl2/shadowmap-main.vs
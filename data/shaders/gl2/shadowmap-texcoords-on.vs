@@ -10,18 +10,10 @@ BDFX INCLUDE shaders/gl2/shadowmap-declarations.vs
 
 void computeShadowTexCoords()
 {
-    // This is basically FFP TexGen for EYE_LINEAR, but we're taking the eye planes
-    // from the rows of bdfx_shadowViewProj (the matrix used to create the depth map).
-    int idx;
-    for( idx=0; idx<4; idx++ )
-    {
-        vec4 ep = vec4( bdfx_shadowViewProj[ 0 ][ idx ],
-                        bdfx_shadowViewProj[ 1 ][ idx ],
-                        bdfx_shadowViewProj[ 2 ][ idx ],
-                        bdfx_shadowViewProj[ 3 ][ idx ] );
-        bdfx_outShadowTexCoord[ idx ] = dot( bdfx_eyeVertex, ( ep * osg_ViewMatrixInverse ) );
-    }
+    // Pass the eye coordinate vertex through. The fragment shader
+    // transforms it by each light's bdfx_shadowMatrices element, which
+    // keeps the varying count independent of the number of lights.
+    bdfx_outShadowEyeVertex = bdfx_eyeVertex;
 }
 
 // END gl2/shadowmap-texcoords-on.vs
-
@@ -1,16 +1,36 @@
 
 uniform sampler2D tex;
+uniform sampler2D bdfx_moonNormalMap;
+uniform bool bdfx_moonUseNormalMap;
+uniform float bdfx_earthshine;
 
 varying vec2 oTC;
 varying vec3 oNormal;
-
-uniform vec3 bdfx_sunPosition;
+varying vec3 oTangent;
+varying vec3 oBinormal;
+varying vec3 oSunDir;
+varying vec3 oMoonDir;
 
 void main()
 {
+    // All vectors are in celestial sphere coordinates.
     vec3 normal = normalize( oNormal );
-    float diffuse = max( dot( bdfx_sunPosition, normal ), 0.1 );
+    if( bdfx_moonUseNormalMap )
+    {
+        vec3 n = texture2D( bdfx_moonNormalMap, oTC ).xyz * 2. - 1.;
+        normal = normalize( mat3( normalize( oTangent ), normalize( oBinormal ), normal ) * n );
+    }
+    vec3 sunDir = normalize( oSunDir );
+    vec3 moonDir = normalize( oMoonDir );
+
+    float sunlight = max( dot( sunDir, normal ), 0. );
+
+    // Earthshine lights the Moon from the Earth, and is brightest when the
+    // Earth seen from the Moon is full (when the Moon is new).
+    float earthPhase = .5 + .5 * dot( sunDir, moonDir );
+    float earthshine = bdfx_earthshine * earthPhase * max( dot( -moonDir, normal ), 0. );
 
     // TBD GL3
-    gl_FragColor = texture2D( tex, oTC ) * diffuse;
+    vec4 color = texture2D( tex, oTC );
+    gl_FragColor = vec4( color.rgb * ( sunlight + earthshine ), 1. );
 }
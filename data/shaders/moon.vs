@@ -2,21 +2,52 @@
 uniform mat4 viewProj;
 uniform mat4 celestialOrientation;
 
-uniform mat4 moonTransform;
-uniform mat3 moonOrientation;
+// Ephemeris samples one simulated minute apart, and the fraction of
+// the minute elapsed since the first sample.
+uniform vec3 bdfx_moonDirection0;
+uniform vec3 bdfx_moonDirection1;
+uniform vec3 bdfx_sunDirection0;
+uniform vec3 bdfx_sunDirection1;
+uniform float bdfx_ephemerisFraction;
+uniform float bdfx_moonDistance;
 
 varying vec2 oTC;
 varying vec3 oNormal;
+varying vec3 oTangent;
+varying vec3 oBinormal;
+varying vec3 oSunDir;
+varying vec3 oMoonDir;
 
 void main()
 {
+    vec3 moonDir = normalize( mix( bdfx_moonDirection0, bdfx_moonDirection1, bdfx_ephemerisFraction ) );
+    vec3 sunDir = normalize( mix( bdfx_sunDirection0, bdfx_sunDirection1, bdfx_ephemerisFraction ) );
+
+    // Orient the Moon so that its local +y faces away from the Earth and
+    // local +z points toward the north celestial pole.
+    vec3 xAxis = cross( moonDir, vec3( 0., 0., 1. ) );
+    if( dot( xAxis, xAxis ) < 1e-8 )
+        xAxis = vec3( 1., 0., 0. );
+    xAxis = normalize( xAxis );
+    mat3 orient = mat3( xAxis, moonDir, cross( xAxis, moonDir ) );
+
+    // Tangent space follows the cylindrical texture coordinates:
+    // s increases around +z, t increases toward +z.
     // TBD GL3
-    vec4 normal = celestialOrientation * vec4( moonOrientation * gl_Normal, 1.0 );
-    oNormal = normal.xyz;
+    vec3 tangent = cross( vec3( 0., 0., 1. ), gl_Normal );
+    if( dot( tangent, tangent ) < 1e-8 )
+        tangent = vec3( -1., 0., 0. );
+    tangent = normalize( tangent );
+    oNormal = orient * gl_Normal;
+    oTangent = orient * tangent;
+    oBinormal = orient * cross( gl_Normal, tangent );
+    oSunDir = sunDir;
+    oMoonDir = moonDir;
 
     // TBD GL3
     oTC = gl_MultiTexCoord0.st;
-    
+
     // TBD GL3
-    gl_Position = viewProj * celestialOrientation * moonTransform * gl_Vertex;
+    vec3 position = orient * gl_Vertex.xyz + moonDir * bdfx_moonDistance;
+    gl_Position = viewProj * celestialOrientation * vec4( position, 1. );
 }
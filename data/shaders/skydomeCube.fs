@@ -0,0 +1,20 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Sky color from the SkyDome sky cache cube map.
+
+uniform mat4 invViewProj;
+uniform samplerCube bdfx_skyCubeMap;
+
+varying vec2 ndc;
+
+void main()
+{
+    // World direction of this pixel. viewProj has no translation.
+    vec4 p = invViewProj * vec4( ndc, 1.0, 1.0 );
+    vec3 dir = p.xyz / p.w;
+
+    // Alpha is zero where the sky wasn't drawn; the SkyDome
+    // alpha test discards those pixels.
+    // TBD GL3
+    gl_FragColor = textureCube( bdfx_skyCubeMap, dir );
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Sky color from the AtmosphereLUT inscatter table.
+// The table parameterization must match AtmosphereLUT.cpp.
+
+uniform mat4 invViewProj;
+uniform vec3 up;
+uniform vec3 bdfx_sunPosition;
+
+uniform sampler3D bdfx_inscatterMap;
+uniform vec3 bdfx_inscatterSize;
+uniform float bdfx_skyExposure;
+
+varying vec2 ndc;
+
+// Must match the AtmosphereLUT model.
+const vec3 betaR = vec3( 5.8e-3, 1.35e-2, 3.31e-2 );
+const float mieG = 0.8;
+const float sunIntensity = 20.0;
+const float pi = 3.14159265;
+
+void main()
+{
+    // World direction of this pixel. viewProj has no translation.
+    vec4 p = invViewProj * vec4( ndc, 1.0, 1.0 );
+    vec3 dir = normalize( p.xyz / p.w );
+
+    float mu = dot( dir, up );
+    float muS = dot( bdfx_sunPosition, up );
+    float nu = dot( dir, bdfx_sunPosition );
+
+    // No need to draw the sky that is below the ground.
+    if( mu < -0.15 )
+    {
+        gl_FragColor = vec4( 0.0 ); // discard using alpha test
+        return;
+    }
+
+    vec3 tc = vec3(
+        0.5 + 0.5 * sign( mu ) * sqrt( abs( mu ) ),
+        max( ( 1.0 - exp( -3.0 * muS - 0.6 ) ) / ( 1.0 - exp( -3.6 ) ), 0.0 ),
+        ( nu + 1.0 ) * 0.5 );
+    // Sample at texel centers.
+    tc = ( 0.5 + tc * ( bdfx_inscatterSize - 1.0 ) ) / bdfx_inscatterSize;
+    vec4 inscatter = texture3D( bdfx_inscatterMap, tc );
+
+    // Mie color from its red channel (Bruneton and Neyret).
+    vec3 mie = inscatter.rgb * inscatter.a / max( inscatter.r, 1e-4 ) * ( betaR.r / betaR );
+
+    float phaseR = 3.0 / ( 16.0 * pi ) * ( 1.0 + nu * nu );
+    float g2 = mieG * mieG;
+    float phaseM = 1.5 / ( 4.0 * pi ) * ( 1.0 - g2 ) * ( 1.0 + nu * nu ) /
+        ( ( 2.0 + g2 ) * pow( 1.0 + g2 - 2.0 * mieG * nu, 1.5 ) );
+
+    vec3 radiance = sunIntensity * ( inscatter.rgb * phaseR + mie * phaseM );
+    // TBD GL3
+    gl_FragColor = vec4( vec3( 1.0 ) - exp( -bdfx_skyExposure * radiance ), 1.0 );
+}
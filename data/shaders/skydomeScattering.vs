@@ -0,0 +1,12 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Fullscreen sky pass. Vertices are in normalized device coordinates.
+
+varying vec2 ndc;
+
+void main()
+{
+    ndc = gl_Vertex.xy;
+    // TBD GL3
+    gl_Position = vec4( gl_Vertex.xy, 0.0, 1.0 );
+}
@@ -0,0 +1,15 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+varying vec4 starColor;
+
+void main()
+{
+    // Round point sprite with a soft edge. Single pixel points
+    // sample the center and draw at full brightness.
+    vec2 p = gl_TexCoord[ 0 ].st * 2.0 - 1.0;
+    float falloff = clamp( 1.0 - dot( p, p ), 0.0, 1.0 );
+
+    // Additive blending. Zero alpha is discarded by the alpha test.
+    // TBD GL3
+    gl_FragColor = starColor * falloff;
+}
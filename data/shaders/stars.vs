@@ -0,0 +1,69 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+// Star field point sprites. Vertices are star directions on the celestial
+// sphere, scaled to the SkyDome radius. Texture coordinate 0 holds the
+// visual magnitude (s) and B-V color index (t). The first vertices are the
+// planets: p holds the planet index plus one, and the direction and
+// magnitude come from bdfx_planets.
+
+uniform mat4 viewProj;
+uniform mat4 celestialOrientation;
+
+uniform vec3 up;
+uniform vec3 bdfx_sunPosition;
+
+// Planet directions (xyz) and magnitudes (w).
+uniform vec4 bdfx_planets[ 5 ];
+
+// Stars within the Moon's angular radius of the Moon direction are hidden.
+uniform vec3 bdfx_moonDirection0;
+uniform vec3 bdfx_moonDirection1;
+uniform float bdfx_ephemerisFraction;
+uniform float bdfx_moonCosRadius;
+
+varying vec4 starColor;
+
+void main()
+{
+    // TBD GL3
+    vec4 vertex = gl_Vertex;
+    float magnitude = gl_MultiTexCoord0.s;
+    float colorIndex = gl_MultiTexCoord0.t;
+    int planet = int( gl_MultiTexCoord0.p + 0.5 ) - 1;
+    if( planet >= 0 )
+    {
+        vertex.xyz = bdfx_planets[ planet ].xyz * length( gl_Vertex.xyz );
+        magnitude = bdfx_planets[ planet ].w;
+    }
+
+    vec4 pos = celestialOrientation * vertex;
+    gl_Position = viewProj * pos;
+
+    // Intensity relative to magnitude 0. Brighter stars draw larger,
+    // fainter stars draw as dimmer single pixels.
+    float intensity = pow( 2.512, -magnitude );
+    gl_PointSize = clamp( 1.0 + 1.5 * sqrt( intensity ), 1.0, 6.0 );
+    float brightness = clamp( 2.0 * sqrt( intensity ), 0.08, 1.0 );
+
+    // Fade out from a Sun elevation of about 3 degrees below the
+    // horizon to about 9 degrees below, and hide stars below the horizon.
+    float dotSun = dot( bdfx_sunPosition, up );
+    float night = clamp( ( -0.05 - dotSun ) / 0.1, 0.0, 1.0 );
+    if( dot( normalize( pos.xyz ), up ) < 0.0 )
+        night = 0.0;
+    vec3 moonDir = normalize( mix( bdfx_moonDirection0, bdfx_moonDirection1, bdfx_ephemerisFraction ) );
+    if( dot( normalize( vertex.xyz ), moonDir ) > bdfx_moonCosRadius )
+        night = 0.0;
+
+    // Approximate star color from B-V: blue-white, white, orange.
+    float t = clamp( ( colorIndex + 0.4 ) / 2.4, 0.0, 1.0 );
+    vec3 color = ( t < 0.3 ) ?
+        mix( vec3( 0.7, 0.8, 1.0 ), vec3( 1.0 ), t / 0.3 ) :
+        mix( vec3( 1.0 ), vec3( 1.0, 0.7, 0.45 ), ( t - 0.3 ) / 0.7 );
+
+    brightness *= night;
+    starColor = vec4( color * brightness, brightness );
+
+    // Replaced by point sprite coordinates.
+    gl_TexCoord[ 0 ] = vec4( 0.0 );
+}
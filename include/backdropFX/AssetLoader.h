@@ -0,0 +1,162 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_ASSET_LOADER_H__
+#define __BACKDROPFX_ASSET_LOADER_H__ 1
+
+
+#include <backdropFX/Export.h>
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Image>
+#include <osg/Texture>
+#include <osg/Vec4>
+#include <osg/NodeCallback>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
+
+#include <string>
+#include <iosfwd>
+#include <list>
+#include <vector>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::AssetLoader AssetLoader.h backdropFX/AssetLoader.h
+
+\brief Loads texture assets on a background thread.
+
+SkyDome, MoonBody, and the SurfaceUtils functions post their texture
+loads to the AssetLoader instead of reading images on the thread that
+builds the scene graph. A low priority worker thread reads and decodes
+each image. update() runs on the update traversal and attaches finished
+images to their textures. Until then, a texture samples as black, unless
+its creator gave it a placeholder image (see createPlaceholderImage()).
+The update traversal never waits for disk I/O or JPEG/PNG decode.
+SkyDome calls update() from its update callback. Nodes outside the
+SkyDome can use UpdateCallback.
+
+Assets can be converted offline to a texture container file (see
+convertImage() and writeContainer(), and the assetconvert app). A
+container holds a complete mipmap chain, optionally DXT compressed, so
+loading it is a single read with no decoding and no mipmap generation.
+readImage() loads the container that has the same base name as the
+requested file (for example, "moon.bdfxtex" for "moon.jpg") if one is in
+the data path. Otherwise it reads the original file with osgDB. Lookup
+tables, such as the noise permutation table "permTexture.png", are always
+read from the original file (see requestImage()).
+
+The container is a 32 byte header (the magic string "BDFXTEX", a version
+number, the image width and height, the GL pixel format and internal
+format, and the number of mipmap levels) followed by the image data for
+all levels in order.
+*/
+class BACKDROPFX_EXPORT AssetLoader : public osg::Referenced
+{
+public:
+    static AssetLoader* instance( const bool erase=false );
+
+    /** \class backdropFX::AssetLoader::Request AssetLoader.h backdropFX/AssetLoader.h
+
+    \brief One asynchronous load.
+
+    load() runs on the worker thread and must not modify the scene graph.
+    apply() runs during update() and attaches the results. */
+    class BACKDROPFX_EXPORT Request : public osg::Referenced
+    {
+    public:
+        Request() {}
+
+        virtual void load() = 0;
+        virtual void apply() = 0;
+
+    protected:
+        virtual ~Request() {}
+    };
+
+    /** Posts \c request to the worker thread. */
+    void request( Request* request );
+    /** Reads \c fileName with readImage() on the worker thread and sets
+    it as image \c face of \c texture during a later update(). Pass false
+    for \c useContainer for lookup tables and other images that must be
+    read exactly as stored. */
+    void requestImage( osg::Texture* texture, const std::string& fileName,
+        unsigned int face=0, bool useContainer=true );
+
+    /** Applies finished requests. Call from the update traversal.
+    Returns the number of requests still loading. */
+    unsigned int update();
+    /** Waits until every posted request is loaded, then applies them.
+    For apps that must have all assets before the first frame. */
+    void flush();
+
+    /** Calls AssetLoader::instance()->update() and traverses. */
+    class BACKDROPFX_EXPORT UpdateCallback : public osg::NodeCallback
+    {
+    public:
+        UpdateCallback() {}
+        virtual void operator()( osg::Node* node, osg::NodeVisitor* nv );
+    };
+
+
+    /** Reads the converted container for \c fileName if there is one and
+    \c useContainer is true, otherwise \c fileName itself. Safe to call
+    from any thread. */
+    static osg::Image* readImage( const std::string& fileName, bool useContainer=true );
+    /** Returns \c fileName with its extension replaced by ".bdfxtex". */
+    static std::string getContainerFileName( const std::string& fileName );
+    /** Returns a 1x1 RGBA image of \c color, for a texture to sample
+    until requestImage() replaces it. */
+    static osg::Image* createPlaceholderImage( const osg::Vec4& color );
+
+    /** Returns a copy of \c image with a box filtered mipmap chain. If
+    \c compress is true, the copy is DXT1 compressed (DXT5 if \c image has
+    alpha). \c image must be an 8-bit luminance, luminance alpha, RGB, or
+    RGBA image. Returns NULL otherwise. Mipmaps require power of two
+    dimensions; other sizes get no mipmaps. */
+    static osg::Image* convertImage( const osg::Image* image, bool compress );
+    /** Returns a tangent space normal map, with a mipmap chain, derived from
+    the first channel of \c image treated as height. s wraps; t doesn't,
+    as for cylindrical maps. \c scale is the slope, in texels, of a height
+    change from 0 to 1. */
+    static osg::Image* createNormalMap( const osg::Image* image, float scale );
+
+    /** Writes \c image and its mipmaps to a container file. */
+    static bool writeContainer( const osg::Image* image, const std::string& fileName );
+    static bool writeContainer( const osg::Image* image, std::ostream& ostr );
+    /** Reads a container file. Returns NULL on failure, including a header
+    with an unsupported pixel format, a dimension over 16384, more mipmap
+    levels than the dimensions allow, or image data longer than the rest
+    of the file. */
+    static osg::Image* readContainer( const std::string& fileName );
+    static osg::Image* readContainer( std::istream& istr );
+
+protected:
+    AssetLoader();
+    ~AssetLoader();
+
+    // Called by the worker thread.
+    friend class AssetLoaderThread;
+    bool waitForRequest( osg::ref_ptr< Request >& request );
+    void storeLoaded( Request* request );
+
+    OpenThreads::Mutex _mutex;
+    OpenThreads::Condition _condition;
+    std::list< osg::ref_ptr< Request > > _pending;
+    std::vector< osg::ref_ptr< Request > > _loaded;
+    unsigned int _numInFlight;
+    bool _done;
+
+    OpenThreads::Thread* _thread;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_ASSET_LOADER_H__
+#endif
@@ -0,0 +1,123 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_ATMOSPHERE_LUT_H__
+#define __BACKDROPFX_ATMOSPHERE_LUT_H__ 1
+
+
+#include <backdropFX/Export.h>
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Vec3d>
+#include <osg/Image>
+#include <osg/Texture2D>
+#include <osg/Texture3D>
+
+#include <string>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::AtmosphereLUT AtmosphereLUT.h backdropFX/AtmosphereLUT.h
+
+\brief Precomputed atmospheric scattering tables for the SkyDome.
+
+AtmosphereLUT models an Earth-like atmosphere (6360km ground radius, 60km
+thick) with Rayleigh and Mie scattering that decreases exponentially with
+altitude, and precomputes two tables from it, following Bruneton and
+Neyret, "Precomputed Atmospheric Scattering" (2008):
+
+\li Transmittance, a 2D table indexed by altitude and the cosine of the
+zenith angle. Each texel is the fraction of light that reaches the top of
+the atmosphere along that ray (zero if the ray hits the ground).
+\li Single scattering inscatter for a viewer on the ground, a 3D table
+indexed by the cosine of the view zenith angle, the cosine of the Sun
+zenith angle, and the cosine of the angle between the view and the Sun.
+RGB is Rayleigh inscatter, alpha is the red channel of Mie inscatter.
+Both are without the phase functions, which the sky shader applies per
+pixel.
+
+The inscatter integration looks up the Sun's transmittance to each sample
+point in the transmittance table, instead of integrating it. Both tables
+are computed on multiple threads (see setNumThreads()).
+
+init() computes the tables once and, if a cache file name is set (see
+setCacheFileName()), writes them to disk. Later calls to init(), including
+from later runs of the app, read the cache instead.
+
+SkyDome::setSkyModel() with SkyDome::SKY_SCATTERING draws the sky as a
+fullscreen pass with a single inscatter texture fetch per pixel.
+*/
+class BACKDROPFX_EXPORT AtmosphereLUT : public osg::Referenced
+{
+public:
+    AtmosphereLUT();
+
+    /** Table dimensions. */
+    static const unsigned int TransmittanceWidth;  // Cosine of zenith angle
+    static const unsigned int TransmittanceHeight; // Altitude
+    static const unsigned int InscatterMuSize;     // Cosine of view zenith angle
+    static const unsigned int InscatterMuSSize;    // Cosine of Sun zenith angle
+    static const unsigned int InscatterNuSize;     // Cosine of view-Sun angle
+
+    /** File in which init() caches the tables. Relative names are relative
+    to the current working directory, so an app that sets one should pass
+    a location it may write, such as a per-user cache directory. Pass an
+    empty string to disable caching. Default is empty: no file is read or
+    written unless the app opts in. */
+    void setCacheFileName( const std::string& fileName ) { _cacheFileName = fileName; }
+    const std::string& getCacheFileName() const { return( _cacheFileName ); }
+
+    /** Number of threads that compute the tables. Pass 0 (the default)
+    to use one per processor. */
+    void setNumThreads( unsigned int numThreads ) { _numThreads = numThreads; }
+    unsigned int getNumThreads() const { return( _numThreads ); }
+
+    /** Reads the tables from the cache file or, if that fails, computes
+    them and writes the cache file. Blocks until done. Does nothing if the
+    tables are already valid. Returns false on failure. */
+    bool init();
+    bool valid() const { return( _inscatterTex.valid() ); }
+
+    osg::Texture2D* getTransmittanceTexture() const { return( _transmittanceTex.get() ); }
+    osg::Texture3D* getInscatterTexture() const { return( _inscatterTex.get() ); }
+
+    /** Returns the transmittance from altitude \c r (the distance in
+    kilometers from the Earth's center) to the top of the atmosphere,
+    along a ray with zenith angle cosine \c mu, bilinearly interpolated
+    from the table. */
+    osg::Vec3d lookupTransmittance( double r, double mu ) const;
+
+protected:
+    ~AtmosphereLUT();
+
+    // Called by the worker threads.
+    friend class AtmosphereLUTThread;
+    void computeTransmittanceRow( unsigned int row );
+    void computeInscatterRow( unsigned int row );
+
+    /** Runs \c numRows rows of the given table on the worker threads. */
+    void computeRows( bool transmittance, unsigned int numRows );
+
+    void createImages();
+    void createTextures();
+    bool readCache();
+    void writeCache() const;
+
+    std::string _cacheFileName;
+    unsigned int _numThreads;
+
+    osg::ref_ptr< osg::Image > _transmittance;
+    osg::ref_ptr< osg::Image > _inscatter;
+    osg::ref_ptr< osg::Texture2D > _transmittanceTex;
+    osg::ref_ptr< osg::Texture3D > _inscatterTex;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_ATMOSPHERE_LUT_H__
+#endif
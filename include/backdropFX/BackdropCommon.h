@@ -4,6 +4,7 @@
 #define __BACKDROPFX_BACKDROP_COMMON_H__ 1
 
 #include <backdropFX/Export.h>
+#include <backdropFX/UniformLocationCache.h>
 #include <osg/GL>
 #include <osg/Geometry>
 #include <osg/FrameBufferObject>
@@ -104,6 +105,7 @@ protected:
     osg::ref_ptr< osg::Depth > _depth;
     osg::ref_ptr< osg::Program > _program;
     osg::ref_ptr< osg::Uniform > _textureUniform;
+    UniformLocationCache _uniformLocations;
 };
 
 #if 0
@@ -0,0 +1,168 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_CLOUD_STAGE_H__
+#define __BACKDROPFX_CLOUD_STAGE_H__ 1
+
+
+#include <osgUtil/RenderStage>
+#include <osg/FrameBufferObject>
+#include <osg/Texture2D>
+#include <osg/Viewport>
+#include <osg/Uniform>
+#include <OpenThreads/Mutex>
+
+#include <deque>
+#include <vector>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::CloudStats CloudStage.h backdropFX/CloudStage.h
+
+\brief Per-frame cost of the SkyDome cloud layer.
+
+Each CloudStage records the number of pixels it shaded when it draws and,
+if the GL_EXT_timer_query extension is available, the GPU time of its cloud
+pass when the timer query result arrives, a frame or two later. get()
+returns the most recent frame whose results are complete, summed over all
+views.
+
+A frame is complete when a later frame has started drawing and every timer
+query issued for it has reported. A frame whose queries haven't reported
+after MaxFrames later frames is dropped, so the statistics keep advancing
+even if results never arrive.
+*/
+class CloudStats : public osg::Referenced
+{
+public:
+    CloudStats();
+
+    /** Called by CloudStage when it draws. \c timed is true if the pass
+    is timed, in which case recordTime() follows. */
+    void recordDraw( unsigned int frameNumber, unsigned int pixels, bool timed );
+    /** Called by CloudStage when a timer query result arrives. \c gpuTime
+    is in milliseconds. */
+    void recordTime( unsigned int frameNumber, double gpuTime );
+
+    /** Returns false if no frame has been measured yet. \c gpuTime is
+    negative if any view drew the frame untimed, either because timer
+    queries aren't supported or because too many were still in flight. */
+    bool get( unsigned int& frameNumber, unsigned int& pixels, double& gpuTime ) const;
+
+    /** Frames kept waiting for timer results. */
+    static const unsigned int MaxFrames = 8;
+
+protected:
+    ~CloudStats();
+
+    /** Moves finished frames from the front of _frames to the last
+    complete frame. Call with _mutex locked. */
+    void complete();
+
+    mutable OpenThreads::Mutex _mutex;
+
+    struct Frame
+    {
+        unsigned int _frameNumber, _pixels;
+        unsigned int _pendingTimes;
+        double _gpuTime;
+        bool _untimed;
+    };
+    // Frames still accumulating, oldest first.
+    std::deque< Frame > _frames;
+
+    bool _lastValid;
+    unsigned int _lastFrameNumber, _lastPixels;
+    double _lastGPUTime;
+};
+
+
+/** \class backdropFX::CloudStage CloudStage.h backdropFX/CloudStage.h
+
+\brief Renders the SkyDome cloud layer at reduced resolution.
+
+When clouds are enabled, SkyDome culls the cloud pass into this stage and
+adds it as a pre-render stage ahead of the SkyDomeStage. draw() renders the
+RenderBin into the stage's own texture, which is the view's viewport divided
+by the downsample factor in each dimension. SkyDome then culls a fullscreen
+composite pass into the SkyDomeStage that upsamples the texture (see
+getCompositeStateSet()) and blends it over the sky.
+
+Each CullVisitor has its own CloudStage, so each view has its own cloud
+texture.
+*/
+class CloudStage : public osgUtil::RenderStage
+{
+public:
+    CloudStage();
+    CloudStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
+    CloudStage( const CloudStage& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
+
+    virtual osg::Object* cloneType() const { return new CloudStage(); }
+    virtual osg::Object* clone(const osg::CopyOp& copyop) const { return new CloudStage( *this, copyop ); } // note only implements a clone of type.
+    virtual bool isSameKindAs(const osg::Object* obj) const { return dynamic_cast<const CloudStage*>(obj)!=0L; }
+    virtual const char* className() const { return "CloudStage"; }
+
+    virtual void draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous );
+
+    /** Sets the size of the cloud texture. Call during cull. The texture
+    and FBO are recreated only if the size changes. */
+    void setSize( unsigned int width, unsigned int height );
+    unsigned int getWidth() const { return( _width ); }
+    unsigned int getHeight() const { return( _height ); }
+
+    /** Statistics object to record into. NULL (the default) disables
+    measuring. */
+    void setCloudStats( CloudStats* stats ) { _stats = stats; }
+    CloudStats* getCloudStats() const { return( _stats.get() ); }
+
+    /** StateSet for the composite pass: the cloud texture on unit 0, its
+    "bdfx_cloudMap" sampler uniform, and "bdfx_cloudMapSize" (width,
+    height, 1/width, 1/height). SkyDome pushes this during cull. */
+    osg::StateSet* getCompositeStateSet();
+
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state ) const;
+
+protected:
+    ~CloudStage();
+    void internalInit();
+
+    /** Reads back timer queries that have finished. */
+    void collectQueries( osg::State& state );
+    /** Hands all query objects to the deletion list of the context that
+    created them. draw() deletes them in that context. */
+    void orphanQueries();
+    /** Deletes query objects orphaned in \c state's context. */
+    static void deleteOrphanedQueries( osg::State& state );
+
+    unsigned int _width, _height;
+
+    osg::ref_ptr< osg::Texture2D > _texture;
+    osg::ref_ptr< osg::FrameBufferObject > _fbo;
+    osg::ref_ptr< osg::Viewport > _cloudViewport;
+    osg::ref_ptr< osg::StateSet > _compositeStateSet;
+    osg::ref_ptr< osg::Uniform > _mapSize;
+
+    osg::ref_ptr< CloudStats > _stats;
+
+    // Timer queries, in the graphics context that draws this stage.
+    unsigned int _queryContextID;
+    struct Query
+    {
+        GLuint _id;
+        unsigned int _frameNumber;
+    };
+    std::deque< Query > _pendingQueries;
+    std::vector< GLuint > _freeQueries;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_CLOUD_STAGE_H__
+#endif
@@ -7,11 +7,17 @@
 #include <backdropFX/BackdropCommon.h>
 #include <osg/Group>
 #include <osg/FrameBufferObject>
+#include <osgUtil/CullVisitor>
+#include <osg/buffered_value>
+#include <OpenThreads/Mutex>
 
 
 namespace backdropFX {
 
 
+class DepthPartitionStage;
+
+
 /** \class backdropFX::DepthPartition DepthPartition.h backdropFX/DepthPartition.h
 
 \brief Renders frustum in back-to-front ordered partitions.
@@ -41,6 +47,59 @@ public:
     void setRatio( double ratio );
     double getRatio() const;
 
+    /** Enables or disables single-pass rendering. By default, DepthPartition
+    renders the scene once per partition, clearing the depth buffer between
+    passes. In single-pass mode, it renders the scene once into a layered
+    framebuffer (one texture array layer per partition), and a geometry shader
+    routes each triangle to the partitions it overlaps. A final pass
+    composites the layers back to front into the destination FBO. This removes
+    the per-partition draw call multiplier for scenes limited by CPU submission
+    cost.
+
+    Limitations:
+    \li Requires GL_EXT_geometry_shader4, GL_EXT_texture_array, OSG 2.9.7 or
+    later, and GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT and
+    GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS_EXT large enough for
+    BDFX_MAX_PARTITIONS copies of a triangle. DepthPartition checks this the
+    first time it draws in each context. If any context fails the check,
+    DepthPartition removes the geometry shader in the next update traversal
+    and renders in multiple passes from then on. The frame that detects the
+    failure may render incorrectly.
+    \li At most BDFX_MAX_PARTITIONS partitions. When the automatically computed
+    number of partitions exceeds this, the ratio is increased so that
+    BDFX_MAX_PARTITIONS partitions cover the view volume.
+    \li Only triangles go through the geometry shader. Drawables with points,
+    lines, or quads are drawn once per partition into each layer, so they
+    cost one draw per partition, as in multipass mode.
+    \li Blended geometry that spans partitions is composited per-layer, which
+    only approximates multipass blending.
+    \li The destination depth buffer receives the depth of the nearest
+    partition, as it does after multiple passes.
+    \li Incompatible with depth peeling. If the DepthPeelBin is in use,
+    DepthPartition renders in multiple passes.
+
+    Changing this value changes the shader modules on this node, so you
+    must call Manager::rebuild() afterwards. Default is false. */
+    void setSinglePass( bool singlePass );
+    bool getSinglePass() const;
+
+    /** Enables or disables culling each partition separately. By default,
+    DepthPartition culls its children once against the overall view volume,
+    and draws everything that passes in every partition. When enabled,
+    DepthPartition culls its children once per partition, with that partition's
+    projection matrix. Objects are then only drawn in the partitions they
+    overlap, and small feature culling and LOD selection (in
+    PIXEL_SIZE_ON_SCREEN mode) see the partition's view volume. This reduces
+    vertex load in the far partitions at the cost of additional cull
+    traversals.
+
+    The partitions are computed during cull from the bounding sphere of
+    DepthPartition's children, clamped to the camera near and far planes.
+    Ignored in single-pass mode, which submits the scene only once.
+    Default is false. */
+    void setPartitionCulling( bool partitionCulling );
+    bool getPartitionCulling() const;
+
 
     /** Enables for standalone use. */
     void setPrototypeHACK( bool enable=true ) { _proto = enable; }
@@ -58,12 +117,52 @@ public:
     void resizeGLObjectBuffers( unsigned int maxSize );
     void releaseGLObjects( osg::State* state ) const;
 
+    /** Manager calls this after rebuilding shader modules, with
+    RebuildShaderModules::getGeometryOutputComponents(). */
+    void setGeometryOutputComponents( unsigned int components );
+
+    /** True if the single pass shader modules (the layered vertex shader
+    and the partition geometry shader) are on this node. */
+    bool getLayeredShaders() const { return( _layeredShaders ); }
+
+    /** Returns true if single pass is usable in the context. The first call
+    in each context queries the extensions and geometry shader limits. If the
+    query fails, this returns false for all contexts, and the next update
+    traversal removes the geometry shader. */
+    bool isSinglePassSupported( unsigned int contextID );
+
+    /** Called during update. Removes the geometry shader if
+    isSinglePassSupported() failed, and sets the shader modules dirty. */
+    void updateSinglePassShaders();
+
+    /** True if the shader modules on this node changed during update, and
+    the shader module programs must be rebuilt. The Manager checks this after
+    each update traversal, and calls Manager::rebuildShaderModules(). Outside
+    the Manager, run RebuildShaderModules on the scene graph yourself, then
+    clear the flag. */
+    bool getShaderModulesDirty() const { return( _shaderModulesDirty ); }
+    void setShaderModulesDirty( bool dirty ) { _shaderModulesDirty = dirty; }
+
 protected:
     ~DepthPartition();
     void internalInit();
 
+    void setPartitionShaders();
+    bool cullPartitions( osgUtil::CullVisitor* cv, DepthPartitionStage* dpStage );
+
     unsigned int _numPartitions;
     double _ratio;
+    bool _singlePass;
+    bool _partitionCulling;
+
+    // Single pass support. _contextSupport is 0 until queried,
+    // then 1 (supported) or -1 (not supported).
+    bool _layeredShaders;
+    bool _singlePassUnsupported;
+    unsigned int _geometryOutputComponents;
+    bool _shaderModulesDirty;
+    osg::buffered_value< int > _contextSupport;
+    OpenThreads::Mutex _supportMutex;
 
     osg::ref_ptr< osg::Object > _renderingCache;
 
@@ -6,9 +6,15 @@
 
 #include <osgUtil/RenderStage>
 #include <osg/FrameBufferObject>
+#include <osg/Texture2DArray>
+#include <osg/Geometry>
+#include <osg/Program>
+#include <osg/BlendFunc>
+#include <osg/Depth>
 #include <osg/Version>
 
 #include <string>
+#include <vector>
 
 
 
@@ -31,20 +37,83 @@ public:
     virtual const char* className() const { return "DepthPartitionStage"; }
 
     virtual void draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous );
+    virtual void reset();
+    /** Also sorts the partition RenderBins, which aren't children of
+    the stage. */
+    virtual void sort();
 
     void setDepthPartition( DepthPartition* depthPartition );
 
     osg::StateSet* getPerCullStateSet();
 
+    typedef std::vector< osg::Matrixf > MatrixList;
+
+    /** Computes the projection matrix of each partition, far to near, from
+    the overall projection \c proj and the DepthPartition settings. */
+    void computePartitions( MatrixList& partitions, const osg::Matrixd& proj, bool singlePass ) const;
+
+    /** Partition culling support. DepthPartition calls this during cull
+    with the partitions it culls against; draw() then uses these partitions
+    and draws each partition's RenderBin instead of the stage's own contents.
+    Cleared by reset(). */
+    void setCullPartitions( const MatrixList& partitions );
+    /** Valid after setCullPartitions(). DepthPartition makes this the current
+    RenderBin and pushes the StateSet while culling partition \c idx. */
+    osgUtil::RenderBin* getPartitionBin( unsigned int idx );
+    osg::StateSet* getPartitionStateSet( unsigned int idx );
+
+    /** Single pass support. The partition geometry shader only accepts
+    triangles. DepthPartition calls this at the end of cull to move the
+    RenderLeaves of \c bin (and its child bins) that aren't triangle-only
+    osg::Geometry into a separate RenderBin, using the partition pass
+    program (see RebuildShaderModules). draw() draws that bin once per
+    partition. */
+    void separatePartitionPassLeaves( osgUtil::RenderBin* bin );
+
 protected:
     ~DepthPartitionStage();
     void internalInit();
 
+    /** Returns true if the single-pass path is usable in this context.
+    Warns (once) if single pass is requested but not usable. */
+    bool useSinglePass( unsigned int contextID );
+
+    /** Renders all partitions in one pass into the layered FBO, then
+    composites the layers into \c fbo (or the window, if NULL). */
+    void drawSinglePass( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous,
+        const MatrixList& partitions, osg::FrameBufferObject* fbo, osg::FBOExtensions* fboExt );
+    void configureLayeredFBO( int width, int height, unsigned int layers );
+
     DepthPartition* _depthPartition;
 
     osg::ref_ptr< osg::StateSet > _stateSet;
     osg::ref_ptr< osg::Uniform > _partitionMatrix;
     osg::ref_ptr< osg::Uniform > _partitionDebug;
+
+    // Partition culling support.
+    MatrixList _cullPartitions;
+    typedef std::vector< osg::ref_ptr< osgUtil::RenderBin > > BinList;
+    BinList _partitionBins;
+    typedef std::vector< osg::ref_ptr< osg::StateSet > > StateSetList;
+    StateSetList _partitionStateSets;
+
+    // Single-pass support.
+    osg::ref_ptr< osg::Uniform > _partitionMatrices;
+    osg::ref_ptr< osg::Uniform > _partitionCount;
+    osg::ref_ptr< osgUtil::RenderBin > _partitionPassBin;
+    typedef std::vector< osg::ref_ptr< osg::FrameBufferObject > > FBOList;
+    FBOList _layerFBOs;
+    osg::ref_ptr< osg::FrameBufferObject > _layeredFBO;
+    osg::ref_ptr< osg::Texture2DArray > _layeredColor;
+    osg::ref_ptr< osg::Texture2DArray > _layeredDepth;
+    osg::ref_ptr< osg::Viewport > _layeredViewport;
+    osg::ref_ptr< osg::Geometry > _fstp;
+    osg::ref_ptr< osg::Program > _compositeProgram;
+    osg::ref_ptr< osg::BlendFunc > _compositeBlendFunc;
+    osg::ref_ptr< osg::Depth > _compositeDepth;
+    osg::ref_ptr< osg::Uniform > _compositeTexture;
+    osg::ref_ptr< osg::Uniform > _compositeDepthTexture;
+    bool _singlePassWarned;
 };
 
 
@@ -133,10 +133,11 @@ protected:
     {
         PerContextInfo();
 
-        void init( const osg::State& state, const GLsizei width, const GLsizei height );
+        void init( const osg::State& state, const GLsizei width, const GLsizei height, const GLint colorFormat );
         void cleanup( const osg::State& state );
         bool _init;
         GLsizei _width, _height;
+        GLint _colorFormat;
 
         GLuint _fbo;
         GLuint _depthTex[ 3 ];
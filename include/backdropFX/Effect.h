@@ -5,9 +5,12 @@
 
 #include <backdropFX/Export.h>
 #include <backdropFX/RenderingEffectsStage.h>
+#include <backdropFX/UniformLocationCache.h>
 #include <osg/Referenced>
 #include <osg/Texture2D>
+#include <osg/Shader>
 #include <osg/Depth>
+#include <osg/Viewport>
 #include <osg/RenderInfo>
 
 #include <vector>
@@ -17,6 +20,8 @@
 namespace backdropFX {
 
 
+class EffectGraph;
+
 /** \brief Used in conjunction with the RenderingEffects class as one element of a post-rendering effects pipeline.
 
 The application stores multiple Effect instances in the RenderingEffects
@@ -38,6 +43,18 @@ with each processing sequentially. However, a better solution is to
 create a specialization of Effect that overrides Effect::draw(). The custom
 draw function can call Effect::internalDraw() iteratively, varying the
 texture, FBO, and program bindings for each pass.
+
+Before drawing, RenderingEffectsStage compiles the EffectVector with an
+EffectGraph, which culls Effects whose output is unused and lets Effects
+share intermediate textures. Each Effect describes itself to the graph in
+addGraphNodes(). Specializations that add internal textures or passes should
+override it, and must bind textures and FBOs through getGraphTexture() and
+getGraphFBO() in draw().
+
+An Effect that computes each output pixel from the same pixel of its inputs
+can also declare a pointwise shader (see setPointwiseShader()). The
+EffectGraph then fuses runs of consecutive pointwise Effects into a single
+generated program, which reads input 0 once and writes the output once.
 */
 class BACKDROPFX_EXPORT Effect : public osg::Object
 {
@@ -62,15 +79,65 @@ public:
     virtual osg::FrameBufferObject* getOutput() const;
 
     /** \brief Attach the color buffer output to the input of an effect.
+    If the Effect has no output, this creates one, 16-bit floating point
+    if the Manager hdr feature flag is set (see Manager::getHDR()), and
+    8-bit otherwise.
     */
     virtual bool attachOutputTo( Effect* effect, unsigned int unit );
+    /** \brief Reformat the output that attachOutputTo() created.
+    16-bit floating point if \c hdr is true, 8-bit otherwise. Manager::rebuild()
+    calls this on the RenderingEffects Effects when the hdr feature flag
+    changes. An output set with setOutput() doesn't change. Specializations
+    that render into temporaries reformat those, too.
+    */
+    virtual void setHDR( bool hdr );
+
+    /** \brief Describe this Effect to the EffectGraph compiler.
+    The base class adds one node that draws one pass, reads all inputs, and
+    writes the output texture. The output is transient if attachOutputTo()
+    created it.
+    */
+    virtual void addGraphNodes( EffectGraph* graph );
+    /** \brief Returns a number that increases whenever the graph nodes change.
+    The Effect functions that change inputs, output, texture size, or the
+    pointwise shader increase it. EffectGraph compares it with the number
+    it last compiled to decide whether to recompile.
+    */
+    virtual unsigned int getGraphRevision() const;
+
+    /** Resize or release the per-context objects of the program and of
+    the uniform location cache. Specializations with programs or caches of
+    their own extend these. RenderingEffects calls them on its EffectVector
+    and default Effect. */
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=NULL ) const;
 
     void setProgram( osg::Program* program );
     osg::Program* getProgram() const { return _program.get(); }
 
+    /** \brief Pointwise form of the Effect, for fusion with adjacent Effects.
+    A fragment shader snippet (no main()) that defines
+    \code
+    vec4 pointwise( vec4 color, vec2 tc );
+    \endcode
+    where \c color is input 0 at \c tc, and the return value is the output
+    color. The snippet samples inputs 1 to 3 as inputTexture1 to
+    inputTexture3, always at \c tc, and never samples inputTexture0. It can
+    declare its own uniforms, which must be in the Effect's uniform list.
+    The generated program provides the declarations in
+    shaders/effects/declarations.common. See createEffectPointwiseShader().
+    Default is NULL: the Effect always draws with its own program.
+    */
+    void setPointwiseShader( osg::Shader* shader );
+    osg::Shader* getPointwiseShader() const { return( _pointwiseShader.get() ); }
+
 
     typedef std::vector< osg::ref_ptr< osg::Uniform > > UniformVector;
 
+    /** Per-Effect osg::Uniforms that draw() applies to the Effect program.
+    */
+    UniformVector& getUniforms() { return( _uniforms ); }
+
     /** Per-Effect osg::Uniforms for use by the effects Camera.
     The Manager or RenderingEffects object calls this function to obtain a list
     of uniforms, and adds them to the effects Camera StateSet. This allows each Effect
@@ -99,8 +166,50 @@ protected:
     */
     virtual void dumpImage( const osg::Viewport* vp, const std::string baseFileName );
 
+    /** Returns the COLOR_BUFFER0 texture of the output FBO, or NULL if the
+    Effect renders to the RenderingEffects output. */
+    osg::Texture* getOutputTexture() const;
+
+    /** Return the texture or FBO to bind in place of \c texture or \c fbo,
+    after the EffectGraph aliased transient textures, in the graph that the
+    context of \c state is drawing. */
+    osg::Texture* getGraphTexture( RenderingEffectsStage* rfxs, const osg::State& state, osg::Texture* texture ) const;
+    osg::FrameBufferObject* getGraphFBO( RenderingEffectsStage* rfxs, const osg::State& state, osg::FrameBufferObject* fbo ) const;
+
+    /** Applies the RenderingEffects viewport with its origin and extents
+    scaled by \c scale, and returns it. Passes that render into reduced
+    resolution textures use this so the area they fill matches
+    texturePercent. A scale of (1,1) applies the RenderingEffects viewport
+    itself. Passes that write the RenderingEffects output always draw at
+    full size, with RTTViewport::applyFullViewport() for an RTTViewport. */
+    const osg::Viewport* applyScaledViewport( RenderingEffectsStage* rfxs, osg::State& state, const osg::Vec2& scale );
+
+    /** Formats \c tex as 16-bit floating point if \c hdr is true, 8-bit
+    otherwise. setHDR() uses it for the output, and specializations for the
+    temporaries they render into, so that a floating point color buffer A
+    stays floating point through every pass. */
+    static void setTextureFormat( osg::Texture2D* tex, bool hdr );
+
+    /** Increases the graph revision. Specializations call this when they
+    change a texture or FBO that addGraphNodes() reports without going
+    through the base class. */
+    void dirtyGraph();
+    unsigned int _graphRevision;
+
+
+    /** Slots in _uniformLocations. draw() applies texturePercent at
+    TexturePercentSlot, the input texture samplers at FirstTextureSlot plus
+    the unit, then _uniforms and the RenderingEffects global uniforms.
+    Specializations that apply uniforms to a single program of their own
+    follow the same layout where they can. */
+    enum {
+        TexturePercentSlot = 0,
+        FirstTextureSlot = 1
+    };
+    UniformLocationCache _uniformLocations;
 
     osg::ref_ptr< osg::Program > _program;
+    osg::ref_ptr< osg::Shader > _pointwiseShader;
     UniformVector _textureUniform;
     UniformVector _effectsPassUniforms;
     UniformVector _uniforms;
@@ -109,12 +218,15 @@ protected:
     IntTextureMap _inputs;
 
     osg::ref_ptr< osg::FrameBufferObject > _output;
+    // True if the Effect created _output, so only later Effects read it.
+    bool _transientOutput;
 
     unsigned int _width, _height;
 
     // TBD need to share these with all Effect classes (a static, perhaps?)
     osg::ref_ptr< osg::Geometry > _fstp;
     osg::ref_ptr< osg::Depth > _depth;
+    osg::ref_ptr< osg::Viewport > _scaledViewport;
 };
 
 
@@ -169,6 +281,19 @@ public:
     /** \brief Attach the color buffer output to the input of an effect.
     */
     virtual bool attachOutputTo( Effect* effect, unsigned int unit );
+    /** Reformats the outputs of all sub-Effects. */
+    virtual void setHDR( bool hdr );
+
+    /** Adds the nodes of all sub-Effects. A CompositeEffect that overrides
+    draw() should override this to add itself as a single node. */
+    virtual void addGraphNodes( EffectGraph* graph );
+    /** Returns the largest revision of the CompositeEffect and its
+    sub-Effects. */
+    virtual unsigned int getGraphRevision() const;
+
+    /** Also resize or release the objects of all sub-Effects. */
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=NULL ) const;
 
 protected:
     ~CompositeEffect();
@@ -0,0 +1,272 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_EFFECT_GRAPH_H__
+#define __BACKDROPFX_EFFECT_GRAPH_H__ 1
+
+#include <backdropFX/Export.h>
+#include <backdropFX/Effect.h>
+#include <osg/Referenced>
+#include <osg/Texture2D>
+#include <osg/FrameBufferObject>
+#include <osg/RenderInfo>
+#include <osg/Program>
+#include <osg/buffered_value>
+#include <OpenThreads/ReentrantMutex>
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+
+namespace backdropFX {
+
+
+class RenderingEffectsStage;
+
+/** \class backdropFX::EffectGraph EffectGraph.h backdropFX/EffectGraph.h
+
+\brief Compiles an EffectVector into a dependency graph of draw nodes.
+
+Each leaf Effect adds one node to the graph (see Effect::addGraphNodes()).
+A node records the textures the Effect reads, the texture it writes (NULL
+for the RenderingEffects FBO or the default framebuffer), any intermediate
+textures it uses internally, and the number of fullscreen passes it draws.
+CompositeEffects add the nodes of their sub-Effects.
+
+Textures are either external (ColorBufferA, the depth buffer, app-supplied
+FBOs) or transient. A transient texture is owned by an Effect and only
+carries data from one node to later nodes in the same frame, such as the
+output that Effect::attachOutputTo() creates, or the horizontal pass of
+EffectSeperableBlur. The compiler uses this to:
+
+\li Cull nodes whose output nothing uses. A node is live if it is part of
+the last Effect in the EffectVector, writes an external texture, or writes a
+transient texture that a later live node reads.
+\li Compute the lifetime of each transient texture, from the first live node
+that writes it to the last live node that reads it.
+\li Fuse runs of consecutive pointwise Effects (see
+Effect::setPointwiseShader()) into a single node that draws one generated
+program. An Effect joins the run if its input 0 is the previous Effect's
+transient output and nothing else reads that output. The fused program reads
+input 0 of the first Effect once, evaluates each Effect's snippet in order,
+and writes the output of the last Effect once, so the intermediate outputs
+are never written. Generated programs are cached by their snippets until a
+recompile no longer draws them.
+\li Alias transient textures whose lifetimes don't overlap onto a single
+texture, if their size, format, filtering, and wrap modes match. Aliased
+textures never allocate GL storage.
+
+RenderingEffectsStage calls draw() with the EffectVector every frame. It
+recompiles only if dirty() was called, or if the EffectVector or the graph
+revision of one of its Effects changed (see Effect::getGraphRevision()),
+or if the uniform list or snippet of a fused Effect changed. Otherwise it
+draws the graph from the last compile without rebuilding any nodes. Like
+the EffectVector itself, don't change Effects while a draw is in progress.
+
+Contexts that share the RenderingEffects share the graph. draw() holds a
+lock only while it compiles and, after a recompile, copies the draw nodes
+and texture aliases into a snapshot for its context. It then draws from the
+snapshot without the lock, so contexts draw in parallel, and a recompile by
+one context never changes the graph another context is drawing. During
+draw, Effects look up the texture and FBO to actually use with getTexture()
+and getFBO(), which read the snapshot of their context.
+
+The report functions, such as getNumPasses() and getAllocatedBytes(),
+describe the most recent compile.
+*/
+class BACKDROPFX_EXPORT EffectGraph : public osg::Referenced
+{
+public:
+    EffectGraph();
+
+
+    //
+    // Building interface, called from Effect::addGraphNodes().
+    //
+
+    /** Starts a new node for \c effect, which draws \c numPasses
+    fullscreen passes. */
+    void addNode( Effect* effect, unsigned int numPasses=1 );
+    /** The current node reads \c texture. NULL is ignored. */
+    void addRead( osg::Texture* texture );
+    /** The current node writes \c texture, or the RenderingEffects output
+    if \c texture is NULL. Pass \c transient as true if the Effect owns the
+    texture and nothing outside the EffectVector samples it. */
+    void addWrite( osg::Texture* texture, bool transient );
+    /** The current node writes and then reads \c texture internally. It's
+    always transient. */
+    void addTemporary( osg::Texture* texture );
+
+
+    /** Rebuilds the graph from \c effectVector if anything changed since the
+    last compile, or if dirty() was called. Returns true if it recompiled. */
+    bool compile( const EffectVector& effectVector );
+    /** Forces the next compile() to recompile. RenderingEffects calls this
+    when its Effect set, attachments, or texture size change. */
+    void dirty();
+
+    /** Compiles \c effectVector if needed, then draws the live nodes in
+    order. */
+    void draw( const EffectVector& effectVector, RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo );
+
+    /** Enable or disable culling, fusion, and aliasing. When disabled, the graph
+    draws every node into its own textures, and the report functions show
+    the unoptimized cost. Default is true. */
+    void setOptimize( bool optimize );
+    bool getOptimize() const { return( _optimize ); }
+
+    /** Returns the texture that \c texture is aliased to in the graph that
+    context \c contextID is drawing, or \c texture if it isn't aliased. */
+    osg::Texture* getTexture( unsigned int contextID, osg::Texture* texture ) const;
+    /** Returns the FBO that renders to the alias of \c texture in the graph
+    that context \c contextID is drawing, or NULL if \c texture isn't
+    aliased. */
+    osg::FrameBufferObject* getFBO( unsigned int contextID, const osg::Texture* texture ) const;
+
+
+    //
+    // Report for the most recent compile.
+    //
+
+    /** Nodes and passes in the EffectVector, and how many draw after
+    culling and fusion. A fused run draws as one node and one pass. */
+    unsigned int getNumNodes() const { return( _numNodes ); }
+    unsigned int getNumDrawnNodes() const { return( _numDrawnNodes ); }
+    unsigned int getNumPasses() const { return( _numPasses ); }
+    unsigned int getNumDrawnPasses() const { return( _numDrawnPasses ); }
+    /** Effects that draw as part of a generated program, and the number of
+    generated programs. */
+    unsigned int getNumFusedEffects() const { return( _numFusedEffects ); }
+    unsigned int getNumFusedPrograms() const { return( _numFusedPrograms ); }
+    /** Transient textures the Effects own, and how many the live nodes
+    actually render into after aliasing. */
+    unsigned int getNumTransientTextures() const { return( _numTransients ); }
+    unsigned int getNumAllocatedTextures() const { return( _numAllocated ); }
+    /** Estimated GPU memory, in bytes, of the transient textures, and of the
+    textures allocated after culling and aliasing. */
+    unsigned int getTransientBytes() const { return( _transientBytes ); }
+    unsigned int getAllocatedBytes() const { return( _allocatedBytes ); }
+
+
+    void resizeGLObjectBuffers( unsigned int maxSize );
+    void releaseGLObjects( osg::State* state ) const;
+
+protected:
+    ~EffectGraph();
+
+    /** True if \c effectVector or a fused Effect changed since the last
+    compile. Call with _mutex held. */
+    bool needsCompile( const EffectVector& effectVector ) const;
+    /** Culls dead nodes, fuses pointwise runs, computes transient
+    lifetimes, and assigns transient textures to slots. */
+    void internalCompile();
+
+    struct Resource
+    {
+        osg::ref_ptr< osg::Texture > _texture;
+        bool _transient;
+        // Size when compiled.
+        unsigned int _width, _height;
+        GLint _format;
+    };
+    typedef std::vector< Resource > ResourceVector;
+    typedef std::vector< osg::ref_ptr< osg::Texture > > TextureVector;
+
+    struct Node
+    {
+        osg::ref_ptr< Effect > _effect;
+        unsigned int _numPasses;
+        TextureVector _reads;
+        ResourceVector _writes;
+        ResourceVector _temporaries;
+        // The node belongs to the last Effect in the EffectVector.
+        bool _last;
+        // Set by internalCompile().
+        bool _live;
+        // _effect draws a generated program for a pointwise run.
+        bool _fused;
+    };
+    typedef std::vector< Node > NodeVector;
+
+    /** A texture that one or more transient textures alias to. */
+    struct Slot
+    {
+        osg::ref_ptr< osg::Texture2D > _texture;
+        osg::ref_ptr< osg::FrameBufferObject > _fbo;
+        // Index of the last node that uses the slot.
+        unsigned int _busyUntil;
+    };
+    typedef std::vector< Slot > SlotVector;
+
+    mutable OpenThreads::ReentrantMutex _mutex;
+
+    bool _dirty;
+    bool _optimize;
+
+    // The Effects of the last compile, and their graph revisions.
+    typedef std::vector< std::pair< osg::ref_ptr< Effect >, unsigned int > > RevisionVector;
+    RevisionVector _revisions;
+
+    // _nodes as built from the EffectVector; _drawNodes after culling and
+    // fusion.
+    NodeVector _nodes, _building, _drawNodes;
+    SlotVector _slots;
+    typedef std::map< const osg::Texture*, unsigned int > TextureSlotMap;
+    TextureSlotMap _aliases;
+    // Incremented by each compile that rebuilds the graph.
+    unsigned int _compileCount;
+
+    /** What one context draws: a copy of _drawNodes, and the slot each
+    aliased texture resolves to, as of compile number _compileCount. Only
+    the draw of its own context writes a snapshot. */
+    struct DrawSnapshot
+    {
+        DrawSnapshot() : _compileCount( 0 ) {}
+
+        unsigned int _compileCount;
+        NodeVector _nodes;
+        typedef std::map< const osg::Texture*, Slot > AliasMap;
+        AliasMap _aliases;
+    };
+    mutable osg::buffered_object< DrawSnapshot > _snapshots;
+
+    // Live reads of each texture, and textures read before any node writes
+    // them, from the most recent compile.
+    typedef std::map< const osg::Texture*, unsigned int > TextureCountMap;
+    TextureCountMap _readCounts;
+    std::set< const osg::Texture* > _persistent;
+
+    /** True if the node draws one pass with a pointwise shader. */
+    bool isPointwise( const Node& node ) const;
+    /** True if _nodes[ next ] can join the pointwise run of _nodes indices
+    in \c run. */
+    bool canFuse( const std::vector< unsigned int >& run, unsigned int next ) const;
+    /** Returns a node that draws the \c run of _nodes with a generated
+    program. */
+    Node fuse( const std::vector< unsigned int >& run );
+    /** Returns the generated program for \c effects, whose inputs 1 to 3
+    are on the texture \c units (~0u if unused). Programs are cached by
+    source. internalCompile() drops the programs the new graph doesn't
+    draw. */
+    osg::Program* getFusedProgram( const std::vector< Effect* >& effects,
+        const std::vector< unsigned int >& units, unsigned int numUnits );
+
+    typedef std::map< std::string, osg::ref_ptr< osg::Program > > ProgramMap;
+    ProgramMap _fusedPrograms;
+    osg::ref_ptr< osg::Shader > _fusedVertexShader;
+
+    unsigned int _numNodes, _numDrawnNodes;
+    unsigned int _numPasses, _numDrawnPasses;
+    unsigned int _numFusedEffects, _numFusedPrograms;
+    unsigned int _numTransients, _numAllocated;
+    unsigned int _transientBytes, _allocatedBytes;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_EFFECT_GRAPH_H__
+#endif
@@ -5,7 +5,9 @@
 
 #include <backdropFX/Export.h>
 #include <backdropFX/Effect.h>
+#include <backdropFX/GaussianKernel.h>
 #include <osg/Program>
+#include <osg/buffered_value>
 
 #include <string>
 
@@ -18,6 +20,12 @@ namespace backdropFX {
 
 
 /** \brief A blur effect, separated into horizontal and vertical passes.
+
+Both passes use the same Gaussian kernel (see GaussianKernel). Its sigma is
+a fraction of the texture width, so the blur covers the same screen area at
+any resolution (see setResolution()). A wide blur at full resolution
+exceeds the kernel's tap limit and spreads its taps, so reduced resolution
+is both cheaper and more accurate.
 */
 class BACKDROPFX_EXPORT EffectSeperableBlur : public Effect
 {
@@ -32,11 +40,38 @@ public:
 
     virtual void setTextureWidthHeight( unsigned int texW, unsigned int texH );
 
+    /** Also reformats the horizontal pass texture. */
+    virtual void setHDR( bool hdr );
+
+    /** Also resize or release the kernel program. */
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=NULL ) const;
+
+    /** Two passes. The horizontal pass texture is a temporary. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
+    /** Fraction of the RenderingEffects viewport that both passes render
+    into. Call setTextureWidthHeight() with the reduced texture size, too.
+    Less than 1.0 requires an output FBO. Default is 1.0. */
+    void setResolution( float resolution );
+    float getResolution() const { return( _resolution ); }
+
+    /** Standard deviation of the blur, as a fraction of the texture width.
+    Cheap to change every frame. Default is 0.016. */
+    void setSigma( float sigma );
+    float getSigma() const { return( _sigma ); }
+
+    /** The kernel both passes use, for example to change its tap limit.
+    setSigma() and setTextureWidthHeight() set its sigma. */
+    GaussianKernel* getKernel() const { return( _kernel.get() ); }
+
 protected:
     ~EffectSeperableBlur();
 
-    osg::ref_ptr< osg::Program > _horizontal;
-    osg::ref_ptr< osg::Program > _vertical;
+    float _resolution;
+    float _sigma;
+
+    osg::ref_ptr< GaussianKernel > _kernel;
 
     osg::ref_ptr< osg::Texture2D > _hBlur;
     osg::ref_ptr< osg::FrameBufferObject > _hBlurFBO;
@@ -44,6 +79,9 @@ protected:
 
 
 /** \brief A Gaussian blur effect.
+
+Both passes use a GaussianKernel, whose sigma is in texels of the texture
+this Effect renders at.
 */
 class BACKDROPFX_EXPORT GaussConvolution : public Effect
 {
@@ -64,17 +102,37 @@ public:
     virtual void setTextureWidthHeight(
         unsigned int texW, unsigned int texH );
 
+    /** Also reformats the x pass texture. */
+    virtual void setHDR( bool hdr );
+
+    /** Also resize or release the kernel program. */
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=NULL ) const;
+
+    /** Two passes. The x pass texture is a temporary. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
+    /** Fraction of the RenderingEffects viewport that both passes render
+    into. Call setTextureWidthHeight() with the reduced texture size, too.
+    Default is 1.0. */
+    void setResolution( float resolution );
+    float getResolution() const { return( m_resolution ); }
+
+    /** Standard deviation of the blur, in texels. Cheap to change every
+    frame. Default is 2.0. */
+    void setSigma( float sigma );
+    float getSigma() const { return( m_kernel->getSigma() ); }
+
+    /** The kernel both passes use, for example to change its tap limit. */
+    GaussianKernel* getKernel() const { return( m_kernel.get() ); }
+
 protected:
     ~GaussConvolution();
 
 private:
-    osg::ref_ptr< osg::Uniform > m_viewportSize;
-
-    osg::ref_ptr< osg::Viewport > m_viewport;
+    float m_resolution;
 
-    osg::ref_ptr< osg::Program > m_1Dx;
-
-    osg::ref_ptr< osg::Program > m_1Dy;
+    osg::ref_ptr< GaussianKernel > m_kernel;
 
     osg::ref_ptr< osg::Texture2D > m_tex2D;
 
@@ -83,6 +141,9 @@ private:
 
 
 /** \brief Resample an input texture.
+
+Renders input 0 into its own output texture, whose size is the texture size
+times the factor. setTextureWidthHeight() takes the full texture size.
 */
 class BACKDROPFX_EXPORT Resample : public Effect
 {
@@ -103,7 +164,10 @@ public:
     virtual void setTextureWidthHeight(
         unsigned int texW, unsigned int texH );
 
+    /** Default is (1,1). Call setTextureWidthHeight() afterwards to
+    resize the output. */
     void setFactor( float xFactor, float yFactor );
+    const osg::Vec2& getFactor() const { return( m_factor ); }
 
 protected:
     ~Resample();
@@ -111,12 +175,46 @@ protected:
 private:
     osg::Vec2 m_factor;
 
-    osg::ref_ptr< osg::Viewport > m_viewport;
-
     osg::ref_ptr< osg::Texture2D > m_tex2D;
 
 };
 
+/** \brief Upsample a reduced resolution texture, preserving edges.
+
+Input 0 is the reduced resolution texture, and input 1 is a full resolution
+guide texture. Each output pixel weights the four nearest texels of input 0
+by their bilinear weight and by how close the guide's red channel at the
+texel is to the guide at the pixel, so texels across an edge in the guide
+don't bleed in. setTextureWidthHeight() takes the full texture size.
+*/
+class BACKDROPFX_EXPORT BilateralUpsample : public Effect
+{
+public:
+    BilateralUpsample();
+
+    BilateralUpsample(
+        BilateralUpsample const& rhs,
+        osg::CopyOp const& copyop = osg::CopyOp::SHALLOW_COPY );
+
+    META_Object( backdropFX, BilateralUpsample );
+
+    virtual void setTextureWidthHeight(
+        unsigned int texW, unsigned int texH );
+
+    /** Resolution of input 0, as a fraction of the texture size.
+    Default is 0.5. */
+    void setInputResolution( float resolution );
+    float getInputResolution() const { return( m_inputResolution ); }
+
+protected:
+    ~BilateralUpsample();
+
+private:
+    float m_inputResolution;
+
+    osg::ref_ptr< osg::Uniform > m_inputSize;
+};
+
 /** \brief Combine scene output with glow output.
 */
 class BACKDROPFX_EXPORT GlowCombine : public Effect
@@ -165,6 +263,8 @@ protected:
 
 
 /** \brief Scale and bias an image.
+The output RGB is the input RGB times the scale, plus the bias. Alpha passes
+through unchanged.
 */
 class BACKDROPFX_EXPORT EffectScaleBias : public Effect
 {
@@ -213,8 +313,19 @@ blurred glow map.
 As a final step, EffectBasicGlow adds the blurred glow map to
 color buffer A.
 
-Input 0: ColorBufferA
-Input 1: GlowColorBuffer
+At reduced resolution (see setResolution()), the blur runs on a downsampled
+glow map, and the combine upsamples the result bilinearly as it reads it.
+The glow should spread across edges, so it doesn't need a bilateral
+upsample. The blur sigma is a fraction of the texture width, so the glow
+radius doesn't change.
+
+Resample (skipped at full resolution)
+  Input 0: GlowColorBuffer
+EffectSeperableBlur
+  Input 0: Resample output, or GlowColorBuffer
+EffectCombine
+  Input 0: EffectSeperableBlur output
+  Input 1: ColorBufferA
 */
 class BACKDROPFX_EXPORT EffectBasicGlow : public CompositeEffect
 {
@@ -223,6 +334,11 @@ public:
     EffectBasicGlow( const EffectBasicGlow& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
     META_Object(backdropFX,EffectBasicGlow);
 
+    virtual void setTextureWidthHeight( unsigned int texW, unsigned int texH );
+
+    /** Skips the Resample at full resolution. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
     virtual void addInput( const unsigned int unit, osg::Texture* texture );
     /* Not a Doxygen comment
     TBD should probably implement these at some point.
@@ -242,9 +358,21 @@ public:
     void setUseGlowAlpha( bool useGlowAlpha );
     bool getUseGlowAlpha() const { return( _useGlowAlpha ); }
 
+    /** Fraction of the texture size, in each dimension, that the blur
+    runs at, for example 0.5 or 0.25. Below 1.0, a Resample downsamples
+    the glow map first. Default is 1.0. */
+    void setResolution( float resolution );
+    float getResolution() const { return( _resolution ); }
+
 protected:
     ~EffectBasicGlow();
 
+    /** Connects the sub-Effects for the current resolution. */
+    void internalAttach();
+
+    float _resolution;
+    osg::ref_ptr< osg::Texture > _glowMap;
+
     osg::Vec4f _glowColor;
     bool _useGlowAlpha;
     osg::ref_ptr< osg::Uniform > _glowColorUniform, _useGlowAlphaUniform;
@@ -252,10 +380,15 @@ protected:
 
 /** \brief Improved glow with Gaussian blur and downsampling.
 
-Resample
+The blur runs at a fraction of the texture size (see setResolution()), and
+GlowCombine upsamples it bilinearly as it reads it. The Gaussian sigma is in
+texels, so the Effect scales it to keep the glow radius it has at the default
+resolution of 0.5.
+
+Resample (skipped at full resolution)
   Input 0: ColorBufferGlow
 GaussConvolution
-  Input 0: Resample output
+  Input 0: Resample output, or ColorBufferGlow
 GlowCombine
   Input 0: ColorBufferA
   Input 1: GaussConvolution output
@@ -289,10 +422,23 @@ public:
     void setUseGlowAlpha( bool useGlowAlpha );
     bool getUseGlowAlpha() const { return( _useGlowAlpha ); }
 
+    /** Fraction of the texture size, in each dimension, that the blur
+    runs at, for example 0.5 or 0.25. Below 1.0, a Resample downsamples
+    the glow map first. Default is 0.5. */
+    void setResolution( float resolution );
+    float getResolution() const { return( _resolution ); }
+
+    /** Skips the Resample at full resolution. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
 protected:
     ~EffectImprovedGlow();
 
-    osg::Vec2 _resampleFactor;
+    /** Connects the sub-Effects for the current resolution. */
+    void internalAttach();
+
+    float _resolution;
+    osg::ref_ptr< osg::Texture > _glowMap;
 
     osg::Vec4f _glowColor;
     bool _useGlowAlpha;
@@ -306,6 +452,27 @@ of blurred data into depth regions that should appear in sharp focus.
 This issue could be addressed by replacing the simple blur with a shader
 that adjusts the blur sample kernel size based on the focal distance
 input texture.
+
+At reduced resolution (see setResolution()), the blur runs on a downsampled
+copy of the color buffer, and a BilateralUpsample guided by the focal
+distance texture brings it back to full resolution, so blurred background
+doesn't smear over sharp foreground edges. The focal distance texture is
+Manager::getDepthBuffer(), which despite its name doesn't hold window depth:
+the effects Camera writes the distance to the focal plane, divided by the
+focal range and clamped to 1, to its red channel. The blur sigma is a fraction of
+the texture width, so the blur radius doesn't change.
+
+Resample (skipped at full resolution)
+  Input 0: ColorBufferA
+EffectSeperableBlur
+  Input 0: Resample output, or ColorBufferA
+BilateralUpsample (skipped at full resolution)
+  Input 0: EffectSeperableBlur output
+  Input 1: normalized focal distance (Manager::getDepthBuffer())
+EffectAlphaBlend
+  Input 0: BilateralUpsample output, or EffectSeperableBlur output
+  Input 1: ColorBufferA
+  Input 2: normalized focal distance (Manager::getDepthBuffer())
 */
 class BACKDROPFX_EXPORT EffectDOF : public CompositeEffect
 {
@@ -314,6 +481,11 @@ public:
     EffectDOF( const EffectDOF& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
     META_Object(backdropFX,EffectDOF);
 
+    virtual void setTextureWidthHeight( unsigned int texW, unsigned int texH );
+
+    /** Skips the Resample and BilateralUpsample at full resolution. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
     virtual void addInput( const unsigned int unit, osg::Texture* texture );
     /* Not a Doxygen comment
     TBD should probably implement these at some point.
@@ -337,11 +509,23 @@ public:
     void setFocalRange( float range );
     float getFocalRange() const { return( _range ); }
 
+    /** Fraction of the texture size, in each dimension, that the blur
+    runs at, for example 0.5 or 0.25. Below 1.0, a Resample downsamples
+    the color buffer first. Default is 1.0. */
+    void setResolution( float resolution );
+    float getResolution() const { return( _resolution ); }
+
 protected:
     ~EffectDOF();
 
+    /** Connects the sub-Effects for the current resolution. */
+    void internalAttach();
+
     float _distance, _range;
     osg::ref_ptr< osg::Uniform > _focalDistance, _focalRange;
+
+    float _resolution;
+    osg::ref_ptr< osg::Texture > _source;
 };
 
 
@@ -379,6 +563,87 @@ protected:
 };
 
 
+/** \brief Luminance-adaptive tone mapping.
+
+Scales input 0 so its average luminance maps to the key value (see
+setKey()), then compresses it with Reinhard's operator, mapping the
+brightest luminance to white. Use it with a floating point color buffer A
+(see Manager::hdr); on an 8-bit color buffer, it acts as auto exposure.
+With the hdr flag, the outputs and temporaries of the Effects upstream,
+such as glow and depth of field, are floating point too, so their results
+aren't clamped to 1.0 before tone mapping.
+
+The average and maximum luminance never leave the GPU. A first pass writes
+the log luminance of a 4x4 sample grid in each texel of a 256x256 texture,
+three passes reduce it by 4x4 blocks to 4x4, and a last pass reduces that to
+a 1x1 texture, keeping the mean and the maximum. The last pass also blends
+the result toward the previous frame's value, so exposure adapts gradually
+(see setAdaptationRate()). The tone mapping pass reads the 1x1 texture.
+Apart from the full resolution tone mapping pass, the passes shade about
+70K pixels, independent of the texture size.
+*/
+class BACKDROPFX_EXPORT EffectToneMapping : public Effect
+{
+public:
+    EffectToneMapping();
+    EffectToneMapping( const EffectToneMapping& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
+    META_Object(backdropFX,EffectToneMapping);
+
+    virtual void draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo, bool last=false );
+
+    /** Six passes. The reduction textures are temporaries. */
+    virtual void addGraphNodes( EffectGraph* graph );
+
+    /** Also resize or release the reduction program. */
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=NULL ) const;
+
+    /** Luminance that the adapted average maps to. Default is 0.18. */
+    void setKey( float key );
+    float getKey() const { return( _key ); }
+
+    /** Adaptation speed, per second. The adapted luminance covers
+    1 - exp( -rate * seconds ) of the distance to the current luminance.
+    Pass 0.0 to disable adaptation and use the current frame only. Default
+    is 1.5. */
+    void setAdaptationRate( float rate );
+    float getAdaptationRate() const { return( _adaptationRate ); }
+
+protected:
+    ~EffectToneMapping();
+
+    float _key, _adaptationRate;
+    osg::ref_ptr< osg::Uniform > _keyUniform;
+
+    osg::ref_ptr< osg::Program > _reduceProgram;
+    /** Slots in _reduceLocations. */
+    enum {
+        ReduceTexturePercentSlot = 0,
+        ReduceInputSlot,
+        ReducePreviousSlot,
+        ReduceBlendSlot,
+        ReduceModeSlot,
+        ReduceSizeSlot
+    };
+    UniformLocationCache _reduceLocations;
+    // Never set; draw() passes per-context values to GL at their locations.
+    osg::ref_ptr< osg::Uniform > _reduceMode, _reduceSize, _adaptBlend;
+    osg::ref_ptr< osg::Uniform > _previousUniform;
+
+    // 256x256 log luminance, then 64x64, 16x16, and 4x4.
+    std::vector< osg::ref_ptr< osg::Texture2D > > _reduce;
+    std::vector< osg::ref_ptr< osg::FrameBufferObject > > _reduceFBO;
+    std::vector< osg::ref_ptr< osg::Viewport > > _reduceViewport;
+
+    // 1x1 adapted luminance. Each context alternates between the two.
+    osg::ref_ptr< osg::Texture2D > _adapted[ 2 ];
+    osg::ref_ptr< osg::FrameBufferObject > _adaptedFBO[ 2 ];
+    osg::ref_ptr< osg::Viewport > _adaptedViewport;
+    osg::buffered_value< unsigned int > _adaptedIndex;
+    osg::buffered_value< double > _lastTime;
+};
+
+
 
 /*@}*/
 
@@ -27,6 +27,15 @@ processes their source and links them into an OSG Program, which returns to the
 */
 BACKDROPFX_EXPORT osg::Program* createEffectProgram( const std::string& baseName );
 
+/** \brief A utility function to load the pointwise form of an Effect shader.
+
+Loads shaders/effects/<baseName>-pointwise.fs, which contains the snippet
+described in Effect::setPointwiseShader(), and processes it with
+backdropFX::shaderPreProcess. Effects pass the returned Shader to
+Effect::setPointwiseShader().
+*/
+BACKDROPFX_EXPORT osg::Shader* createEffectPointwiseShader( const std::string& baseName );
+
 
 
 // namespace backdropFX
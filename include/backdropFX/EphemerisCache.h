@@ -0,0 +1,200 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_EPHEMERIS_CACHE_H__
+#define __BACKDROPFX_EPHEMERIS_CACHE_H__ 1
+
+
+#ifdef __APPLE__
+#  ifndef _DARWIN
+#    define _DARWIN 1
+#  endif
+#endif
+
+#include <backdropFX/Export.h>
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osgEphemeris/CelestialBodies.h>
+#include <osgEphemeris/DateTime.h>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
+
+#include <vector>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::EphemerisCache EphemerisCache.h backdropFX/EphemerisCache.h
+
+\brief Precomputed, interpolated Sun and Moon positions.
+
+SkyDome positions the Sun and Moon, and orients the celestial sphere, with
+osgEphemeris. Computing the Moon position and the local sidereal time is
+expensive, and with SkyDome::setAutoAdvanceTime() it happens every time
+the simulated second changes.
+
+EphemerisCache instead computes a table of samples at fixed steps (see
+setStep()) covering a window of time (see setWindow()) on a low priority
+background thread. getSample() linearly interpolates between the two
+samples bracketing the requested time. When the requested time nears the
+end of the table, a new table is computed in the background, starting
+slightly before the requested time, so that time-lapse animation never
+stalls. When time runs backwards and nears the start of the table, the
+new table instead ends slightly after the requested time.
+
+The Moon position is topocentric, so the table is only valid near the
+latitude and longitude it was computed for (see setLocationTolerance()).
+If getSample() is called with a location outside the tolerance, or with a
+time the table doesn't cover, it computes the sample directly and requests
+a new table.
+
+With the default 10 minute step, interpolation error is well under one
+arc second for the Sun and a few arc seconds for the Moon. The
+ephemeriscache test measures this.
+*/
+class BACKDROPFX_EXPORT EphemerisCache : public osg::Referenced
+{
+public:
+    EphemerisCache();
+
+    /** One ephemeris sample. Right ascension and local sidereal time are
+    in hours, declination is in degrees. */
+    struct Sample
+    {
+        double _sunRA, _sunDec;
+        double _moonRA, _moonDec;
+        double _lst;
+    };
+
+    /** Interval between table samples in minutes. Default is 10.0. */
+    void setStep( double minutes );
+    double getStep() const { return( _stepMinutes ); }
+    /** Length of the table in hours. Default is 48.0. */
+    void setWindow( double hours );
+    double getWindow() const { return( _windowHours ); }
+    /** Largest difference in latitude or longitude, in degrees, between the
+    location passed to getSample() and the location of the table for which
+    the table is still used. Within the tolerance, the local sidereal time
+    is computed for the exact longitude, and the Moon parallax error is
+    about 60 arc seconds per degree. Default is 0.01 (about one kilometer,
+    under one arc second). */
+    void setLocationTolerance( double degrees );
+    double getLocationTolerance() const { return( _locationTolerance ); }
+
+    /** Returns the ephemeris at \c mjd (a modified Julian date) for the
+    given location in \c sample. Returns true if the sample was
+    interpolated from the table, false if it was computed directly. */
+    bool getSample( double mjd, double latitude, double longitude, Sample& sample );
+
+    /** Computes a table covering \c mjd on the calling thread. Use this
+    to avoid direct computation on the first frames. */
+    void fill( double mjd, double latitude, double longitude );
+
+    /** Discards the table. The next getSample() computes directly and
+    requests a new table. */
+    void invalidate();
+
+    /** Computes the ephemeris at \c mjd directly with osgEphemeris.
+    Not thread safe: call this from only one thread at a time. */
+    void computeSample( double mjd, double latitude, double longitude, Sample& sample );
+
+    /** Computes a sample with the given osgEphemeris bodies. Safe to call
+    from multiple threads, provided each uses its own bodies. */
+    static void computeSample( osgEphemeris::Sun* sun, osgEphemeris::Moon* moon,
+        double mjd, double latitude, double longitude, Sample& sample );
+
+    /** Converts \c mjd, a modified Julian date as returned by
+    osgEphemeris::DateTime::getModifiedJulianDate() (days since the XEphem
+    epoch, 1899 December 31 12:00 GMT), to a GMT DateTime, truncated to
+    whole seconds. */
+    static osgEphemeris::DateTime toDateTime( double mjd );
+
+    /** The naked eye planets. See computePlanet(). */
+    enum Planet
+    {
+        MERCURY,
+        VENUS,
+        MARS,
+        JUPITER,
+        SATURN,
+        NUM_PLANETS
+    };
+
+    /** Computes the geocentric right ascension (hours), declination
+    (degrees), and visual magnitude of \c planet at \c mjd from mean
+    orbital elements, without perturbations (Paul Schlyter, "How to compute
+    planetary positions"). Positions are for the equinox of date, and are
+    good to a few arc minutes for Mercury, Venus, and Mars, and a few tenths
+    of a degree for Jupiter and Saturn. The magnitude of Saturn excludes its
+    rings. This is cheap and thread safe, so it isn't cached. */
+    static void computePlanet( Planet planet, double mjd,
+        double& ra, double& dec, double& magnitude );
+
+protected:
+    ~EphemerisCache();
+
+    struct Table : public osg::Referenced
+    {
+        double _startMJD, _stepDays;
+        double _latitude, _longitude;
+        unsigned int _generation;
+        // True if computed for time running backwards.
+        bool _backward;
+        std::vector< Sample > _samples;
+
+        double getEndMJD() const { return( _startMJD + _stepDays * ( _samples.size() - 1 ) ); }
+    };
+    struct Request
+    {
+        double _startMJD, _stepDays;
+        unsigned int _numSamples;
+        double _latitude, _longitude;
+        unsigned int _generation;
+        bool _backward;
+    };
+
+    /** Posts a request for a new table that begins slightly before \c mjd,
+    or, if \c backward, ends slightly after it. */
+    void request( double mjd, double latitude, double longitude, bool backward=false );
+    bool matchLocation( double latitude, double longitude,
+        double tableLatitude, double tableLongitude ) const;
+    /** Call with _mutex locked. */
+    void initRequest( Request& req, double mjd, double latitude, double longitude,
+        bool backward=false ) const;
+    static Table* computeTable( const Request& req,
+        osgEphemeris::Sun* sun, osgEphemeris::Moon* moon );
+
+    // Called by the worker thread.
+    friend class EphemerisCacheThread;
+    bool waitForRequest( Request& req );
+    void storeTable( Table* table );
+
+    double _stepMinutes, _windowHours;
+    double _locationTolerance;
+
+    OpenThreads::Mutex _mutex;
+    OpenThreads::Condition _condition;
+    osg::ref_ptr< Table > _table;
+    Request _request;
+    bool _requestPending;
+    bool _requestInFlight;
+    // Incremented by invalidate(), so that tables requested
+    // before the invalidation are discarded.
+    unsigned int _generation;
+    bool _done;
+
+    osg::ref_ptr< osgEphemeris::Sun > _cSun;
+    osg::ref_ptr< osgEphemeris::Moon > _cMoon;
+
+    OpenThreads::Thread* _thread;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_EPHEMERIS_CACHE_H__
+#endif
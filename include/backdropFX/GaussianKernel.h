@@ -0,0 +1,123 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_GAUSSIAN_KERNEL_H__
+#define __BACKDROPFX_GAUSSIAN_KERNEL_H__ 1
+
+#include <backdropFX/Export.h>
+#include <backdropFX/UniformLocationCache.h>
+#include <osg/Referenced>
+#include <osg/Program>
+#include <osg/Uniform>
+#include <osg/State>
+#include <osg/Vec2>
+
+#include <vector>
+
+
+namespace backdropFX {
+
+
+/** \brief Computes a normalized, linearly sampled 1D Gaussian kernel.
+
+Fills \c kernel with one (offset, weight) pair per tap, in texels. Tap 0 is
+the center. Each other tap stands for two adjacent discrete texels, i and i+1,
+and sits between them at the offset where bilinear filtering returns their
+weighted sum, so a pass samples it at +offset and -offset. A kernel that
+covers 3 sigma on each side takes 1 + ceil( ceil( 3 sigma ) / 2 ) taps, about
+half the discrete texel count.
+
+If that exceeds \c maxTaps, the function computes the kernel for a smaller
+sigma that fits and scales the offsets back up, so the taps are more than a
+texel apart. That keeps the cost bounded, but undersamples the input.
+
+Returns the tap spacing in texels: 1.0, or greater than 1.0 if the kernel
+was spread.
+*/
+BACKDROPFX_EXPORT float computeGaussianKernel( float sigma, unsigned int maxTaps,
+    std::vector< osg::Vec2 >& kernel );
+
+/** \brief Returns the separable blur program for \c numTaps taps.
+
+The first call for a tap count generates the program: it defines
+GAUSS_TAPS ahead of shaders/effects/gaussBlur.fs and processes the source
+with backdropFX::shaderPreProcess. Later calls return the same program, so
+each tap count compiles once per process. \c numTaps is clamped to the
+range [1,GaussianKernel::MaxTaps].
+*/
+BACKDROPFX_EXPORT osg::Program* getGaussianBlurProgram( unsigned int numTaps );
+
+
+/** \class backdropFX::GaussianKernel GaussianKernel.h backdropFX/GaussianKernel.h
+
+\brief The kernel, program, and uniforms for a separable Gaussian blur pass.
+
+setSigma() recomputes the kernel with computeGaussianKernel() and selects the
+program for its tap count with getGaussianBlurProgram(). The kernel is a
+uniform array sized for MaxTaps, so a new sigma only changes uniform values,
+and Effects can change the blur radius every frame. A change in tap count
+switches to another cached program; it compiles only the first time that
+count is used.
+
+Effects call apply() once per pass, with the texture coordinate step of one
+texel along the pass axis. The program reads inputTexture0 on unit 0.
+*/
+class BACKDROPFX_EXPORT GaussianKernel : public osg::Referenced
+{
+public:
+    /** Taps per pass, including the center, of the largest variant. */
+    static const unsigned int MaxTaps = 16;
+
+    GaussianKernel( float sigma=2.f, unsigned int maxTaps=8 );
+
+    /** Standard deviation, in texels of the input texture. Default
+    is 2.0. */
+    void setSigma( float sigma );
+    float getSigma() const { return( _sigma ); }
+
+    /** Limit on taps per pass, including the center, from 1 to MaxTaps.
+    Wider kernels spread their taps (see computeGaussianKernel()).
+    Default is 8. */
+    void setMaxTaps( unsigned int maxTaps );
+    unsigned int getMaxTaps() const { return( _maxTaps ); }
+
+    /** Taps in the current kernel, and texture fetches per pixel per pass,
+    which is 2 * taps - 1. */
+    unsigned int getNumTaps() const { return( _numTaps ); }
+    unsigned int getNumFetches() const { return( 2 * _numTaps - 1 ); }
+    /** Tap spacing in texels. Greater than 1.0 if the kernel was spread. */
+    float getSpacing() const { return( _spacing ); }
+
+    osg::Program* getProgram() const { return( _program.get() ); }
+
+    /** Applies the program and the kernel uniforms. \c step is the texture
+    coordinate offset of one texel along the pass axis, for example
+    ( 1/width, 0 ). */
+    void apply( osg::State& state, const osg::Vec2& step ) const;
+
+    void resizeGLObjectBuffers( unsigned int maxSize );
+    void releaseGLObjects( osg::State* state=NULL ) const;
+
+protected:
+    ~GaussianKernel();
+
+    void internalUpdate();
+
+    float _sigma;
+    unsigned int _maxTaps;
+
+    unsigned int _numTaps;
+    float _spacing;
+
+    osg::ref_ptr< osg::Program > _program;
+    osg::ref_ptr< osg::Uniform > _kernel;
+    // Never set; apply() passes its step to GL at this uniform's location.
+    osg::ref_ptr< osg::Uniform > _step;
+    mutable UniformLocationCache _locations;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_GAUSSIAN_KERNEL_H__
+#endif
@@ -4,9 +4,12 @@
 #define __BACKDROPFX_LOCATION_DATA_H__ 1
 
 #include <backdropFX/Export.h>
+#include <osg/Referenced>
 #include <osg/Vec3>
 #include <osg/Uniform>
+#include <osg/observer_ptr>
 #include <osgEphemeris/DateTime.h>
+#include <OpenThreads/Mutex>
 
 #include <vector>
 
@@ -17,14 +20,46 @@ namespace backdropFX
 
 /** \class backdropFX::LocationData LocationData.h backdropFX/LocationData.h
 
-\li Singleton for tracking information about the current viewer
-position and ground orientation. 
+\li Tracks information about the viewer position, ground orientation,
+and date and time.
 \li Several modules within the rendering 
 system access it. 
-\li Sun position is set internally by SkyDome. */
-class BACKDROPFX_EXPORT LocationData
+\li Sun position is set internally by SkyDome.
+
+The s_instance() singleton is the default context, used by every view
+unless the app assigns the view its own. To render views at different
+locations or times in one process, create a LocationData per view and
+assign it to the view's Camera with Manager::setLocationData(). SkyDome,
+ShadowMap, and Sun lighting look up the context for the Camera they are
+culled under, so all views share one scene graph.
+\code
+osg::ref_ptr< LocationData > ld( new LocationData );
+ld->setLatitudeLongitude( lat, lon );
+Manager::instance()->setLocationData( view->getCamera(), ld.get() );
+\endcode
+
+Setting a value equal to the current value does nothing. Otherwise, each
+set function executes all registered callbacks, unless it is bracketed
+by beginUpdate() and endUpdate(). Then, the changes are accumulated and
+the callbacks execute once, from the outermost endUpdate(), with all the
+change bits combined:
+\code
+LocationData* ld( LocationData::s_instance() );
+ld->beginUpdate();
+ld->setLatitudeLongitude( lat, lon );
+ld->setEastUp( east, up );
+ld->setDateTime( dateTime );
+ld->endUpdate(); // Callbacks execute here, once.
+\endcode
+*/
+class BACKDROPFX_EXPORT LocationData : public osg::Referenced
 {
 public:
+    /** Creates a context with the default location (the ISU campus) and
+    date and time (1/1/2011, 6:00 GMT). */
+    LocationData();
+
+    /** The default context. */
     static backdropFX::LocationData* s_instance();
 
     void setLatitudeLongitude( double latitude, double longitude );
@@ -51,10 +86,25 @@ public:
 
         virtual void operator()( unsigned int changeMask ) = 0;
     };
-    typedef std::vector< osg::ref_ptr< Callback > > CallbackList;
+    typedef std::vector< osg::observer_ptr< Callback > > CallbackList;
+
+    /** Registers \c cb. LocationData doesn't keep a reference to the
+    callback; the caller owns it, and it is unregistered automatically
+    when it is deleted. Adding a callback twice has no effect. */
+    void addCallback( Callback* cb );
+    void removeCallback( Callback* cb );
 
+    /** \deprecated Use addCallback() and removeCallback(). Kept for
+    existing apps. The list holds weak references, so a callback pushed
+    here is only called while something else holds a reference to it. */
     CallbackList& getCallbackList();
 
+    /** Defer callbacks until the matching endUpdate(). Calls nest. */
+    void beginUpdate();
+    /** Executes the callbacks deferred since the outermost beginUpdate(),
+    once, if anything changed. */
+    void endUpdate();
+
 
     /** Not for apps to call; used internally for 
     lighting, shadows, lens flare, etc. */
@@ -65,17 +115,21 @@ public:
     osg::Uniform* getSunPositionUniform();
 
 protected:
-    LocationData();
     ~LocationData();
 
     void internalInit( unsigned int changed );
     void computeSunPosition();
+    void executeCallbacks( unsigned int changed );
+    /** Removes the entries of deleted callbacks from _cbList. */
+    void pruneCallbacks();
 
     double _latitude, _longitude;
     osg::Vec3 _east, _up;
     osgEphemeris::DateTime _dateTime;
 
     CallbackList _cbList;
+    unsigned int _updateDepth;
+    unsigned int _pendingChanges;
 
     osg::Matrix _sunMatrix, _celestialSphereMatrix;
     osg::Vec3 _pos;
@@ -11,12 +11,17 @@
 #include <backdropFX/DepthPeelBin.h>
 #include <backdropFX/RenderingEffects.h>
 #include <backdropFX/LightInfo.h>
+#include <backdropFX/LocationData.h>
 #include <osg/Referenced>
+#include <osg/Observer>
 #include <osg/ref_ptr>
 #include <osg/Group>
 #include <osg/Fog>
 #include <osg/FrameBufferObject>
 #include <osg/Texture2D>
+#include <OpenThreads/Mutex>
+
+#include <map>
 
 
 
@@ -48,7 +53,7 @@ for direct control. For example, to control the SkyDome directly, call
 getSkyDome(), then call directly into the returned SkyDome reference.
 
 */
-class BACKDROPFX_EXPORT Manager : public osg::Referenced
+class BACKDROPFX_EXPORT Manager : public osg::Referenced, public osg::Observer
 {
 public:
     static Manager* instance( const bool erase=false );
@@ -82,12 +87,27 @@ public:
     \param featureFlags If absent, all features are enabled. Passing
     \c skyDome causes the sky dome to appear. Leave out \c skyDome if you don't want
     to see it. Pass \c depthPeel enabled transparency. Leave out \c depthPeel
-    if you don't want transparency. */
+    if you don't want transparency. Pass \c hdr to allocate color buffer A
+    and the depth peel layers as 16-bit floating point (GL_RGBA16F_ARB), so
+    scene colors above 1.0 reach the RenderingEffects; use it with
+    RenderingEffects::effectToneMapping. \c hdr isn't in \c defaultFeatures. */
     void rebuild( unsigned int featureFlags=defaultFeatures );
     static unsigned int defaultFeatures;
     static unsigned int skyDome;
     static unsigned int shadowMap;
     static unsigned int depthPeel;
+    static unsigned int hdr;
+    /** True if the last rebuild() passed \c hdr. Effect::attachOutputTo()
+    uses it to choose the format of the outputs it creates, and the blur
+    Effects that glow and depth of field use choose the format of their
+    temporaries with it. */
+    bool getHDR() const;
+
+    /** Rebuilds the shader module programs without changing anything else.
+    rebuild() calls this. Call it after changing shader modules on a node in
+    the managed scene graph, or in your scene data, if nothing else requires
+    a rebuild(). */
+    void rebuildShaderModules();
 
 
     /** Directly access the SkyDome class. */
@@ -103,6 +123,23 @@ public:
     /** Directly access the RenderingEffects class. */
     RenderingEffects& getRenderingEffects();
 
+    /** Assigns a location and time context to a view. \c camera is the
+    Camera that renders the managed root: usually the osgViewer::View
+    master Camera, or a slave Camera. SkyDome, the Sun cascades in ShadowMap,
+    and Sun lighting use \c locationData when culled under \c camera.
+    Pass NULL to revert \c camera to the default context,
+    LocationData::s_instance().
+
+    The Manager keeps a reference to \c locationData, but not to
+    \c camera. When \c camera is deleted, the Manager forgets its
+    context. */
+    void setLocationData( osg::Camera* camera, LocationData* locationData );
+    /** Returns the context assigned to \c camera, or LocationData::s_instance()
+    if none is assigned. Safe to call from multiple cull threads. The
+    returned reference keeps the context alive even if another thread
+    reassigns \c camera meanwhile. */
+    osg::ref_ptr< LocationData > getLocationData( const osg::Camera* camera ) const;
+
     /** Access to rendered output. Color buffer A is the combined output
     of the SkyDome, DepthPartition, and DepthPeel classes. */
     osg::Texture2D* getColorBufferA();
@@ -138,6 +175,8 @@ public:
     void setLight( osg::Light* light, bool enable=true );
     void setLightEnable( unsigned int lightNum, bool enable );
     bool getLightEnable( unsigned int lightNum ) const;
+    /** Returns the light set with setLight(), or NULL if there isn't one. */
+    const osg::Light* getLight( unsigned int lightNum ) const;
     unsigned int getNumLights() const { return( _lightInfoVec.size() ); }
     /** Optimized function for updating the position. Sets the position
     uniform, but does not re-evaluate the set of shader modules to support
@@ -197,6 +236,8 @@ protected:
     Manager();
     ~Manager();
 
+    friend class LocationDataCullCB;
+
     void internalInit();
 
     void setSceneFogState( osg::Node* node );
@@ -216,6 +257,8 @@ protected:
     // Shadow shaders (avoids reloads when toggles on/off).
     osg::ref_ptr< osg::Shader > _shadowsOnVertex, _shadowsOffVertex;
     osg::ref_ptr< osg::Shader > _shadowsOnFragment, _shadowsOffFragment;
+    osg::ref_ptr< osg::Shader > _shadowsCascadeOnFragment, _shadowsCascadeOffFragment;
+    osg::ref_ptr< osg::Shader > _shadowsFilterHardFragment, _shadowsFilterPCFFragment, _shadowsFilterKernelFragment;
     bool _lightModelSimplified;
     osg::Vec4 _lightModelAmbient;
 
@@ -237,6 +280,23 @@ protected:
     //     _renderFX
     //
     osg::ref_ptr< osg::Group > _rootNode;
+
+    /** osg::Observer override. Removes the LocationData of a deleted Camera. */
+    virtual void objectDeleted( void* object );
+
+    // Per-view LocationData, keyed by Camera. The StateSet holds the
+    // context's Sun position uniform, pushed above the whole scene.
+    // Manager observes each Camera in the map, and removes its entry when
+    // the Camera is deleted, so a new Camera at the same address doesn't
+    // inherit it.
+    struct LocationContext
+    {
+        osg::ref_ptr< LocationData > _locationData;
+        osg::ref_ptr< osg::StateSet > _stateSet;
+    };
+    typedef std::map< const osg::Camera*, LocationContext > LocationContextMap;
+    LocationContextMap _locationContexts;
+    mutable OpenThreads::Mutex _locationContextLock;
     osg::ref_ptr< SkyDome > _skyDome;
     osg::ref_ptr< ShadowMap > _shadowMap;
     osg::ref_ptr< DepthPartition > _depthPart;
@@ -247,6 +307,8 @@ protected:
 
     osg::ref_ptr< osg::FrameBufferObject > _colorBufferAFBO;
     osg::ref_ptr< osg::Texture2D > _colorBufferA;
+    // Color buffer A is floating point (the hdr feature flag).
+    bool _hdr;
     osg::ref_ptr< osg::Texture2D > _colorBufferGlow;
     osg::ref_ptr< osg::Texture2D > _depthBuffer;
 
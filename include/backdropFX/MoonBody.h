@@ -5,10 +5,41 @@
 
 #include <backdropFX/Export.h>
 #include <osg/Geometry>
+#include <osg/Texture2D>
+#include <osg/Uniform>
+
+#include <string>
 
 namespace backdropFX {
 
 
+/** \class backdropFX::MoonBody MoonBody.h backdropFX/MoonBody.h
+
+\brief The Moon, with its phase and earthshine computed on the GPU.
+
+The vertex shader positions and orients the Moon from its direction on the
+celestial sphere. Moon and Sun directions come from two ephemeris samples
+(the "bdfx_moonDirection0/1" and "bdfx_sunDirection0/1" uniforms), one
+simulated minute apart. The shader interpolates between them by
+"bdfx_ephemerisFraction". SkyDome sets new samples only once per simulated
+minute, so between ephemeris ticks the only per-frame change is the
+fraction, and the CPU never touches the Moon.
+
+The fragment shader lights the Moon from the interpolated Sun direction,
+which gives the actual phase. It adds earthshine (see setEarthshine()) on the
+dark side, scaled by the phase of the Earth as seen from the Moon. Surface
+detail comes from a normal map derived from the Moon texture.
+
+The Moon texture and normal map, each with a precomputed mipmap chain, are
+owned by the MoonBody, created on its first update(), and released with its
+GL objects. Copies share them, as does a MoonBody passed to
+shareTextures(), so that SkyDome::rebuild() doesn't reload them. They load
+on the AssetLoader thread, from the converted containers "moon.bdfxtex" and
+"moon-normal.bdfxtex" if present. Otherwise they are computed from
+"moon.jpg", and, if caching is enabled (see setTextureCacheFileName()),
+written to a cache file that later runs read instead of recomputing them.
+The Moon draws black until the textures arrive.
+*/
 class BACKDROPFX_EXPORT MoonBody : public osg::Geometry
 {
 public:
@@ -16,27 +47,69 @@ public:
     MoonBody( const MoonBody& moon, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
 
     virtual osg::Object* cloneType() const { return new MoonBody(); }
-    virtual osg::Object* clone(const osg::CopyOp& copyop) const { return new MoonBody(*this,copyop); }        
+    virtual osg::Object* clone(const osg::CopyOp& copyop) const { return new MoonBody(*this,copyop); }
     virtual bool isSameKindAs(const Object* obj) const { return dynamic_cast<const MoonBody*>(obj)!=NULL; }
     virtual const char* libraryName() const { return "backdropFX"; }
     virtual const char* className() const { return "MoonBody"; }
 
     void update();
 
+    /** Radius of the Moon, before scaling. */
+    float getRadius() const;
     void setScale( float scale );
     float getScale() const;
     void setSubdivisions( unsigned int sub );
     unsigned int getSubdivisions() const;
 
+    /** Sets both ephemeris samples of the Moon direction, and the Moon
+    distance. */
     void setRADecDistance( float ra, float dec, float distance );
+    /** Sets both ephemeris samples of the Sun direction, which determines
+    the phase. */
+    void setSunRADec( float ra, float dec );
+    /** Computes the Moon orientation and the matrix that transforms the
+    Moon from the origin to the given celestial position. The Moon vertex
+    shader computes the same transformation from the Moon direction. */
+    static void computeMoonMatrices( float ra, float dec, float distance,
+        osg::Matrix3& orient, osg::Matrix& transform );
+    /** Returns the unit direction on the celestial sphere for right
+    ascension \c ra in hours and declination \c dec in degrees. */
+    static osg::Vec3 computeDirection( float ra, float dec );
     float getRA() const;
     float getDec() const;
     float getDistance() const;
 
+    /** Brightness of earthshine on the dark side of the Moon, relative to
+    sunlight, when the Earth seen from the Moon is full (at new Moon).
+    Default is 0.12. */
+    void setEarthshine( float earthshine );
+    float getEarthshine() const;
+
+    /** File in which the Moon texture and normal map mipmap chains are
+    cached. Relative names are relative to the current working directory,
+    so pass a path in a writable per-user cache directory. The cache is
+    used only if its header matches the size, format, and a hash of the
+    pixels of the decoded source image. It is written to a temporary file
+    and renamed, so that an interrupted run never leaves a partial
+    cache. Pass an empty string to disable caching. Default is
+    empty (disabled). */
+    static void setTextureCacheFileName( const std::string& fileName );
+    static const std::string& getTextureCacheFileName();
+
+    /** Uses the Moon texture, normal map, and normal map switch of \c moon,
+    instead of creating and loading new ones. Call before update(). */
+    void shareTextures( const MoonBody& moon );
+
+    virtual void resizeGLObjectBuffers( unsigned int maxSize );
+    virtual void releaseGLObjects( osg::State* state=0 ) const;
+
 protected:
     ~MoonBody();
 
     void internalInit();
+    /** Creates the textures, if this MoonBody doesn't have them yet,
+    and requests their images from the AssetLoader. */
+    bool initTextures();
 
     bool _dirty;
 
@@ -47,8 +120,14 @@ protected:
     float _dec;
     float _distance;
 
-    osg::ref_ptr< osg::Uniform > _moonTransform;
-    osg::ref_ptr< osg::Uniform > _moonOrient;
+    osg::ref_ptr< osg::Uniform > _moonDirection0, _moonDirection1;
+    osg::ref_ptr< osg::Uniform > _sunDirection0, _sunDirection1;
+    osg::ref_ptr< osg::Uniform > _ephemerisFraction;
+    osg::ref_ptr< osg::Uniform > _moonDistance;
+    osg::ref_ptr< osg::Uniform > _earthshine;
+
+    osg::ref_ptr< osg::Texture2D > _colorTex, _normalTex;
+    osg::ref_ptr< osg::Uniform > _useNormalMap;
 };
 
 
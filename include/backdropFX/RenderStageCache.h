@@ -0,0 +1,199 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_RENDER_STAGE_CACHE_H__
+#define __BACKDROPFX_RENDER_STAGE_CACHE_H__ 1
+
+
+#include <osg/Object>
+#include <osg/observer_ptr>
+#include <osgUtil/CullVisitor>
+#include <OpenThreads/Atomic>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::RenderStageCache RenderStageCache.h backdropFX/RenderStageCache.h
+
+\brief Per-CullVisitor cache of a custom RenderStage.
+
+SkyDome, ShadowMap, and DepthPartition each keep one custom RenderStage per
+CullVisitor, reusing it from frame to frame. The original implementation was
+lifted from CullVisitor and took a mutex on every lookup, which contends in
+CullThreadPerCameraDrawThreadPerContext mode with many cameras.
+
+This version is lock-free. Entries live in fixed-size chunks of slots; a
+CullVisitor claims a slot with a compare-and-swap on the slot key, and new
+chunks are appended with a compare-and-swap on the chunk link. Chunks are
+never freed until the cache is destroyed, so readers never see reclaimed
+memory. A given CullVisitor is only ever used by one cull thread at a time,
+so the stage stored in a claimed slot has a single writer.
+
+The cache observes each CullVisitor it stores. When the CullVisitor is
+deleted (for example, when the owning view is removed from the viewer), its
+slot is evicted and becomes available for reuse.
+*/
+template< class STAGE >
+class RenderStageCache : public osg::Object, public osg::Observer
+{
+public:
+    RenderStageCache()
+      : _head( new Chunk )
+    {}
+    RenderStageCache( const RenderStageCache&, const osg::CopyOp& )
+      : _head( new Chunk )
+    {}
+
+    META_Object( backdropFX, RenderStageCache );
+
+    /** Returns the RenderStage stored for \c cv, or NULL if there isn't one. */
+    STAGE* getRenderStage( osgUtil::CullVisitor* cv )
+    {
+        Slot* slot( findSlot( cv ) );
+        return( ( slot != NULL ) ? slot->_stage.get() : NULL );
+    }
+
+    void setRenderStage( osgUtil::CullVisitor* cv, STAGE* rs )
+    {
+        Slot* slot( findSlot( cv ) );
+        if( slot == NULL )
+        {
+            slot = claimSlot( cv );
+            cv->addObserver( this );
+        }
+        slot->_stage = rs;
+    }
+
+    /** Explicitly evict the entry for \c cv. This happens automatically
+    when \c cv is deleted. */
+    void removeRenderStage( osgUtil::CullVisitor* cv )
+    {
+        if( evict( cv ) )
+            cv->removeObserver( this );
+    }
+
+    /** osg::Observer override; evicts the entry for the deleted CullVisitor. */
+    virtual void objectDeleted( void* ptr )
+    {
+        evict( ptr );
+    }
+
+    void resizeGLObjectBuffers( unsigned int maxSize )
+    {
+        for( Chunk* chunk=_head; chunk != NULL; chunk=chunk->next() )
+        {
+            for( unsigned int idx=0; idx<Chunk::NumSlots; idx++ )
+            {
+                Slot& slot( chunk->_slots[ idx ] );
+                if( ( slot._key.get() != NULL ) && slot._stage.valid() )
+                    slot._stage->resizeGLObjectBuffers( maxSize );
+            }
+        }
+    }
+    void releaseGLObjects( osg::State* state ) const
+    {
+        for( const Chunk* chunk=_head; chunk != NULL; chunk=chunk->next() )
+        {
+            for( unsigned int idx=0; idx<Chunk::NumSlots; idx++ )
+            {
+                const Slot& slot( chunk->_slots[ idx ] );
+                if( ( slot._key.get() != NULL ) && slot._stage.valid() )
+                    slot._stage->releaseGLObjects( state );
+            }
+        }
+    }
+
+protected:
+    ~RenderStageCache()
+    {
+        // Stop observing any CullVisitors that are still alive.
+        for( Chunk* chunk=_head; chunk != NULL; chunk=chunk->next() )
+        {
+            for( unsigned int idx=0; idx<Chunk::NumSlots; idx++ )
+            {
+                osgUtil::CullVisitor* cv( static_cast< osgUtil::CullVisitor* >(
+                    chunk->_slots[ idx ]._key.get() ) );
+                if( cv != NULL )
+                    cv->removeObserver( this );
+            }
+        }
+        delete _head;
+    }
+
+    struct Slot
+    {
+        OpenThreads::AtomicPtr _key;
+        osg::ref_ptr< STAGE > _stage;
+    };
+    struct Chunk
+    {
+        enum { NumSlots = 16 };
+
+        Chunk() : _next( NULL ) {}
+        ~Chunk() { delete next(); }
+
+        Chunk* next() const { return( static_cast< Chunk* >( _next.get() ) ); }
+
+        Slot _slots[ NumSlots ];
+        OpenThreads::AtomicPtr _next;
+    };
+
+    Slot* findSlot( const void* key ) const
+    {
+        for( Chunk* chunk=_head; chunk != NULL; chunk=chunk->next() )
+        {
+            for( unsigned int idx=0; idx<Chunk::NumSlots; idx++ )
+            {
+                if( chunk->_slots[ idx ]._key.get() == key )
+                    return( &( chunk->_slots[ idx ] ) );
+            }
+        }
+        return( NULL );
+    }
+
+    Slot* claimSlot( osgUtil::CullVisitor* cv )
+    {
+        Chunk* chunk( _head );
+        while( true )
+        {
+            for( unsigned int idx=0; idx<Chunk::NumSlots; idx++ )
+            {
+                Slot& slot( chunk->_slots[ idx ] );
+                if( ( slot._key.get() == NULL ) && slot._key.assign( cv, NULL ) )
+                    return( &slot );
+            }
+
+            // This chunk is full. Move to the next one, appending it if necessary.
+            // If another thread beat us to it, discard ours and use theirs.
+            if( chunk->next() == NULL )
+            {
+                Chunk* newChunk( new Chunk );
+                if( !( chunk->_next.assign( newChunk, NULL ) ) )
+                    delete newChunk;
+            }
+            chunk = chunk->next();
+        }
+    }
+
+    bool evict( const void* key )
+    {
+        Slot* slot( findSlot( key ) );
+        if( slot == NULL )
+            return( false );
+
+        slot->_stage = NULL;
+        slot->_key.assign( NULL, key );
+        return( true );
+    }
+
+    Chunk* _head;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_RENDER_STAGE_CACHE_H__
+#endif
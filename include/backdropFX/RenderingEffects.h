@@ -6,6 +6,8 @@
 #include <backdropFX/Export.h>
 #include <backdropFX/BackdropCommon.h>
 #include <backdropFX/Effect.h>
+#include <backdropFX/EffectGraph.h>
+#include <backdropFX/UniformLocationCache.h>
 #include <osg/Group>
 #include <osg/Uniform>
 #include <osg/FrameBufferObject>
@@ -114,6 +116,13 @@ public:
     */
     EffectVector& getEffectVector() { return( _effectVector ); }
 
+    /** The compiled form of the EffectVector. RenderingEffectsStage
+    recompiles it whenever the EffectVector changes, and draws from it. Use
+    it to disable culling and texture aliasing (EffectGraph::setOptimize()),
+    or to get the number of passes and texture memory they saved.
+    */
+    EffectGraph* getEffectGraph() { return( _effectGraph.get() ); }
+    const EffectGraph* getEffectGraph() const { return( _effectGraph.get() ); }
 
 
     /** Set and get the default Effect. RenderingEffects uses the default Effect only when
@@ -134,7 +143,11 @@ public:
 
     osg::Uniform* getGlobalUniform( const std::string& objectName );
     bool removeGlobalUniform( const std::string& objectName );
-    void applyAllGlobalUniforms( osg::State& state, osg::GL2Extensions* gl2Ext );
+    /** Applies the global uniforms to the current program. If \c cache is
+    not NULL, it finds their locations there, starting at \c firstSlot (see
+    UniformLocationCache). */
+    void applyAllGlobalUniforms( osg::State& state, osg::GL2Extensions* gl2Ext,
+        UniformLocationCache* cache=NULL, unsigned int firstSlot=0 );
 
     /** Override for base class traverse(). During cull, this function inserts
     a RenderingEffectsStage (custom RenderStage) into the OSG render graph.
@@ -167,6 +180,7 @@ protected:
 
 
     EffectVector _effectVector;
+    osg::ref_ptr< EffectGraph > _effectGraph;
     osg::ref_ptr< Effect > _defaultEffect;
     unsigned int _effectSet;
 
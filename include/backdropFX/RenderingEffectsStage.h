@@ -25,8 +25,9 @@ RenderingEffects class and RenderingEffectsStage is analogous to the
 relationship between the osg::Camera and osgUtil::RenderStage.
 
 RenderingEffectsStage overrides the base class draw() function to process
-the RenderingEffects EffectVector. RenderingEffectsStage sequencially draws each Effect
-in the Effects vector.
+the RenderingEffects EffectVector. RenderingEffectsStage compiles the Effects vector
+with the RenderingEffects EffectGraph, then draws each Effect that contributes to the
+output, in order.
 */
 class RenderingEffectsStage : public osgUtil::RenderStage
 {
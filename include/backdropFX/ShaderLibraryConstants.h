@@ -46,11 +46,44 @@ unit to obtain texels for rendering each streamline point sprite.
 <b>Shader uniform:</b> \c bdfx_streamlineImageUnit */
 #define BDFX_STREAMLINE_IMAGE_UNIT 7
 
+/** Maximum number of depth partitions DepthPartition renders in a single
+pass (see DepthPartition::setSinglePass()). Sizes the partition matrix array
+and the number of texture array layers. The partition geometry shader emits
+at most 3 * BDFX_MAX_PARTITIONS vertices per input triangle.
+
+<b>Shader uniform:</b> \c bdfx_partitionMatrices */
+#define BDFX_MAX_PARTITIONS 8
+
+/** Maximum number of Sun shadow map cascades (see
+ShadowMap::setNumSunCascades()). Sizes the cascade matrix array and the
+number of depth texture array layers. The cascade split distances are
+passed as a single vec4, so this value can't exceed 4.
+
+<b>Shader uniform:</b> \c bdfx_shadowCascadeMatrices */
+#define BDFX_MAX_SHADOW_CASCADES 4
+
+/** Maximum number of lights that cast shadows, not counting Sun cascades.
+When more lights are enabled, ShadowMap renders and the scene shaders
+sample only the most important ones. Sizes the shadow matrix and atlas
+tile arrays.
+
+<b>Shader uniform:</b> \c bdfx_shadowMatrices */
+#define BDFX_MAX_SHADOW_LIGHTS 4
+
+/** Number of taps in the soft shadow sampling kernel (see
+ShadowMap::setSoftShadowMode()). The kernel texture stores two taps
+per texel, so it is BDFX_SHADOW_KERNEL_TAPS / 2 texels wide.
+
+<b>Shader uniform:</b> \c bdfx_shadowKernelMap */
+#define BDFX_SHADOW_KERNEL_TAPS 16
+
 
 /** Reserved texture units, counting backwards starting from 13.
 GeForce 8800 OS X has max units of 16 (0 through 15), and depth
 peeling already uses units 14 and 15. */
 #define BDFX_TEX_UNIT_SHADOW_MAP 13
+#define BDFX_TEX_UNIT_SHADOW_CASCADES 12
+#define BDFX_TEX_UNIT_SHADOW_KERNEL 11
 
 
 /*@}*/
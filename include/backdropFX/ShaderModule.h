@@ -120,6 +120,13 @@ public:
 
     virtual void apply( osg::Node& node );
 
+    /** Returns the largest number of output components per vertex written
+    by any program with a geometry shader module that this visitor built,
+    or 0 if it built none. DepthPartition compares this against
+    GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS_EXT before it renders in a
+    single pass. */
+    unsigned int getGeometryOutputComponents() const { return( _geometryOutputComponents ); }
+
 protected:
     typedef std::vector< osg::Shader* > ShaderList;
     typedef std::map< ShaderList, osg::ref_ptr< osg::StateSet > > ShaderStateSetMap;
@@ -128,6 +135,24 @@ protected:
     unsigned int _depth;
 
     void rebuildSource( ShaderModuleCullCallback* smccb, osg::NodePath& np );
+
+    /** Replaces the vertex shader modules in \c sl with copies that
+    have their varyings renamed for geometry shader input, and adds the
+    generated varying passthrough geometry shader module. */
+    void addGeometryPassthrough( ShaderList& sl );
+
+    /** Creates a StateSet with a program built from \c sl without its
+    geometry shader modules, and attaches it to \c prog as user data.
+    See the sm-geom section of the shader module documentation. */
+    void addPartitionPassProgram( osg::Program* prog, const ShaderList& sl );
+
+    typedef std::map< osg::Shader*, osg::ref_ptr< osg::Shader > > ShaderShaderMap;
+    ShaderShaderMap _geometryInputMap;
+    ShaderShaderMap _partitionPassMap;
+    typedef std::map< std::string, osg::ref_ptr< osg::Shader > > PassthroughMap;
+    PassthroughMap _passthroughMap;
+
+    unsigned int _geometryOutputComponents;
 };
 
 
@@ -247,6 +272,31 @@ backdropFX shader module system doesn't presently employ this strategy, it might
 be possible to use the preprocessor to provide this functionality in a future
 enhancement.
 
+\subsection sm-geom Geometry Shader Modules
+
+Shader module declarations use GLSL 1.20 \c varying variables in \c .common
+files shared by vertex and fragment shaders. GL_EXT_geometry_shader4 requires
+geometry shader inputs and outputs to have different names, so when
+a complete program contains a geometry shader module,
+RebuildShaderModules makes a copy of each vertex shader module with every
+varying it declares renamed to \c <name>_gsIn, and adds a generated geometry
+shader module that declares the matching inputs and outputs. The generated
+module defines \c bdfx_copyVaryings(int), which copies the varyings (and
+\c gl_TexCoord) of the given input vertex to the outputs. Geometry shader
+modules call it before each \c EmitVertex().
+
+Geometry shader modules take triangles as input, output triangle strips,
+and emit no more than 3 * BDFX_MAX_PARTITIONS vertices. See
+\c bdfx-partition-layered.gs for an example.
+
+Because the program only accepts triangles, RebuildShaderModules also builds
+a partition pass program from the same modules, without the geometry shader
+modules and with the original (not renamed) vertex shader modules. It
+prepends \c "#define BDFX_PARTITION_PASS 1" to each vertex shader module that
+mentions \c BDFX_PARTITION_PASS, and stores a StateSet containing the program
+as the user data of the geometry shader program. DepthPartitionStage draws
+points, lines, and other non-triangle drawables with it, once per partition.
+
 \subsection sm-port Shader Portability
 
 The shader module system predefines several uniforms and vertex attributes
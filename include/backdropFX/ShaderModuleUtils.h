@@ -47,6 +47,11 @@ This preprocessor directive must start at column 0 with no text following the fi
 
 The preprocessor removes the directive and file name, loads the file (which it finds using  
 the OSG_FILE_PATH), and inserts the file contents instead of the directive and file name.
+
+After processing includes, the preprocessor defines the ShaderLibraryConstants.h
+constants that size shader arrays (BDFX_MAX_PARTITIONS, BDFX_MAX_SHADOW_CASCADES,
+and BDFX_MAX_SHADOW_LIGHTS) if the source uses them, so shaders declare those
+arrays with the constant instead of a literal size.
 */
 BACKDROPFX_EXPORT void shaderPreProcess( osg::Shader* shader );
 
@@ -7,6 +7,9 @@
 #include <backdropFX/BackdropCommon.h>
 #include <osg/Texture2D>
 #include <osg/FrameBufferObject>
+#include <osg/NodeCallback>
+#include <osg/observer_ptr>
+#include <OpenThreads/Atomic>
 
 #include <backdropFX/ShadowMapStage.h>
 
@@ -20,14 +23,19 @@ namespace backdropFX {
 
 /**
 We'll specify one or more LightInfo structs that contain the light position.
-During draw, ShadowMapStage will do an RTT for each, storing the texture address.
+During cull, ShadowMap culls its children once per enabled light, against that
+light's view and projection, into a separate RenderBin for each light. During
+draw, ShadowMapStage renders each into its own tile of a shared shadow atlas.
 It'll compute the view based on the light direction and a point computed to be
 in front of the viewer. The view matrix also needs to be stored in the LightInfo
 struct.
 
-As the scene is rendered by DepthPeel, a vertex shader module will compute texture
-coordinates using the stored view matrix per light. A fragment shader module will
-then perform the depth map lookup and z compare, and color the fragment accordingly.
+As the scene is rendered by DepthPeel, a fragment shader module transforms the
+eye coordinate vertex by each light's stored matrix, performs the depth map lookup
+and z compare (filtered as specified by setSoftShadowMode()), and colors the
+fragment by the average visibility over all lights.
+At most BDFX_MAX_SHADOW_LIGHTS lights (the most important ones) are shadowed; no
+depth map is rendered for the rest.
 */
 class BACKDROPFX_EXPORT ShadowMap : public osg::Group, public backdropFX::BackdropCommon
 {
@@ -40,10 +48,149 @@ public:
     void traverse( osg::NodeVisitor& nv );
 
     osg::StateSet* getViewProjStateSet( osgUtil::CullVisitor* cv );
-    osg::Uniform* getViewProjUniform( osgUtil::CullVisitor* cv );
 
     osg::StateSet* getDepthTexStateSet( osgUtil::CullVisitor* cv );
 
+    /** Specifies the traversal mask used when culling the scene for each
+    light's depth map. Use this to exclude nodes that should receive
+    shadows but not cast them (terrain that can't self-shadow, sky, HUD
+    geometry). The mask is ANDed with the CullVisitor's traversal mask.
+    Default is 0xffffffff (all nodes cast shadows). */
+    void setCasterTraversalMask( osg::Node::NodeMask mask ) { _casterMask = mask; dirtyStaticCasters(); }
+    osg::Node::NodeMask getCasterTraversalMask() const { return( _casterMask ); }
+
+    /** Enables shadow map caching. Casters are split into static and
+    dynamic sets by the dynamic caster traversal mask. Static caster depth
+    is rendered into a second atlas and kept from frame to frame; each
+    frame, a light's cached tile is copied into the live atlas and only the
+    dynamic casters are rendered on top of it. If there are no dynamic
+    casters (the default mask is 0), the cached atlas is sampled directly
+    and a light with a valid cache costs nothing to cull or render.
+
+    A light's cached depth is re-rendered when:
+    \li The light moves past the cache thresholds (see setCacheAngleThreshold()
+    and setCacheDistanceThreshold()). Smaller movements are ignored; the
+    light's shadows continue to use its cached position.
+    \li The light's atlas tile changes size or position.
+    \li The caster set changes: children are added to or removed from
+    this node, or a traversal mask changes.
+    \li A static caster with a ShadowCasterCallback moves or changes its
+    bound.
+    \li The app calls dirtyStaticCasters(), for example from an update
+    callback on a static node that moved.
+
+    Each view has its own cache. Default is false (shadows are fully
+    re-rendered every frame). */
+    void setShadowCacheEnable( bool enable ) { _cacheEnable = enable; dirtyStaticCasters(); }
+    bool getShadowCacheEnable() const { return( _cacheEnable ); }
+
+    /** When caching is enabled, nodes whose node mask intersects this mask
+    are dynamic casters, rendered every frame. All other casters are static.
+    Default is 0 (all casters are static). */
+    void setDynamicCasterTraversalMask( osg::Node::NodeMask mask ) { _dynamicMask = mask; dirtyStaticCasters(); }
+    osg::Node::NodeMask getDynamicCasterTraversalMask() const { return( _dynamicMask ); }
+
+    /** Angle in radians that a directional light may rotate before its
+    cached depth is re-rendered. Default is 0.25 degrees. */
+    void setCacheAngleThreshold( double radians ) { _cacheAngle = radians; }
+    double getCacheAngleThreshold() const { return( _cacheAngle ); }
+    /** Distance that a positional light may move before its cached depth
+    is re-rendered. Default is 0.1. */
+    void setCacheDistanceThreshold( double distance ) { _cacheDistance = distance; }
+    double getCacheDistanceThreshold() const { return( _cacheDistance ); }
+
+    /** Invalidates the cached static caster depth of every light in every
+    view. Safe to call from any thread. */
+    void dirtyStaticCasters() { ++_staticGeneration; }
+    unsigned int getStaticCasterGeneration() const { return( _staticGeneration ); }
+
+    /** Width and height in texels of the shadow atlas, a single depth
+    texture shared by all shadow-casting lights (except Sun cascades, see
+    setNumSunCascades()). This is the shadow memory budget: 2048 (the
+    default) is 16MB regardless of the number of lights. Rounded down to
+    a power of two. With setShadowCacheEnable(), a second atlas of the same
+    size holds the cached static caster depth. It's only allocated while
+    caching is enabled, and the live atlas isn't allocated when caching with
+    no dynamic casters.
+
+    Each light gets a square, power of two tile of the atlas. Its size is
+    proportional to the light's importance: directional lights, and
+    positional lights whose attenuation range contains the viewer, are
+    fully important; other positional lights are scaled down by the
+    ratio of their attenuation range to their distance from the viewer.
+    If the tiles don't fit, they are halved until they do. */
+    void setShadowAtlasSize( unsigned int size );
+    unsigned int getShadowAtlasSize() const { return( _atlasSize ); }
+
+    /** Smallest tile a light may receive in the shadow atlas. Lights that
+    don't fit at this size cast no shadows. Tiles are powers of two, so
+    other sizes are rounded up to a power of two, with a warning.
+    Default is 128. */
+    void setMinShadowTileSize( unsigned int size );
+    unsigned int getMinShadowTileSize() const { return( _minTileSize ); }
+
+    /** Enables cascaded shadow maps for the Sun (light 8), with the Sun
+    direction taken from the view's LocationData (see
+    Manager::setLocationData()). The view frustum is split into
+    \c numCascades slices, and each slice gets its own layer of a depth
+    texture array. When the DepthPartition slice boundaries fit within
+    \c numCascades, they're used as the cascade splits; otherwise the
+    splits are a blend of logarithmic and uniform distribution.
+    Each cascade's light volume is snapped to shadow map texels to
+    prevent shadow edges from swimming as the camera moves.
+
+    Pass 0 to disable cascades and shadow the Sun with a single map, like
+    any other light. The value is clamped to BDFX_MAX_SHADOW_CASCADES.
+    Cascades require GL_EXT_texture_array and GL_EXT_gpu_shader4.
+    Default is 0. Changing this value between zero and non-zero requires
+    a call to Manager::rebuild() to swap the scene shadow shaders. */
+    void setNumSunCascades( unsigned int numCascades );
+    unsigned int getNumSunCascades() const { return( _numSunCascades ); }
+
+    /** Width and height in texels of each cascade layer. Default is 1024. */
+    void setCascadeResolution( unsigned int resolution ) { _cascadeResolution = resolution; }
+    unsigned int getCascadeResolution() const { return( _cascadeResolution ); }
+
+    /** Maximum eye distance at which the Sun casts shadows. The last
+    cascade ends here (or at the far plane, if that is closer). Fragments
+    beyond this distance are unshadowed. Default is 5000.0. */
+    void setSunShadowDistance( double distance ) { _sunShadowDistance = distance; }
+    double getSunShadowDistance() const { return( _sunShadowDistance ); }
+
+    typedef enum {
+        SHADOW_HARD,
+        SHADOW_PCF,
+        SHADOW_PCF_KERNEL
+    } SoftShadowMode;
+    /** Selects how the scene shaders filter the shadow atlas and the Sun
+    cascades. Per shadowed light, each shaded pixel costs:
+    \li SHADOW_HARD: One depth compare with NEAREST filtering. Shadow
+    edges alias to the shadow map texels.
+    \li SHADOW_PCF: One depth compare with LINEAR filtering. The hardware
+    compares the 2x2 nearest texels and blends the results (percentage
+    closer filtering), smoothing the edges over one texel at nearly the
+    cost of SHADOW_HARD.
+    \li SHADOW_PCF_KERNEL: BDFX_SHADOW_KERNEL_TAPS (16) LINEAR depth
+    compares, spread over the soft shadow radius by a Poisson disk kernel,
+    plus BDFX_SHADOW_KERNEL_TAPS / 2 fetches from the kernel texture.
+    Gives wide, soft penumbrae.
+
+    The shadowbench test measures each mode on the current hardware.
+    Default is SHADOW_HARD. Changing this value requires a call to
+    Manager::rebuild() to swap the scene shadow shaders. */
+    void setSoftShadowMode( SoftShadowMode mode ) { _softShadowMode = mode; }
+    SoftShadowMode getSoftShadowMode() const { return( _softShadowMode ); }
+
+    /** Radius in shadow map texels of the SHADOW_PCF_KERNEL sampling kernel.
+    Default is 1.5. */
+    void setSoftShadowRadius( float texels ) { _softShadowRadius = texels; }
+    float getSoftShadowRadius() const { return( _softShadowRadius ); }
+
+    /** The SHADOW_PCF_KERNEL sampling kernel: BDFX_SHADOW_KERNEL_TAPS
+    Poisson disk offsets in the unit circle, two per RGBA texel, mapped
+    from [-1,1] to [0,1]. */
+    osg::Texture2D* getShadowKernelTexture() const { return( _kernelTex.get() ); }
+
 
     //
     // For internal use
@@ -60,7 +207,64 @@ protected:
     ~ShadowMap();
     void internalInit();
 
+    /** osg::Group overrides; the caster set changed. */
+    virtual void childInserted( unsigned int pos );
+    virtual void childRemoved( unsigned int pos, unsigned int numChildrenToRemove );
+
     osg::ref_ptr< osg::Object > _renderingCache;
+
+    osg::Node::NodeMask _casterMask;
+
+    bool _cacheEnable;
+    osg::Node::NodeMask _dynamicMask;
+    double _cacheAngle, _cacheDistance;
+    OpenThreads::Atomic _staticGeneration;
+
+    unsigned int _atlasSize;
+    unsigned int _minTileSize;
+
+    unsigned int _numSunCascades;
+    unsigned int _cascadeResolution;
+    double _sunShadowDistance;
+
+    SoftShadowMode _softShadowMode;
+    float _softShadowRadius;
+    osg::ref_ptr< osg::Texture2D > _kernelTex;
+};
+
+
+/** \class backdropFX::ShadowCasterCallback ShadowMap.h backdropFX/ShadowMap.h
+
+\brief Per-node dirty flag for static shadow casters.
+
+Attach as the update callback of a static caster (a node outside the
+ShadowMap dynamic caster traversal mask) that moves or changes from time to
+time. During each update traversal, the callback compares the node's
+bounding sphere, and its world matrix (accumulated over the node path, so
+a parent transform moving counts), with the previous frame. If either changed, or if the app called dirty(), it calls
+ShadowMap::dirtyStaticCasters(), so the cached shadow depth is re-rendered
+once instead of every frame. */
+class BACKDROPFX_EXPORT ShadowCasterCallback : public osg::NodeCallback
+{
+public:
+    /** If \c shadowMap is NULL, uses Manager::getShadowMap(). */
+    ShadowCasterCallback( ShadowMap* shadowMap=NULL );
+
+    virtual void operator()( osg::Node* node, osg::NodeVisitor* nv );
+
+    /** Invalidates the static caster cache during the next update
+    traversal. Safe to call from any thread. */
+    void dirty() { _dirty.exchange( 1 ); }
+
+protected:
+    ~ShadowCasterCallback();
+
+    osg::observer_ptr< ShadowMap > _shadowMap;
+    bool _useManager;
+    OpenThreads::Atomic _dirty;
+    bool _first;
+    osg::BoundingSphere _bound;
+    osg::Matrix _matrix;
 };
 
 
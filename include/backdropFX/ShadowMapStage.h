@@ -7,9 +7,13 @@
 #include <backdropFX/Export.h>
 #include <osgUtil/RenderStage>
 #include <osg/FrameBufferObject>
+#include <osg/Texture2D>
+#include <osg/Texture2DArray>
+#include <osg/BoundingSphere>
 #include <osg/Version>
 
 #include <string>
+#include <vector>
 
 
 
@@ -32,6 +36,7 @@ public:
     virtual const char* className() const { return "ShadowMapStage"; }
 
     virtual void draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous );
+    virtual void reset();
 
     void setShadowMapNode( ShadowMap* shadowMapNode );
     ShadowMap* getShadowMapNode() const { return( _shadowMapNode ); }
@@ -44,6 +49,63 @@ public:
     void setFBO( osg::FrameBufferObject* fbo );
     const osg::FrameBufferObject& getFBO() const;
 
+    /** Computes the view and projection matrices used to render the depth map
+    for a light at \c pos. The light volume encloses \c casterBound: an
+    orthographic box for directional lights, and for positional lights, the
+    frustum from the light to the bound, out to its far side. */
+    static void computeLightMatrices( const osg::Vec4& pos, const osg::BoundingSphere& casterBound,
+        osg::Matrix& lightView, osg::Matrix& lightProj );
+
+    /** Per-light cull support. ShadowMap calls this during cull for each
+    shadowed light, then makes the light's RenderBin current and pushes
+    the light's StateSet while culling the scene against the light's
+    view and projection. \c view is the camera view matrix, used to
+    transform eye coordinates into the light's depth map during the main
+    pass. \c importance, in the range (0,1], sizes the light's shadow
+    atlas tile. draw() renders a depth map only for lights culled since
+    the last reset(). */
+    void setLightCull( unsigned int idx, const osg::Matrix& view,
+        const osg::Matrix& lightView, const osg::Matrix& lightProj, float importance=1.f );
+    /** Returns false if layoutAtlas() dropped the light. */
+    bool getLightShadowed( unsigned int idx ) const;
+    void getLightMatrices( unsigned int idx, osg::Matrix& lightView, osg::Matrix& lightProj ) const;
+    osgUtil::RenderBin* getLightBin( unsigned int idx );
+    osg::StateSet* getLightStateSet( unsigned int idx );
+
+    /** Shadow cache support (see ShadowMap::setShadowCacheEnable()).
+    ShadowMap calls this before setLightCull(). It invalidates the light's
+    cached static depth if the light moved past the cache thresholds or
+    the static casters changed, and returns the light position to use
+    this frame: \c pos, or the cached position if the cache is still valid.
+    It also invalidates the cache if \c casterBound grew out of the bound
+    the cached depth was fitted to, and returns the bound to fit the light
+    volume to in \c casterBound. */
+    osg::Vec4 updateLightCache( unsigned int idx, const osg::Vec4& pos, osg::BoundingSphere& casterBound );
+    /** Returns true if the light's static casters must be culled into
+    its static RenderBin this frame, because its cached depth is invalid. */
+    bool requestStaticCull( unsigned int idx );
+    osgUtil::RenderBin* getLightStaticBin( unsigned int idx );
+    osg::StateSet* getLightStaticStateSet( unsigned int idx );
+
+    /** Assigns each light culled since the last reset() a tile of the
+    shadow atlas, (re)allocating the atlas if its size changed. Lights
+    that don't fit at the minimum tile size are dropped. ShadowMap calls
+    this after culling all lights. */
+    void layoutAtlas();
+
+    /** Sun cascade cull support. Splits the view volume (camera \c view and
+    \c proj) into ShadowMap::getNumSunCascades() slices, and computes a
+    texel-snapped orthographic light volume around each slice that
+    encloses the casters in \c casterBound. \c sunDir points towards the Sun.
+    Returns the number of cascades to cull, or 0 if cascades can't be used
+    this frame. ShadowMap then culls the scene once per cascade, as for
+    lights. */
+    unsigned int setCascadeCull( const osg::Vec3& sunDir, const osg::Matrix& view,
+        const osg::Matrix& proj, const osg::BoundingSphere& casterBound );
+    void getCascadeMatrices( unsigned int idx, osg::Matrix& lightView, osg::Matrix& lightProj ) const;
+    osgUtil::RenderBin* getCascadeBin( unsigned int idx );
+    osg::StateSet* getCascadeStateSet( unsigned int idx );
+
 
     void resizeGLObjectBuffers( unsigned int maxSize );
     void releaseGLObjects( osg::State* state ) const;
@@ -53,7 +115,6 @@ protected:
 
     void internalInit();
 
-    static osg::Matrixf computeLightMatrix( const osg::Vec4 pos, const osg::Matrix& view );
     osg::ref_ptr< osg::StateSet > _viewProjStateSet;
     osg::ref_ptr< osg::StateSet > _depthTexStateSet;
 
@@ -71,13 +132,72 @@ protected:
         void resizeGLObjectBuffers( unsigned int maxSize );
         void releaseGLObjects( osg::State* state );
 
-        osg::ref_ptr< osg::Texture2D > _depthTex;
-        osg::ref_ptr< osg::FrameBufferObject > _depthFBO;
+        // Shadow atlas tile.
         osg::ref_ptr< osg::Viewport > _viewport;
+        // Tile offset (xy) and scale (zw) in atlas texture coordinates.
+        osg::Vec4f _tileRect;
+
+        // Per-cull data, valid when _culled is true.
+        osg::ref_ptr< osgUtil::RenderBin > _bin;
+        osg::ref_ptr< osg::StateSet > _stateSet;
+        osg::Matrix _lightView, _lightProj;
+        osg::Matrixf _eyeToLight;
+        float _importance;
+        bool _culled;
+
+        // Shadow cache. _cacheValid is true when the static atlas tile
+        // holds static caster depth for _cachedPos and _cachedBound.
+        osg::ref_ptr< osgUtil::RenderBin > _staticBin;
+        osg::ref_ptr< osg::StateSet > _staticStateSet;
+        osg::Vec4 _cachedPos;
+        osg::BoundingSphere _cachedBound;
+        unsigned int _cachedGeneration;
+        bool _cacheValid;
+        bool _staticCulled;
     };
     typedef std::vector< osg::ref_ptr< ShadowInfo > > ShadowInfoVec;
 
     ShadowInfoVec _shadowInfoVec;
+    ShadowInfo* getOrCreateShadowInfo( unsigned int idx );
+    void invalidateLightCaches();
+
+    osg::ref_ptr< osg::Texture2D > _atlasTex;
+    osg::ref_ptr< osg::FrameBufferObject > _atlasFBO;
+    osg::ref_ptr< osg::Viewport > _atlasViewport;
+    osg::ref_ptr< osg::Texture2D > _staticAtlasTex;
+    osg::ref_ptr< osg::FrameBufferObject > _staticAtlasFBO;
+    osg::ref_ptr< osg::Uniform > _shadowMatrices;
+    osg::ref_ptr< osg::Uniform > _shadowTiles;
+    osg::ref_ptr< osg::Uniform > _shadowCount;
+    osg::ref_ptr< osg::Uniform > _shadowTexelSize;
+    osg::ref_ptr< osg::Uniform > _shadowFilterRadius;
+    osg::ref_ptr< osg::Uniform > _shadowKernelTaps;
+
+
+    /** Computes the eye distances of the Sun cascade far planes, nearest first. */
+    void computeCascadeSplits( std::vector< double >& splits, double camFar,
+        double inNear, double inFar, unsigned int numCascades ) const;
+    void configureCascades( unsigned int numCascades, unsigned int resolution );
+
+    struct CascadeInfo
+    {
+        osg::ref_ptr< osgUtil::RenderBin > _bin;
+        osg::ref_ptr< osg::StateSet > _stateSet;
+        osg::ref_ptr< osg::FrameBufferObject > _fbo;
+        osg::Matrix _lightView, _lightProj;
+        osg::Matrixf _eyeToShadow;
+    };
+    typedef std::vector< CascadeInfo > CascadeInfoVec;
+
+    CascadeInfoVec _cascadeInfoVec;
+    unsigned int _numCascadesCulled;
+    osg::Vec4f _cascadeSplitValues;
+    osg::ref_ptr< osg::Texture2DArray > _cascadeTex;
+    osg::ref_ptr< osg::Viewport > _cascadeViewport;
+
+    osg::ref_ptr< osg::Uniform > _cascadeMatrices;
+    osg::ref_ptr< osg::Uniform > _cascadeSplits;
+    osg::ref_ptr< osg::Uniform > _cascadeCount;
 
 
     osg::ref_ptr< osg::FrameBufferObject > _fbo;
@@ -0,0 +1,117 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_SKY_CUBE_STAGE_H__
+#define __BACKDROPFX_SKY_CUBE_STAGE_H__ 1
+
+
+#include <osgUtil/RenderStage>
+#include <osg/FrameBufferObject>
+#include <osg/TextureCubeMap>
+#include <osg/Viewport>
+#include <osg/Uniform>
+#include <osg/buffered_value>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::SkyCubeMap SkyCubeStage.h backdropFX/SkyCubeStage.h
+
+\brief A cube map holding the rendered sky for one LocationData.
+
+SkyDome calls dirty() when the sky moves past the sky cache threshold (see
+SkyDome::setSkyCacheThreshold()). SkyCubeStage re-renders the six faces at
+most once per dirty() in each graphics context, no matter how many views
+share the context.
+*/
+class SkyCubeMap : public osg::Referenced
+{
+public:
+    SkyCubeMap( unsigned int size );
+
+    unsigned int getSize() const { return( _size ); }
+    osg::TextureCubeMap* getTexture() const { return( _texture.get() ); }
+    osg::FrameBufferObject* getFBO( unsigned int face ) const { return( _fbo[ face ].get() ); }
+
+    /** Marks the faces out of date in all graphics contexts. */
+    void dirty() { _generation++; }
+
+    /** Returns true if the faces must be rendered in \c contextID. */
+    bool needsRender( unsigned int contextID ) const;
+    /** Call after rendering the faces in \c contextID. */
+    void rendered( unsigned int contextID );
+
+    void resizeGLObjectBuffers( unsigned int maxSize );
+    void releaseGLObjects( osg::State* state ) const;
+
+protected:
+    ~SkyCubeMap();
+
+    unsigned int _size;
+    osg::ref_ptr< osg::TextureCubeMap > _texture;
+    osg::ref_ptr< osg::FrameBufferObject > _fbo[ 6 ];
+
+    unsigned int _generation;
+    // Generation last rendered in each context. Zero means never.
+    mutable osg::buffered_value< unsigned int > _renderedGeneration;
+};
+
+
+/** \class backdropFX::SkyCubeStage SkyCubeStage.h backdropFX/SkyCubeStage.h
+
+\brief Renders the sky into a SkyCubeMap.
+
+When the sky cache is enabled, SkyDome culls its children into this stage
+and adds it as a pre-render stage ahead of the SkyDomeStage. draw() renders
+the RenderBin into each cube face with a 90 degree view, setting the stage's
+"viewProj" and "invViewProj" uniforms per face, but only if the SkyCubeMap is
+out of date in the current graphics context. Otherwise it draws nothing.
+*/
+class SkyCubeStage : public osgUtil::RenderStage
+{
+public:
+    SkyCubeStage();
+    SkyCubeStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
+    SkyCubeStage( const SkyCubeStage& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY );
+
+    virtual osg::Object* cloneType() const { return new SkyCubeStage(); }
+    virtual osg::Object* clone(const osg::CopyOp& copyop) const { return new SkyCubeStage( *this, copyop ); } // note only implements a clone of type.
+    virtual bool isSameKindAs(const osg::Object* obj) const { return dynamic_cast<const SkyCubeStage*>(obj)!=0L; }
+    virtual const char* className() const { return "SkyCubeStage"; }
+
+    virtual void draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous );
+
+    void setSkyCubeMap( SkyCubeMap* skyCube ) { _skyCube = skyCube; }
+    SkyCubeMap* getSkyCubeMap() const { return( _skyCube.get() ); }
+
+    /** Near and far planes of the cube face projections. */
+    void setNearFar( double zNear, double zFar );
+
+    /** StateSet containing the "viewProj" and "invViewProj" uniforms
+    that draw() sets for each face. SkyDome pushes this during cull. */
+    osg::StateSet* getPerCullStateSet();
+
+    /** Returns the view matrix for the given osg::TextureCubeMap::Face. */
+    static osg::Matrix getFaceViewMatrix( unsigned int face );
+
+protected:
+    ~SkyCubeStage();
+    void internalInit();
+
+    osg::ref_ptr< SkyCubeMap > _skyCube;
+    double _zNear, _zFar;
+
+    osg::ref_ptr< osg::Viewport > _cubeViewport;
+    osg::ref_ptr< osg::StateSet > _stateSet;
+    osg::ref_ptr< osg::Uniform > _viewProj;
+    osg::ref_ptr< osg::Uniform > _invViewProj;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_SKY_CUBE_STAGE_H__
+#endif
@@ -13,16 +13,27 @@
 #include <backdropFX/Export.h>
 #include <backdropFX/BackdropCommon.h>
 #include <osg/Group>
+#include <osg/Geode>
 #include <osg/FrameBufferObject>
 #include <osgEphemeris/DateTime.h>
 #include <osgEphemeris/CelestialBodies.h>
 #include <backdropFX/SunBody.h>
 #include <backdropFX/MoonBody.h>
+#include <backdropFX/EphemerisCache.h>
+#include <backdropFX/AtmosphereLUT.h>
+#include <backdropFX/StarCatalog.h>
 #include <osgUtil/CullVisitor>
+#include <osg/observer_ptr>
+#include <OpenThreads/Mutex>
 
 #include <backdropFX/SkyDomeStage.h>
+#include <backdropFX/SkyCubeStage.h>
+#include <backdropFX/CloudStage.h>
 
 #include <map>
+#include <string>
+#include <vector>
+
 
 
 namespace backdropFX {
@@ -31,7 +42,9 @@ namespace backdropFX {
 // Forward
 class SkyDomeUpdateCB;
 class SkyDomeCullCB;
+class SkyDomeContext;
 class LocationCB;
+class LocationData;
 
 
 /** \class backdropFX::SkyDome SkyDome.h backdropFX/SkyDome.h
@@ -56,10 +69,45 @@ disabled.
 So, if you want Sun lighting, you must enable the SkyDome, but if you want control over
 the clear color you must disable the SkyDome. As a result, there is no way to have both
 Sun lighting and control over the clear color.
+
+\section Per-View Location and Time
+
+Each view renders the sky for its own LocationData (see Manager::setLocationData()).
+SkyDome keeps a context for every LocationData it is culled with: the clock, the
+EphemerisCache, and the uniforms that orient the celestial sphere and position the Sun
+and Moon. The update traversal advances and repositions every context, and the cull
+traversal pushes the context for the current view. Views that share a LocationData
+share a context. The Sun and Moon drawables are shared by all views.
+
+\section SkyCache Sky Cache
+
+By default, every view draws the dome (or scattering pass), Sun, and Moon every frame.
+With setSkyCacheEnable(), SkyDome instead renders the sky for each LocationData into a
+cube map, and each view draws its sky with one cube map lookup per pixel in its clear
+pass. The cube map is rendered again only when the sky moves past the threshold set by
+setSkyCacheThreshold(), when location changes, or when SkyDome is rebuilt, and at most
+once per graphics context, so multiple views and both eyes of a stereo view share it.
+
+\section Clouds Cloud Layer
+
+With setCloudEnable(), SkyDome draws a layer of clouds on a plane at the altitude set by
+setCloudAltitude(). The clouds are tiled noise (the "noise.png" texture), thresholded by
+the coverage, and the wind moves them across the plane. Wind uses the frame time, not the
+SkyDome clock, so it isn't affected by setAutoAdvanceTime() scaling.
+
+Each view renders the clouds into its own texture, a CloudStage, at its viewport size
+divided by setCloudDownsample() in each dimension. A fullscreen pass then upsamples the
+texture over the sky. The upsample is bilateral: it weights each texel by how close its
+distance to the cloud plane is to that of the pixel, which keeps the horizon and the
+dense distant clouds from smearing. The noise shader cost is bounded by the downsampled
+pixel count. The composite pass costs four texture fetches per pixel above the horizon.
+getCloudStats() reports the pixels shaded and the GPU time of the cloud passes for recent
+frames. Clouds draw over the sky cache, so they move even when the cache doesn't change.
 */
 class BACKDROPFX_EXPORT SkyDome : public osg::Group, public backdropFX::BackdropCommon
 {
     friend class SkyDomeUpdateCB;
+    friend class SkyDomeContext;
     friend class LocationCB;
 
 public:
@@ -78,11 +126,46 @@ public:
     Updating is handled in the SkyDomeUpdateCB, so advanced once per
     frame. The scale factor defaults to 1.0 which maps to real-time.
     Set to 2.0 to advance time at a 2x rate, 0.5 at a 1/2x rate, etc.
-    Negative scaling isn't supported. */
+    A negative scale runs time backwards at that rate, and 0.0 holds it,
+    while the clouds keep drifting with the wind. The EphemerisCache
+    follows the direction, so neither direction stalls.
+
+    SkyDome keeps a continuous clock for each LocationData, a modified
+    Julian date (see getModifiedJulianDate()), and repositions the Sun, Moon, and celestial
+    sphere from it every frame, so the sky moves smoothly at any scale.
+    LocationData only stores whole seconds, and changing it triggers all
+    LocationData callbacks, so SkyDome publishes the clock to LocationData
+    only when the sky has moved past the threshold set by
+    setDateTimeThreshold(). Calling LocationData::setDateTime() from the
+    app resets the clock. */
     void setAutoAdvanceTime( bool advance=true, float scale=1.f );
     bool getAutoAdvanceTime() const;
     bool getAutoAdvanceTime( float& scale ) const;
+
+    /** Angle in degrees the sky must turn (or the Moon must move) before
+    auto-advancing time publishes the new date and time to LocationData.
+    The sky turns 0.25 degrees (the default) in one minute. Pass 0.0 to
+    publish every frame. */
+    void setDateTimeThreshold( double degrees ) { _dateTimeThreshold = degrees; }
+    double getDateTimeThreshold() const { return( _dateTimeThreshold ); }
+
+    /** The SkyDome clock for \c locationData, which includes fractional
+    seconds. Pass NULL for the default context, LocationData::s_instance().
+    Returns 0.0 if SkyDome hasn't been culled with \c locationData. */
+    double getModifiedJulianDate( const LocationData* locationData=NULL ) const;
     
+    /** Enable or disable the ephemeris cache. When enabled (the default),
+    Sun and Moon positions and local sidereal time are interpolated from a
+    table computed on a background thread, instead of computed with
+    osgEphemeris every time the date and time changes. See EphemerisCache. */
+    void setEphemerisCacheEnable( bool enable=true ) { _ephemerisCacheEnable = enable; }
+    bool getEphemerisCacheEnable() const { return( _ephemerisCacheEnable ); }
+    /** Access the ephemeris cache of the default context, for example to
+    change its step or window. The Moon position depends on location, so
+    each LocationData has its own cache; caches created later copy the
+    step and window of this one. */
+    EphemerisCache* getEphemerisCache() const;
+
     /** Set the radius of the skydome, which represents the
     distance to the Sun and Moon bodies. By default, the radius
     is 384403 (distance to the moon in kilometers). */
@@ -122,7 +205,128 @@ public:
     void setEnable( bool enable=true ) { _enable = enable; }
     bool getEnable() const { return( _enable ); }
 
-    // TBD Prototype, not fully functional.
+    typedef enum {
+        SKY_GRADIENT,
+        SKY_SCATTERING
+    } SkyModel;
+    /** Selects how the sky is shaded.
+    \li SKY_GRADIENT: A geodesic sphere. Each fragment blends between
+    zenith and horizon colors for day, dusk, and night, weighted by the
+    Sun elevation.
+    \li SKY_SCATTERING: A fullscreen pass that looks up Rayleigh and Mie
+    inscatter for the pixel's view direction and the Sun direction in a
+    precomputed AtmosphereLUT, then applies the phase functions. The cost
+    is one 3D texture fetch per pixel.
+
+    The rebuild that enables SKY_SCATTERING runs in the next update
+    traversal, and blocks it while AtmosphereLUT::init() computes the
+    tables on every processor, so that frame stalls. To avoid the stall,
+    call getAtmosphereLUT()->init() during startup, for example while
+    loading models; the rebuild then reuses the tables. To skip the
+    computation in later runs, set a cache file with
+    setAtmosphereCacheFileName().
+
+    Default is SKY_GRADIENT. */
+    void setSkyModel( SkyModel skyModel );
+    SkyModel getSkyModel() const { return( _skyModel ); }
+
+    /** SKY_SCATTERING maps radiance to color with
+    1 - exp( -exposure * radiance ). Default is 1.0. */
+    void setSkyExposure( float exposure );
+    float getSkyExposure() const;
+
+    /** The SKY_SCATTERING tables. Use this, for example, to compute them
+    before enabling SKY_SCATTERING. */
+    AtmosphereLUT* getAtmosphereLUT() const { return( _atmosphere.get() ); }
+
+    /** File in which the SKY_SCATTERING tables are cached between runs
+    (see AtmosphereLUT::setCacheFileName()). Default is empty, which
+    disables the cache. */
+    void setAtmosphereCacheFileName( const std::string& fileName );
+    const std::string& getAtmosphereCacheFileName() const;
+
+    /** Star catalog file (see StarCatalog). SkyDome draws the catalog's
+    stars brighter than the magnitude limit as point sprites, in one draw
+    call, and fades them out as the Sun rises. The same draw includes the
+    naked eye planets (see EphemerisCache::computePlanet()), positioned
+    once per simulated minute for each LocationData. Stars and planets
+    behind the Moon don't draw. Pass an empty string to draw no stars.
+    Default is "bdfx-stars.cat". If the file isn't found, SkyDome draws
+    no stars. Either way, it still draws the planets.
+
+    backdropFX doesn't ship a catalog in the data directory. Create one
+    with the starfield test (see \ref starfieldtest) from a text catalog
+    of right ascension, declination, magnitude, and B-V color, such as
+    columns extracted from HYG or Hipparcos:
+    \code
+    starfield -i hyg.txt -o <data directory>/bdfx-stars.cat --nowindow
+    \endcode
+    Without -i, the test writes random stars, which are useful for timing
+    but aren't the real sky. */
+    void setStarCatalogFileName( const std::string& fileName );
+    const std::string& getStarCatalogFileName() const { return( _starCatalogFileName ); }
+    /** Faintest visual magnitude to draw. Default is 6.5, the naked eye
+    limit. Changing the limit changes the number of stars drawn, without
+    a rebuild. */
+    void setStarMagnitudeLimit( float magnitude );
+    float getStarMagnitudeLimit() const { return( _starMagnitudeLimit ); }
+    /** Number of stars drawn with the current catalog and limit,
+    excluding the planets. */
+    unsigned int getNumStarsDrawn() const;
+    /** The loaded catalog, or NULL if SkyDome draws no stars. */
+    StarCatalog* getStarCatalog() const;
+
+    /** Enable or disable the sky cache (see \ref SkyCache). Off by default. */
+    void setSkyCacheEnable( bool enable=true );
+    bool getSkyCacheEnable() const { return( _skyCacheEnable ); }
+    /** Width and height in pixels of each sky cache cube map face.
+    Default is 512. */
+    void setSkyCacheResolution( unsigned int size );
+    unsigned int getSkyCacheResolution() const { return( _skyCacheResolution ); }
+    /** Angle in degrees the sky must turn (or the Moon must move) before
+    the sky cache is rendered again. The default, 0.1 degrees, is about
+    half a texel of a 512 pixel cube map face. Pass 0.0 to render the sky
+    cache every frame that time advances. */
+    void setSkyCacheThreshold( double degrees ) { _skyCacheThreshold = degrees; }
+    double getSkyCacheThreshold() const { return( _skyCacheThreshold ); }
+
+    /** Enable or disable the cloud layer (see \ref Clouds). Off by default. */
+    void setCloudEnable( bool enable=true ) { _cloudEnable = enable; }
+    bool getCloudEnable() const { return( _cloudEnable ); }
+    /** Fraction of the sky covered by cloud, from 0.0 (clear) to 1.0
+    (overcast). Default is 0.5. */
+    void setCloudCoverage( float coverage );
+    float getCloudCoverage() const;
+    /** Altitude of the cloud plane above the viewer. Default is 2000.0.
+    The units are arbitrary (for example, meters) but must be the same as
+    those of setCloudTileSize() and setCloudWind(). */
+    void setCloudAltitude( float altitude );
+    float getCloudAltitude() const { return( _cloudAltitude ); }
+    /** Width of one tile of the cloud noise texture on the cloud plane.
+    Default is 10000.0. */
+    void setCloudTileSize( float size );
+    float getCloudTileSize() const { return( _cloudTileSize ); }
+    /** The wind moves the clouds toward compass \c heading in degrees
+    (0.0 is north, 90.0 is east) at \c speed units per second. Default is
+    heading 90.0 and speed 10.0. */
+    void setCloudWind( float heading, float speed );
+    void getCloudWind( float& heading, float& speed ) const;
+    /** Clouds render at the viewport size divided by \c downsample in each
+    dimension. Default is 4, or 1/16 of the pixels. */
+    void setCloudDownsample( unsigned int downsample );
+    unsigned int getCloudDownsample() const { return( _cloudDownsample ); }
+    /** Cost of the cloud layer in the most recently measured frame, summed
+    over all views: the number of pixels that ran the cloud shader, and
+    the GPU time of the reduced resolution pass in milliseconds. GPU time
+    is negative if the GL_EXT_timer_query extension isn't supported, or if
+    a view couldn't time that frame (see CloudStats).
+    Timer results arrive a frame or two late, so \c frameNumber is the
+    frame they belong to. Returns false if no frame has been measured. */
+    bool getCloudStats( unsigned int& frameNumber, unsigned int& pixels, double& gpuTime ) const;
+
+    /** \deprecated Draws \c texture on a sphere just inside the dome,
+    blended over the sky. A prototype, not fully functional, kept for
+    existing apps. Use setCloudEnable() for clouds. */
     void useTexture( osg::TextureCubeMap* texture );
 
 
@@ -138,19 +342,58 @@ public:
     void resizeGLObjectBuffers( unsigned int maxSize );
     void releaseGLObjects( osg::State* state ) const;
 
+    /** Creates and positions the sky for \c locationData, if it doesn't
+    have one yet. Manager::setLocationData() calls this, so the first frame
+    of the view is correct. Call from the update or app thread only. */
+    void addLocationData( LocationData* locationData );
+
 protected:
     ~SkyDome();
 
     void rebuild();
-    void updateLocationData();
     void updateDebug();
-
-    void setSunPosition( backdropFX::SunBody* sunBody, const osgEphemeris::DateTime& dateTime );
-    void setMoonPosition( backdropFX::MoonBody* moonBody, const osgEphemeris::DateTime& dateTime );
+    /** Loads the star catalog and returns the star field, including the
+    planets. */
+    osg::Geometry* createStars();
+
+    /** Returns the context for \c locationData, creating and positioning
+    it on the first lookup. Safe to call from multiple cull threads. */
+    SkyDomeContext* getContext( LocationData* locationData );
+    /** Updates every context, advancing each clock by \c seconds, and
+    discards contexts whose LocationData was deleted. */
+    void updateContexts( double seconds );
+
+    void updateLocationData( SkyDomeContext* ctx );
+    /** Advances the clock, repositions the sky, and publishes the date
+    and time to LocationData if the sky moved past the threshold. */
+    void advanceTime( SkyDomeContext* ctx, double seconds );
+    /** Positions the Sun, Moon, and celestial sphere for the current clock. */
+    void updateCelestial( SkyDomeContext* ctx );
+
+    void setSunPosition( backdropFX::SunBody* sunBody, const EphemerisCache::Sample& sample );
+    void setMoonPosition( backdropFX::MoonBody* moonBody, const EphemerisCache::Sample& sample );
+
+    /** Marks the context's sky cache out of date if \c force is true or
+    the sky moved past the sky cache threshold since it was last rendered. */
+    void updateSkyCache( SkyDomeContext* ctx, bool force );
+    /** Marks every context's sky cache out of date. */
+    void dirtySkyCaches();
+    /** Culls the sky into the SkyCubeStage for \c cv, and the cached sky
+    pass into \c sds. */
+    void cullSkyCache( osgUtil::CullVisitor* cv, SkyDomeContext* ctx, SkyDomeStage* sds );
+
+    /** Creates the cloud uniforms and statistics. Called by the constructors. */
+    void createCloudUniforms( float coverage );
+    /** Moves the clouds with the wind for \c seconds of frame time. */
+    void updateClouds( double seconds );
+    /** Culls the cloud pass into the CloudStage for \c cv, and the cloud
+    composite pass into \c sds. */
+    void cullClouds( osgUtil::CullVisitor* cv, SkyDomeStage* sds );
 
     static const unsigned int RebuildDirty;
     static const unsigned int LocationDataDirty;
     static const unsigned int DebugDirty;
+    static const unsigned int DateTimeDirty;
     static const unsigned int AllDirty;
 
     bool _timeAdvance;
@@ -163,33 +406,69 @@ protected:
     float _moonScale;
     unsigned int _moonSub;
 
-    osg::ref_ptr< osg::Uniform > _orientationUniform;
+    double _dateTimeThreshold;
 
     osg::ref_ptr< backdropFX::SunBody > _sunBody;
     osg::ref_ptr< backdropFX::MoonBody > _moonBody;
 
-    osg::ref_ptr< osgEphemeris::Sun > _cSun;
-    osg::ref_ptr< osgEphemeris::Moon > _cMoon;
+    bool _ephemerisCacheEnable;
+
+    // Per-LocationData state. The context map is read, and added to, by
+    // cull threads, so it's protected by _contextLock.
+    typedef std::map< const LocationData*, osg::ref_ptr< SkyDomeContext > > ContextMap;
+    ContextMap _contexts;
+    mutable OpenThreads::Mutex _contextLock;
+    osg::ref_ptr< SkyDomeContext > _defaultContext;
 
     osg::ref_ptr< SkyDomeUpdateCB > _updateCB;
     osg::ref_ptr< SkyDomeCullCB > _cullCB;
 
-    // TBD Prototype, not fully functional.
-    osg::ref_ptr< osg::TextureCubeMap > _texture;
+    /** Set the per-cull viewProj uniform, and its inverse, from the
+    CullVisitor's modelview and projection matrices. */
+    void updateViewProjUniform( osgUtil::CullVisitor* cv, osg::Uniform* viewProj,
+        osg::Uniform* invViewProj=NULL );
+
+    bool _enable;
 
-    /** Map CullVisitor address to StateSets.
-    StateSet stores uniform for modified
-    view and projection matrices concatenation. */
-    typedef struct std::pair< osg::ref_ptr< osg::StateSet >, osg::Uniform* > UniformBundle;
-    typedef std::map< osgUtil::CullVisitor*, UniformBundle > StateSetPerCull;
-    StateSetPerCull _stateSetPerCull;
-    OpenThreads::Mutex _stateSetMapLock;
+    SkyModel _skyModel;
+    osg::ref_ptr< AtmosphereLUT > _atmosphere;
+    osg::ref_ptr< osg::Uniform > _skyExposure;
 
-    UniformBundle* updateViewProjUniforms( osgUtil::CullVisitor* cv );
+    std::string _starCatalogFileName;
+    float _starMagnitudeLimit;
+    osg::ref_ptr< StarCatalog > _starCatalog;
+    osg::ref_ptr< osg::DrawArrays > _starPrimitives;
 
-    bool _enable;
+    bool _skyCacheEnable;
+    unsigned int _skyCacheResolution;
+    double _skyCacheThreshold;
+    // Fullscreen pass that draws the sky from a context's cube map.
+    osg::ref_ptr< osg::Geode > _skyCacheGeode;
 
     osg::ref_ptr< osg::Object > _renderingCache;
+    // RenderStageCache of SkyCubeStages.
+    osg::ref_ptr< osg::Object > _skyCacheRenderingCache;
+
+    bool _cloudEnable;
+    float _cloudAltitude;
+    float _cloudTileSize;
+    float _cloudWindHeading, _cloudWindSpeed;
+    unsigned int _cloudDownsample;
+    // Wind advection in noise tiles, wrapped to [0,1).
+    double _cloudOffsetX, _cloudOffsetY;
+    osg::ref_ptr< osg::Uniform > _cloudCoverage;
+    osg::ref_ptr< osg::Uniform > _cloudHeight;
+    osg::ref_ptr< osg::Uniform > _cloudOffset;
+    osg::ref_ptr< osg::Texture2D > _cloudNoise;
+    // See useTexture().
+    osg::ref_ptr< osg::TextureCubeMap > _texture;
+    osg::ref_ptr< CloudStats > _cloudStats;
+    // Reduced resolution cloud pass, and the pass that composites it
+    // over the sky. Neither is a child; SkyDome culls them explicitly.
+    osg::ref_ptr< osg::Geode > _cloudGeode;
+    osg::ref_ptr< osg::Geode > _cloudCompositeGeode;
+    // RenderStageCache of CloudStages.
+    osg::ref_ptr< osg::Object > _cloudRenderingCache;
 };
 
 
@@ -6,6 +6,7 @@
 
 #include <osgUtil/RenderStage>
 #include <osg/FrameBufferObject>
+#include <osg/Uniform>
 #include <osg/Version>
 
 #include <string>
@@ -39,6 +40,13 @@ public:
     void setEnable( bool enable=true );
     bool getEnable() const { return( _enable ); }
 
+    /** StateSet containing the per-cull "viewProj" and "invViewProj"
+    uniforms. SkyDome pushes this during cull so that each CullVisitor
+    gets its own view/projection concatenation. */
+    osg::StateSet* getPerCullStateSet();
+    osg::Uniform* getViewProjUniform();
+    osg::Uniform* getInvViewProjUniform();
+
 protected:
     ~SkyDomeStage();
     void internalInit();
@@ -48,6 +56,10 @@ protected:
     BackdropCommon* _backdropCommon;
 
     bool _enable;
+
+    osg::ref_ptr< osg::StateSet > _stateSet;
+    osg::ref_ptr< osg::Uniform > _viewProj;
+    osg::ref_ptr< osg::Uniform > _invViewProj;
 };
 
 
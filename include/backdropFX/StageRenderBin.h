@@ -0,0 +1,48 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_STAGE_RENDER_BIN_H__
+#define __BACKDROPFX_STAGE_RENDER_BIN_H__ 1
+
+
+#include <osgUtil/RenderBin>
+#include <osgUtil/RenderStage>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::StageRenderBin StageRenderBin.h backdropFX/StageRenderBin.h
+
+\brief A RenderBin owned by a custom RenderStage, drawn explicitly by that stage.
+
+Custom RenderStages that cull their subgraph more than once (for example,
+DepthPartitionStage once per partition, or ShadowMapStage once per light)
+need a separate RenderBin for each traversal. During cull, make the
+StageRenderBin the CullVisitor's current RenderBin. Nested bins (such as
+DepthPeelBin) inherit the stage, just as they would as children of the stage
+itself. During draw, the owning stage calls draw() on the StageRenderBin.
+
+Also push a StateSet unique to each traversal. Otherwise leaves from
+different traversals share StateGraphs, and only the first traversal's
+bin receives them.
+*/
+class StageRenderBin : public osgUtil::RenderBin
+{
+public:
+    StageRenderBin( osgUtil::RenderStage* stage )
+    {
+        _stage = stage;
+    }
+
+protected:
+    ~StageRenderBin() {}
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_STAGE_RENDER_BIN_H__
+#endif
@@ -0,0 +1,100 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_STAR_CATALOG_H__
+#define __BACKDROPFX_STAR_CATALOG_H__ 1
+
+
+#include <backdropFX/Export.h>
+#include <osg/Referenced>
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+
+namespace backdropFX
+{
+
+
+/** \class backdropFX::StarCatalog StarCatalog.h backdropFX/StarCatalog.h
+
+\brief A compact, memory-mapped binary star catalog.
+
+A catalog file is a 16 byte header (the magic string "BDFXSTR", a version
+number, and the number of stars) followed by one Star record per star,
+sorted brightest first. Each record holds the star's direction on the unit
+celestial sphere, precomputed from right ascension and declination (see
+computeDirection()), its visual magnitude, and its B-V color index.
+
+load() maps the file into memory and validates the header. There is no
+parsing, so loading 100k stars takes well under a millisecond. Mapping only
+speeds up loading: SkyDome copies the records into its vertex arrays once
+per rebuild, because osg::Array owns its storage, and afterwards reads the
+mapping only to look up the magnitude limit. Because the records are sorted
+by magnitude, the stars brighter than any limit are a prefix of the catalog
+(see getNumStarsBrighterThan()), and SkyDome draws them with a single
+glDrawArrays call.
+
+write() creates a catalog file from an array of stars, for example, stars
+read from a text catalog. The starfield test converts text catalogs and
+measures load time and per-frame cost.
+*/
+class BACKDROPFX_EXPORT StarCatalog : public osg::Referenced
+{
+public:
+    StarCatalog();
+
+    /** One catalog record. The direction is in the SkyDome celestial
+    sphere coordinate system: +z is the north celestial pole, -y is 0h right
+    ascension, and +x is 6h right ascension. */
+    struct Star
+    {
+        float _x, _y, _z;
+        float _magnitude;
+        float _colorIndex; // B-V
+    };
+
+    /** Maps \c fileName into memory, unmapping any previously loaded
+    catalog. Relative names are found with osgDB::findDataFile(). Returns
+    false if the file can't be found or mapped, or isn't a catalog. */
+    bool load( const std::string& fileName );
+    /** Unmaps the catalog. */
+    void unload();
+    bool valid() const { return( _stars != NULL ); }
+
+    unsigned int getNumStars() const { return( _numStars ); }
+    /** Returns the records, which are valid until unload() or deletion. */
+    const Star* getStars() const { return( _stars ); }
+    /** Returns the number of stars with magnitude less than or equal to
+    \c magnitude: the length of the catalog prefix to draw. */
+    unsigned int getNumStarsBrighterThan( float magnitude ) const;
+
+    /** Sets the direction of \c star from right ascension \c ra in hours
+    and declination \c dec in degrees. */
+    static void computeDirection( double ra, double dec, Star& star );
+    /** Sorts \c stars brightest first and writes them to \c fileName.
+    Returns false on failure. */
+    static bool write( const std::string& fileName, std::vector< Star >& stars );
+
+protected:
+    ~StarCatalog();
+
+    const Star* _stars;
+    unsigned int _numStars;
+
+    // The file mapping.
+    void* _mapAddress;
+    size_t _mapLength;
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#endif
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_STAR_CATALOG_H__
+#endif
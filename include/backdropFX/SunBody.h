@@ -67,13 +67,16 @@ public:
     the origin to the specified location. This is set as a uniform, and 
 	the Sun shaders use it to transform the sphere vertices.
 
-    This function also stores the Sun transformation matrix in the
-    LocationData singleton. See LocationData::storeSunMatrix. This
-    lets the code query the vector to the Sun, which lighting uses. It
-    also sets a vec3 sunPosition uniform to color the sky dome
-    for day, dusk, night, and dawn.
+    SkyDome stores the same matrix in each view's LocationData (see
+    LocationData::storeSunMatrix), which lets the code query the vector
+    to the Sun for lighting, and sets a vec3 sunPosition uniform to color
+    the sky dome for day, dusk, night, and dawn. Views at different
+    locations or times override the sunTransform uniform during cull.
     */
     void setRADecDistance( float ra, float dec, float distance );
+    /** Returns the matrix that transforms the Sun from the origin to the
+    given celestial position. See setRADecDistance. */
+    static osg::Matrix computeSunMatrix( float ra, float dec, float distance );
     float getRA() const;
     float getDec() const;
     float getDistance() const;
@@ -0,0 +1,96 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_UNIFORM_LOCATION_CACHE_H__
+#define __BACKDROPFX_UNIFORM_LOCATION_CACHE_H__ 1
+
+#include <backdropFX/Export.h>
+#include <osg/Program>
+#include <osg/Uniform>
+#include <osg/State>
+#include <osg/observer_ptr>
+#include <osg/buffered_value>
+
+#include <vector>
+
+
+namespace backdropFX {
+
+
+/** \class backdropFX::UniformLocationCache UniformLocationCache.h backdropFX/UniformLocationCache.h
+
+\brief Remembers uniform locations for code that applies uniforms directly.
+
+Effects and other draw-time code apply uniforms with osg::Uniform::apply(),
+which needs a location. osg::State::getUniformLocation() finds it with a
+map lookup (by name, or by name ID with OSG_SUPPORTS_UNIFORM_ID) on every
+call. This class finds it once per program and context.
+
+The caller assigns each uniform it applies a slot, a small index that is the
+same every draw. Each context keeps a flat array of slots, holding the
+PerContextProgram the location belongs to, the uniform, and the location.
+apply() compares the program last applied to the osg::State, and the
+uniform, with the slot. If both match, it applies the uniform at the stored
+location. Otherwise it looks up the location and stores it. A slot only
+observes its PerContextProgram, so it doesn't keep a released program alive,
+and never mistakes a new PerContextProgram at the same address for it.
+
+A cache serves one program at a time. Code that alternates between programs
+in a draw, or that shares slots between programs, still works, but looks
+locations up again on each change; give each program its own cache instead.
+
+Linking can move locations. Apply the program with applyProgram(), which
+forgets the stored locations of a program that is about to link or relink,
+for example after its shaders changed. The cache only sees links of the
+programs it applies, so code that applies a program some other way, and
+relinks it, needs a cache of its own. releaseGLObjects() forgets the
+locations of a context.
+*/
+class BACKDROPFX_EXPORT UniformLocationCache
+{
+public:
+    UniformLocationCache();
+    ~UniformLocationCache();
+
+    /** Returns the location of \c uniform in the program last applied to
+    \c state, or -1 if the uniform is inactive or no program is applied.
+    */
+    GLint getLocation( osg::State& state, unsigned int slot, const osg::Uniform* uniform );
+
+    /** Applies \c program to \c state. If the program links during the
+    apply, forgets the locations stored for it first. */
+    void applyProgram( osg::State& state, const osg::Program* program );
+
+    /** Applies \c uniform to the program last applied to \c state, if the
+    program uses it. */
+    void apply( osg::State& state, osg::GL2Extensions* gl2Ext, unsigned int slot, const osg::Uniform* uniform )
+    {
+        const GLint location( getLocation( state, slot, uniform ) );
+        if( location >= 0 )
+            uniform->apply( gl2Ext, location );
+    }
+
+    void resizeGLObjectBuffers( unsigned int maxSize );
+    /** Forgets the locations stored for the context of \c state, or for
+    all contexts if \c state is NULL. */
+    void releaseGLObjects( osg::State* state=NULL ) const;
+
+protected:
+    struct Binding
+    {
+        Binding() : _location( -1 ) {}
+
+        osg::observer_ptr< const osg::Program::PerContextProgram > _pcp;
+        osg::ref_ptr< const osg::Uniform > _uniform;
+        GLint _location;
+    };
+    typedef std::vector< Binding > BindingVector;
+
+    mutable osg::buffered_object< BindingVector > _bindings;
+};
+
+
+// namespace backdropFX
+}
+
+// __BACKDROPFX_UNIFORM_LOCATION_CACHE_H__
+#endif
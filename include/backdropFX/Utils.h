@@ -6,6 +6,8 @@
 #include <backdropFX/Export.h>
 #include <osg/Notify>
 #include <osg/FrameBufferObject>
+#include <osg/Node>
+#include <osg/NodeCallback>
 #include <osgwTools/Version.h>
 #include <string>
 
@@ -21,6 +23,23 @@ namespace backdropFX {
     ( ( ( OSGWORKS_OSG_VERSION < 20900 ) && ( OSGWORKS_OSG_VERSION >= 20805 ) ) || \
     ( OSGWORKS_OSG_VERSION >= 20910 ) )
 
+// Attaching an entire texture array to an FBO, with the layer selected
+// per-primitive by a geometry shader (Camera::FACE_CONTROLLED_BY_GEOMETRY_SHADER),
+// is supported starting with 2.9.7.
+#define OSG_SUPPORTS_LAYERED_FBO \
+    ( OSGWORKS_OSG_VERSION >= 20907 )
+
+// Node::addUpdateCallback(), which nests a callback into any existing update
+// callback, isn't available on the 2.8 branch. It's used starting with 3.0.
+#define OSG_SUPPORTS_ADD_UPDATE_CALLBACK \
+    ( OSGWORKS_OSG_VERSION >= 30000 )
+
+// observer_ptr::lock(), which safely takes a reference to an object that
+// another thread might be deleting, arrived with the thread safe
+// observer_ptr. It's used starting with 3.0.
+#define OSG_SUPPORTS_OBSERVER_LOCK \
+    ( OSGWORKS_OSG_VERSION >= 30000 )
+
 
 
 #define UTIL_MEMORY_CHECK( ptr, message, failureReturn ) \
@@ -56,6 +75,12 @@ For example, if you want "bdfx_light[0].diffuse", then you would pass:
 */
 std::string BACKDROPFX_EXPORT elementName( const std::string& prefix, int element, const std::string& suffix );
 
+/** Adds \c cb to the update callbacks of \c node. If \c node already has an
+update callback, \c cb is nested at the end of its chain, so callbacks the
+application installed keep running. Uses Node::addUpdateCallback() where OSG
+supports it (OSG_SUPPORTS_ADD_UPDATE_CALLBACK). */
+void BACKDROPFX_EXPORT addUpdateCallback( osg::Node& node, osg::NodeCallback* cb );
+
 
 // namespace backdropFX
 }
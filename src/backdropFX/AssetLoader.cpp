@@ -0,0 +1,730 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/AssetLoader.h>
+#include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/ScopedLock>
+#include <osg/Texture>
+#include <osg/Notify>
+#include <osg/Math>
+
+#include <backdropFX/Utils.h>
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+// Low priority worker that runs AssetLoader requests.
+class AssetLoaderThread : public OpenThreads::Thread
+{
+public:
+    AssetLoaderThread( AssetLoader* loader )
+      : _loader( loader )
+    {}
+
+    virtual void run()
+    {
+        osg::ref_ptr< AssetLoader::Request > req;
+        while( _loader->waitForRequest( req ) )
+        {
+            req->load();
+            _loader->storeLoaded( req.get() );
+            req = NULL;
+        }
+    }
+
+protected:
+    // The loader owns and joins this thread, so no ref_ptr.
+    AssetLoader* _loader;
+};
+
+// Reads an image into a texture.
+class ImageRequest : public AssetLoader::Request
+{
+public:
+    ImageRequest( osg::Texture* texture, const std::string& fileName, unsigned int face, bool useContainer )
+      : _texture( texture ),
+        _fileName( fileName ),
+        _face( face ),
+        _useContainer( useContainer )
+    {}
+
+    virtual void load()
+    {
+        _image = AssetLoader::readImage( _fileName, _useContainer );
+        if( !( _image.valid() ) )
+            osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Can't load \"" << _fileName << "\"." << std::endl;
+    }
+    virtual void apply()
+    {
+        if( _image.valid() )
+            _texture->setImage( _face, _image.get() );
+    }
+
+protected:
+    osg::ref_ptr< osg::Texture > _texture;
+    std::string _fileName;
+    unsigned int _face;
+    bool _useContainer;
+    osg::ref_ptr< osg::Image > _image;
+};
+
+
+static const char ContainerMagic[ 8 ] = { 'B', 'D', 'F', 'X', 'T', 'E', 'X', 0 };
+static const unsigned int ContainerVersion( 1 );
+// Largest container width or height. Keeps the size of a full RGBA
+// mipmap chain within 32 bits.
+static const unsigned int MaxContainerSize( 16384 );
+
+struct ContainerHeader
+{
+    char _magic[ 8 ];
+    unsigned int _version;
+    unsigned int _width, _height;
+    unsigned int _pixelFormat;
+    unsigned int _internalFormat;
+    unsigned int _numLevels;
+};
+
+static bool isPowerOfTwo( unsigned int n )
+{
+    return( ( n != 0 ) && ( ( n & ( n - 1 ) ) == 0 ) );
+}
+
+// Bytes per 4x4 block for DXT formats, 0 for uncompressed formats.
+static unsigned int getBlockSize( GLenum pixelFormat )
+{
+    switch( pixelFormat )
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return( 8 );
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return( 16 );
+    default:
+        return( 0 );
+    }
+}
+
+static unsigned int computeLevelSize( unsigned int width, unsigned int height, GLenum pixelFormat )
+{
+    const unsigned int blockSize( getBlockSize( pixelFormat ) );
+    if( blockSize > 0 )
+        return( ( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * blockSize );
+    return( width * height * osg::Image::computeNumComponents( pixelFormat ) );
+}
+
+// Returns the total size in bytes of numLevels tightly packed mipmap
+// levels, and the offsets of levels 1 through numLevels-1.
+static unsigned int computeLayout( unsigned int width, unsigned int height, GLenum pixelFormat,
+    unsigned int numLevels, osg::Image::MipmapDataType& offsets )
+{
+    offsets.clear();
+    unsigned int size( computeLevelSize( width, height, pixelFormat ) );
+    unsigned int level;
+    for( level=1; level<numLevels; level++ )
+    {
+        width = osg::maximum< unsigned int >( width >> 1, 1 );
+        height = osg::maximum< unsigned int >( height >> 1, 1 );
+        offsets.push_back( size );
+        size += computeLevelSize( width, height, pixelFormat );
+    }
+    return( size );
+}
+
+// Pixel formats convertImage() and createNormalMap() produce.
+static bool isContainerFormat( GLenum pixelFormat )
+{
+    switch( pixelFormat )
+    {
+    case GL_LUMINANCE:
+    case GL_LUMINANCE_ALPHA:
+    case GL_RGB:
+    case GL_RGBA:
+        return( true );
+    default:
+        return( getBlockSize( pixelFormat ) > 0 );
+    }
+}
+
+// Number of levels in a full mipmap chain, whether or not the
+// dimensions are powers of two.
+static unsigned int computeMaxLevels( unsigned int width, unsigned int height )
+{
+    unsigned int numLevels( 1 );
+    while( ( width > 1 ) || ( height > 1 ) )
+    {
+        width = osg::maximum< unsigned int >( width >> 1, 1 );
+        height = osg::maximum< unsigned int >( height >> 1, 1 );
+        numLevels++;
+    }
+    return( numLevels );
+}
+
+static unsigned int computeNumLevels( unsigned int width, unsigned int height )
+{
+    if( !isPowerOfTwo( width ) || !isPowerOfTwo( height ) )
+        return( 1 );
+    return( computeMaxLevels( width, height ) );
+}
+
+static osg::Image* allocateImage( unsigned int width, unsigned int height, GLenum pixelFormat,
+    unsigned int numLevels )
+{
+    osg::Image::MipmapDataType offsets;
+    const unsigned int size( computeLayout( width, height, pixelFormat, numLevels, offsets ) );
+
+    osg::Image* image = new osg::Image;
+    UTIL_MEMORY_CHECK( image, "AssetLoader Image", NULL );
+    unsigned char* data = new unsigned char[ size ];
+    UTIL_MEMORY_CHECK( data, "AssetLoader Image data", NULL );
+    image->setImage( width, height, 1, pixelFormat, pixelFormat, GL_UNSIGNED_BYTE,
+        data, osg::Image::USE_NEW_DELETE, 1 );
+    image->setMipmapLevels( offsets );
+    return( image );
+}
+
+static unsigned int getTotalSize( const osg::Image* image )
+{
+    osg::Image::MipmapDataType offsets;
+    return( computeLayout( image->s(), image->t(), image->getPixelFormat(),
+        image->getNumMipmapLevels(), offsets ) );
+}
+
+// Fills in levels 1 through n of a tightly packed mipmap chain with a 2x2 box filter.
+static void buildMipmaps( osg::Image* image )
+{
+    unsigned int width( image->s() ), height( image->t() );
+    const unsigned int components( osg::Image::computeNumComponents( image->getPixelFormat() ) );
+    const osg::Image::MipmapDataType& offsets( image->getMipmapLevels() );
+    const unsigned char* src( image->data() );
+    unsigned int level;
+    for( level=0; level<offsets.size(); level++ )
+    {
+        const unsigned int w( osg::maximum< unsigned int >( width >> 1, 1 ) );
+        const unsigned int h( osg::maximum< unsigned int >( height >> 1, 1 ) );
+        unsigned char* dst( image->data() + offsets[ level ] );
+        unsigned int x, y, c;
+        for( y=0; y<h; y++ )
+        {
+            const unsigned int y0( osg::minimum( y * 2, height - 1 ) );
+            const unsigned int y1( osg::minimum( y * 2 + 1, height - 1 ) );
+            for( x=0; x<w; x++ )
+            {
+                const unsigned int x0( osg::minimum( x * 2, width - 1 ) );
+                const unsigned int x1( osg::minimum( x * 2 + 1, width - 1 ) );
+                for( c=0; c<components; c++ )
+                {
+                    const unsigned int sum(
+                        src[ ( y0 * width + x0 ) * components + c ] +
+                        src[ ( y0 * width + x1 ) * components + c ] +
+                        src[ ( y1 * width + x0 ) * components + c ] +
+                        src[ ( y1 * width + x1 ) * components + c ] );
+                    dst[ ( y * w + x ) * components + c ] = (unsigned char)( ( sum + 2 ) / 4 );
+                }
+            }
+        }
+        src = dst;
+        width = w;
+        height = h;
+    }
+}
+
+
+// DXT compression. Endpoints are the corners of the color bounding box,
+// which is fast and good enough for the smooth, mostly monochrome sky
+// and surface textures.
+static unsigned short packRGB565( const unsigned char* rgb )
+{
+    return( (unsigned short)( ( ( rgb[ 0 ] >> 3 ) << 11 ) | ( ( rgb[ 1 ] >> 2 ) << 5 ) | ( rgb[ 2 ] >> 3 ) ) );
+}
+static void unpackRGB565( unsigned short c, int* rgb )
+{
+    rgb[ 0 ] = ( ( c >> 11 ) & 31 ) * 255 / 31;
+    rgb[ 1 ] = ( ( c >> 5 ) & 63 ) * 255 / 63;
+    rgb[ 2 ] = ( c & 31 ) * 255 / 31;
+}
+
+// block is 16 RGBA texels. Writes 8 bytes.
+static void compressColorBlock( const unsigned char* block, unsigned char* out )
+{
+    unsigned char minColor[ 3 ] = { 255, 255, 255 };
+    unsigned char maxColor[ 3 ] = { 0, 0, 0 };
+    unsigned int idx, c;
+    for( idx=0; idx<16; idx++ )
+    {
+        for( c=0; c<3; c++ )
+        {
+            minColor[ c ] = osg::minimum( minColor[ c ], block[ idx * 4 + c ] );
+            maxColor[ c ] = osg::maximum( maxColor[ c ], block[ idx * 4 + c ] );
+        }
+    }
+
+    unsigned short c0( packRGB565( maxColor ) ), c1( packRGB565( minColor ) );
+    if( c0 < c1 )
+        std::swap( c0, c1 );
+
+    // Four color palette. c0 > c1 selects four color mode.
+    int palette[ 4 ][ 3 ];
+    unpackRGB565( c0, palette[ 0 ] );
+    unpackRGB565( c1, palette[ 1 ] );
+    for( c=0; c<3; c++ )
+    {
+        palette[ 2 ][ c ] = ( 2 * palette[ 0 ][ c ] + palette[ 1 ][ c ] ) / 3;
+        palette[ 3 ][ c ] = ( palette[ 0 ][ c ] + 2 * palette[ 1 ][ c ] ) / 3;
+    }
+
+    unsigned int indices( 0 );
+    if( c0 != c1 )
+    {
+        for( idx=0; idx<16; idx++ )
+        {
+            unsigned int best( 0 );
+            int bestDist( 0x7fffffff );
+            unsigned int p;
+            for( p=0; p<4; p++ )
+            {
+                int dist( 0 );
+                for( c=0; c<3; c++ )
+                {
+                    const int d( block[ idx * 4 + c ] - palette[ p ][ c ] );
+                    dist += d * d;
+                }
+                if( dist < bestDist )
+                {
+                    bestDist = dist;
+                    best = p;
+                }
+            }
+            indices |= best << ( idx * 2 );
+        }
+    }
+
+    out[ 0 ] = (unsigned char)( c0 & 0xff );
+    out[ 1 ] = (unsigned char)( c0 >> 8 );
+    out[ 2 ] = (unsigned char)( c1 & 0xff );
+    out[ 3 ] = (unsigned char)( c1 >> 8 );
+    for( idx=0; idx<4; idx++ )
+        out[ 4 + idx ] = (unsigned char)( ( indices >> ( idx * 8 ) ) & 0xff );
+}
+
+// block is 16 RGBA texels. Writes the 8 byte DXT5 alpha block.
+static void compressAlphaBlock( const unsigned char* block, unsigned char* out )
+{
+    unsigned char a0( 0 ), a1( 255 );
+    unsigned int idx;
+    for( idx=0; idx<16; idx++ )
+    {
+        a0 = osg::maximum( a0, block[ idx * 4 + 3 ] );
+        a1 = osg::minimum( a1, block[ idx * 4 + 3 ] );
+    }
+    out[ 0 ] = a0;
+    out[ 1 ] = a1;
+
+    // a0 > a1 selects eight level mode: index 0 is a0, 1 is a1, and
+    // 2 through 7 step from a0 to a1.
+    unsigned long long indices( 0 );
+    if( a0 != a1 )
+    {
+        for( idx=0; idx<16; idx++ )
+        {
+            const unsigned int step( ( ( a0 - block[ idx * 4 + 3 ] ) * 7 + ( a0 - a1 ) / 2 ) / ( a0 - a1 ) );
+            const unsigned long long code( ( step == 0 ) ? 0 : ( ( step == 7 ) ? 1 : step + 1 ) );
+            indices |= code << ( idx * 3 );
+        }
+    }
+    for( idx=0; idx<6; idx++ )
+        out[ 2 + idx ] = (unsigned char)( ( indices >> ( idx * 8 ) ) & 0xff );
+}
+
+// Compresses one tightly packed level. Texels past the edge of levels
+// smaller than a block repeat the edge texels.
+static void compressLevel( const unsigned char* src, unsigned int width, unsigned int height,
+    unsigned int components, bool alpha, unsigned char* dst )
+{
+    unsigned char block[ 16 * 4 ];
+    unsigned int bx, by;
+    for( by=0; by<height; by+=4 )
+    {
+        for( bx=0; bx<width; bx+=4 )
+        {
+            unsigned int x, y;
+            for( y=0; y<4; y++ )
+            {
+                for( x=0; x<4; x++ )
+                {
+                    const unsigned int sx( osg::minimum( bx + x, width - 1 ) );
+                    const unsigned int sy( osg::minimum( by + y, height - 1 ) );
+                    const unsigned char* texel( src + ( sy * width + sx ) * components );
+                    unsigned char* b( block + ( y * 4 + x ) * 4 );
+                    if( components < 3 )
+                    {
+                        // Luminance, luminance alpha.
+                        b[ 0 ] = b[ 1 ] = b[ 2 ] = texel[ 0 ];
+                        b[ 3 ] = ( components == 2 ) ? texel[ 1 ] : 255;
+                    }
+                    else
+                    {
+                        b[ 0 ] = texel[ 0 ];
+                        b[ 1 ] = texel[ 1 ];
+                        b[ 2 ] = texel[ 2 ];
+                        b[ 3 ] = ( components == 4 ) ? texel[ 3 ] : 255;
+                    }
+                }
+            }
+            if( alpha )
+            {
+                compressAlphaBlock( block, dst );
+                dst += 8;
+            }
+            compressColorBlock( block, dst );
+            dst += 8;
+        }
+    }
+}
+/** \endcond */
+
+
+
+AssetLoader*
+AssetLoader::instance( const bool erase )
+{
+    static osg::ref_ptr< AssetLoader > s_loader = new AssetLoader;
+    if( erase )
+        s_loader = NULL;
+    return( s_loader.get() );
+}
+
+AssetLoader::AssetLoader()
+  : _numInFlight( 0 ),
+    _done( false ),
+    _thread( NULL )
+{
+}
+AssetLoader::~AssetLoader()
+{
+    if( _thread != NULL )
+    {
+        {
+            OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+            _done = true;
+            _condition.broadcast();
+        }
+        _thread->join();
+        delete _thread;
+    }
+}
+
+
+void AssetLoader::request( Request* request )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    _pending.push_back( request );
+
+    if( _thread == NULL )
+    {
+        _thread = new AssetLoaderThread( this );
+        UTIL_MEMORY_CHECK( _thread, "AssetLoader _thread", );
+        _thread->setSchedulePriority( OpenThreads::Thread::THREAD_PRIORITY_LOW );
+        _thread->start();
+    }
+    _condition.signal();
+}
+
+void AssetLoader::requestImage( osg::Texture* texture, const std::string& fileName,
+    unsigned int face, bool useContainer )
+{
+    // The image is attached during update, possibly while the previous
+    // frame draws.
+    texture->setDataVariance( osg::Object::DYNAMIC );
+
+    osg::ref_ptr< ImageRequest > req( new ImageRequest( texture, fileName, face, useContainer ) );
+    UTIL_MEMORY_CHECK( req.get(), "AssetLoader ImageRequest", );
+    request( req.get() );
+}
+
+unsigned int AssetLoader::update()
+{
+    std::vector< osg::ref_ptr< Request > > loaded;
+    unsigned int numLoading;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        loaded.swap( _loaded );
+        numLoading = _pending.size() + _numInFlight;
+    }
+
+    std::vector< osg::ref_ptr< Request > >::iterator it;
+    for( it = loaded.begin(); it != loaded.end(); ++it )
+        (*it)->apply();
+    return( numLoading );
+}
+
+void AssetLoader::flush()
+{
+    while( true )
+    {
+        {
+            OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+            if( _pending.empty() && ( _numInFlight == 0 ) )
+                break;
+        }
+        OpenThreads::Thread::microSleep( 1000 );
+    }
+    update();
+}
+
+void AssetLoader::UpdateCallback::operator()( osg::Node* node, osg::NodeVisitor* nv )
+{
+    AssetLoader::instance()->update();
+    traverse( node, nv );
+}
+
+
+bool AssetLoader::waitForRequest( osg::ref_ptr< Request >& request )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    while( _pending.empty() && !_done )
+        _condition.wait( &_mutex );
+    if( _done )
+        return( false );
+
+    request = _pending.front();
+    _pending.pop_front();
+    _numInFlight++;
+    return( true );
+}
+
+void AssetLoader::storeLoaded( Request* request )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    _loaded.push_back( request );
+    _numInFlight--;
+}
+
+
+osg::Image* AssetLoader::readImage( const std::string& fileName, bool useContainer )
+{
+    if( !useContainer )
+        return( osgDB::readImageFile( fileName ) );
+
+    const std::string containerName( osgDB::findDataFile( getContainerFileName( fileName ) ) );
+    if( !( containerName.empty() ) )
+    {
+        osg::Image* image( readContainer( containerName ) );
+        if( image != NULL )
+            return( image );
+    }
+    return( osgDB::readImageFile( fileName ) );
+}
+
+std::string AssetLoader::getContainerFileName( const std::string& fileName )
+{
+    return( osgDB::getNameLessExtension( fileName ) + ".bdfxtex" );
+}
+
+osg::Image* AssetLoader::createPlaceholderImage( const osg::Vec4& color )
+{
+    osg::Image* image( new osg::Image );
+    UTIL_MEMORY_CHECK( image, "AssetLoader placeholder Image", NULL );
+    image->allocateImage( 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+    unsigned char* data( image->data() );
+    unsigned int idx;
+    for( idx=0; idx<4; idx++ )
+        data[ idx ] = (unsigned char)( osg::clampBetween( color[ idx ], 0.f, 1.f ) * 255.f + .5f );
+    return( image );
+}
+
+
+osg::Image* AssetLoader::convertImage( const osg::Image* image, bool compress )
+{
+    const GLenum pixelFormat( image->getPixelFormat() );
+    if( ( image->getDataType() != GL_UNSIGNED_BYTE ) || ( image->r() != 1 ) ||
+        ( ( pixelFormat != GL_LUMINANCE ) && ( pixelFormat != GL_LUMINANCE_ALPHA ) &&
+        ( pixelFormat != GL_RGB ) && ( pixelFormat != GL_RGBA ) ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Can't convert \"" << image->getFileName() <<
+            "\". Image must be 8-bit luminance, luminance alpha, RGB, or RGBA." << std::endl;
+        return( NULL );
+    }
+
+    // Copy level 0 from the source image, which might not be tightly
+    // packed, and build the mipmap chain.
+    const unsigned int width( image->s() ), height( image->t() );
+    const unsigned int numLevels( computeNumLevels( width, height ) );
+    osg::ref_ptr< osg::Image > mipmapped( allocateImage( width, height, pixelFormat, numLevels ) );
+    UTIL_MEMORY_CHECK( mipmapped.get(), "AssetLoader mipmapped Image", NULL );
+    const unsigned int rowSize( width * osg::Image::computeNumComponents( pixelFormat ) );
+    unsigned int row;
+    for( row=0; row<height; row++ )
+        memcpy( mipmapped->data() + row * rowSize, image->data( 0, row ), rowSize );
+    buildMipmaps( mipmapped.get() );
+    mipmapped->setFileName( image->getFileName() );
+
+    if( !compress )
+        return( mipmapped.release() );
+
+    const bool alpha( ( pixelFormat == GL_LUMINANCE_ALPHA ) || ( pixelFormat == GL_RGBA ) );
+    const GLenum compressedFormat( alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT );
+    osg::Image* compressed( allocateImage( width, height, compressedFormat, numLevels ) );
+    UTIL_MEMORY_CHECK( compressed, "AssetLoader compressed Image", NULL );
+    compressed->setFileName( image->getFileName() );
+
+    const unsigned int components( osg::Image::computeNumComponents( pixelFormat ) );
+    unsigned int w( width ), h( height ), level;
+    for( level=0; level<numLevels; level++ )
+    {
+        compressLevel( mipmapped->getMipmapData( level ), w, h, components, alpha,
+            compressed->getMipmapData( level ) );
+        w = osg::maximum< unsigned int >( w >> 1, 1 );
+        h = osg::maximum< unsigned int >( h >> 1, 1 );
+    }
+    return( compressed );
+}
+
+osg::Image* AssetLoader::createNormalMap( const osg::Image* image, float scale )
+{
+    if( image->getDataType() != GL_UNSIGNED_BYTE )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Can't create normal map from \"" <<
+            image->getFileName() << "\". Image must be 8-bit." << std::endl;
+        return( NULL );
+    }
+
+    const unsigned int width( image->s() ), height( image->t() );
+    osg::Image* normalMap( allocateImage( width, height, GL_RGB, computeNumLevels( width, height ) ) );
+    UTIL_MEMORY_CHECK( normalMap, "AssetLoader normal map Image", NULL );
+    unsigned char* dst( normalMap->data() );
+
+    unsigned int x, y;
+    for( y=0; y<height; y++ )
+    {
+        const unsigned int yDown( ( y > 0 ) ? y - 1 : 0 );
+        const unsigned int yUp( osg::minimum( y + 1, height - 1 ) );
+        for( x=0; x<width; x++ )
+        {
+            const unsigned int xLeft( ( x + width - 1 ) % width );
+            const unsigned int xRight( ( x + 1 ) % width );
+            const float ds( ( *( image->data( xRight, y ) ) - *( image->data( xLeft, y ) ) ) / 510.f );
+            const float dt( ( *( image->data( x, yUp ) ) - *( image->data( x, yDown ) ) ) / 510.f );
+
+            osg::Vec3 n( -ds * scale, -dt * scale, 1.f );
+            n.normalize();
+            unsigned char* texel( dst + ( y * width + x ) * 3 );
+            texel[ 0 ] = (unsigned char)( ( n[ 0 ] * .5f + .5f ) * 255.f + .5f );
+            texel[ 1 ] = (unsigned char)( ( n[ 1 ] * .5f + .5f ) * 255.f + .5f );
+            texel[ 2 ] = (unsigned char)( ( n[ 2 ] * .5f + .5f ) * 255.f + .5f );
+        }
+    }
+    buildMipmaps( normalMap );
+    normalMap->setFileName( image->getFileName() );
+    return( normalMap );
+}
+
+
+bool AssetLoader::writeContainer( const osg::Image* image, const std::string& fileName )
+{
+    std::ofstream ostr( fileName.c_str(), std::ios_base::out | std::ios_base::binary );
+    if( !ostr.good() || !( writeContainer( image, ostr ) ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Can't write \"" << fileName << "\"." << std::endl;
+        return( false );
+    }
+    return( true );
+}
+bool AssetLoader::writeContainer( const osg::Image* image, std::ostream& ostr )
+{
+    const GLenum pixelFormat( image->getPixelFormat() );
+    if( ( image->getDataType() != GL_UNSIGNED_BYTE ) || ( image->getPacking() != 1 ) ||
+        ( ( getBlockSize( pixelFormat ) == 0 ) && ( osg::Image::computeNumComponents( pixelFormat ) == 0 ) ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Can't store \"" << image->getFileName() <<
+            "\" in a container. Use convertImage() first." << std::endl;
+        return( false );
+    }
+
+    ContainerHeader header;
+    memcpy( header._magic, ContainerMagic, sizeof( ContainerMagic ) );
+    header._version = ContainerVersion;
+    header._width = image->s();
+    header._height = image->t();
+    header._pixelFormat = pixelFormat;
+    header._internalFormat = image->getInternalTextureFormat();
+    header._numLevels = image->getNumMipmapLevels();
+    ostr.write( (const char*)&header, sizeof( header ) );
+    ostr.write( (const char*)( image->data() ), getTotalSize( image ) );
+    return( ostr.good() );
+}
+
+osg::Image* AssetLoader::readContainer( const std::string& fileName )
+{
+    std::ifstream istr( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if( !istr.good() )
+        return( NULL );
+    osg::Image* image( readContainer( istr ) );
+    if( image == NULL )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: \"" << fileName << "\" isn't a valid container." << std::endl;
+        return( NULL );
+    }
+    image->setFileName( fileName );
+    return( image );
+}
+osg::Image* AssetLoader::readContainer( std::istream& istr )
+{
+    ContainerHeader header;
+    istr.read( (char*)&header, sizeof( header ) );
+    if( !istr.good() || ( memcmp( header._magic, ContainerMagic, sizeof( ContainerMagic ) ) != 0 ) ||
+        ( header._version != ContainerVersion ) )
+        return( NULL );
+
+    // Validate the header before allocating anything from it.
+    if( ( header._width == 0 ) || ( header._width > MaxContainerSize ) ||
+        ( header._height == 0 ) || ( header._height > MaxContainerSize ) ||
+        !isContainerFormat( header._pixelFormat ) || ( header._numLevels == 0 ) ||
+        ( header._numLevels > computeMaxLevels( header._width, header._height ) ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Invalid container header: " <<
+            header._width << "x" << header._height << ", format " << std::hex << header._pixelFormat <<
+            std::dec << ", " << header._numLevels << " levels." << std::endl;
+        return( NULL );
+    }
+    osg::Image::MipmapDataType offsets;
+    const unsigned int size( computeLayout( header._width, header._height,
+        header._pixelFormat, header._numLevels, offsets ) );
+
+    // The data must fit in the rest of the stream, if it's seekable.
+    const std::streampos dataStart( istr.tellg() );
+    if( dataStart != std::streampos( -1 ) )
+    {
+        istr.seekg( 0, std::ios_base::end );
+        const std::streampos end( istr.tellg() );
+        istr.seekg( dataStart );
+        if( !istr.good() || ( end - dataStart < (std::streamoff)size ) )
+        {
+            osg::notify( osg::WARN ) << "backdropFX: AssetLoader: Container is truncated: " <<
+                size << " bytes of image data expected." << std::endl;
+            return( NULL );
+        }
+    }
+
+    osg::ref_ptr< osg::Image > image( allocateImage( header._width, header._height,
+        header._pixelFormat, header._numLevels ) );
+    UTIL_MEMORY_CHECK( image.get(), "AssetLoader container Image", NULL );
+    image->setInternalTextureFormat( header._internalFormat );
+    istr.read( (char*)( image->data() ), size );
+    if( istr.fail() )
+        return( NULL );
+    return( image.release() );
+}
+
+
+// namespace backdropFX
+}
@@ -0,0 +1,411 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/AtmosphereLUT.h>
+#include <OpenThreads/Thread>
+#include <osg/Timer>
+#include <osg/Math>
+#include <osg/Notify>
+
+#include <backdropFX/Utils.h>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cmath>
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+// Atmosphere model, in kilometers. Change CacheVersion when changing
+// any of these, so that old cache files are recomputed.
+static const double Rg( 6360. );      // Ground radius
+static const double Rt( 6420. );      // Top of atmosphere radius
+static const double HR( 8. );         // Rayleigh scale height
+static const double HM( 1.2 );        // Mie scale height
+static const osg::Vec3d betaR( 5.8e-3, 1.35e-2, 3.31e-2 );
+static const double betaMSca( 4e-3 );
+static const double betaMEx( betaMSca / .9 );
+static const double viewerRadius( Rg + .01 );
+
+static const char CacheMagic[ 8 ] = { 'B', 'D', 'F', 'X', 'A', 'T', 'M', 0 };
+static const unsigned int CacheVersion( 1 );
+
+
+// Computes the rows of one table, interleaved with the other threads.
+class AtmosphereLUTThread : public OpenThreads::Thread
+{
+public:
+    AtmosphereLUTThread( AtmosphereLUT* lut, bool transmittance,
+            unsigned int first, unsigned int stride, unsigned int numRows )
+      : _lut( lut ),
+        _transmittance( transmittance ),
+        _first( first ),
+        _stride( stride ),
+        _numRows( numRows )
+    {}
+
+    virtual void run()
+    {
+        unsigned int row;
+        for( row=_first; row<_numRows; row+=_stride )
+        {
+            if( _transmittance )
+                _lut->computeTransmittanceRow( row );
+            else
+                _lut->computeInscatterRow( row );
+        }
+    }
+
+protected:
+    AtmosphereLUT* _lut;
+    bool _transmittance;
+    unsigned int _first, _stride, _numRows;
+};
+
+// Distance from radius r along zenith cosine mu to the top of the
+// atmosphere, or to the ground if the ray hits it.
+static double rayLength( double r, double mu )
+{
+    double dist( -r * mu + sqrt( osg::maximum( r * r * ( mu * mu - 1. ) + Rt * Rt, 0. ) ) );
+    const double delta2( r * r * ( mu * mu - 1. ) + Rg * Rg );
+    if( delta2 >= 0. )
+    {
+        const double din( -r * mu - sqrt( delta2 ) );
+        if( din >= 0. )
+            dist = osg::minimum( dist, din );
+    }
+    return( dist );
+}
+static bool hitsGround( double r, double mu )
+{
+    return( mu < -sqrt( osg::maximum( 1. - ( Rg / r ) * ( Rg / r ), 0. ) ) );
+}
+
+// Optical depth of a layer with scale height H along a ray.
+static double opticalDepth( double H, double r, double mu )
+{
+    if( hitsGround( r, mu ) )
+        return( 1e9 );
+
+    const unsigned int steps( 500 );
+    const double dx( rayLength( r, mu ) / steps );
+    double prev( exp( -( r - Rg ) / H ) );
+    double result( 0. );
+    unsigned int idx;
+    for( idx=1; idx<=steps; idx++ )
+    {
+        const double x( dx * idx );
+        const double ri( sqrt( r * r + x * x + 2. * x * r * mu ) );
+        const double cur( exp( -( ri - Rg ) / H ) );
+        result += ( prev + cur ) * .5 * dx;
+        prev = cur;
+    }
+    return( result );
+}
+
+static osg::Vec3d extinction( double depthR, double depthM )
+{
+    return( osg::Vec3d(
+        exp( -( betaR[ 0 ] * depthR + betaMEx * depthM ) ),
+        exp( -( betaR[ 1 ] * depthR + betaMEx * depthM ) ),
+        exp( -( betaR[ 2 ] * depthR + betaMEx * depthM ) ) ) );
+}
+
+// Table parameterizations, from [0,1] texture coordinates.
+// These must match the sky shader, skydomeScattering.fs.
+static double transmittanceR( double v )
+{
+    return( Rg + v * v * ( Rt - Rg ) );
+}
+static double transmittanceMu( double u )
+{
+    return( -.15 + tan( 1.5 * u ) / tan( 1.5 ) * 1.15 );
+}
+static double inscatterMu( double u )
+{
+    // Concentrate resolution at the horizon.
+    const double s( 2. * u - 1. );
+    return( ( s < 0. ) ? -s * s : s * s );
+}
+static double inscatterMuS( double u )
+{
+    return( -( log( 1. - u * ( 1. - exp( -3.6 ) ) ) + .6 ) / 3. );
+}
+/** \endcond */
+
+
+
+const unsigned int AtmosphereLUT::TransmittanceWidth( 256 );
+const unsigned int AtmosphereLUT::TransmittanceHeight( 64 );
+const unsigned int AtmosphereLUT::InscatterMuSize( 64 );
+const unsigned int AtmosphereLUT::InscatterMuSSize( 32 );
+const unsigned int AtmosphereLUT::InscatterNuSize( 16 );
+
+
+AtmosphereLUT::AtmosphereLUT()
+  : _numThreads( 0 )
+{
+}
+AtmosphereLUT::~AtmosphereLUT()
+{
+}
+
+
+bool AtmosphereLUT::init()
+{
+    if( valid() )
+        return( true );
+
+    createImages();
+    if( !( _transmittance.valid() ) || !( _inscatter.valid() ) )
+        return( false );
+
+    if( !( readCache() ) )
+    {
+        osg::Timer timer;
+        timer.setStartTick();
+
+        // Inscatter integration uses the transmittance table.
+        computeRows( true, TransmittanceHeight );
+        computeRows( false, InscatterNuSize * InscatterMuSSize );
+
+        osg::notify( osg::INFO ) << "backdropFX: AtmosphereLUT: Computed tables in " <<
+            timer.time_m() << " ms." << std::endl;
+        writeCache();
+    }
+
+    createTextures();
+    return( valid() );
+}
+
+osg::Vec3d AtmosphereLUT::lookupTransmittance( double r, double mu ) const
+{
+    if( hitsGround( r, mu ) )
+        return( osg::Vec3d( 0., 0., 0. ) );
+
+    // Invert the parameterization, then bilinearly interpolate.
+    const double u( atan( ( mu + .15 ) / 1.15 * tan( 1.5 ) ) / 1.5 );
+    const double v( sqrt( osg::clampBetween( ( r - Rg ) / ( Rt - Rg ), 0., 1. ) ) );
+    const double fx( osg::clampBetween( u, 0., 1. ) * ( TransmittanceWidth - 1 ) );
+    const double fy( v * ( TransmittanceHeight - 1 ) );
+    const unsigned int x0( osg::minimum< unsigned int >( (unsigned int)fx, TransmittanceWidth - 2 ) );
+    const unsigned int y0( osg::minimum< unsigned int >( (unsigned int)fy, TransmittanceHeight - 2 ) );
+    const double tx( fx - x0 ), ty( fy - y0 );
+
+    const float* row0( (const float*)( _transmittance->data( 0, y0 ) ) );
+    const float* row1( (const float*)( _transmittance->data( 0, y0 + 1 ) ) );
+    osg::Vec3d result;
+    unsigned int c;
+    for( c=0; c<3; c++ )
+    {
+        const double a( row0[ x0 * 3 + c ] * ( 1. - tx ) + row0[ ( x0 + 1 ) * 3 + c ] * tx );
+        const double b( row1[ x0 * 3 + c ] * ( 1. - tx ) + row1[ ( x0 + 1 ) * 3 + c ] * tx );
+        result[ c ] = a * ( 1. - ty ) + b * ty;
+    }
+    return( result );
+}
+
+
+void AtmosphereLUT::computeTransmittanceRow( unsigned int row )
+{
+    const double r( transmittanceR( (double)row / ( TransmittanceHeight - 1 ) ) );
+    float* dest( (float*)( _transmittance->data( 0, row ) ) );
+    unsigned int idx;
+    for( idx=0; idx<TransmittanceWidth; idx++ )
+    {
+        const double mu( transmittanceMu( (double)idx / ( TransmittanceWidth - 1 ) ) );
+        const osg::Vec3d t( extinction( opticalDepth( HR, r, mu ), opticalDepth( HM, r, mu ) ) );
+        *dest++ = (float)( t[ 0 ] );
+        *dest++ = (float)( t[ 1 ] );
+        *dest++ = (float)( t[ 2 ] );
+    }
+}
+
+void AtmosphereLUT::computeInscatterRow( unsigned int row )
+{
+    // One row is all view zenith angles for one Sun zenith angle
+    // and one view-Sun angle.
+    const unsigned int muSIdx( row % InscatterMuSSize );
+    const unsigned int nuIdx( row / InscatterMuSSize );
+    const double muS( inscatterMuS( (double)muSIdx / ( InscatterMuSSize - 1 ) ) );
+    const double nu( 2. * nuIdx / ( InscatterNuSize - 1 ) - 1. );
+    const double sinS( sqrt( osg::maximum( 1. - muS * muS, 0. ) ) );
+
+    float* dest( (float*)( _inscatter->data( 0, muSIdx, nuIdx ) ) );
+    unsigned int idx;
+    for( idx=0; idx<InscatterMuSize; idx++ )
+    {
+        // The viewer is on the z axis, looking in the xz plane.
+        const double mu( inscatterMu( (double)idx / ( InscatterMuSize - 1 ) ) );
+        const double sinV( sqrt( osg::maximum( 1. - mu * mu, 0. ) ) );
+        const osg::Vec3d x0( 0., 0., viewerRadius );
+        const osg::Vec3d v( sinV, 0., mu );
+
+        // Sun direction with zenith cosine muS and view cosine nu (as
+        // close as possible, for combinations that can't occur).
+        double sx( ( sinV > 1e-6 ) ? ( nu - mu * muS ) / sinV : 0. );
+        sx = osg::clampBetween( sx, -sinS, sinS );
+        const osg::Vec3d s( sx, sqrt( osg::maximum( sinS * sinS - sx * sx, 0. ) ), muS );
+
+        // Trapezoid integration along the view ray. The view ray optical
+        // depth accumulates as we step; the Sun's transmittance to each
+        // sample point comes from the table.
+        const unsigned int steps( 50 );
+        const double dx( rayLength( viewerRadius, mu ) / steps );
+        double depthR( 0. ), depthM( 0. );
+        double prevHR( 0. ), prevHM( 0. );
+        osg::Vec3d prevRay, prevMie, rayleigh, mie;
+        unsigned int step;
+        for( step=0; step<=steps; step++ )
+        {
+            const osg::Vec3d p( x0 + v * ( dx * step ) );
+            const double ri( p.length() );
+            const double hR( exp( -( ri - Rg ) / HR ) );
+            const double hM( exp( -( ri - Rg ) / HM ) );
+            if( step > 0 )
+            {
+                depthR += ( prevHR + hR ) * .5 * dx;
+                depthM += ( prevHM + hM ) * .5 * dx;
+            }
+
+            const osg::Vec3d tView( extinction( depthR, depthM ) );
+            const osg::Vec3d tSun( lookupTransmittance( ri, ( p * s ) / ri ) );
+            const osg::Vec3d t( tView[ 0 ] * tSun[ 0 ], tView[ 1 ] * tSun[ 1 ], tView[ 2 ] * tSun[ 2 ] );
+            const osg::Vec3d curRay( t * hR );
+            const osg::Vec3d curMie( t * hM );
+            if( step > 0 )
+            {
+                rayleigh += ( prevRay + curRay ) * ( .5 * dx );
+                mie += ( prevMie + curMie ) * ( .5 * dx );
+            }
+            prevHR = hR;
+            prevHM = hM;
+            prevRay = curRay;
+            prevMie = curMie;
+        }
+
+        *dest++ = (float)( rayleigh[ 0 ] * betaR[ 0 ] );
+        *dest++ = (float)( rayleigh[ 1 ] * betaR[ 1 ] );
+        *dest++ = (float)( rayleigh[ 2 ] * betaR[ 2 ] );
+        *dest++ = (float)( mie[ 0 ] * betaMSca );
+    }
+}
+
+void AtmosphereLUT::computeRows( bool transmittance, unsigned int numRows )
+{
+    unsigned int numThreads( _numThreads );
+    if( numThreads == 0 )
+        numThreads = osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+    numThreads = osg::minimum( numThreads, numRows );
+
+    std::vector< AtmosphereLUTThread* > threads;
+    unsigned int idx;
+    for( idx=0; idx<numThreads; idx++ )
+    {
+        AtmosphereLUTThread* thread( new AtmosphereLUTThread(
+            this, transmittance, idx, numThreads, numRows ) );
+        UTIL_MEMORY_CHECK( thread, "AtmosphereLUT thread", );
+        thread->start();
+        threads.push_back( thread );
+    }
+    for( idx=0; idx<threads.size(); idx++ )
+    {
+        threads[ idx ]->join();
+        delete threads[ idx ];
+    }
+}
+
+
+void AtmosphereLUT::createImages()
+{
+    _transmittance = new osg::Image;
+    UTIL_MEMORY_CHECK( _transmittance.get(), "AtmosphereLUT transmittance Image", );
+    _transmittance->allocateImage( TransmittanceWidth, TransmittanceHeight, 1, GL_RGB, GL_FLOAT );
+    _transmittance->setInternalTextureFormat( GL_RGB16F_ARB );
+
+    _inscatter = new osg::Image;
+    UTIL_MEMORY_CHECK( _inscatter.get(), "AtmosphereLUT inscatter Image", );
+    _inscatter->allocateImage( InscatterMuSize, InscatterMuSSize, InscatterNuSize, GL_RGBA, GL_FLOAT );
+    _inscatter->setInternalTextureFormat( GL_RGBA16F_ARB );
+}
+
+void AtmosphereLUT::createTextures()
+{
+    _transmittanceTex = new osg::Texture2D( _transmittance.get() );
+    UTIL_MEMORY_CHECK( _transmittanceTex.get(), "AtmosphereLUT transmittance Texture2D", );
+    _transmittanceTex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    _transmittanceTex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    _transmittanceTex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _transmittanceTex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+
+    _inscatterTex = new osg::Texture3D( _inscatter.get() );
+    UTIL_MEMORY_CHECK( _inscatterTex.get(), "AtmosphereLUT inscatter Texture3D", );
+    _inscatterTex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    _inscatterTex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    _inscatterTex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _inscatterTex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    _inscatterTex->setWrap( osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE );
+}
+
+bool AtmosphereLUT::readCache()
+{
+    if( _cacheFileName.empty() )
+        return( false );
+    std::ifstream istr( _cacheFileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if( !istr.good() )
+        return( false );
+
+    char magic[ 8 ];
+    unsigned int header[ 6 ];
+    istr.read( magic, sizeof( magic ) );
+    istr.read( (char*)header, sizeof( header ) );
+    if( !istr.good() || ( memcmp( magic, CacheMagic, sizeof( magic ) ) != 0 ) ||
+        ( header[ 0 ] != CacheVersion ) ||
+        ( header[ 1 ] != TransmittanceWidth ) || ( header[ 2 ] != TransmittanceHeight ) ||
+        ( header[ 3 ] != InscatterMuSize ) || ( header[ 4 ] != InscatterMuSSize ) ||
+        ( header[ 5 ] != InscatterNuSize ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AtmosphereLUT: Ignoring incompatible cache file \"" <<
+            _cacheFileName << "\"." << std::endl;
+        return( false );
+    }
+
+    istr.read( (char*)( _transmittance->data() ), _transmittance->getTotalSizeInBytes() );
+    istr.read( (char*)( _inscatter->data() ), _inscatter->getTotalSizeInBytes() );
+    if( istr.fail() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AtmosphereLUT: Can't read cache file \"" <<
+            _cacheFileName << "\"." << std::endl;
+        return( false );
+    }
+    osg::notify( osg::INFO ) << "backdropFX: AtmosphereLUT: Read cache file \"" <<
+        _cacheFileName << "\"." << std::endl;
+    return( true );
+}
+
+void AtmosphereLUT::writeCache() const
+{
+    if( _cacheFileName.empty() )
+        return;
+    std::ofstream ostr( _cacheFileName.c_str(), std::ios_base::out | std::ios_base::binary );
+    if( !ostr.good() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: AtmosphereLUT: Can't write cache file \"" <<
+            _cacheFileName << "\"." << std::endl;
+        return;
+    }
+
+    const unsigned int header[ 6 ] = { CacheVersion,
+        TransmittanceWidth, TransmittanceHeight,
+        InscatterMuSize, InscatterMuSSize, InscatterNuSize };
+    ostr.write( CacheMagic, sizeof( CacheMagic ) );
+    ostr.write( (const char*)header, sizeof( header ) );
+    ostr.write( (const char*)( _transmittance->data() ), _transmittance->getTotalSizeInBytes() );
+    ostr.write( (const char*)( _inscatter->data() ), _inscatter->getTotalSizeInBytes() );
+}
+
+
+// namespace backdropFX
+}
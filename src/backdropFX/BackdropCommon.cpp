@@ -110,12 +110,8 @@ BackdropCommon::performClear( osg::RenderInfo& renderInfo )
         osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
 
         state.applyMode( GL_DEPTH_TEST, true );
-        state.applyAttribute( _program.get() );
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( _textureUniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( _textureUniform->getName() );
-#endif
+        _uniformLocations.applyProgram( state, _program.get() );
+        const GLint location( _uniformLocations.getLocation( state, 0, _textureUniform.get() ) );
         if( location >= 0 )
             _textureUniform->apply( gl2Ext, location );
         else
@@ -0,0 +1,417 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/CloudStage.h>
+#include <osgUtil/RenderStage>
+#include <osgUtil/StateGraph>
+#include <osg/GLExtensions>
+#include <osg/FrameBufferObject>
+#include <osg/Drawable>
+#include <osg/FrameStamp>
+#include <osgwTools/FBOUtils.h>
+#include <osg/buffered_value>
+#include <OpenThreads/ScopedLock>
+
+#include <backdropFX/Utils.h>
+
+
+#ifndef GL_TIME_ELAPSED_EXT
+#  define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#  define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#  define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+
+
+namespace backdropFX
+{
+
+
+CloudStats::CloudStats()
+  : _lastValid( false ),
+    _lastFrameNumber( 0 ),
+    _lastPixels( 0 ),
+    _lastGPUTime( -1. )
+{
+}
+CloudStats::~CloudStats()
+{
+}
+
+void
+CloudStats::recordDraw( unsigned int frameNumber, unsigned int pixels, bool timed )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+
+    std::deque< Frame >::iterator it;
+    for( it=_frames.begin(); it!=_frames.end(); it++ )
+    {
+        if( it->_frameNumber == frameNumber )
+            break;
+    }
+    if( it == _frames.end() )
+    {
+        // Draws for frames already completed or dropped are ignored.
+        if( ( _lastValid && ( frameNumber <= _lastFrameNumber ) ) ||
+            ( !( _frames.empty() ) && ( frameNumber < _frames.back()._frameNumber ) ) )
+            return;
+        Frame frame;
+        frame._frameNumber = frameNumber;
+        frame._pixels = 0;
+        frame._pendingTimes = 0;
+        frame._gpuTime = 0.;
+        frame._untimed = false;
+        _frames.push_back( frame );
+        it = _frames.end() - 1;
+    }
+
+    // Another view in the same frame adds to it.
+    it->_pixels += pixels;
+    if( timed )
+        it->_pendingTimes++;
+    else
+        it->_untimed = true;
+    complete();
+}
+
+void
+CloudStats::recordTime( unsigned int frameNumber, double gpuTime )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+
+    std::deque< Frame >::iterator it;
+    for( it=_frames.begin(); it!=_frames.end(); it++ )
+    {
+        if( ( it->_frameNumber == frameNumber ) && ( it->_pendingTimes > 0 ) )
+        {
+            it->_gpuTime += gpuTime;
+            it->_pendingTimes--;
+            complete();
+            return;
+        }
+    }
+    // Results for frames already dropped are ignored.
+}
+
+void
+CloudStats::complete()
+{
+    // The newest frame might still get draws from other views.
+    while( _frames.size() > 1 )
+    {
+        const Frame& frame( _frames.front() );
+        if( frame._pendingTimes > 0 )
+        {
+            if( _frames.size() <= MaxFrames )
+                break;
+            // Results that never arrive mustn't stall the statistics.
+            _frames.pop_front();
+            continue;
+        }
+        _lastValid = true;
+        _lastFrameNumber = frame._frameNumber;
+        _lastPixels = frame._pixels;
+        _lastGPUTime = frame._untimed ? -1. : frame._gpuTime;
+        _frames.pop_front();
+    }
+}
+
+bool
+CloudStats::get( unsigned int& frameNumber, unsigned int& pixels, double& gpuTime ) const
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    if( !_lastValid )
+        return( false );
+    frameNumber = _lastFrameNumber;
+    pixels = _lastPixels;
+    gpuTime = _lastGPUTime;
+    return( true );
+}
+
+
+
+CloudStage::CloudStage()
+  : osgUtil::RenderStage(),
+    _width( 0 ),
+    _height( 0 ),
+    _queryContextID( 0 )
+{
+    internalInit();
+}
+CloudStage::CloudStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop )
+  : osgUtil::RenderStage( rhs ),
+    _width( 0 ),
+    _height( 0 ),
+    _queryContextID( 0 )
+{
+    internalInit();
+}
+CloudStage::CloudStage( const CloudStage& rhs, const osg::CopyOp& copyop )
+  : osgUtil::RenderStage( rhs ),
+    _width( 0 ),
+    _height( 0 ),
+    _stats( rhs._stats ),
+    _queryContextID( 0 )
+{
+    internalInit();
+    setSize( rhs._width, rhs._height );
+}
+
+CloudStage::~CloudStage()
+{
+    orphanQueries();
+}
+
+
+void
+CloudStage::internalInit()
+{
+    _cloudViewport = new osg::Viewport;
+    UTIL_MEMORY_CHECK( _cloudViewport.get(), "CloudStage::internalInit Viewport", )
+
+    _compositeStateSet = new osg::StateSet;
+    UTIL_MEMORY_CHECK( _compositeStateSet.get(), "CloudStage::internalInit StateSet", )
+    // The texture changes if the size changes.
+    _compositeStateSet->setDataVariance( osg::Object::DYNAMIC );
+
+    osg::ref_ptr< osg::Uniform > mapUniform( new osg::Uniform( "bdfx_cloudMap", 0 ) );
+    UTIL_MEMORY_CHECK( mapUniform.get(), "CloudStage::internalInit map uniform", )
+    _compositeStateSet->addUniform( mapUniform.get() );
+
+    _mapSize = new osg::Uniform( "bdfx_cloudMapSize", osg::Vec4( 1., 1., 1., 1. ) );
+    UTIL_MEMORY_CHECK( _mapSize.get(), "CloudStage::internalInit map size uniform", )
+    _mapSize->setDataVariance( osg::Object::DYNAMIC );
+    _compositeStateSet->addUniform( _mapSize.get() );
+}
+
+
+void
+CloudStage::setSize( unsigned int width, unsigned int height )
+{
+    if( ( width == 0 ) || ( height == 0 ) ||
+        ( ( width == _width ) && ( height == _height ) ) )
+        return;
+    _width = width;
+    _height = height;
+
+    // The composite pass reads texel centers, so no filtering.
+    _texture = new osg::Texture2D;
+    UTIL_MEMORY_CHECK( _texture.get(), "CloudStage texture", );
+    _texture->setName( "CloudStage" );
+    _texture->setInternalFormat( GL_RGBA );
+    _texture->setSourceFormat( GL_RGBA );
+    _texture->setSourceType( GL_UNSIGNED_BYTE );
+    _texture->setTextureSize( width, height );
+    _texture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    _texture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _texture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+
+    _fbo = new osg::FrameBufferObject;
+    UTIL_MEMORY_CHECK( _fbo.get(), "CloudStage FBO", );
+    _fbo->setAttachment( osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment( _texture.get() ) );
+
+    _cloudViewport->setViewport( 0, 0, width, height );
+    _compositeStateSet->setTextureAttributeAndModes( 0, _texture.get(), osg::StateAttribute::ON );
+    _mapSize->set( osg::Vec4( width, height, 1.f / width, 1.f / height ) );
+}
+
+osg::StateSet*
+CloudStage::getCompositeStateSet()
+{
+    return( _compositeStateSet.get() );
+}
+
+void
+CloudStage::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    if( _texture.valid() )
+        _texture->resizeGLObjectBuffers( maxSize );
+    if( _fbo.valid() )
+        _fbo->resizeGLObjectBuffers( maxSize );
+    osgUtil::RenderStage::resizeGLObjectBuffers( maxSize );
+}
+void
+CloudStage::releaseGLObjects( osg::State* state ) const
+{
+    if( _texture.valid() )
+        _texture->releaseGLObjects( state );
+    if( _fbo.valid() )
+        _fbo->releaseGLObjects( state );
+
+    // The queries are deleted at the next draw in their context, which
+    // might not be current now. draw() creates new ones as needed.
+    if( ( state == NULL ) || ( state->getContextID() == _queryContextID ) )
+        const_cast< CloudStage* >( this )->orphanQueries();
+
+    osgUtil::RenderStage::releaseGLObjects( state );
+}
+
+
+/** \cond */
+// Timer queries kept in flight per stage. If all are still pending,
+// draw() renders without timing.
+static const unsigned int MaxPendingQueries( 4 );
+
+// Query objects released or left by destroyed stages, per context.
+static OpenThreads::Mutex s_orphanedQueriesMutex;
+static osg::buffered_object< std::vector< GLuint > > s_orphanedQueries;
+/** \endcond */
+
+void
+CloudStage::orphanQueries()
+{
+    if( _pendingQueries.empty() && _freeQueries.empty() )
+        return;
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( s_orphanedQueriesMutex );
+    std::vector< GLuint >& orphans( s_orphanedQueries[ _queryContextID ] );
+    std::deque< Query >::const_iterator it;
+    for( it=_pendingQueries.begin(); it!=_pendingQueries.end(); it++ )
+        orphans.push_back( it->_id );
+    orphans.insert( orphans.end(), _freeQueries.begin(), _freeQueries.end() );
+    _pendingQueries.clear();
+    _freeQueries.clear();
+}
+
+void
+CloudStage::deleteOrphanedQueries( osg::State& state )
+{
+    const unsigned int contextID( state.getContextID() );
+    std::vector< GLuint > orphans;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( s_orphanedQueriesMutex );
+        orphans.swap( s_orphanedQueries[ contextID ] );
+    }
+    if( orphans.empty() )
+        return;
+    osg::Drawable::Extensions* ext( osg::Drawable::getExtensions( contextID, true ) );
+    ext->glDeleteQueries( orphans.size(), &( orphans[ 0 ] ) );
+}
+
+void
+CloudStage::collectQueries( osg::State& state )
+{
+    osg::Drawable::Extensions* ext( osg::Drawable::getExtensions( state.getContextID(), true ) );
+    while( !( _pendingQueries.empty() ) )
+    {
+        const Query& query( _pendingQueries.front() );
+        GLint available( 0 );
+        ext->glGetQueryObjectiv( query._id, GL_QUERY_RESULT_AVAILABLE, &available );
+        if( !available )
+            break;
+
+        GLuint64EXT elapsed( 0 );
+        ext->glGetQueryObjectui64v( query._id, GL_QUERY_RESULT, &elapsed );
+        if( _stats.valid() )
+            _stats->recordTime( query._frameNumber, elapsed * 1e-6 );
+
+        _freeQueries.push_back( query._id );
+        _pendingQueries.pop_front();
+    }
+}
+
+void
+CloudStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous )
+{
+    if( _stageDrawnThisFrame )
+        return;
+    _stageDrawnThisFrame = true;
+
+    if( !( _fbo.valid() ) )
+        return;
+
+    osg::notify( osg::DEBUG_INFO ) << "backdropFX: CloudStage::draw" << std::endl;
+
+    osg::State& state( *renderInfo.getState() );
+    const unsigned int contextID( state.getContextID() );
+    osg::FBOExtensions* fboExt( osg::FBOExtensions::instance( contextID, true ) );
+    if( fboExt == NULL )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: CS: FBOExtensions == NULL." << std::endl;
+        return;
+    }
+
+    // See SkyDomeStage::draw(), redmine 434.
+    if( _camera )
+        renderInfo.pushCamera( _camera );
+
+    // Time the cloud pass if we can, without waiting on earlier queries.
+    const unsigned int frameNumber( ( state.getFrameStamp() != NULL ) ?
+        state.getFrameStamp()->getFrameNumber() : 0 );
+    const unsigned int pixels( _width * _height );
+    osg::Drawable::Extensions* ext( osg::Drawable::getExtensions( contextID, true ) );
+    const bool timing( _stats.valid() && ( ext != NULL ) && ext->isTimerQuerySupported() );
+    GLuint queryID( 0 );
+    if( timing )
+    {
+        deleteOrphanedQueries( state );
+        // A stage draws in one context.
+        _queryContextID = contextID;
+        collectQueries( state );
+        if( _freeQueries.empty() && ( _pendingQueries.size() < MaxPendingQueries ) )
+        {
+            GLuint id;
+            ext->glGenQueries( 1, &id );
+            _freeQueries.push_back( id );
+        }
+        if( !( _freeQueries.empty() ) )
+        {
+            queryID = _freeQueries.back();
+            _freeQueries.pop_back();
+            ext->glBeginQuery( GL_TIME_ELAPSED_EXT, queryID );
+        }
+    }
+    // Record the pixels now, so that the statistics advance even when
+    // this frame isn't timed.
+    if( _stats.valid() )
+        _stats->recordDraw( frameNumber, pixels, queryID != 0 );
+
+    _fbo->apply( state );
+    state.applyAttribute( _cloudViewport.get() );
+
+    glClearColor( 0.f, 0.f, 0.f, 0.f );
+    glClear( GL_COLOR_BUFFER_BIT );
+
+    UTIL_GL_ERROR_CHECK( "CS pre drawImplementation()" );
+    RenderBin::drawImplementation( renderInfo, previous );
+
+    // Return to the root StateGraph. The SkyDomeStage composite pass
+    // samples the texture we just rendered.
+    if( previous != NULL )
+    {
+        osgUtil::StateGraph::moveToRootStateGraph( state, previous->_parent );
+        state.apply();
+        previous = NULL;
+    }
+
+    if( queryID != 0 )
+    {
+        ext->glEndQuery( GL_TIME_ELAPSED_EXT );
+        Query query;
+        query._id = queryID;
+        query._frameNumber = frameNumber;
+        _pendingQueries.push_back( query );
+    }
+
+    if( state.getCheckForGLErrors() != osg::State::NEVER_CHECK_GL_ERRORS )
+    {
+        std::string msg( "at CS draw end" );
+        UTIL_GL_ERROR_CHECK( msg );
+        UTIL_GL_FBO_ERROR_CHECK( msg, fboExt );
+    }
+
+    // Unbind the cloud FBO. SkyDomeStage binds its own.
+    osgwTools::glBindFramebuffer( fboExt, GL_DRAW_FRAMEBUFFER_EXT, 0 );
+    osgwTools::glBindFramebuffer( fboExt, GL_READ_FRAMEBUFFER_EXT, 0 );
+
+    if( _camera )
+        renderInfo.popCamera();
+}
+
+
+// namespace backdropFX
+}
@@ -2,7 +2,9 @@
 
 #include <backdropFX/DepthPartition.h>
 #include <backdropFX/DepthPartitionStage.h>
+#include <backdropFX/RenderStageCache.h>
 #include <backdropFX/ShaderModuleUtils.h>
+#include <backdropFX/ShaderLibraryConstants.h>
 #include <backdropFX/Manager.h>
 #include <backdropFX/ShadowMap.h>
 #include <osgDB/FileUtils>
@@ -12,8 +14,11 @@
 #include <osg/Geometry>
 #include <osg/Depth>
 #include <osg/Texture2D>
+#include <osg/GLExtensions>
+#include <OpenThreads/ScopedLock>
 
 #include <backdropFX/Utils.h>
+#include <sstream>
 
 
 namespace backdropFX
@@ -21,37 +26,39 @@ namespace backdropFX
 
 
 
-// Lifted directly from CullVisitor
-class RenderStageCache : public osg::Object
+/** \cond */
+typedef RenderStageCache< DepthPartitionStage > DepthPartitionStageCache;
+
+class DepthPartitionUpdate : public osg::NodeCallback
 {
 public:
-    RenderStageCache() {}
-    RenderStageCache(const RenderStageCache&, const osg::CopyOp&) {}
-
-    META_Object(myLib,RenderStageCache);
-
-    void setRenderStage( osgUtil::CullVisitor* cv, DepthPartitionStage* rs)
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        _renderStageMap[cv] = rs;
-    }        
+    DepthPartitionUpdate() {}
 
-    DepthPartitionStage* getRenderStage( osgUtil::CullVisitor* cv )
+    void operator()( osg::Node* node, osg::NodeVisitor* nv )
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        return _renderStageMap[cv].get();
+        static_cast< backdropFX::DepthPartition* >( node )->updateSinglePassShaders();
+        traverse( node, nv );
     }
-
-    typedef std::map< osgUtil::CullVisitor*, osg::ref_ptr< DepthPartitionStage > > RenderStageMap;
-
-    OpenThreads::Mutex  _mutex;
-    RenderStageMap      _renderStageMap;
 };
+/** \endcond */
+
+#ifndef GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT
+#  define GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT 0x8DE0
+#endif
+#ifndef GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS_EXT
+#  define GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS_EXT 0x8DE1
+#endif
 
 
 DepthPartition::DepthPartition()
   : _numPartitions( 0 ),
     _ratio( 0.0005 ),
+    _singlePass( false ),
+    _partitionCulling( false ),
+    _layeredShaders( false ),
+    _singlePassUnsupported( false ),
+    _geometryOutputComponents( 0 ),
+    _shaderModulesDirty( false ),
     _proto( false )
 {
     internalInit();
@@ -61,22 +68,61 @@ DepthPartition::DepthPartition( const DepthPartition& dp, const osg::CopyOp& cop
     backdropFX::BackdropCommon( dp, copyop ),
     _numPartitions( dp._numPartitions ),
     _ratio( 0.0005 ),
+    _singlePass( dp._singlePass ),
+    _partitionCulling( dp._partitionCulling ),
+    _layeredShaders( false ),
+    _singlePassUnsupported( false ),
+    _geometryOutputComponents( dp._geometryOutputComponents ),
+    _shaderModulesDirty( false ),
     _proto( false )
 {
     internalInit();
 }
 void
 DepthPartition::internalInit()
+{
+    setPartitionShaders();
+
+    // The copy constructor shares the update callbacks of the original.
+    osg::NodeCallback* nodecb;
+    for( nodecb = getUpdateCallback(); nodecb != NULL; nodecb = nodecb->getNestedCallback() )
+        if( dynamic_cast< DepthPartitionUpdate* >( nodecb ) != NULL )
+            return;
+    addUpdateCallback( *this, new DepthPartitionUpdate() );
+}
+void
+DepthPartition::setPartitionShaders()
 {
     ShaderModuleCullCallback* smccb = getOrCreateShaderModuleCullCallback( *this );
-    UTIL_MEMORY_CHECK( smccb, "DepthPartition internalInit SMCCB", );
+    UTIL_MEMORY_CHECK( smccb, "DepthPartition setPartitionShaders SMCCB", );
+
+    // Don't install the geometry shader where it can't be used. A program
+    // containing it fails to link without GL_EXT_geometry_shader4.
+#if OSG_SUPPORTS_LAYERED_FBO
+    _layeredShaders = ( _singlePass && !_singlePassUnsupported );
+#else
+    _layeredShaders = false;
+#endif
 
     osg::ref_ptr< osg::Shader > shader;
-    std::string fileName( "shaders/gl2/bdfx-init.vs" );
+    std::string fileName( _layeredShaders ? "shaders/gl2/bdfx-init-layered.vs" : "shaders/gl2/bdfx-init.vs" );
     __LOAD_SHADER( shader, osg::Shader::VERTEX, fileName );
-    UTIL_MEMORY_CHECK( shader, "DepthPartition internalInit bdfx-init.vs", );
+    UTIL_MEMORY_CHECK( shader, "DepthPartition setPartitionShaders " + fileName, );
     smccb->setShader( getShaderSemantic( fileName ), shader.get(),
         ShaderModuleCullCallback::InheritanceOverride );
+
+    // The geometry shader routes each triangle to the texture array
+    // layers for the partitions it overlaps.
+    fileName = std::string( "shaders/gl2/bdfx-partition-layered.gs" );
+    if( _layeredShaders )
+    {
+        __LOAD_SHADER( shader, osg::Shader::GEOMETRY, fileName );
+        UTIL_MEMORY_CHECK( shader, "DepthPartition setPartitionShaders " + fileName, );
+        smccb->setShader( getShaderSemantic( fileName ), shader.get(),
+            ShaderModuleCullCallback::InheritanceOverride );
+    }
+    else
+        smccb->removeShader( getShaderSemantic( fileName ), osg::Shader::GEOMETRY );
 }
 
 DepthPartition::~DepthPartition()
@@ -108,10 +154,10 @@ DepthPartition::traverse( osg::NodeVisitor& nv )
     osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
     osg::Camera* camera = previousStage->getCamera();
 
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< DepthPartitionStageCache > rsCache = dynamic_cast< DepthPartitionStageCache* >( getRenderingCache() );
     if( !rsCache )
     {
-        rsCache = new RenderStageCache;
+        rsCache = new DepthPartitionStageCache;
         UTIL_MEMORY_CHECK( rsCache, "DepthPartition DepthPartitionStage Cache", );
         setRenderingCache( rsCache.get() );
     }
@@ -163,8 +209,13 @@ DepthPartition::traverse( osg::NodeVisitor& nv )
         // Add a per-cull uniform for the partition matrix.
         cv->pushStateSet( dpStage->getPerCullStateSet() );
 
-        // Traverse
-        osg::Group::traverse( nv );
+        // Traverse, either once per partition or once for all partitions.
+        if( !( _partitionCulling && !_singlePass && cullPartitions( cv, dpStage.get() ) ) )
+            osg::Group::traverse( nv );
+
+        // The partition geometry shader only accepts triangles.
+        if( _layeredShaders )
+            dpStage->separatePartitionPassLeaves( dpStage.get() );
 
         // Pop the per-cull uniform.
         cv->popStateSet();
@@ -181,6 +232,54 @@ DepthPartition::traverse( osg::NodeVisitor& nv )
 }
 
 
+bool
+DepthPartition::cullPartitions( osgUtil::CullVisitor* cv, DepthPartitionStage* dpStage )
+{
+    osg::Matrixd proj( *( cv->getProjectionMatrix() ) );
+    double left, right, bottom, top, zNear, zFar;
+    if( !( proj.getFrustum( left, right, bottom, top, zNear, zFar ) ) )
+        // Not a perspective projection.
+        return( false );
+
+    // The overall projection matrix doesn't have its final near and far
+    // planes until cull completes. Instead, use the eye space depth range
+    // of our bounding sphere, clamped to the camera near and far planes.
+    const osg::BoundingSphere& bs( getBound() );
+    if( !( bs.valid() ) )
+        return( false );
+    const double centerDepth( -( bs.center() * *( cv->getModelViewMatrix() ) ).z() );
+    const double boundNear( osg::maximum< double >( zNear, centerDepth - bs.radius() ) );
+    const double boundFar( osg::minimum< double >( zFar, centerDepth + bs.radius() ) );
+    if( boundFar <= boundNear )
+        // Entirely outside the view volume. Let the normal traversal cull it.
+        return( false );
+
+    const double scale( boundNear / zNear );
+    proj.makeFrustum( left * scale, right * scale, bottom * scale, top * scale, boundNear, boundFar );
+
+    DepthPartitionStage::MatrixList partitions;
+    dpStage->computePartitions( partitions, proj, false );
+    dpStage->setCullPartitions( partitions );
+
+    unsigned int idx;
+    for( idx=0; idx<partitions.size(); idx++ )
+    {
+        osgUtil::RenderBin* previousRenderBin = cv->getCurrentRenderBin();
+        cv->setCurrentRenderBin( dpStage->getPartitionBin( idx ) );
+        cv->pushStateSet( dpStage->getPartitionStateSet( idx ) );
+        cv->pushProjectionMatrix( new osg::RefMatrix( partitions[ idx ] ) );
+
+        osg::Group::traverse( *cv );
+
+        cv->popProjectionMatrix();
+        cv->popStateSet();
+        cv->setCurrentRenderBin( previousRenderBin );
+    }
+
+    return( true );
+}
+
+
 void
 DepthPartition::setNumPartitions( unsigned int numPartitions )
 {
@@ -203,12 +302,108 @@ DepthPartition::getRatio() const
     return( _ratio );
 }
 
+void
+DepthPartition::setSinglePass( bool singlePass )
+{
+    if( _singlePass == singlePass )
+        return;
+
+    _singlePass = singlePass;
+    setPartitionShaders();
+}
+bool
+DepthPartition::getSinglePass() const
+{
+    return( _singlePass );
+}
+
+bool
+DepthPartition::isSinglePassSupported( unsigned int contextID )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _supportMutex );
+    if( _singlePassUnsupported )
+        return( false );
+    int& support( _contextSupport[ contextID ] );
+    if( support != 0 )
+        return( support > 0 );
+
+    std::string reason;
+#if OSG_SUPPORTS_LAYERED_FBO
+    if( !( osg::isGLExtensionSupported( contextID, "GL_EXT_geometry_shader4" ) ) )
+        reason = "GL_EXT_geometry_shader4 not supported";
+    else if( !( osg::isGLExtensionSupported( contextID, "GL_EXT_texture_array" ) ) )
+        reason = "GL_EXT_texture_array not supported";
+    else
+    {
+        // The partition geometry shader emits each triangle once per partition.
+        const GLint vertices( 3 * BDFX_MAX_PARTITIONS );
+        GLint maxVertices( 0 ), maxComponents( 0 );
+        glGetIntegerv( GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT, &maxVertices );
+        glGetIntegerv( GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS_EXT, &maxComponents );
+        std::ostringstream ostr;
+        if( maxVertices < vertices )
+            ostr << "needs " << vertices << " geometry shader output vertices, only " <<
+                maxVertices << " available";
+        else if( maxComponents < vertices * (GLint)( _geometryOutputComponents ) )
+            ostr << "needs " << vertices * _geometryOutputComponents <<
+                " geometry shader output components, only " << maxComponents << " available";
+        reason = ostr.str();
+    }
+#else
+    reason = "requires OSG 2.9.7 or later";
+#endif
+
+    if( reason.empty() )
+    {
+        support = 1;
+        return( true );
+    }
+
+    osg::notify( osg::WARN ) << "backdropFX: DepthPartition: Single pass " <<
+        reason << ". Using multiple passes." << std::endl;
+    support = -1;
+    _singlePassUnsupported = true;
+    return( false );
+}
+
+void
+DepthPartition::updateSinglePassShaders()
+{
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _supportMutex );
+        if( !( _singlePassUnsupported && _layeredShaders ) )
+            return;
+    }
+
+    osg::notify( osg::INFO ) << "backdropFX: DepthPartition: Removing the partition geometry shader." << std::endl;
+    setPartitionShaders();
+    _shaderModulesDirty = true;
+}
+
+void
+DepthPartition::setGeometryOutputComponents( unsigned int components )
+{
+    _geometryOutputComponents = components;
+}
+
+void
+DepthPartition::setPartitionCulling( bool partitionCulling )
+{
+    _partitionCulling = partitionCulling;
+}
+bool
+DepthPartition::getPartitionCulling() const
+{
+    return( _partitionCulling );
+}
+
 
 void
 DepthPartition::resizeGLObjectBuffers( unsigned int maxSize )
 {
     if( _renderingCache.valid() )
         const_cast< DepthPartition* >( this )->_renderingCache->resizeGLObjectBuffers( maxSize );
+    _uniformLocations.resizeGLObjectBuffers( maxSize );
 
     osg::Group::resizeGLObjectBuffers(maxSize);
 }
@@ -218,6 +413,7 @@ DepthPartition::releaseGLObjects( osg::State* state ) const
 {
     if( _renderingCache.valid() )
         const_cast< DepthPartition* >( this )->_renderingCache->releaseGLObjects( state );
+    _uniformLocations.releaseGLObjects( state );
 
     osg::Group::releaseGLObjects(state);
 }
@@ -6,14 +6,21 @@
 #include <osg/GLExtensions>
 #include <osg/FrameBufferObject>
 #include <backdropFX/DepthPeelBin.h>
+#include <backdropFX/StageRenderBin.h>
+#include <backdropFX/ShaderLibraryConstants.h>
 #include <osg/StateSet>
 #include <osg/Uniform>
+#include <osg/GL2Extensions>
+#include <osg/Camera>
+#include <osgDB/FileUtils>
 #include <osgwTools/FBOUtils.h>
+#include <osgwTools/Shapes.h>
 #include <osgwTools/Version.h>
 #include <osg/Timer>
 
 #include <backdropFX/Utils.h>
 #include <string>
+#include <cmath>
 
 
 
@@ -21,22 +28,63 @@ namespace backdropFX
 {
 
 
+/** \cond */
+// True if the partition geometry shader can draw everything in the Drawable.
+static bool isTriangleOnly( osg::Drawable* drawable )
+{
+    const osg::Geometry* geom( drawable->asGeometry() );
+    if( geom == NULL )
+        return( false );
+
+    unsigned int idx;
+    for( idx=0; idx<geom->getNumPrimitiveSets(); idx++ )
+    {
+        const GLenum mode( geom->getPrimitiveSet( idx )->getMode() );
+        if( ( mode != GL_TRIANGLES ) && ( mode != GL_TRIANGLE_STRIP ) &&
+            ( mode != GL_TRIANGLE_FAN ) )
+            return( false );
+    }
+    return( true );
+}
+
+// Returns the partition pass StateSet of the innermost program
+// in the StateGraph's path, or NULL if that program has none.
+static osg::StateSet* getPartitionPassStateSet( osgUtil::StateGraph* sg )
+{
+    for( ; sg != NULL; sg = sg->_parent )
+    {
+        const osg::StateSet* ss( sg->getStateSet() );
+        if( ss == NULL )
+            continue;
+        osg::Program* prog( const_cast< osg::Program* >( dynamic_cast< const osg::Program* >(
+            ss->getAttribute( osg::StateAttribute::PROGRAM ) ) ) );
+        if( prog != NULL )
+            return( dynamic_cast< osg::StateSet* >( prog->getUserData() ) );
+    }
+    return( NULL );
+}
+/** \endcond */
+
+
 DepthPartitionStage::DepthPartitionStage()
   : osgUtil::RenderStage(),
-    _depthPartition( NULL )
+    _depthPartition( NULL ),
+    _singlePassWarned( false )
 {
     internalInit();
 }
 
 DepthPartitionStage::DepthPartitionStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop )
   : osgUtil::RenderStage( rhs ),
-    _depthPartition( NULL )
+    _depthPartition( NULL ),
+    _singlePassWarned( false )
 {
     internalInit();
 }
 DepthPartitionStage::DepthPartitionStage( const DepthPartitionStage& rhs, const osg::CopyOp& copyop )
   : osgUtil::RenderStage( rhs ),
-    _depthPartition( rhs._depthPartition )
+    _depthPartition( rhs._depthPartition ),
+    _singlePassWarned( false )
 {
     internalInit();
 }
@@ -67,6 +115,60 @@ DepthPartitionStage::internalInit()
     _partitionDebug = new osg::Uniform( osg::Uniform::FLOAT_VEC4, "bdfx_partitionDebug" );
     UTIL_MEMORY_CHECK( _partitionDebug.get(), "DepthPartitionStage::internalInit _partitionDebug", )
     _stateSet->addUniform( _partitionDebug.get() );
+
+    // Single-pass partitioning. The partition geometry shader transforms
+    // each triangle by each of these matrices, far partition first.
+    _partitionMatrices = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "bdfx_partitionMatrices", BDFX_MAX_PARTITIONS );
+    UTIL_MEMORY_CHECK( _partitionMatrices.get(), "DepthPartitionStage::internalInit _partitionMatrices", )
+    _stateSet->addUniform( _partitionMatrices.get() );
+    _partitionCount = new osg::Uniform( "bdfx_partitionCount", 1 );
+    UTIL_MEMORY_CHECK( _partitionCount.get(), "DepthPartitionStage::internalInit _partitionCount", )
+    _stateSet->addUniform( _partitionCount.get() );
+
+    // Composite of the layered color buffer. Same full screen
+    // tri pair as DepthPeelBin.
+    _fstp = osgwTools::makePlane(
+        osg::Vec3( -1,-1,0 ), osg::Vec3( 2,0,0 ), osg::Vec3( 0,2,0 ) );
+    UTIL_MEMORY_CHECK( _fstp.get(), "DepthPartitionStage::internalInit FSTP", )
+    _fstp->setColorBinding( osg::Geometry::BIND_OFF );
+    _fstp->setNormalBinding( osg::Geometry::BIND_OFF );
+    _fstp->setTexCoordArray( 0, NULL );
+    _fstp->setUseDisplayList( false );
+    _fstp->setUseVertexBufferObjects( true );
+
+    _compositeProgram = new osg::Program();
+    UTIL_MEMORY_CHECK( _compositeProgram.get(), "DepthPartitionStage::internalInit composite program", )
+    _compositeProgram->setName( "DepthPartitionComposite" );
+    std::string fileName( "shaders/DepthPartitionComposite.vs" );
+    std::string fullName( osgDB::findDataFile( fileName ) );
+    if( fullName.empty() )
+        osg::notify( osg::WARN ) << "backdropFX: DepthPartitionStage: Can't find file " << fileName << std::endl;
+    else
+        _compositeProgram->addShader( osg::Shader::readShaderFile( osg::Shader::VERTEX, fullName ) );
+    fileName = "shaders/DepthPartitionComposite.fs";
+    fullName = osgDB::findDataFile( fileName );
+    if( fullName.empty() )
+        osg::notify( osg::WARN ) << "backdropFX: DepthPartitionStage: Can't find file " << fileName << std::endl;
+    else
+        _compositeProgram->addShader( osg::Shader::readShaderFile( osg::Shader::FRAGMENT, fullName ) );
+
+    // Composite shader output is premultiplied.
+    _compositeBlendFunc = new osg::BlendFunc( osg::BlendFunc::ONE,
+        osg::BlendFunc::ONE_MINUS_SRC_ALPHA );
+    UTIL_MEMORY_CHECK( _compositeBlendFunc.get(), "DepthPartitionStage::internalInit composite BlendFunc", )
+
+    // The composite writes the nearest layer's depth without testing.
+    _compositeDepth = new osg::Depth( osg::Depth::ALWAYS );
+    UTIL_MEMORY_CHECK( _compositeDepth.get(), "DepthPartitionStage::internalInit composite Depth", )
+
+    _compositeTexture = new osg::Uniform( "bdfx_partitionColor", 0 );
+    UTIL_MEMORY_CHECK( _compositeTexture.get(), "DepthPartitionStage::internalInit composite texture uniform", )
+    _compositeDepthTexture = new osg::Uniform( "bdfx_partitionDepth", 1 );
+    UTIL_MEMORY_CHECK( _compositeDepthTexture.get(), "DepthPartitionStage::internalInit composite depth texture uniform", )
+
+    // Points, lines, and other drawables the partition geometry shader can't take.
+    _partitionPassBin = new StageRenderBin( this );
+    UTIL_MEMORY_CHECK( _partitionPassBin.get(), "DepthPartitionStage::internalInit partition pass bin", )
 }
 
 
@@ -89,6 +191,83 @@ inline void computeFrustum(
 }
 
 
+void
+DepthPartitionStage::computePartitions( MatrixList& partitions, const osg::Matrixd& proj, bool singlePass ) const
+{
+    // Get the overall projection parameters.
+    double inLeft, inRight, inBottom, inTop, inNear, inFar;
+    proj.getFrustum( inLeft, inRight, inBottom, inTop, inNear, inFar );
+
+    // Get the desired number of partitions.
+    double ratio = _depthPartition->getRatio();
+    unsigned int numPartitions = _depthPartition->getNumPartitions();
+    const bool autoCompute = ( numPartitions == 0 );
+    if( autoCompute )
+    {
+        // App has requested that we compute the best number of partitions.
+        double tempFar = inFar;
+        do {
+            numPartitions++;
+            tempFar *= ratio;
+        } while( tempFar > inNear );
+        osg::notify( osg::DEBUG_FP ) << "Computed partitions: " << numPartitions << std::endl;
+    }
+    else
+        osg::notify( osg::DEBUG_FP ) << "Using partitions: " << numPartitions << std::endl;
+
+    const bool clamped = ( singlePass && ( numPartitions > BDFX_MAX_PARTITIONS ) );
+    if( clamped )
+    {
+        // Too many partitions for the texture array. Rather than fall back to
+        // multiple passes, increase the ratio so that the maximum number of
+        // partitions covers the entire view volume.
+        numPartitions = BDFX_MAX_PARTITIONS;
+        ratio = pow( inNear / inFar, 1. / (double)numPartitions );
+        osg::notify( osg::DEBUG_FP ) << "  Single pass, clamped to " << numPartitions <<
+            " partitions, ratio " << ratio << std::endl;
+    }
+
+    //
+    // Compute the projection matrix for each partition, far to near.
+
+    partitions.clear();
+    double tempFar = inFar;
+    for( unsigned int idx=0; idx<numPartitions; idx++ )
+    {
+        double newNear;
+        if( numPartitions == 1 )
+            // Just one partitions, so do the whole view volume.
+            newNear = inNear;
+        else
+        {
+            newNear = tempFar * ratio;
+            // if numPartitions is 0 (auto computed), we're done.
+
+            if( ( !autoCompute ) && ( newNear < inNear ) )
+            {
+                // If numPartitions was specified (greater than 1) and our
+                // new near plane is closer (less than) the view volume near,
+                // clamp to the view volume near and stop looping.
+                newNear = inNear;
+                idx = numPartitions - 1;
+            }
+            else if( clamped && ( idx == numPartitions - 1 ) )
+                // Ratio was recomputed for single pass. Guard against
+                // floating point error and end exactly at the view volume near.
+                newNear = inNear;
+        }
+        osg::notify( osg::DEBUG_FP ) << "  backdropFX: DepthPartitionStage pass " << idx << ", far " << tempFar << " near " << newNear << std::endl;
+
+        double newLeft, newRight, newBottom, newTop;
+        computeFrustum( newLeft, newRight, newBottom, newTop, newNear,
+            inLeft, inRight, inBottom, inTop, inNear );
+
+        partitions.push_back( osg::Matrix::frustum( newLeft, newRight, newBottom, newTop, newNear, tempFar ) );
+
+        tempFar = newNear;
+    }
+}
+
 void
 DepthPartitionStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous )
 {
@@ -138,123 +317,101 @@ DepthPartitionStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& pr
     //
 
 
-    // Get the overall projection parameters.
-    osg::Matrixd projD = _camera->getProjectionMatrix();
-    double inLeft, inRight, inBottom, inTop, inNear, inFar;
-    projD.getFrustum( inLeft, inRight, inBottom, inTop, inNear, inFar );
+    const bool singlePass = useSinglePass( contextID );
 
-    // Get the desired number of partitions.
-    const double ratio = _depthPartition->getRatio();
-    unsigned int numPartitions = _depthPartition->getNumPartitions();
-    const bool autoCompute = ( numPartitions == 0 );
-    if( autoCompute )
-    {
-        // App has requested that we compute the best number of partitions.
-        double tempFar = inFar;
-        do {
-            numPartitions++;
-            tempFar *= ratio;
-        } while( tempFar > inNear );
-        osg::notify( osg::DEBUG_FP ) << "Computed partitions: " << numPartitions << std::endl;
-    }
-    else
-        osg::notify( osg::DEBUG_FP ) << "Using partitions: " << numPartitions << std::endl;
+    // Get the partition projection matrices. If DepthPartition culled
+    // each partition separately, use the partitions it culled with.
+    MatrixList partitions( _cullPartitions );
+    const bool partitionBins = !( partitions.empty() ) && !singlePass;
+    if( !partitionBins )
+        computePartitions( partitions, _camera->getProjectionMatrix(), singlePass );
 
     const bool dumpImages = (
         ( _depthPartition->getDebugMode() & backdropFX::BackdropCommon::debugImages ) != 0 );
 
 
-    //
-    // Draw loop
-
-    double tempFar = inFar;
-    bool doCopyTexture( false );
-    unsigned int idx;
-    for( idx=0; idx<numPartitions; idx++ )
+    if( singlePass )
     {
-        {
-            // Create the projection matrix for this partition and set
-            // as the bdfx_partitionMatrix uniform.
+        drawSinglePass( renderInfo, previous, partitions, fbo, fboExt );
+    }
+    else
+    {
+        //
+        // Draw loop
 
-            double newNear;
-            if( numPartitions == 1 )
-                // Just one partitions, so do the whole view volume.
-                newNear = inNear;
+        bool doCopyTexture( false );
+        unsigned int idx;
+        for( idx=0; idx<partitions.size(); idx++ )
+        {
+            // When culled per partition, each partition has its own RenderBin.
+            osgUtil::RenderBin* bin( partitionBins ?
+                _partitionBins[ idx ].get() : static_cast< osgUtil::RenderBin* >( this ) );
+
+            // Set the projection matrix for this partition as the
+            // bdfx_partitionMatrix uniform. If the partition geometry shader
+            // is present (single pass was requested but isn't usable), it
+            // renders just this partition.
+            _partitionMatrix->set( partitions[ idx ] );
+            _partitionMatrices->setElement( 0, partitions[ idx ] );
+            _partitionCount->set( 1 );
+
+            // TBD should be tied to debug.
+            // Debugging aid: Add a pinkish tint to odd partitions.
+            // This is done in bdfx-finalize.fs.
+            if( idx & 1 )
+                _partitionDebug->set( osg::Vec4f( .5f, 0.f, 0.f, 0.f ) );
             else
-            {
-                newNear = tempFar * ratio;
-                // if numPartitions is 0 (auto computed), we're done.
+                _partitionDebug->set( osg::Vec4f( 0.f, 0.f, 0.f, 0.f ) );
 
-                if( ( !autoCompute ) && ( newNear < inNear ) )
+            if( dumpImages )
+            {
+                // If dumping images, pass the current partition number to the DepthPeelBin.
+                // It encodes the partition number in the dumped image file name.
+                osgUtil::RenderBin::RenderBinList& bins( bin->getRenderBinList() );
+                osgUtil::RenderBin::RenderBinList::iterator rb = bins.find( 0 );
+                if( rb != bins.end() )
                 {
-                    // If numPartitions was specified (greater than 1) and our
-                    // new near plane is closer (less than) the view volume near,
-                    // clamp to the view volume near and stop looping.
-                    newNear = inNear;
-                    idx = numPartitions - 1;
+                    backdropFX::DepthPeelBin* dpb = dynamic_cast< backdropFX::DepthPeelBin* >( rb->second.get() );
+                    if( dpb != NULL )
+                    {
+                        dpb->setPartitionNumber( idx );
+                        osg::notify( osg::INFO ) << "  Setting partNum: " << idx << std::endl;
+                    }
                 }
             }
-            osg::notify( osg::DEBUG_FP ) << "  backdropFX: DepthPartitionStage pass " << idx << ", far " << tempFar << " near " << newNear << std::endl;
 
-            double newLeft, newRight, newBottom, newTop;
-            computeFrustum( newLeft, newRight, newBottom, newTop, newNear,
-                inLeft, inRight, inBottom, inTop, inNear );
+            // Must clear the depth buffer for each pass.
+            // Not really necessary if depth peeling is on, but required when
+            // depth peeling is off.
+            glClear( GL_DEPTH_BUFFER_BIT );
 
-            osg::Matrixf m = osg::Matrix::frustum( newLeft, newRight, newBottom, newTop, newNear, tempFar );
-            _partitionMatrix->set( m );
+            // Render child stages.
+            drawPreRenderStages( renderInfo, previous );
 
-            tempFar = newNear;
-        }
+            //osg::Timer timerA;
+            if( partitionBins )
+                bin->draw( renderInfo, previous );
+            else
+                RenderBin::drawImplementation( renderInfo, previous );
+            //osg::notify( osg::ALWAYS ) << "DepthPart drawImpl: " << timerA.time_s() << std::endl;
 
-        // TBD should be tied to debug.
-        // Debugging aid: Add a pinkish tint to odd partitions.
-        // This is done in bdfx-finalize.fs.
-        if( idx & 1 )
-            _partitionDebug->set( osg::Vec4f( .5f, 0.f, 0.f, 0.f ) );
-        else
-            _partitionDebug->set( osg::Vec4f( 0.f, 0.f, 0.f, 0.f ) );
+            // Points and lines, if the partition geometry shader is present.
+            _partitionPassBin->draw( renderInfo, previous );
 
-        if( dumpImages )
-        {
-            // If dumping images, pass the current partition number to the DepthPeelBin.
-            // It encodes the partition number in the dumped image file name.
-            osgUtil::RenderBin::RenderBinList::iterator rb = _bins.find( 0 );
-            if( rb != _bins.end() )
+            if( _depthPartition->getPrototypeHACK() )
             {
-                backdropFX::DepthPeelBin* dpb = dynamic_cast< backdropFX::DepthPeelBin* >( rb->second.get() );
-                if( dpb != NULL )
-                {
-                    dpb->setPartitionNumber( idx );
-                    osg::notify( osg::INFO ) << "  Setting partNum: " << idx << std::endl;
-                }
+                // Don't need this when it's a parent of DepthPeel
+                // but need it for a standalone test app
+                drawInner( renderInfo, previous, doCopyTexture );
             }
-        }
-
-        // Must clear the depth buffer for each pass.
-        // Not really necessary if depth peeling is on, but required when
-        // depth peeling is off.
-        glClear( GL_DEPTH_BUFFER_BIT );
 
-        // Render child stages.
-        drawPreRenderStages( renderInfo, previous );
-
-        //osg::Timer timerA;
-        RenderBin::drawImplementation( renderInfo, previous );
-        //osg::notify( osg::ALWAYS ) << "DepthPart drawImpl: " << timerA.time_s() << std::endl;
-
-        if( _depthPartition->getPrototypeHACK() )
-        {
-            // Don't need this when it's a parent of DepthPeel
-            // but need it for a standalone test app
-            drawInner( renderInfo, previous, doCopyTexture );
+            UTIL_GL_ERROR_CHECK( "depth partition inner draw loop" );
         }
 
-        UTIL_GL_ERROR_CHECK( "depth partition inner draw loop" );
+        // End of draw loop
+        //
     }
 
-    // End of draw loop
-    //
-
 
     // Unbind
     // If backdropFX is configured to render to window (no destination specified by app)
@@ -280,6 +437,282 @@ DepthPartitionStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& pr
         renderInfo.popCamera();
 }
 
+bool
+DepthPartitionStage::useSinglePass( unsigned int contextID )
+{
+    if( !( _depthPartition->getSinglePass() ) || _depthPartition->getPrototypeHACK() )
+        return( false );
+
+    // DepthPartition checks extensions and limits once per context, and
+    // removes the geometry shader if they're insufficient.
+    if( !( _depthPartition->isSinglePassSupported( contextID ) ) ||
+        !( _depthPartition->getLayeredShaders() ) )
+        return( false );
+
+    // Depth peeling renders its own layers into non-layered FBOs.
+    osgUtil::RenderBin::RenderBinList::iterator rb = _bins.find( 0 );
+    if( ( rb == _bins.end() ) ||
+        ( dynamic_cast< backdropFX::DepthPeelBin* >( rb->second.get() ) == NULL ) )
+        return( true );
+
+    if( !_singlePassWarned )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: DepthPartitionStage: Single pass " <<
+            "incompatible with depth peeling. Using multiple passes." << std::endl;
+        _singlePassWarned = true;
+    }
+    return( false );
+}
+
+void
+DepthPartitionStage::configureLayeredFBO( int width, int height, unsigned int layers )
+{
+    if( _layeredFBO.valid() &&
+        ( _layeredColor->getTextureWidth() == width ) &&
+        ( _layeredColor->getTextureHeight() == height ) &&
+        ( _layeredColor->getTextureDepth() == (int)layers ) )
+        return;
+
+    osg::notify( osg::INFO ) << "backdropFX: DepthPartitionStage: Layered FBO " <<
+        width << "x" << height << ", " << layers << " layers." << std::endl;
+
+    _layeredColor = new osg::Texture2DArray;
+    UTIL_MEMORY_CHECK( _layeredColor.get(), "DepthPartitionStage layered color", )
+    _layeredColor->setTextureSize( width, height, layers );
+    _layeredColor->setInternalFormat( GL_RGBA );
+    _layeredColor->setSourceFormat( GL_RGBA );
+    _layeredColor->setSourceType( GL_UNSIGNED_BYTE );
+    _layeredColor->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _layeredColor->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+
+    _layeredDepth = new osg::Texture2DArray;
+    UTIL_MEMORY_CHECK( _layeredDepth.get(), "DepthPartitionStage layered depth", )
+    _layeredDepth->setTextureSize( width, height, layers );
+    _layeredDepth->setInternalFormat( GL_DEPTH_COMPONENT24 );
+    _layeredDepth->setSourceFormat( GL_DEPTH_COMPONENT );
+    _layeredDepth->setSourceType( GL_UNSIGNED_INT );
+    _layeredDepth->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    _layeredDepth->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+
+    _layeredFBO = new osg::FrameBufferObject;
+    UTIL_MEMORY_CHECK( _layeredFBO.get(), "DepthPartitionStage layered FBO", )
+#if OSG_SUPPORTS_LAYERED_FBO
+    _layeredFBO->setAttachment( osg::Camera::COLOR_BUFFER0,
+        osg::FrameBufferAttachment( _layeredColor.get(), osg::Camera::FACE_CONTROLLED_BY_GEOMETRY_SHADER ) );
+    _layeredFBO->setAttachment( osg::Camera::DEPTH_BUFFER,
+        osg::FrameBufferAttachment( _layeredDepth.get(), osg::Camera::FACE_CONTROLLED_BY_GEOMETRY_SHADER ) );
+#endif
+
+    // One FBO per layer, for drawing points and lines into a single partition.
+    _layerFBOs.clear();
+    unsigned int idx;
+    for( idx=0; idx<layers; idx++ )
+    {
+        osg::FrameBufferObject* layerFBO = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( layerFBO, "DepthPartitionStage layer FBO", )
+        layerFBO->setAttachment( osg::Camera::COLOR_BUFFER0,
+            osg::FrameBufferAttachment( _layeredColor.get(), idx ) );
+        layerFBO->setAttachment( osg::Camera::DEPTH_BUFFER,
+            osg::FrameBufferAttachment( _layeredDepth.get(), idx ) );
+        _layerFBOs.push_back( layerFBO );
+    }
+
+    _layeredViewport = new osg::Viewport( 0., 0., width, height );
+}
+
+void
+DepthPartitionStage::drawSinglePass( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous,
+    const MatrixList& partitions, osg::FrameBufferObject* fbo, osg::FBOExtensions* fboExt )
+{
+    osg::State& state( *renderInfo.getState() );
+    const osg::Viewport* vp( getViewport() );
+    configureLayeredFBO( (int)( vp->width() ), (int)( vp->height() ), partitions.size() );
+
+    unsigned int idx;
+    for( idx=0; idx<partitions.size(); idx++ )
+        _partitionMatrices->setElement( idx, partitions[ idx ] );
+    _partitionCount->set( (int)( partitions.size() ) );
+    _partitionDebug->set( osg::Vec4f( 0.f, 0.f, 0.f, 0.f ) );
+
+
+    //
+    // Render all partitions into the layered FBO. The partition geometry
+    // shader sends each triangle to the layers it overlaps.
+
+    _layeredFBO->apply( state );
+    state.applyAttribute( _layeredViewport.get() );
+    glClearColor( 0.f, 0.f, 0.f, 0.f );
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+    drawPreRenderStages( renderInfo, previous );
+    RenderBin::drawImplementation( renderInfo, previous );
+    UTIL_GL_ERROR_CHECK( "depth partition single pass draw" );
+
+    // Points, lines, and other non-triangle drawables bypass the geometry
+    // shader. Draw them into each layer with that partition's matrix.
+    if( !( _partitionPassBin->getStateGraphList().empty() ) )
+    {
+        for( idx=0; idx<partitions.size(); idx++ )
+        {
+            _layerFBOs[ idx ]->apply( state );
+            _partitionMatrix->set( partitions[ idx ] );
+            _partitionPassBin->draw( renderInfo, previous );
+        }
+        UTIL_GL_ERROR_CHECK( "depth partition single pass points and lines" );
+    }
+
+
+    //
+    // Composite the layers, back to front, over the destination.
+
+    if( fbo != NULL )
+        fbo->apply( state );
+    else
+        osgwTools::glBindFramebuffer( fboExt, GL_FRAMEBUFFER_EXT, 0 );
+    state.applyAttribute( getViewport() );
+
+    const unsigned int contextID( state.getContextID() );
+    osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
+
+    state.applyAttribute( _compositeProgram.get() );
+#if OSG_SUPPORTS_UNIFORM_ID
+    GLint textureLoc = state.getUniformLocation( _compositeTexture->getNameID() );
+    GLint depthLoc = state.getUniformLocation( _compositeDepthTexture->getNameID() );
+    GLint countLoc = state.getUniformLocation( _partitionCount->getNameID() );
+#else
+    GLint textureLoc = state.getUniformLocation( _compositeTexture->getName() );
+    GLint depthLoc = state.getUniformLocation( _compositeDepthTexture->getName() );
+    GLint countLoc = state.getUniformLocation( _partitionCount->getName() );
+#endif
+    if( textureLoc >= 0 )
+        _compositeTexture->apply( gl2Ext, textureLoc );
+    if( depthLoc >= 0 )
+        _compositeDepthTexture->apply( gl2Ext, depthLoc );
+    if( countLoc >= 0 )
+        _partitionCount->apply( gl2Ext, countLoc );
+
+    // Save the blend and depth state the composite changes.
+    const bool blend( state.getLastAppliedMode( GL_BLEND ) );
+    const bool depthTest( state.getLastAppliedMode( GL_DEPTH_TEST ) );
+    const osg::StateAttribute* blendFunc( state.getLastAppliedAttribute( osg::StateAttribute::BLENDFUNC ) );
+    const osg::StateAttribute* depth( state.getLastAppliedAttribute( osg::StateAttribute::DEPTH ) );
+
+    state.setActiveTextureUnit( 1 );
+    state.applyTextureAttribute( 1, _layeredDepth.get() );
+    state.setActiveTextureUnit( 0 );
+    state.applyTextureAttribute( 0, _layeredColor.get() );
+    state.applyAttribute( _compositeBlendFunc.get() );
+    state.applyMode( GL_BLEND, true );
+    // GL only writes depth with the depth test enabled.
+    state.applyAttribute( _compositeDepth.get() );
+    state.applyMode( GL_DEPTH_TEST, true );
+
+    _fstp->draw( renderInfo );
+    UTIL_GL_ERROR_CHECK( "depth partition single pass composite" );
+
+    // Restore.
+    state.applyMode( GL_BLEND, blend );
+    state.applyMode( GL_DEPTH_TEST, depthTest );
+    if( blendFunc != NULL )
+        state.applyAttribute( blendFunc );
+    else
+        state.haveAppliedAttribute( osg::StateAttribute::BLENDFUNC );
+    if( depth != NULL )
+        state.applyAttribute( depth );
+    else
+        state.haveAppliedAttribute( osg::StateAttribute::DEPTH );
+}
+
+void
+DepthPartitionStage::reset()
+{
+    osgUtil::RenderStage::reset();
+
+    BinList::iterator itr;
+    for( itr = _partitionBins.begin(); itr != _partitionBins.end(); itr++ )
+        (*itr)->reset();
+    _cullPartitions.clear();
+    _partitionPassBin->reset();
+}
+
+void
+DepthPartitionStage::sort()
+{
+    osgUtil::RenderStage::sort();
+
+    // Only the partitions culled this frame have contents.
+    unsigned int idx;
+    for( idx=0; idx<_cullPartitions.size(); idx++ )
+        _partitionBins[ idx ]->sort();
+    _partitionPassBin->sort();
+}
+
+void
+DepthPartitionStage::separatePartitionPassLeaves( osgUtil::RenderBin* bin )
+{
+    osgUtil::RenderBin::StateGraphList& sgList( bin->getStateGraphList() );
+    osgUtil::RenderBin::StateGraphList::iterator sgitr;
+    for( sgitr = sgList.begin(); sgitr != sgList.end(); sgitr++ )
+    {
+        osgUtil::StateGraph* sg( *sgitr );
+        osgUtil::StateGraph::LeafList& leaves( sg->_leaves );
+        osgUtil::StateGraph::LeafList::iterator litr( leaves.begin() );
+        while( litr != leaves.end() )
+        {
+            osg::StateSet* partitionSS( NULL );
+            if( !isTriangleOnly( (*litr)->_drawable ) )
+                partitionSS = getPartitionPassStateSet( sg );
+            if( partitionSS == NULL )
+            {
+                litr++;
+                continue;
+            }
+
+            // The partition pass StateSet overrides the program in the leaf's
+            // StateGraph. The StateGraph is unique to this leaf's state, so the
+            // child is too.
+            osg::ref_ptr< osgUtil::RenderLeaf > leaf( *litr );
+            litr = leaves.erase( litr );
+            osgUtil::StateGraph* partitionSG( sg->find_or_insert( partitionSS ) );
+            if( partitionSG->leaves_empty() )
+                _partitionPassBin->addStateGraph( partitionSG );
+            partitionSG->addLeaf( leaf.get() );
+        }
+    }
+
+    osgUtil::RenderBin::RenderBinList& bins( bin->getRenderBinList() );
+    osgUtil::RenderBin::RenderBinList::iterator bitr;
+    for( bitr = bins.begin(); bitr != bins.end(); bitr++ )
+        separatePartitionPassLeaves( bitr->second.get() );
+}
+
+void
+DepthPartitionStage::setCullPartitions( const MatrixList& partitions )
+{
+    _cullPartitions = partitions;
+
+    while( _partitionBins.size() < partitions.size() )
+    {
+        _partitionBins.push_back( new StageRenderBin( this ) );
+
+        // An otherwise empty StateSet, unique to this partition.
+        // See StageRenderBin.
+        osg::StateSet* ss = new osg::StateSet;
+        ss->setDataVariance( osg::Object::DYNAMIC );
+        _partitionStateSets.push_back( ss );
+    }
+}
+osgUtil::RenderBin*
+DepthPartitionStage::getPartitionBin( unsigned int idx )
+{
+    return( _partitionBins[ idx ].get() );
+}
+osg::StateSet*
+DepthPartitionStage::getPartitionStateSet( unsigned int idx )
+{
+    return( _partitionStateSets[ idx ].get() );
+}
+
 void
 DepthPartitionStage::setDepthPartition( DepthPartition* depthPartition )
 {
@@ -317,12 +317,16 @@ void DepthPeelBin::drawImplementation( osg::RenderInfo& renderInfo, osgUtil::Ren
 
         insertStateSetPosition = drawInit( state, previous );
 
+        // The layer color texture matches color buffer A, which is
+        // floating point with the Manager hdr feature flag.
+        const GLint colorFormat( Manager::instance()->getColorBufferA()->getInternalFormat() );
         if( pci._init &&
-            ( ( pci._width < width ) || ( pci._height < height ) ) )
+            ( ( pci._width < width ) || ( pci._height < height ) ||
+              ( pci._colorFormat != colorFormat ) ) )
         {
             // We've already created textures at a given size, but we
-            // now have a larger viewport. Delete those textures and
-            // force a re-initialization.
+            // now have a larger viewport (or a new color format). Delete
+            // those textures and force a re-initialization.
             // NOTE We never resize the textures smaller, only larger.
             osg::notify( osg::INFO ) << "BDFX: DepthPeelBin cleanup. ";
             pci.cleanup( state );
@@ -331,7 +335,7 @@ void DepthPeelBin::drawImplementation( osg::RenderInfo& renderInfo, osgUtil::Ren
         {
             osg::notify( osg::INFO ) << "BDFX: DepthPeelBin resize to width: " <<
                 width << " height: " << height << std::endl;
-            pci.init( state, width, height );
+            pci.init( state, width, height, colorFormat );
         }
 
         // Compute the percentage of the texture we will render to.
@@ -532,6 +536,7 @@ DepthPeelBin::PerContextInfo::PerContextInfo()
     _fbo( 0 ),
     _width( 0 ),
     _height( 0 ),
+    _colorFormat( GL_RGBA ),
     _colorTex( 0 ),
     _queryID( 0 )
 {
@@ -539,12 +544,13 @@ DepthPeelBin::PerContextInfo::PerContextInfo()
 }
 
 void
-DepthPeelBin::PerContextInfo::init( const osg::State& state, const GLsizei width, const GLsizei height )
+DepthPeelBin::PerContextInfo::init( const osg::State& state, const GLsizei width, const GLsizei height, const GLint colorFormat )
 {
     TRACEDUMP("PerContextInfo::init");
 
     _width = width;
     _height = height;
+    _colorFormat = colorFormat;
 
 
     // Create two depth buffers; First two are ping-pong buffers for each pass.
@@ -569,8 +575,8 @@ DepthPeelBin::PerContextInfo::init( const osg::State& state, const GLsizei width
     glGenTextures( 1, &_colorTex );
     UTIL_GL_ERROR_CHECK( "DepthPeelBin PerContextInfo Color Tex" );
     glBindTexture( GL_TEXTURE_2D, _colorTex );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, _width, _height,
-        0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    glTexImage2D( GL_TEXTURE_2D, 0, _colorFormat, _width, _height,
+        0, GL_RGBA, ( _colorFormat == GL_RGBA ) ? GL_UNSIGNED_BYTE : GL_FLOAT, NULL );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glBindTexture( GL_TEXTURE_2D, 0 );
@@ -1,16 +1,20 @@
 // Copyright (c) 2010 Skew Matrix Software. All rights reserved.
 
 #include <backdropFX/RenderingEffects.h>
+#include <backdropFX/Manager.h>
 #include <backdropFX/RenderingEffectsStage.h>
 #include <backdropFX/Effect.h>
+#include <backdropFX/EffectGraph.h>
 #include <backdropFX/Utils.h>
 #include <backdropFX/RTTViewport.h>
 #include <osg/Texture2D>
 #include <osg/Depth>
+#include <osg/Math>
 #include <osgwTools/Shapes.h>
 #include <osgwTools/Version.h>
 #include <backdropFX/Utils.h>
 #include <osgwTools/FBOUtils.h>
+#include <OpenThreads/Atomic>
 
 #include <sstream>
 
@@ -19,11 +23,21 @@ namespace backdropFX
 {
 
 
+/** \cond */
+// Source of Effect graph revisions. Every change takes a new number, so a
+// CompositeEffect's largest sub-Effect revision always increases. Effects
+// on different threads can change at once, so it's atomic.
+static OpenThreads::Atomic s_graphRevision( 0 );
+/** \endcond */
+
+
 Effect::Effect()
   : osg::Object(),
+    _transientOutput( false ),
     _width( 0 ),
     _height( 0 )
 {
+    dirtyGraph();
     // TBD need to share the uniform and VBO across all BackdropCommon classes.
 
     _fstp = osgwTools::makePlane(
@@ -52,16 +66,20 @@ Effect::Effect()
 Effect::Effect( const Effect& rhs, const osg::CopyOp& copyop )
   : osg::Object( rhs ),
     _program( rhs._program ),
+    _pointwiseShader( rhs._pointwiseShader ),
     _textureUniform( rhs._textureUniform ),
     _uniforms( rhs._uniforms ),
     _inputs( rhs._inputs ),
     _output( rhs._output ),
+    _transientOutput( rhs._transientOutput ),
     _width( rhs._width ),
     _height( rhs._height ),
     // TBD need to share this with all Effect classes (a static, perhaps?)
     _fstp( rhs._fstp ),
     _depth( rhs._depth )
 {
+    // _scaledViewport changes during draw, so it isn't shared.
+    dirtyGraph();
 }
 Effect::~Effect()
 {
@@ -72,6 +90,7 @@ void
 Effect::addInput( const unsigned int unit, osg::Texture* texture )
 {
     _inputs[ unit ] = texture;
+    dirtyGraph();
 }
 osg::Texture*
 Effect::getInput( const unsigned int unit ) const
@@ -100,6 +119,7 @@ Effect::removeInput( const unsigned int unit )
     if( itr != _inputs.end() )
     {
         _inputs.erase( itr );
+        dirtyGraph();
         return( true );
     }
     else
@@ -119,6 +139,8 @@ void
 Effect::setOutput( osg::FrameBufferObject* fbo )
 {
     _output = fbo;
+    _transientOutput = false;
+    dirtyGraph();
 }
 osg::FrameBufferObject*
 Effect::getOutput() const
@@ -132,6 +154,12 @@ Effect::setProgram( osg::Program* program )
 {
     _program = program;
 }
+void
+Effect::setPointwiseShader( osg::Shader* shader )
+{
+    _pointwiseShader = shader;
+    dirtyGraph();
+}
 
 void
 Effect::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo, bool last )
@@ -147,7 +175,7 @@ Effect::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo, bool las
         osg::notify( osg::INFO ) << "Effect: applying local Effect FBO." << std::endl;
 
         // We have an FBO assigned, use it.
-        fbo = _output.get();
+        fbo = getGraphFBO( rfxs, state, _output.get() );
     }
     else
     {
@@ -180,52 +208,31 @@ Effect::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo, bool las
     if( _program.valid() )
     {
         osg::notify( osg::INFO ) << "Effect: applying program." << std::endl;
-        state.applyAttribute( _program.get() );
+        _uniformLocations.applyProgram( state, _program.get() );
     }
 
-    // Bind the input textures and set their sampler uniforms.
+    // Bind the input textures and set their sampler uniforms. Locations come
+    // from _uniformLocations, so only the first draw with a program looks
+    // them up.
     osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
     IntTextureMap::const_iterator inItr;
     for( inItr = _inputs.begin(); inItr != _inputs.end(); inItr++ )
     {
         osg::notify( osg::INFO ) << "Effect: applying input texture." << std::endl;
 
-        osg::Uniform* uniform = _textureUniform[ inItr->first ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( uniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( uniform->getName() );
-#endif
-        if( location >= 0 )
-            uniform->apply( gl2Ext, location );
+        _uniformLocations.apply( state, gl2Ext, FirstTextureSlot + inItr->first,
+            _textureUniform[ inItr->first ].get() );
 
         state.setActiveTextureUnit( inItr->first );
-        osg::Texture* texture = inItr->second.get();
+        osg::Texture* texture = getGraphTexture( rfxs, state, inItr->second.get() );
         state.applyTextureAttribute( inItr->first, texture );
     }
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
+    unsigned int slot( FirstTextureSlot + (unsigned int)( _textureUniform.size() ) );
     UniformVector::const_iterator uItr;
     for( uItr = _uniforms.begin(); uItr != _uniforms.end(); uItr++ )
-    {
-        osg::Uniform* uniform = uItr->get();
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( uniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( uniform->getName() );
-#endif
-        if( location >= 0 )
-            uniform->apply( gl2Ext, location );
-    }
-    {
-        osg::Uniform* uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( uniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( uniform->getName() );
-#endif
-        if( location >= 0 )
-            uniform->apply( gl2Ext, location );
-    }
-    rfxs->getRenderingEffects()->applyAllGlobalUniforms( state, gl2Ext );
+        _uniformLocations.apply( state, gl2Ext, slot++, uItr->get() );
+    rfxs->getRenderingEffects()->applyAllGlobalUniforms( state, gl2Ext, &_uniformLocations, slot );
 
     UTIL_GL_ERROR_CHECK( (getName() + std::string(" Effect::draw()." ) ) ) \
 
@@ -248,7 +255,9 @@ bool Effect::attachOutputTo( Effect* effect, unsigned int unit )
         osg::notify( osg::INFO ) << "BDFX: Effect::attachOutputTo implicitly creating output FBO." << std::endl;
 
         tex = new osg::Texture2D();
-        tex->setInternalFormat( GL_RGBA );
+        // Effects often create their outputs before their inputs are
+        // attached, so follow the Manager flag rather than input 0.
+        setTextureFormat( tex, Manager::instance()->getHDR() );
         tex->setBorderWidth( 0 );
         tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
         tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
@@ -258,6 +267,8 @@ bool Effect::attachOutputTo( Effect* effect, unsigned int unit )
 
         _output = new osg::FrameBufferObject();
         _output->setAttachment( osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment( tex ) );
+        _transientOutput = true;
+        dirtyGraph();
     }
     else
     {
@@ -278,11 +289,131 @@ bool Effect::attachOutputTo( Effect* effect, unsigned int unit )
     }
 }
 
+void
+Effect::setTextureFormat( osg::Texture2D* tex, bool hdr )
+{
+    if( hdr )
+    {
+        tex->setInternalFormat( GL_RGBA16F_ARB );
+        tex->setSourceFormat( GL_RGBA );
+        tex->setSourceType( GL_FLOAT );
+    }
+    else
+    {
+        tex->setInternalFormat( GL_RGBA );
+        tex->setSourceFormat( GL_RGBA );
+        tex->setSourceType( GL_UNSIGNED_BYTE );
+    }
+}
+
+void
+Effect::setHDR( bool hdr )
+{
+    if( !_transientOutput )
+        return;
+    osg::Texture2D* tex( dynamic_cast< osg::Texture2D* >( getOutputTexture() ) );
+    if( tex == NULL )
+        return;
+    setTextureFormat( tex, hdr );
+    tex->dirtyTextureObject();
+    // The format decides which outputs the EffectGraph can alias.
+    dirtyGraph();
+}
+
+unsigned int
+Effect::getGraphRevision() const
+{
+    return( _graphRevision );
+}
+void
+Effect::dirtyGraph()
+{
+    _graphRevision = ++s_graphRevision;
+}
+
+void
+Effect::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    if( _program.valid() )
+        _program->resizeGLObjectBuffers( maxSize );
+    _uniformLocations.resizeGLObjectBuffers( maxSize );
+}
+void
+Effect::releaseGLObjects( osg::State* state ) const
+{
+    if( _program.valid() )
+        _program->releaseGLObjects( state );
+    _uniformLocations.releaseGLObjects( state );
+}
+
+void
+Effect::addGraphNodes( EffectGraph* graph )
+{
+    graph->addNode( this );
+    IntTextureMap::const_iterator inItr;
+    for( inItr = _inputs.begin(); inItr != _inputs.end(); inItr++ )
+        graph->addRead( inItr->second.get() );
+    graph->addWrite( getOutputTexture(), _transientOutput );
+}
+
+osg::Texture*
+Effect::getOutputTexture() const
+{
+    if( !( _output.valid() ) || !( _output->hasAttachment( osg::Camera::COLOR_BUFFER0 ) ) )
+        return( NULL );
+    const osg::FrameBufferAttachment& fba = _output->getAttachment( osg::Camera::COLOR_BUFFER0 );
+    return( const_cast< osg::FrameBufferAttachment* >( &fba )->getTexture() );
+}
+
+osg::Texture*
+Effect::getGraphTexture( RenderingEffectsStage* rfxs, const osg::State& state, osg::Texture* texture ) const
+{
+    return( rfxs->getRenderingEffects()->getEffectGraph()->getTexture( state.getContextID(), texture ) );
+}
+osg::FrameBufferObject*
+Effect::getGraphFBO( RenderingEffectsStage* rfxs, const osg::State& state, osg::FrameBufferObject* fbo ) const
+{
+    if( ( fbo == NULL ) || !( fbo->hasAttachment( osg::Camera::COLOR_BUFFER0 ) ) )
+        return( fbo );
+    const osg::FrameBufferAttachment& fba = fbo->getAttachment( osg::Camera::COLOR_BUFFER0 );
+    osg::FrameBufferObject* alias = rfxs->getRenderingEffects()->getEffectGraph()->getFBO( state.getContextID(),
+        const_cast< osg::FrameBufferAttachment* >( &fba )->getTexture() );
+    return( ( alias != NULL ) ? alias : fbo );
+}
+
+const osg::Viewport*
+Effect::applyScaledViewport( RenderingEffectsStage* rfxs, osg::State& state, const osg::Vec2& scale )
+{
+    osg::Viewport* vp = rfxs->getViewport();
+    if( ( scale.x() == 1.f ) && ( scale.y() == 1.f ) )
+    {
+        state.applyAttribute( vp );
+        return( vp );
+    }
+
+    if( !( _scaledViewport.valid() ) )
+    {
+        _scaledViewport = new osg::Viewport;
+        UTIL_MEMORY_CHECK( _scaledViewport.get(), "Effect _scaledViewport", NULL );
+    }
+    // The reduced resolution textures hold the whole texture at the same
+    // scale, so the origin scales with the extents. Round the extents the
+    // same way as the texture sizes. An RTTViewport's origin is (0,0).
+    _scaledViewport->setViewport(
+        (unsigned int)( vp->x() * scale.x() ),
+        (unsigned int)( vp->y() * scale.y() ),
+        osg::maximum( (unsigned int)( vp->width() * scale.x() ), 1u ),
+        osg::maximum( (unsigned int)( vp->height() * scale.y() ), 1u ) );
+    state.applyAttribute( _scaledViewport.get() );
+    return( _scaledViewport.get() );
+}
+
 void
 Effect::setTextureWidthHeight( unsigned int texW, unsigned int texH )
 {
     _width = texW;
     _height = texH;
+    dirtyGraph();
 
     if( _output != NULL )
     {
@@ -468,6 +599,44 @@ bool CompositeEffect::attachOutputTo( Effect* effect, unsigned int unit )
     return( (*rit)->attachOutputTo( effect, unit ) );
 }
 
+void CompositeEffect::setHDR( bool hdr )
+{
+    EffectVector::iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+        (*it)->setHDR( hdr );
+}
+
+void CompositeEffect::addGraphNodes( EffectGraph* graph )
+{
+    EffectVector::iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+        (*it)->addGraphNodes( graph );
+}
+
+unsigned int CompositeEffect::getGraphRevision() const
+{
+    unsigned int revision( _graphRevision );
+    EffectVector::const_iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+        revision = osg::maximum( revision, (*it)->getGraphRevision() );
+    return( revision );
+}
+
+void CompositeEffect::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    Effect::resizeGLObjectBuffers( maxSize );
+    EffectVector::iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+        (*it)->resizeGLObjectBuffers( maxSize );
+}
+void CompositeEffect::releaseGLObjects( osg::State* state ) const
+{
+    Effect::releaseGLObjects( state );
+    EffectVector::const_iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+        (*it)->releaseGLObjects( state );
+}
+
 void CompositeEffect::dumpImage( const osg::Viewport* vp, const std::string baseFileName )
 {
     // TBD not sure how to implement this in CompositeEffect.
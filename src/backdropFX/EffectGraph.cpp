@@ -0,0 +1,892 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/EffectGraph.h>
+#include <backdropFX/Effect.h>
+#include <backdropFX/RenderingEffectsStage.h>
+#include <backdropFX/ShaderModuleUtils.h>
+#include <osg/Texture2D>
+#include <osg/FrameBufferObject>
+#include <osg/Math>
+#include <osg/Notify>
+#include <osg/DisplaySettings>
+#include <osgDB/FileUtils>
+#include <OpenThreads/ScopedLock>
+
+#include <backdropFX/Utils.h>
+#include <set>
+#include <algorithm>
+#include <sstream>
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+// Transient textures are aliased only if they are interchangeable.
+static bool
+compatible( const osg::Texture2D* lhs, const osg::Texture2D* rhs )
+{
+    return( ( lhs->getTextureWidth() == rhs->getTextureWidth() ) &&
+        ( lhs->getTextureHeight() == rhs->getTextureHeight() ) &&
+        ( lhs->getInternalFormat() == rhs->getInternalFormat() ) &&
+        ( lhs->getSourceFormat() == rhs->getSourceFormat() ) &&
+        ( lhs->getSourceType() == rhs->getSourceType() ) &&
+        ( lhs->getFilter( osg::Texture::MIN_FILTER ) == rhs->getFilter( osg::Texture::MIN_FILTER ) ) &&
+        ( lhs->getFilter( osg::Texture::MAG_FILTER ) == rhs->getFilter( osg::Texture::MAG_FILTER ) ) &&
+        ( lhs->getWrap( osg::Texture::WRAP_S ) == rhs->getWrap( osg::Texture::WRAP_S ) ) &&
+        ( lhs->getWrap( osg::Texture::WRAP_T ) == rhs->getWrap( osg::Texture::WRAP_T ) ) );
+}
+
+// Estimated storage for a render target texture. Formats we don't know
+// count as 4 bytes per texel.
+static unsigned int
+textureBytes( const osg::Texture2D* texture )
+{
+    unsigned int texelBytes;
+    switch( texture->getInternalFormat() )
+    {
+    case GL_RGBA16F_ARB:
+        texelBytes = 8;
+        break;
+    case GL_RGBA32F_ARB:
+        texelBytes = 16;
+        break;
+    case GL_RGB16F_ARB:
+        texelBytes = 6;
+        break;
+    case GL_RGB32F_ARB:
+        texelBytes = 12;
+        break;
+    default:
+        texelBytes = 4;
+        break;
+    }
+    return( texture->getTextureWidth() * texture->getTextureHeight() * texelBytes );
+}
+
+// Lifetime of a transient texture, in draw node indices.
+struct Lifetime
+{
+    Lifetime() : _texture( NULL ), _first( ~0u ), _last( 0 ), _order( 0 ) {}
+
+    osg::Texture2D* _texture;
+    unsigned int _first, _last;
+    // Order of first appearance, to break ties. Zero until first seen.
+    unsigned int _order;
+
+    bool operator<( const Lifetime& rhs ) const
+    {
+        if( _first != rhs._first )
+            return( _first < rhs._first );
+        return( _order < rhs._order );
+    }
+};
+
+// Texture units available to a generated program.
+static const unsigned int MaxFusedUnits( 8 );
+
+// Assigns texture units to the inputs of a pointwise run. Unit 0 is input 0
+// of the first Effect. Inputs 1 to 3 of each Effect share a unit if they
+// share a texture. units[ effect*3 + input-1 ] is ~0u for unused inputs.
+static void
+assignUnits( const std::vector< Effect* >& effects,
+    std::vector< osg::Texture* >& unitTextures, std::vector< unsigned int >& units )
+{
+    unitTextures.clear();
+    units.clear();
+    unitTextures.push_back( effects.front()->getInput( 0 ) );
+
+    std::vector< Effect* >::const_iterator eit;
+    for( eit = effects.begin(); eit != effects.end(); eit++ )
+    {
+        unsigned int input;
+        for( input = 1; input < 4; input++ )
+        {
+            osg::Texture* texture( (*eit)->getInput( input ) );
+            if( texture == NULL )
+            {
+                units.push_back( ~0u );
+                continue;
+            }
+            std::vector< osg::Texture* >::const_iterator tit(
+                std::find( unitTextures.begin(), unitTextures.end(), texture ) );
+            units.push_back( (unsigned int)( tit - unitTextures.begin() ) );
+            if( tit == unitTextures.end() )
+                unitTextures.push_back( texture );
+        }
+    }
+}
+
+// Draws a fused pointwise run with its generated program. Reads the run's
+// inputs on the units from assignUnits(), applies the union of the member
+// uniforms, and writes the output of the last member. It remembers each
+// member's uniform list and snippet, so the graph can tell when the
+// generated program or the union is out of date.
+class FusedEffect : public Effect
+{
+public:
+    FusedEffect() {}
+    FusedEffect( const std::vector< Effect* >& effects, osg::Program* program,
+            const std::vector< osg::Texture* >& unitTextures )
+    {
+        _program = program;
+
+        _textureUniform.resize( unitTextures.size() );
+        unsigned int unit;
+        for( unit = 0; unit < unitTextures.size(); unit++ )
+        {
+            std::ostringstream ostr;
+            ostr << "bdfx_fusedTexture" << unit;
+            osg::Uniform* uniform( new osg::Uniform( osg::Uniform::SAMPLER_2D, ostr.str(), 1 ) );
+            uniform->set( (int)unit );
+            _textureUniform[ unit ] = uniform;
+            _inputs[ unit ] = unitTextures[ unit ];
+        }
+
+        std::string name( "Fused(" );
+        std::vector< Effect* >::const_iterator eit;
+        for( eit = effects.begin(); eit != effects.end(); eit++ )
+        {
+            const UniformVector& uniforms( (*eit)->getUniforms() );
+            _uniforms.insert( _uniforms.end(), uniforms.begin(), uniforms.end() );
+            _members.push_back( *eit );
+            _memberUniforms.push_back( uniforms );
+            _memberSources.push_back( (*eit)->getPointwiseShader()->getShaderSource() );
+            if( eit != effects.begin() )
+                name += "+";
+            name += (*eit)->getName().empty() ? (*eit)->className() : (*eit)->getName();
+        }
+        setName( name + ")" );
+
+        _output = effects.back()->getOutput();
+    }
+    FusedEffect( const FusedEffect& rhs, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY )
+      : Effect( rhs, copyop ),
+        _members( rhs._members ),
+        _memberUniforms( rhs._memberUniforms ),
+        _memberSources( rhs._memberSources )
+    {}
+    META_Object(backdropFX,FusedEffect);
+
+    // False if a member's uniform list or snippet changed since fusion.
+    bool isCurrent() const
+    {
+        unsigned int idx;
+        for( idx = 0; idx < _members.size(); idx++ )
+        {
+            const osg::Shader* shader( _members[ idx ]->getPointwiseShader() );
+            if( ( shader == NULL ) || ( shader->getShaderSource() != _memberSources[ idx ] ) ||
+                ( _members[ idx ]->getUniforms() != _memberUniforms[ idx ] ) )
+                return( false );
+        }
+        return( true );
+    }
+
+protected:
+    ~FusedEffect() {}
+
+    EffectVector _members;
+    std::vector< UniformVector > _memberUniforms;
+    std::vector< std::string > _memberSources;
+};
+/** \endcond */
+
+
+
+EffectGraph::EffectGraph()
+  : _dirty( true ),
+    _optimize( true ),
+    _compileCount( 0 ),
+    // Sized up front, so a draw never reallocates the snapshot another
+    // context is drawing from.
+    _snapshots( osg::DisplaySettings::instance()->getMaxNumberOfGraphicsContexts() ),
+    _numNodes( 0 ),
+    _numDrawnNodes( 0 ),
+    _numPasses( 0 ),
+    _numDrawnPasses( 0 ),
+    _numFusedEffects( 0 ),
+    _numFusedPrograms( 0 ),
+    _numTransients( 0 ),
+    _numAllocated( 0 ),
+    _transientBytes( 0 ),
+    _allocatedBytes( 0 )
+{
+}
+EffectGraph::~EffectGraph()
+{
+}
+
+
+void
+EffectGraph::addNode( Effect* effect, unsigned int numPasses )
+{
+    Node node;
+    node._effect = effect;
+    node._numPasses = numPasses;
+    node._last = false;
+    node._live = true;
+    node._fused = false;
+    _building.push_back( node );
+}
+
+void
+EffectGraph::addRead( osg::Texture* texture )
+{
+    if( _building.empty() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectGraph: addRead() without addNode()." << std::endl;
+        return;
+    }
+    if( texture != NULL )
+        _building.back()._reads.push_back( texture );
+}
+
+void
+EffectGraph::addWrite( osg::Texture* texture, bool transient )
+{
+    if( _building.empty() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectGraph: addWrite() without addNode()." << std::endl;
+        return;
+    }
+
+    Resource resource;
+    resource._texture = texture;
+    // Only Texture2D render targets can be aliased.
+    osg::Texture2D* tex2D( dynamic_cast< osg::Texture2D* >( texture ) );
+    resource._transient = transient && ( tex2D != NULL );
+    resource._width = ( tex2D != NULL ) ? tex2D->getTextureWidth() : 0;
+    resource._height = ( tex2D != NULL ) ? tex2D->getTextureHeight() : 0;
+    resource._format = ( texture != NULL ) ? texture->getInternalFormat() : 0;
+    _building.back()._writes.push_back( resource );
+}
+
+void
+EffectGraph::addTemporary( osg::Texture* texture )
+{
+    if( _building.empty() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectGraph: addTemporary() without addNode()." << std::endl;
+        return;
+    }
+    if( texture == NULL )
+        return;
+
+    osg::Texture2D* tex2D( dynamic_cast< osg::Texture2D* >( texture ) );
+    Resource resource;
+    resource._texture = texture;
+    resource._transient = ( tex2D != NULL );
+    resource._width = ( tex2D != NULL ) ? tex2D->getTextureWidth() : 0;
+    resource._height = ( tex2D != NULL ) ? tex2D->getTextureHeight() : 0;
+    resource._format = texture->getInternalFormat();
+    _building.back()._temporaries.push_back( resource );
+}
+
+
+bool
+EffectGraph::compile( const EffectVector& effectVector )
+{
+    // Contexts that share the RenderingEffects compile in turn. Only the
+    // first one after a change does any work.
+    OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+    if( !needsCompile( effectVector ) )
+        return( false );
+
+    _building.clear();
+    _revisions.clear();
+    EffectVector::const_iterator it;
+    for( it = effectVector.begin(); it != effectVector.end(); it++ )
+    {
+        const unsigned int firstNode( (unsigned int)( _building.size() ) );
+        (*it)->addGraphNodes( this );
+        if( (*it) == effectVector.back() )
+        {
+            unsigned int idx;
+            for( idx = firstNode; idx < _building.size(); idx++ )
+                _building[ idx ]._last = true;
+        }
+        _revisions.push_back( std::make_pair( *it, (*it)->getGraphRevision() ) );
+    }
+
+    _nodes.swap( _building );
+    _building.clear();
+    _dirty = false;
+
+    internalCompile();
+    _compileCount++;
+    return( true );
+}
+
+bool
+EffectGraph::needsCompile( const EffectVector& effectVector ) const
+{
+    if( _dirty || ( effectVector.size() != _revisions.size() ) )
+        return( true );
+
+    unsigned int idx;
+    for( idx = 0; idx < effectVector.size(); idx++ )
+    {
+        if( ( effectVector[ idx ] != _revisions[ idx ].first ) ||
+            ( effectVector[ idx ]->getGraphRevision() != _revisions[ idx ].second ) )
+            return( true );
+    }
+
+    // Fused programs and uniform lists are generated from the members, so
+    // regenerate them if a member's snippet or uniforms changed.
+    NodeVector::const_iterator it;
+    for( it = _drawNodes.begin(); it != _drawNodes.end(); it++ )
+    {
+        if( it->_fused && !( static_cast< const FusedEffect* >( it->_effect.get() )->isCurrent() ) )
+            return( true );
+    }
+    return( false );
+}
+
+void
+EffectGraph::dirty()
+{
+    OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+    _dirty = true;
+}
+
+void
+EffectGraph::setOptimize( bool optimize )
+{
+    OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+    if( _optimize != optimize )
+    {
+        _optimize = optimize;
+        dirty();
+    }
+}
+
+
+void
+EffectGraph::internalCompile()
+{
+    _slots.clear();
+    _aliases.clear();
+
+    //
+    // Liveness. Textures read before any node writes them carry data from
+    // the previous frame, so their writers are always live. Then walk
+    // backwards, tracking the transient textures that later live nodes
+    // still need.
+    //
+    _persistent.clear();
+    std::set< const osg::Texture* > written;
+    NodeVector::const_iterator nit;
+    for( nit = _nodes.begin(); nit != _nodes.end(); nit++ )
+    {
+        TextureVector::const_iterator tit;
+        for( tit = nit->_reads.begin(); tit != nit->_reads.end(); tit++ )
+        {
+            if( written.find( tit->get() ) == written.end() )
+                _persistent.insert( tit->get() );
+        }
+        ResourceVector::const_iterator wit;
+        for( wit = nit->_writes.begin(); wit != nit->_writes.end(); wit++ )
+            written.insert( wit->_texture.get() );
+    }
+
+    std::set< const osg::Texture* > needed( _persistent );
+    NodeVector::reverse_iterator rit;
+    for( rit = _nodes.rbegin(); rit != _nodes.rend(); rit++ )
+    {
+        Node& node( *rit );
+
+        bool live( !_optimize || node._last || node._writes.empty() );
+        ResourceVector::const_iterator wit;
+        for( wit = node._writes.begin(); !live && ( wit != node._writes.end() ); wit++ )
+        {
+            if( !( wit->_transient ) || ( needed.find( wit->_texture.get() ) != needed.end() ) )
+                live = true;
+        }
+        node._live = live;
+        if( !live )
+            continue;
+
+        // This node produces its transient outputs, so earlier writers of
+        // the same textures aren't needed for them...
+        for( wit = node._writes.begin(); wit != node._writes.end(); wit++ )
+        {
+            if( wit->_transient && ( _persistent.find( wit->_texture.get() ) == _persistent.end() ) )
+                needed.erase( wit->_texture.get() );
+        }
+        // ...but they are needed for what this node reads.
+        TextureVector::const_iterator tit;
+        for( tit = node._reads.begin(); tit != node._reads.end(); tit++ )
+            needed.insert( tit->get() );
+    }
+
+
+    //
+    // Fusion. Collect runs of live pointwise nodes, each reading only the
+    // previous node's output, and draw each run as one node.
+    //
+    _readCounts.clear();
+    for( nit = _nodes.begin(); nit != _nodes.end(); nit++ )
+    {
+        if( !( nit->_live ) )
+            continue;
+        TextureVector::const_iterator tit;
+        for( tit = nit->_reads.begin(); tit != nit->_reads.end(); tit++ )
+            _readCounts[ tit->get() ]++;
+    }
+
+    _drawNodes.clear();
+    _numFusedEffects = _numFusedPrograms = 0;
+    unsigned int idx( 0 );
+    while( idx < _nodes.size() )
+    {
+        if( !( _nodes[ idx ]._live ) )
+        {
+            idx++;
+            continue;
+        }
+
+        std::vector< unsigned int > run;
+        run.push_back( idx );
+        if( _optimize && isPointwise( _nodes[ idx ] ) )
+        {
+            unsigned int next( idx + 1 );
+            while( next < _nodes.size() )
+            {
+                if( !( _nodes[ next ]._live ) )
+                    next++;
+                else if( canFuse( run, next ) )
+                    run.push_back( next++ );
+                else
+                    break;
+            }
+        }
+
+        if( run.size() > 1 )
+            _drawNodes.push_back( fuse( run ) );
+        else
+            _drawNodes.push_back( _nodes[ idx ] );
+        idx = run.back() + 1;
+    }
+
+    // Drop the generated programs this graph doesn't draw. Snapshots that
+    // still draw one hold a reference until their context takes the new
+    // graph.
+    std::set< const osg::Program* > fusedPrograms;
+    for( nit = _drawNodes.begin(); nit != _drawNodes.end(); nit++ )
+    {
+        if( nit->_fused )
+            fusedPrograms.insert( nit->_effect->getProgram() );
+    }
+    ProgramMap::iterator pit( _fusedPrograms.begin() );
+    while( pit != _fusedPrograms.end() )
+    {
+        if( fusedPrograms.find( pit->second.get() ) == fusedPrograms.end() )
+            _fusedPrograms.erase( pit++ );
+        else
+            pit++;
+    }
+
+
+    //
+    // Lifetimes of transient textures, over the nodes that draw.
+    //
+    _numNodes = (unsigned int)( _nodes.size() );
+    _numPasses = 0;
+    _transientBytes = 0;
+
+    // Count every transient texture, live or not, for the report.
+    std::set< const osg::Texture* > allTransients;
+    for( nit = _nodes.begin(); nit != _nodes.end(); nit++ )
+    {
+        _numPasses += nit->_numPasses;
+
+        ResourceVector resources( nit->_writes );
+        resources.insert( resources.end(), nit->_temporaries.begin(), nit->_temporaries.end() );
+        ResourceVector::const_iterator rsit;
+        for( rsit = resources.begin(); rsit != resources.end(); rsit++ )
+        {
+            if( rsit->_transient && allTransients.insert( rsit->_texture.get() ).second )
+                _transientBytes += textureBytes( static_cast< const osg::Texture2D* >( rsit->_texture.get() ) );
+        }
+    }
+
+    typedef std::map< const osg::Texture*, Lifetime > LifetimeMap;
+    LifetimeMap lifetimes;
+    unsigned int order( 0 );
+    _numDrawnNodes = (unsigned int)( _drawNodes.size() );
+    _numDrawnPasses = 0;
+    for( idx = 0; idx < _drawNodes.size(); idx++ )
+    {
+        const Node& node( _drawNodes[ idx ] );
+        _numDrawnPasses += node._numPasses;
+
+        ResourceVector resources( node._writes );
+        resources.insert( resources.end(), node._temporaries.begin(), node._temporaries.end() );
+        ResourceVector::const_iterator rsit;
+        for( rsit = resources.begin(); rsit != resources.end(); rsit++ )
+        {
+            if( !( rsit->_transient ) )
+                continue;
+            Lifetime& lifetime( lifetimes[ rsit->_texture.get() ] );
+            if( lifetime._order == 0 )
+            {
+                lifetime._texture = static_cast< osg::Texture2D* >( rsit->_texture.get() );
+                lifetime._order = ++order;
+            }
+            lifetime._first = osg::minimum( lifetime._first, idx );
+            lifetime._last = osg::maximum( lifetime._last, idx );
+        }
+
+        TextureVector::const_iterator tit;
+        for( tit = node._reads.begin(); tit != node._reads.end(); tit++ )
+        {
+            if( allTransients.find( tit->get() ) == allTransients.end() )
+                // External texture.
+                continue;
+            Lifetime& lifetime( lifetimes[ tit->get() ] );
+            if( lifetime._order == 0 )
+            {
+                lifetime._texture = static_cast< osg::Texture2D* >( tit->get() );
+                lifetime._order = ++order;
+            }
+            lifetime._last = osg::maximum( lifetime._last, idx );
+        }
+    }
+    _numTransients = (unsigned int)( allTransients.size() );
+
+
+    if( !_optimize )
+    {
+        // Every live transient keeps its own texture.
+        _numAllocated = (unsigned int)( lifetimes.size() );
+        _allocatedBytes = 0;
+        LifetimeMap::const_iterator lit;
+        for( lit = lifetimes.begin(); lit != lifetimes.end(); lit++ )
+            _allocatedBytes += textureBytes( lit->second._texture );
+    }
+    else
+    {
+        //
+        // Assign transients to slots in order of their first use. A slot is
+        // free once the last node that uses its current texture has drawn.
+        // The first texture assigned to a slot provides its storage.
+        //
+        std::vector< Lifetime > ordered;
+        LifetimeMap::const_iterator lit;
+        for( lit = lifetimes.begin(); lit != lifetimes.end(); lit++ )
+            ordered.push_back( lit->second );
+        std::sort( ordered.begin(), ordered.end() );
+
+        _allocatedBytes = 0;
+        std::vector< Lifetime >::const_iterator oit;
+        for( oit = ordered.begin(); oit != ordered.end(); oit++ )
+        {
+            const Lifetime& lifetime( *oit );
+            // Persistent textures keep their contents between frames, so
+            // they never share.
+            const bool keep( _persistent.find( lifetime._texture ) != _persistent.end() );
+
+            unsigned int slotIdx( (unsigned int)( _slots.size() ) );
+            if( !keep )
+            {
+                unsigned int sIdx;
+                for( sIdx = 0; sIdx < _slots.size(); sIdx++ )
+                {
+                    if( ( _slots[ sIdx ]._busyUntil < lifetime._first ) &&
+                        compatible( _slots[ sIdx ]._texture.get(), lifetime._texture ) )
+                    {
+                        slotIdx = sIdx;
+                        break;
+                    }
+                }
+            }
+            if( slotIdx == _slots.size() )
+            {
+                Slot slot;
+                slot._texture = lifetime._texture;
+                slot._fbo = new osg::FrameBufferObject;
+                UTIL_MEMORY_CHECK( slot._fbo.get(), "EffectGraph slot FBO", );
+                slot._fbo->setAttachment( osg::Camera::COLOR_BUFFER0,
+                    osg::FrameBufferAttachment( lifetime._texture ) );
+                _slots.push_back( slot );
+                _allocatedBytes += textureBytes( lifetime._texture );
+            }
+            _slots[ slotIdx ]._busyUntil = keep ? ~0u : lifetime._last;
+            _aliases[ lifetime._texture ] = slotIdx;
+        }
+        _numAllocated = (unsigned int)( _slots.size() );
+    }
+
+    osg::notify( osg::INFO ) << "backdropFX: EffectGraph: Drawing " <<
+        _numDrawnPasses << " of " << _numPasses << " passes (" <<
+        _numDrawnNodes << " of " << _numNodes << " Effects, " <<
+        _numFusedEffects << " fused into " << _numFusedPrograms << " programs), " <<
+        _numAllocated << " of " << _numTransients << " transient textures (" <<
+        _allocatedBytes / 1024 << " of " << _transientBytes / 1024 << " KB)." << std::endl;
+}
+
+
+bool
+EffectGraph::isPointwise( const Node& node ) const
+{
+    return( ( node._effect->getPointwiseShader() != NULL ) &&
+        ( node._numPasses == 1 ) &&
+        node._temporaries.empty() &&
+        ( node._writes.size() == 1 ) );
+}
+
+bool
+EffectGraph::canFuse( const std::vector< unsigned int >& run, unsigned int next ) const
+{
+    const Node& last( _nodes[ run.back() ] );
+    const Node& node( _nodes[ next ] );
+    if( !isPointwise( node ) )
+        return( false );
+
+    // The run's output must be an intermediate that only this node reads,
+    // as its input 0, at the same size.
+    const Resource& out( last._writes.front() );
+    if( !( out._transient ) || !( out._texture.valid() ) ||
+        ( _persistent.find( out._texture.get() ) != _persistent.end() ) )
+        return( false );
+    TextureCountMap::const_iterator cit( _readCounts.find( out._texture.get() ) );
+    if( ( cit == _readCounts.end() ) || ( cit->second != 1 ) )
+        return( false );
+    if( node._effect->getInput( 0 ) != out._texture.get() )
+        return( false );
+    const Resource& nodeOut( node._writes.front() );
+    if( nodeOut._texture.valid() &&
+        ( ( nodeOut._width != out._width ) || ( nodeOut._height != out._height ) ) )
+        return( false );
+
+    // Each snippet defines its own uniforms, so the same snippet can't
+    // appear twice, and uniform names must not collide.
+    const std::string& source( node._effect->getPointwiseShader()->getShaderSource() );
+    std::set< std::string > names;
+    std::vector< Effect* > effects;
+    std::vector< unsigned int >::const_iterator it;
+    for( it = run.begin(); it != run.end(); it++ )
+    {
+        Effect* effect( _nodes[ *it ]._effect.get() );
+        if( effect->getPointwiseShader()->getShaderSource() == source )
+            return( false );
+        const Effect::UniformVector& uniforms( effect->getUniforms() );
+        Effect::UniformVector::const_iterator uit;
+        for( uit = uniforms.begin(); uit != uniforms.end(); uit++ )
+            names.insert( (*uit)->getName() );
+        effects.push_back( effect );
+    }
+    const Effect::UniformVector& uniforms( node._effect->getUniforms() );
+    Effect::UniformVector::const_iterator uit;
+    for( uit = uniforms.begin(); uit != uniforms.end(); uit++ )
+    {
+        if( names.find( (*uit)->getName() ) != names.end() )
+            return( false );
+    }
+
+    effects.push_back( node._effect.get() );
+    std::vector< osg::Texture* > unitTextures;
+    std::vector< unsigned int > units;
+    assignUnits( effects, unitTextures, units );
+    return( unitTextures.size() <= MaxFusedUnits );
+}
+
+EffectGraph::Node
+EffectGraph::fuse( const std::vector< unsigned int >& run )
+{
+    std::vector< Effect* > effects;
+    std::set< const osg::Texture* > intermediates;
+    std::vector< unsigned int >::const_iterator it;
+    for( it = run.begin(); it != run.end(); it++ )
+    {
+        effects.push_back( _nodes[ *it ]._effect.get() );
+        if( *it != run.back() )
+            intermediates.insert( _nodes[ *it ]._writes.front()._texture.get() );
+    }
+
+    std::vector< osg::Texture* > unitTextures;
+    std::vector< unsigned int > units;
+    assignUnits( effects, unitTextures, units );
+
+    Node node;
+    node._effect = new FusedEffect( effects,
+        getFusedProgram( effects, units, (unsigned int)( unitTextures.size() ) ), unitTextures );
+    node._numPasses = 1;
+    node._writes = _nodes[ run.back() ]._writes;
+    node._last = _nodes[ run.back() ]._last;
+    node._live = true;
+    node._fused = true;
+    for( it = run.begin(); it != run.end(); it++ )
+    {
+        TextureVector::const_iterator tit;
+        for( tit = _nodes[ *it ]._reads.begin(); tit != _nodes[ *it ]._reads.end(); tit++ )
+        {
+            if( ( intermediates.find( tit->get() ) == intermediates.end() ) &&
+                ( std::find( node._reads.begin(), node._reads.end(), *tit ) == node._reads.end() ) )
+                node._reads.push_back( *tit );
+        }
+    }
+
+    _numFusedEffects += (unsigned int)( run.size() );
+    _numFusedPrograms++;
+    return( node );
+}
+
+osg::Program*
+EffectGraph::getFusedProgram( const std::vector< Effect* >& effects,
+    const std::vector< unsigned int >& units, unsigned int numUnits )
+{
+    // Each snippet sees its inputs under their usual names, and defines
+    // pointwise() under a name of its own.
+    std::ostringstream ostr;
+    ostr << "\nBDFX INCLUDE shaders/effects/declarations.common\n\n";
+    unsigned int idx;
+    for( idx = 0; idx < numUnits; idx++ )
+        ostr << "uniform sampler2D bdfx_fusedTexture" << idx << ";\n";
+    for( idx = 0; idx < effects.size(); idx++ )
+    {
+        ostr << "\n";
+        unsigned int input;
+        for( input = 1; input < 4; input++ )
+        {
+            const unsigned int unit( units[ idx * 3 + input - 1 ] );
+            if( unit != ~0u )
+                ostr << "#define inputTexture" << input << " bdfx_fusedTexture" << unit << "\n";
+        }
+        ostr << "#define pointwise bdfx_pointwise" << idx << "\n";
+        ostr << effects[ idx ]->getPointwiseShader()->getShaderSource() << "\n";
+        ostr << "#undef pointwise\n";
+        for( input = 1; input < 4; input++ )
+        {
+            if( units[ idx * 3 + input - 1 ] != ~0u )
+                ostr << "#undef inputTexture" << input << "\n";
+        }
+    }
+    ostr << "\nvoid main( void )\n{\n" <<
+        "    vec4 color = texture2D( bdfx_fusedTexture0, oTC );\n";
+    for( idx = 0; idx < effects.size(); idx++ )
+        ostr << "    color = bdfx_pointwise" << idx << "( color, oTC );\n";
+    ostr << "    gl_FragColor = color;\n}\n";
+    const std::string source( ostr.str() );
+
+    ProgramMap::const_iterator pit( _fusedPrograms.find( source ) );
+    if( pit != _fusedPrograms.end() )
+        return( pit->second.get() );
+
+    if( !( _fusedVertexShader.valid() ) )
+    {
+        __LOAD_SHADER( _fusedVertexShader, osg::Shader::VERTEX, "shaders/effects/none.vs" );
+    }
+    osg::ref_ptr< osg::Shader > fragment( new osg::Shader( osg::Shader::FRAGMENT ) );
+    UTIL_MEMORY_CHECK( fragment.get(), "EffectGraph fused Shader", NULL );
+    fragment->setName( "fused-pointwise.fs" );
+    fragment->setShaderSource( source );
+    backdropFX::shaderPreProcess( fragment.get() );
+
+    osg::ref_ptr< osg::Program > program( new osg::Program );
+    UTIL_MEMORY_CHECK( program.get(), "EffectGraph fused Program", NULL );
+    program->setName( "EffectGraph fused" );
+    program->addShader( _fusedVertexShader.get() );
+    program->addShader( fragment.get() );
+    _fusedPrograms[ source ] = program;
+
+    osg::notify( osg::INFO ) << "backdropFX: EffectGraph: Generated " <<
+        program->getName() << " program for " << effects.size() << " Effects." << std::endl;
+    return( program.get() );
+}
+
+
+void
+EffectGraph::draw( const EffectVector& effectVector, RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo )
+{
+    DrawSnapshot* snapshot;
+    {
+        // Only the compile and the copy need the lock. Effects shared with
+        // another context's snapshot stay alive until it takes the new graph.
+        OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+        compile( effectVector );
+
+        snapshot = &( _snapshots[ renderInfo.getContextID() ] );
+        if( snapshot->_compileCount != _compileCount )
+        {
+            snapshot->_compileCount = _compileCount;
+            snapshot->_nodes = _drawNodes;
+            snapshot->_aliases.clear();
+            TextureSlotMap::const_iterator ait;
+            for( ait = _aliases.begin(); ait != _aliases.end(); ait++ )
+                snapshot->_aliases[ ait->first ] = _slots[ ait->second ];
+        }
+    }
+
+    NodeVector::const_iterator it;
+    for( it = snapshot->_nodes.begin(); it != snapshot->_nodes.end(); it++ )
+        it->_effect->draw( rfxs, renderInfo, it->_last );
+}
+
+
+osg::Texture*
+EffectGraph::getTexture( unsigned int contextID, osg::Texture* texture ) const
+{
+    if( contextID >= _snapshots.size() )
+        return( texture );
+    const DrawSnapshot::AliasMap& aliases( _snapshots[ contextID ]._aliases );
+    DrawSnapshot::AliasMap::const_iterator it( aliases.find( texture ) );
+    if( it == aliases.end() )
+        return( texture );
+    return( it->second._texture.get() );
+}
+
+osg::FrameBufferObject*
+EffectGraph::getFBO( unsigned int contextID, const osg::Texture* texture ) const
+{
+    if( contextID >= _snapshots.size() )
+        return( NULL );
+    const DrawSnapshot::AliasMap& aliases( _snapshots[ contextID ]._aliases );
+    DrawSnapshot::AliasMap::const_iterator it( aliases.find( texture ) );
+    if( it == aliases.end() )
+        return( NULL );
+    return( it->second._fbo.get() );
+}
+
+
+void
+EffectGraph::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+    SlotVector::iterator it;
+    for( it = _slots.begin(); it != _slots.end(); it++ )
+        it->_fbo->resizeGLObjectBuffers( maxSize );
+    _snapshots.resize( maxSize );
+}
+
+void
+EffectGraph::releaseGLObjects( osg::State* state ) const
+{
+    OpenThreads::ScopedLock< OpenThreads::ReentrantMutex > lock( _mutex );
+    // The slot textures belong to Effects, which release them.
+    SlotVector::const_iterator it;
+    for( it = _slots.begin(); it != _slots.end(); it++ )
+        it->_fbo->releaseGLObjects( state );
+    ProgramMap::const_iterator pit;
+    for( pit = _fusedPrograms.begin(); pit != _fusedPrograms.end(); pit++ )
+        pit->second->releaseGLObjects( state );
+
+    // A snapshot can hold the FBOs of an earlier compile. Discard it, so
+    // the context copies the current graph when it draws again.
+    unsigned int idx;
+    for( idx = 0; idx < _snapshots.size(); idx++ )
+    {
+        if( ( state != NULL ) && ( state->getContextID() != idx ) )
+            continue;
+        DrawSnapshot& snapshot( _snapshots[ idx ] );
+        DrawSnapshot::AliasMap::const_iterator ait;
+        for( ait = snapshot._aliases.begin(); ait != snapshot._aliases.end(); ait++ )
+            ait->second._fbo->releaseGLObjects( state );
+        snapshot = DrawSnapshot();
+    }
+}
+
+
+// namespace backdropFX
+}
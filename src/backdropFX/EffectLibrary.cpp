@@ -3,6 +3,7 @@
 #include <backdropFX/Manager.h>
 #include <backdropFX/EffectLibrary.h>
 #include <backdropFX/Effect.h>
+#include <backdropFX/EffectGraph.h>
 #include <backdropFX/RenderingEffects.h>
 #include <backdropFX/RTTViewport.h>
 #include <backdropFX/EffectLibraryUtils.h>
@@ -10,6 +11,7 @@
 #include <osgDB/ReadFile>
 #include <osg/Program>
 #include <osg/Texture2D>
+#include <osg/Math>
 #include <osgwTools/Version.h>
 #include <osgwTools/FBOUtils.h>
 #include <backdropFX/Utils.h>
@@ -25,17 +27,19 @@ namespace backdropFX
 
 
 EffectSeperableBlur::EffectSeperableBlur()
-  : Effect()
+  : Effect(),
+    _resolution( 1.f ),
+    _sigma( .016f )
 {
-    _horizontal = createEffectProgram( "blurHorizontal" );
-    _vertical = createEffectProgram( "blurVertical" );
+    // setTextureWidthHeight() converts sigma to texels.
+    _kernel = new GaussianKernel;
+    UTIL_MEMORY_CHECK( _kernel.get(), "EffectSeperableBlur _kernel", )
 
     _hBlur = new osg::Texture2D;
     UTIL_MEMORY_CHECK( _hBlur.get(), "EffectSeperableBlur _hBlur", )
-    // TBD can't hard code this size.
-    _hBlur->setTextureSize( 800, 600 );
-    _hBlur->dirtyTextureObject();
-    _hBlur->setInternalFormat( GL_RGBA );
+    // setTextureWidthHeight() sizes the texture. The format follows the
+    // hdr feature flag, like the outputs attachOutputTo() creates.
+    setTextureFormat( _hBlur.get(), backdropFX::Manager::instance()->getHDR() );
     _hBlur->setBorderWidth( 0 );
     _hBlur->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
     _hBlur->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
@@ -46,8 +50,9 @@ EffectSeperableBlur::EffectSeperableBlur()
 }
 EffectSeperableBlur::EffectSeperableBlur( const EffectSeperableBlur& rhs, const osg::CopyOp& copyop )
   : Effect( rhs, copyop ),
-    _horizontal( rhs._horizontal ),
-    _vertical( rhs._vertical ),
+    _resolution( rhs._resolution ),
+    _sigma( rhs._sigma ),
+    _kernel( rhs._kernel ),
     _hBlur( rhs._hBlur ),
     _hBlurFBO( rhs._hBlurFBO )
 {
@@ -76,30 +81,18 @@ EffectSeperableBlur::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderI
 
     // Step 1
     // Render input texture into hBlur.
-    _hBlurFBO->apply( state );
+    getGraphFBO( rfxs, state, _hBlurFBO.get() )->apply( state );
     UTIL_GL_FBO_ERROR_CHECK( "EffectSeperableBlur _hBlurFBO", fboExt );
+    const osg::Vec2 scale( _resolution, _resolution );
+    applyScaledViewport( rfxs, state, scale );
 
-    state.applyAttribute( _horizontal.get() );
-    osg::Uniform* uniform = _textureUniform[ 0 ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
-    {
-        osg::Uniform* uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( uniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( uniform->getName() );
-#endif
-        if( location >= 0 )
-            uniform->apply( gl2Ext, location );
-    }
+    _kernel->apply( state, osg::Vec2( 1.f / (float)_width, 0.f ) );
+    _uniformLocations.apply( state, gl2Ext, FirstTextureSlot, _textureUniform[ 0 ].get() );
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
 
     IntTextureMap::const_iterator inItr = _inputs.find( 0 );
     state.setActiveTextureUnit( 0 );
-    osg::Texture* texture = inItr->second.get();
+    osg::Texture* texture = getGraphTexture( rfxs, state, inItr->second.get() );
     state.applyTextureAttribute( 0, texture );
 
     internalDraw( renderInfo );
@@ -115,7 +108,7 @@ EffectSeperableBlur::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderI
         osg::notify( osg::INFO ) << "Effect: applying local Effect FBO." << std::endl;
 
         // We have an FBO assigned, use it.
-        fbo = _output.get();
+        fbo = getGraphFBO( rfxs, state, _output.get() );
     }
     else
     {
@@ -137,41 +130,29 @@ EffectSeperableBlur::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderI
  
     // If the 'last' flag is set, apply the full viewport.
     backdropFX::RTTViewport* rttvp = last ? dynamic_cast< backdropFX::RTTViewport* >( rfxs->getViewport() ) : NULL;
+    const osg::Viewport* vp;
     if( rttvp != NULL )
+    {
         rttvp->applyFullViewport( state );
+        vp = rttvp;
+    }
     else
-        state.applyAttribute( rfxs->getViewport() );
+        // The RenderingEffects output is full size.
+        vp = applyScaledViewport( rfxs, state, last ? osg::Vec2( 1.f, 1.f ) : scale );
 
 
     // OK, do the blur now...
-    state.applyAttribute( _vertical.get() );
-    uniform = _textureUniform[ 0 ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
-    {
-        osg::Uniform* uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-        GLint location = state.getUniformLocation( uniform->getNameID() );
-#else
-        GLint location = state.getUniformLocation( uniform->getName() );
-#endif
-        if( location >= 0 )
-            uniform->apply( gl2Ext, location );
-    }
+    _kernel->apply( state, osg::Vec2( 0.f, 1.f / (float)_height ) );
+    _uniformLocations.apply( state, gl2Ext, FirstTextureSlot, _textureUniform[ 0 ].get() );
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
 
     state.setActiveTextureUnit( 0 );
-    state.applyTextureAttribute( 0, _hBlur.get() );
+    state.applyTextureAttribute( 0, getGraphTexture( rfxs, state, _hBlur.get() ) );
 
     internalDraw( renderInfo );
 
     if( ( renderingEffects->getDebugMode() & backdropFX::BackdropCommon::debugImages ) != 0 )
-    {
-        const osg::Viewport* vp = rfxs->getViewport();
         dumpImage( vp, renderingEffects->debugImageBaseFileName( contextID ) );
-    }
 
 
     if( rttvp != NULL )
@@ -183,6 +164,7 @@ void
 EffectSeperableBlur::setTextureWidthHeight( unsigned int texW, unsigned int texH )
 {
     Effect::setTextureWidthHeight( texW, texH );
+    _kernel->setSigma( _sigma * texW );
 
     _hBlur->setTextureSize( texW, texH );
     _hBlur->dirtyTextureObject();
@@ -191,31 +173,70 @@ EffectSeperableBlur::setTextureWidthHeight( unsigned int texW, unsigned int texH
     _hBlurFBO = NULL;
 }
 
+void
+EffectSeperableBlur::setHDR( bool hdr )
+{
+    Effect::setHDR( hdr );
+
+    setTextureFormat( _hBlur.get(), hdr );
+    _hBlur->dirtyTextureObject();
+
+    // Force rebuild of FBOs.
+    _hBlurFBO = NULL;
+    // The format decides which temporaries the EffectGraph can alias.
+    dirtyGraph();
+}
+
+void
+EffectSeperableBlur::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    Effect::resizeGLObjectBuffers( maxSize );
+    _kernel->resizeGLObjectBuffers( maxSize );
+}
+void
+EffectSeperableBlur::releaseGLObjects( osg::State* state ) const
+{
+    Effect::releaseGLObjects( state );
+    _kernel->releaseGLObjects( state );
+}
+
+void
+EffectSeperableBlur::addGraphNodes( EffectGraph* graph )
+{
+    graph->addNode( this, 2 );
+    graph->addRead( getInput( 0 ) );
+    graph->addTemporary( _hBlur.get() );
+    graph->addWrite( getOutputTexture(), _transientOutput );
+}
+
+void
+EffectSeperableBlur::setResolution( float resolution )
+{
+    _resolution = resolution;
+}
+
+void
+EffectSeperableBlur::setSigma( float sigma )
+{
+    _sigma = sigma;
+    _kernel->setSigma( _sigma * _width );
+}
+
 
 GaussConvolution::GaussConvolution()
     :
     Effect(),
-    m_viewportSize(
-        new osg::Uniform( "viewportSize", osg::Vec2( 800.0, 600.0 ) ) ),
-    m_viewport( new osg::Viewport( 0, 0, 0, 0 ) ),
-    m_1Dx( createEffectProgram( "gaussConvolution1Dx" ) ),
-    m_1Dy( createEffectProgram( "gaussConvolution1Dy" ) ),
+    m_resolution( 1.f ),
+    m_kernel( new GaussianKernel() ),
     m_tex2D( new osg::Texture2D() ),
     m_fbo( new osg::FrameBufferObject() )
 {
-    UTIL_MEMORY_CHECK(
-        m_viewportSize.get(), "GaussConvolution Viewport Size Uniform", );
-
-    UTIL_MEMORY_CHECK( m_viewport.get(), "GaussConvolution m_viewport", )
-
-    UTIL_MEMORY_CHECK( m_1Dx.get(), "GaussConvolution m_1Dx", )
-    UTIL_MEMORY_CHECK( m_1Dy.get(), "GaussConvolution m_1Dy", )
+    UTIL_MEMORY_CHECK( m_kernel.get(), "GaussConvolution m_kernel", )
 
     UTIL_MEMORY_CHECK( m_tex2D.get(), "GaussConvolution m_tex2D", )
-    //TBD can't hard code this size
-    m_tex2D->setTextureSize( 800, 600 );
-    m_tex2D->dirtyTextureObject();
-    m_tex2D->setInternalFormat( GL_RGBA );
+    //setTextureWidthHeight() sizes the texture, the hdr feature flag
+    //sets the format
+    setTextureFormat( m_tex2D.get(), backdropFX::Manager::instance()->getHDR() );
     m_tex2D->setBorderWidth( 0 );
     m_tex2D->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
     m_tex2D->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
@@ -233,10 +254,8 @@ GaussConvolution::GaussConvolution(
     osg::CopyOp const& copyop )
     :
     Effect( rhs, copyop ),
-    m_viewportSize( rhs.m_viewportSize ),
-    m_viewport( rhs.m_viewport ),
-    m_1Dx( rhs.m_1Dx ),
-    m_1Dy( rhs.m_1Dy ),
+    m_resolution( rhs.m_resolution ),
+    m_kernel( rhs.m_kernel ),
     m_tex2D( rhs.m_tex2D ),
     m_fbo( rhs.m_fbo )
 {
@@ -262,35 +281,24 @@ void GaussConvolution::draw(
     //Bind the output FBO
     osg::FBOExtensions* fboExt(
         osg::FBOExtensions::instance( contextID, true ) );
-    m_fbo->apply( state );
+    getGraphFBO( rfxs, state, m_fbo.get() )->apply( state );
     UTIL_GL_FBO_ERROR_CHECK( "GaussConvolution::draw", fboExt );
 
-    state.applyAttribute( m_viewport.get() );
+    const osg::Vec2 scale( m_resolution, m_resolution );
+    const osg::Viewport* vp = applyScaledViewport( rfxs, state, scale );
 
-    //Use the specified program
-    state.applyAttribute( m_1Dx.get() );
+    //Use the kernel program, stepping along s
+    m_kernel->apply( state, osg::Vec2( 1.f / (float)_width, 0.f ) );
 
     //Bind the input textures and set their sampler uniforms
     IntTextureMap::const_iterator inItr = _inputs.find( 0 );
     state.setActiveTextureUnit( 0 );
-    osg::Texture* texture = inItr->second.get();
+    osg::Texture* texture = getGraphTexture( rfxs, state, inItr->second.get() );
     state.applyTextureAttribute( 0, texture );
 
     osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
-    osg::Uniform* uniform = _textureUniform[ 0 ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
-    uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-    m_viewportSize->apply( gl2Ext, state.getUniformLocation( m_viewportSize->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-    m_viewportSize->apply( gl2Ext, state.getUniformLocation( m_viewportSize->getName() ) );
-#endif
+    _uniformLocations.apply( state, gl2Ext, FirstTextureSlot, _textureUniform[ 0 ].get() );
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
 
     UTIL_GL_ERROR_CHECK( "GaussConvolution::draw()." ) \
 
@@ -305,7 +313,7 @@ void GaussConvolution::draw(
             << "Effect: applying local Effect FBO." << std::endl;
 
         //We have an FBO assigned, use it
-        fbo = _output.get();
+        fbo = getGraphFBO( rfxs, state, _output.get() );
     }
     else
     {
@@ -326,27 +334,25 @@ void GaussConvolution::draw(
     }
     UTIL_GL_FBO_ERROR_CHECK( (getName() + std::string(" Effect::draw") ), fboExt );
 
-    state.applyAttribute( m_viewport.get() );
+    //If the 'last' flag is set, apply the full viewport; the
+    //RenderingEffects output is full size
+    backdropFX::RTTViewport* rttvp = last ?
+        dynamic_cast< backdropFX::RTTViewport* >( rfxs->getViewport() ) : NULL;
+    if( rttvp != NULL )
+    {
+        rttvp->applyFullViewport( state );
+        vp = rttvp;
+    }
+    else
+        vp = applyScaledViewport( rfxs, state, last ? osg::Vec2( 1.f, 1.f ) : scale );
 
-    //Use the specified program
-    state.applyAttribute( m_1Dy.get() );
+    //Use the kernel program, stepping along t
+    m_kernel->apply( state, osg::Vec2( 0.f, 1.f / (float)_height ) );
     state.setActiveTextureUnit( 0 );
-    state.applyTextureAttribute( 0, m_tex2D.get() );
-
-    uniform = _textureUniform[ 0 ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
-    uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-    m_viewportSize->apply( gl2Ext, state.getUniformLocation( m_viewportSize->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-    m_viewportSize->apply( gl2Ext, state.getUniformLocation( m_viewportSize->getName() ) );
-#endif
+    state.applyTextureAttribute( 0, getGraphTexture( rfxs, state, m_tex2D.get() ) );
+
+    _uniformLocations.apply( state, gl2Ext, FirstTextureSlot, _textureUniform[ 0 ].get() );
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
 
     internalDraw( renderInfo );
 
@@ -354,9 +360,13 @@ void GaussConvolution::draw(
           backdropFX::BackdropCommon::debugImages ) != 0 )
     {
         dumpImage(
-            m_viewport.get(),
+            vp,
             renderingEffects->debugImageBaseFileName( contextID ) );
     }
+
+    if( rttvp != NULL )
+        //State doesn't know we changed the viewport. Reset it the way it was
+        rttvp->apply( state );
 }
 
 void GaussConvolution::setTextureWidthHeight(
@@ -364,14 +374,6 @@ void GaussConvolution::setTextureWidthHeight(
 {
     Effect::setTextureWidthHeight( texW, texH );
 
-    m_viewportSize->set( osg::Vec2(
-        static_cast< osg::Viewport::value_type >( texW ),
-        static_cast< osg::Viewport::value_type >( texH ) ) );
-    m_viewport->width() =
-        static_cast< osg::Viewport::value_type >( texW );
-    m_viewport->height() =
-        static_cast< osg::Viewport::value_type >( texH );
-
     m_tex2D->setTextureSize( texW, texH );
     m_tex2D->dirtyTextureObject(); 
 
@@ -383,23 +385,65 @@ void GaussConvolution::setTextureWidthHeight(
         osg::FrameBufferAttachment( m_tex2D.get() ) );
 }
 
+void GaussConvolution::setHDR( bool hdr )
+{
+    Effect::setHDR( hdr );
+
+    setTextureFormat( m_tex2D.get(), hdr );
+    m_tex2D->dirtyTextureObject();
+
+    //Force rebuild of FBOs
+    m_fbo = new osg::FrameBufferObject();
+    UTIL_MEMORY_CHECK( m_fbo.get(), "GaussConvolution m_fbo", )
+    m_fbo->setAttachment(
+        osg::Camera::COLOR_BUFFER0,
+        osg::FrameBufferAttachment( m_tex2D.get() ) );
+    //The format decides which temporaries the EffectGraph can alias
+    dirtyGraph();
+}
+
+void GaussConvolution::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    Effect::resizeGLObjectBuffers( maxSize );
+    m_kernel->resizeGLObjectBuffers( maxSize );
+}
+
+void GaussConvolution::releaseGLObjects( osg::State* state ) const
+{
+    Effect::releaseGLObjects( state );
+    m_kernel->releaseGLObjects( state );
+}
+
+void GaussConvolution::addGraphNodes( EffectGraph* graph )
+{
+    graph->addNode( this, 2 );
+    graph->addRead( getInput( 0 ) );
+    graph->addTemporary( m_tex2D.get() );
+    graph->addWrite( getOutputTexture(), _transientOutput );
+}
+
+void GaussConvolution::setResolution( float resolution )
+{
+    m_resolution = resolution;
+}
+
+void GaussConvolution::setSigma( float sigma )
+{
+    m_kernel->setSigma( sigma );
+}
+
 
 Resample::Resample()
     :
     Effect(),
     m_factor( 1.0, 1.0 ),
-    m_viewport( new osg::Viewport( 0, 0, 0, 0 ) ),
     m_tex2D( new osg::Texture2D() )
 {
-    UTIL_MEMORY_CHECK( m_viewport.get(), "Resample m_viewport", )
-
     _program = backdropFX::createEffectProgram( "none" );
     UTIL_MEMORY_CHECK( _program.get(), "Resample _program", )
 
     UTIL_MEMORY_CHECK( m_tex2D.get(), "Resample m_tex2D", )
-    //TBD can't hard code this size
-    m_tex2D->setTextureSize( 800, 600 );
-    m_tex2D->dirtyTextureObject();
+    //setTextureWidthHeight() sizes the texture
     m_tex2D->setInternalFormat( GL_RGBA );
     m_tex2D->setBorderWidth( 0 );
     m_tex2D->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
@@ -412,6 +456,10 @@ Resample::Resample()
     _output->setAttachment(
         osg::Camera::COLOR_BUFFER0,
         osg::FrameBufferAttachment( m_tex2D.get() ) );
+    _transientOutput = true;
+
+    //Same format as the outputs attachOutputTo() creates
+    setHDR( backdropFX::Manager::instance()->getHDR() );
 }
 
 Resample::Resample(
@@ -420,7 +468,6 @@ Resample::Resample(
     :
     Effect( rhs, copyop ),
     m_factor( rhs.m_factor ),
-    m_viewport( rhs.m_viewport ),
     m_tex2D( rhs.m_tex2D )
 {
     osg::notify( osg::NOTICE )
@@ -443,14 +490,14 @@ void Resample::draw(
     RenderingEffects* renderingEffects = rfxs->getRenderingEffects();
 
     //Bind the output FBO
-    osg::FrameBufferObject* fbo;
+    osg::FrameBufferObject* fbo( NULL );
     if( _output.valid() )
     {
         osg::notify( osg::INFO )
             << "Resample: applying local Effect FBO." << std::endl;
 
         //We have an FBO assigned, use it
-        fbo = _output.get();
+        fbo = getGraphFBO( rfxs, state, _output.get() );
     }
 
     osg::FBOExtensions* fboExt(
@@ -462,34 +509,24 @@ void Resample::draw(
 
     UTIL_GL_FBO_ERROR_CHECK( "Resample::draw", fboExt );
 
-    state.applyAttribute( m_viewport.get() );
+    const osg::Viewport* vp = applyScaledViewport( rfxs, state, m_factor );
 
     //Use the specified program
     if( _program.valid() )
     {
         osg::notify( osg::INFO ) << "Resample: applying program." << std::endl;
-        state.applyAttribute( _program.get() );
+        _uniformLocations.applyProgram( state, _program.get() );
     }
 
     //Bind the input textures and set their sampler uniforms
     IntTextureMap::const_iterator inItr = _inputs.find( 0 );
     state.setActiveTextureUnit( 0 );
-    osg::Texture* texture = inItr->second.get();
+    osg::Texture* texture = getGraphTexture( rfxs, state, inItr->second.get() );
     state.applyTextureAttribute( 0, texture );
 
     osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
-    osg::Uniform* uniform = _textureUniform[ 0 ].get();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
-    uniform = rfxs->getTexturePercentUniform();
-#if OSG_SUPPORTS_UNIFORM_ID
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getNameID() ) );
-#else
-    uniform->apply( gl2Ext, state.getUniformLocation( uniform->getName() ) );
-#endif
+    _uniformLocations.apply( state, gl2Ext, FirstTextureSlot, _textureUniform[ 0 ].get() );
+    _uniformLocations.apply( state, gl2Ext, TexturePercentSlot, rfxs->getTexturePercentUniform() );
 
     UTIL_GL_ERROR_CHECK( "Resample::draw()." ) \
 
@@ -500,7 +537,7 @@ void Resample::draw(
           backdropFX::BackdropCommon::debugImages ) != 0 )
     {
         dumpImage(
-            m_viewport.get(),
+            vp,
             renderingEffects->debugImageBaseFileName( contextID ) );
     }
 }
@@ -513,13 +550,10 @@ void Resample::setFactor( float xFactor, float yFactor )
 void Resample::setTextureWidthHeight(
     unsigned int texW, unsigned int texH )
 {
-    m_viewport->width() =
-        static_cast< osg::Viewport::value_type >( texW * m_factor.x() );
-    m_viewport->height() =
-        static_cast< osg::Viewport::value_type >( texH * m_factor.y() );
-
-    _width = static_cast< unsigned int >( m_viewport->width() );
-    _height = static_cast< unsigned int >( m_viewport->height() );
+    _width = osg::maximum(
+        static_cast< unsigned int >( texW * m_factor.x() ), 1u );
+    _height = osg::maximum(
+        static_cast< unsigned int >( texH * m_factor.y() ), 1u );
 
     m_tex2D->setTextureSize( _width, _height );
     m_tex2D->dirtyTextureObject();
@@ -528,6 +562,55 @@ void Resample::setTextureWidthHeight(
     _output->setAttachment(
         osg::Camera::COLOR_BUFFER0,
         osg::FrameBufferAttachment( m_tex2D.get() ) );
+    dirtyGraph();
+}
+
+BilateralUpsample::BilateralUpsample()
+    :
+    Effect(),
+    m_inputResolution( .5f ),
+    m_inputSize(
+        new osg::Uniform( "inputSize", osg::Vec4( 1.0, 1.0, 1.0, 1.0 ) ) )
+{
+    UTIL_MEMORY_CHECK( m_inputSize.get(), "BilateralUpsample Input Size Uniform", );
+    _uniforms.push_back( m_inputSize.get() );
+
+    setProgram( backdropFX::createEffectProgram( "bilateralUpsample" ) );
+}
+
+BilateralUpsample::BilateralUpsample(
+    BilateralUpsample const& rhs,
+    osg::CopyOp const& copyop )
+    :
+    Effect( rhs, copyop ),
+    m_inputResolution( rhs.m_inputResolution ),
+    m_inputSize( rhs.m_inputSize )
+{
+}
+
+BilateralUpsample::~BilateralUpsample()
+{
+    ;
+}
+
+void BilateralUpsample::setTextureWidthHeight(
+    unsigned int texW, unsigned int texH )
+{
+    Effect::setTextureWidthHeight( texW, texH );
+
+    //Same rounding as the Resample that produced input 0
+    const float w( osg::maximum(
+        static_cast< unsigned int >( texW * m_inputResolution ), 1u ) );
+    const float h( osg::maximum(
+        static_cast< unsigned int >( texH * m_inputResolution ), 1u ) );
+    m_inputSize->set( osg::Vec4( w, h, 1.f / w, 1.f / h ) );
+}
+
+void BilateralUpsample::setInputResolution( float resolution )
+{
+    m_inputResolution = resolution;
+    if( _width > 0 )
+        setTextureWidthHeight( _width, _height );
 }
 
 GlowCombine::GlowCombine()
@@ -536,6 +619,7 @@ GlowCombine::GlowCombine()
 {
     osg::Program* program = backdropFX::createEffectProgram( "glowCombine" );
     setProgram( program );
+    setPointwiseShader( backdropFX::createEffectPointwiseShader( "glowCombine" ) );
 }
 
 GlowCombine::GlowCombine(
@@ -560,6 +644,7 @@ EffectCombine::EffectCombine()
 {
     osg::Program* program = backdropFX::createEffectProgram( "combine" );
     setProgram( program );
+    setPointwiseShader( backdropFX::createEffectPointwiseShader( "combine" ) );
 }
 EffectCombine::EffectCombine( const EffectCombine& rhs, const osg::CopyOp& copyop )
   : Effect( rhs, copyop )
@@ -577,6 +662,7 @@ EffectAlphaBlend::EffectAlphaBlend()
 {
     osg::Program* program = backdropFX::createEffectProgram( "alphaBlend" );
     setProgram( program );
+    setPointwiseShader( backdropFX::createEffectPointwiseShader( "alphaBlend" ) );
 }
 EffectAlphaBlend::EffectAlphaBlend( const EffectAlphaBlend& rhs, const osg::CopyOp& copyop )
   : Effect( rhs, copyop )
@@ -592,6 +678,10 @@ EffectAlphaBlend::~EffectAlphaBlend()
 EffectScaleBias::EffectScaleBias()
   : _scaleBias( osg::Vec2f( 1.f, 0.f ) )
 {
+    osg::Program* program = backdropFX::createEffectProgram( "scaleBias" );
+    setProgram( program );
+    setPointwiseShader( backdropFX::createEffectPointwiseShader( "scaleBias" ) );
+
     osg::Uniform* scaleBiasUniform = new osg::Uniform( osg::Uniform::FLOAT_VEC2, "scaleBias" );
     scaleBiasUniform->set( _scaleBias );
     _uniforms.push_back( scaleBiasUniform );
@@ -626,12 +716,19 @@ void EffectScaleBias::setScaleBias( const osg::Vec2f& scaleBias )
 
 
 EffectBasicGlow::EffectBasicGlow()
-  : _glowColor( osg::Vec4( 0., 0., 0., 0. ) ),
+  : _resolution( 1.f ),
+    _glowColor( osg::Vec4( 0., 0., 0., 0. ) ),
     _useGlowAlpha( false )
 {
+    //  Resample
     //  EffectSeperableBlur
     //  EffectCombine
 
+    Effect* effectResample = new backdropFX::Resample();
+    UTIL_MEMORY_CHECK( effectResample, "EffectLibraryUtil Glow Resample", );
+    effectResample->setName( "EffectBasicGlow-Resample" );
+    _subEffects.push_back( effectResample );
+
     Effect* effectBlur = new backdropFX::EffectSeperableBlur();
     UTIL_MEMORY_CHECK( effectBlur, "EffectLibraryUtil Glow EffectSeperableBlur", );
     effectBlur->setName( "EffectBasicGlow-Blur" );
@@ -643,6 +740,7 @@ EffectBasicGlow::EffectBasicGlow()
     _subEffects.push_back( effectCombine );
 
     effectBlur->attachOutputTo( effectCombine, 0 );
+    internalAttach();
 
     _glowColorUniform = new osg::Uniform( "bdfx_glowColor", _glowColor );
     UTIL_MEMORY_CHECK( _glowColorUniform, "EffectBasicGlow constructur uniform", );
@@ -654,6 +752,8 @@ EffectBasicGlow::EffectBasicGlow()
 }
 EffectBasicGlow::EffectBasicGlow( const EffectBasicGlow& rhs, const osg::CopyOp& copyop )
   : CompositeEffect( rhs, copyop ),
+    _resolution( rhs._resolution ),
+    _glowMap( rhs._glowMap ),
     _glowColor( rhs._glowColor ),
     _useGlowAlpha( rhs._useGlowAlpha ),
     _glowColorUniform( rhs._glowColorUniform ),
@@ -672,14 +772,17 @@ void EffectBasicGlow::addInput( const unsigned int unit, osg::Texture* texture )
     if( unit == 0 )
     {
         // Attach ColorBufferA.
-        // Input 1 of the combine effect.
-        ( _subEffects[ 1 ] )->addInput( 1, texture );
+        // Input 1 of the 3rd (combine) effect.
+        ( _subEffects[ 2 ] )->addInput( 1, texture );
     }
     else if( unit == 1 )
     {
         // Attach ColorBufferGlow.
-        // Input 0 of the blur effect.
+        // Input 0 of the 1st (resample) effect, and of the 2nd (blur)
+        // effect at full resolution.
+        _glowMap = texture;
         ( _subEffects[ 0 ] )->addInput( 0, texture );
+        internalAttach();
     }
     else
     {
@@ -687,6 +790,53 @@ void EffectBasicGlow::addInput( const unsigned int unit, osg::Texture* texture )
     }
 }
 
+void EffectBasicGlow::setTextureWidthHeight( unsigned int texW, unsigned int texH )
+{
+    _width = texW;
+    _height = texH;
+
+    // Resample applies its own factor. The blur runs at the reduced size.
+    ( _subEffects[ 0 ] )->setTextureWidthHeight( texW, texH );
+    ( _subEffects[ 1 ] )->setTextureWidthHeight( texW * _resolution, texH * _resolution );
+    ( _subEffects[ 2 ] )->setTextureWidthHeight( texW, texH );
+}
+
+void EffectBasicGlow::addGraphNodes( EffectGraph* graph )
+{
+    EffectVector::iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+    {
+        // The Resample only runs at reduced resolution.
+        if( ( it == _subEffects.begin() ) && ( _resolution >= 1.f ) )
+            continue;
+        (*it)->addGraphNodes( graph );
+    }
+}
+
+void EffectBasicGlow::setResolution( float resolution )
+{
+    if( ( resolution <= 0.f ) || ( resolution > 1.f ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectBasicGlow: Resolution must be in the range (0,1]." << std::endl;
+        return;
+    }
+    _resolution = resolution;
+
+    static_cast< Resample* >( _subEffects[ 0 ].get() )->setFactor( _resolution, _resolution );
+    static_cast< EffectSeperableBlur* >( _subEffects[ 1 ].get() )->setResolution( _resolution );
+    internalAttach();
+    if( _width > 0 )
+        setTextureWidthHeight( _width, _height );
+}
+
+void EffectBasicGlow::internalAttach()
+{
+    if( _resolution < 1.f )
+        ( _subEffects[ 0 ] )->attachOutputTo( _subEffects[ 1 ].get(), 0 );
+    else if( _glowMap.valid() )
+        ( _subEffects[ 1 ] )->addInput( 0, _glowMap.get() );
+}
+
 void EffectBasicGlow::setDefaultGlowColor( const osg::Vec4f& glowColor )
 {
     _glowColor = glowColor;
@@ -701,7 +851,7 @@ void EffectBasicGlow::setUseGlowAlpha( bool useGlowAlpha )
 
 
 EffectImprovedGlow::EffectImprovedGlow()
-  : _resampleFactor( .5, .5 ),
+  : _resolution( .5f ),
     _glowColor( osg::Vec4( 0., 0., 0., 0. ) ),
     _useGlowAlpha( false )
 {
@@ -713,22 +863,22 @@ EffectImprovedGlow::EffectImprovedGlow()
     UTIL_MEMORY_CHECK( effectResample, "EffectLibraryUtil Glow Resample", );
     effectResample->setName( "EffectImprovedGlow-Resample" );
     static_cast< Resample* >( effectResample )->setFactor(
-        _resampleFactor.x(), _resampleFactor.y() );
+        _resolution, _resolution );
     _subEffects.push_back( effectResample );
 
     Effect* effectBlur = new backdropFX::GaussConvolution();
     UTIL_MEMORY_CHECK( effectBlur, "EffectLibraryUtil Glow GaussConvolution", );
     effectBlur->setName( "EffectImprovedGlow-Blur" );
+    static_cast< GaussConvolution* >( effectBlur )->setResolution( _resolution );
     _subEffects.push_back( effectBlur );
 
-    effectResample->attachOutputTo( effectBlur, 0 );
-
     Effect* effectCombine = new backdropFX::GlowCombine();
     UTIL_MEMORY_CHECK( effectCombine, "EffectLibraryUtil Glow GlowCombine", );
     effectCombine->setName( "EffectImprovedGlow-GlowCombine" );
     _subEffects.push_back( effectCombine );
 
     effectBlur->attachOutputTo( effectCombine, 1 );
+    internalAttach();
 
     _glowColorUniform = new osg::Uniform( "bdfx_glowColor", _glowColor );
     UTIL_MEMORY_CHECK( _glowColorUniform, "EffectBasicGlow constructur uniform", );
@@ -740,7 +890,8 @@ EffectImprovedGlow::EffectImprovedGlow()
 }
 EffectImprovedGlow::EffectImprovedGlow( const EffectImprovedGlow& rhs, const osg::CopyOp& copyop )
   : CompositeEffect( rhs, copyop ),
-    _resampleFactor( rhs._resampleFactor ),
+    _resolution( rhs._resolution ),
+    _glowMap( rhs._glowMap ),
     _glowColor( rhs._glowColor ),
     _useGlowAlpha( rhs._useGlowAlpha ),
     _glowColorUniform( rhs._glowColorUniform ),
@@ -753,6 +904,9 @@ EffectImprovedGlow::~EffectImprovedGlow()
 
 void EffectImprovedGlow::setTextureWidthHeight( unsigned int texW, unsigned int texH )
 {
+    _width = texW;
+    _height = texH;
+
     int idx;
     EffectVector::iterator it;
     for( it = _subEffects.begin(), idx=0; it != _subEffects.end(); it++, idx++ )
@@ -760,7 +914,7 @@ void EffectImprovedGlow::setTextureWidthHeight( unsigned int texW, unsigned int
         if( idx == 1 )
         {
             // Special handling for the GaussConvolution effect.
-            (*it)->setTextureWidthHeight( texW * _resampleFactor.x(), texH * _resampleFactor.y() );
+            (*it)->setTextureWidthHeight( texW * _resolution, texH * _resolution );
         }
         else
         {
@@ -783,10 +937,13 @@ void EffectImprovedGlow::addInput( const unsigned int unit, osg::Texture* textur
     else if( unit == 1 )
     {
         // Attach ColorBufferGlow.
-        // Input 0 of the 1st (resample) effect.
+        // Input 0 of the 1st (resample) effect, and of the 2nd (blur)
+        // effect at full resolution.
         // Input 2 of the 3rd (combine) effect.
+        _glowMap = texture;
         ( _subEffects[ 0 ] )->addInput( 0, texture );
         ( _subEffects[ 2 ] )->addInput( 2, texture );
+        internalAttach();
     }
     else
     {
@@ -805,26 +962,79 @@ void EffectImprovedGlow::setUseGlowAlpha( bool useGlowAlpha )
     _useGlowAlphaUniform->set( _useGlowAlpha?1:0 );
 }
 
+void EffectImprovedGlow::addGraphNodes( EffectGraph* graph )
+{
+    EffectVector::iterator it;
+    for( it = _subEffects.begin(); it != _subEffects.end(); it++ )
+    {
+        // The Resample only runs at reduced resolution.
+        if( ( it == _subEffects.begin() ) && ( _resolution >= 1.f ) )
+            continue;
+        (*it)->addGraphNodes( graph );
+    }
+}
+
+void EffectImprovedGlow::setResolution( float resolution )
+{
+    if( ( resolution <= 0.f ) || ( resolution > 1.f ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectImprovedGlow: Resolution must be in the range (0,1]." << std::endl;
+        return;
+    }
+    _resolution = resolution;
+
+    static_cast< Resample* >( _subEffects[ 0 ].get() )->setFactor( _resolution, _resolution );
+    GaussConvolution* blur( static_cast< GaussConvolution* >( _subEffects[ 1 ].get() ) );
+    blur->setResolution( _resolution );
+    // Sigma is in texels. Keep the screen space radius of the default
+    // half resolution blur.
+    blur->setSigma( 2.f * _resolution / .5f );
+    internalAttach();
+    if( _width > 0 )
+        setTextureWidthHeight( _width, _height );
+}
+
+void EffectImprovedGlow::internalAttach()
+{
+    if( _resolution < 1.f )
+        ( _subEffects[ 0 ] )->attachOutputTo( _subEffects[ 1 ].get(), 0 );
+    else if( _glowMap.valid() )
+        ( _subEffects[ 1 ] )->addInput( 0, _glowMap.get() );
+}
+
 
 
 EffectDOF::EffectDOF()
   : _distance( 2.f ),
-    _range( 500.f )
+    _range( 500.f ),
+    _resolution( 1.f )
 {
+    //  Resample
     //  EffectSeperableBlur
+    //  BilateralUpsample
     //  EffectAlphaBlend
 
+    Effect* effectResample = new backdropFX::Resample();
+    UTIL_MEMORY_CHECK( effectResample, "EffectLibraryUtil DOF Resample", );
+    effectResample->setName( "EffectDOF-Resample" );
+    _subEffects.push_back( effectResample );
+
     Effect* effectBlur = new backdropFX::EffectSeperableBlur();
     UTIL_MEMORY_CHECK( effectBlur, "EffectLibraryUtil DOF EffectSeperableBlur", );
     effectBlur->setName( "EffectDOF-Blur" );
     _subEffects.push_back( effectBlur );
 
+    Effect* effectUpsample = new backdropFX::BilateralUpsample();
+    UTIL_MEMORY_CHECK( effectUpsample, "EffectLibraryUtil DOF BilateralUpsample", );
+    effectUpsample->setName( "EffectDOF-Upsample" );
+    _subEffects.push_back( effectUpsample );
+
     Effect* effectBlend = new backdropFX::EffectAlphaBlend();
     UTIL_MEMORY_CHECK( effectBlend, "EffectLibraryUtil DOF EffectAlphaBlend", );
     effectBlend->setName( "EffectDOF-Blend" );
     _subEffects.push_back( effectBlend );
 
-    effectBlur->attachOutputTo( effectBlend, 0 );
+    internalAttach();
 
     _focalDistance = new osg::Uniform( "bdfx_dofFocalDistance", _distance );
     UTIL_MEMORY_CHECK( _focalDistance, "EffectDOF constructor uniform", );
@@ -837,7 +1047,9 @@ EffectDOF::EffectDOF()
 EffectDOF::EffectDOF( const EffectDOF& rhs, const osg::CopyOp& copyop )
   : CompositeEffect( rhs, copyop ),
     _distance( rhs._distance ),
-    _range( rhs._range )
+    _range( rhs._range ),
+    _resolution( rhs._resolution ),
+    _source( rhs._source )
 {
 }
 EffectDOF::~EffectDOF()
@@ -851,10 +1063,13 @@ void EffectDOF::addInput( const unsigned int unit, osg::Texture* texture )
     if( unit == 0 )
     {
         // Attach ColorBufferA.
-        // Input 0 of the 1st (blur) effect.
-        // Input 1 of the 2nd (combine) effect.
+        // Input 0 of the 1st (resample) effect, and of the 2nd (blur)
+        // effect at full resolution.
+        // Input 1 of the 4th (blend) effect.
+        _source = texture;
         ( _subEffects[ 0 ] )->addInput( 0, texture );
-        ( _subEffects[ 1 ] )->addInput( 1, texture );
+        ( _subEffects[ 3 ] )->addInput( 1, texture );
+        internalAttach();
     }
     else
     {
@@ -863,8 +1078,74 @@ void EffectDOF::addInput( const unsigned int unit, osg::Texture* texture )
 
     // Putting this here so that the constructor doesn't invoke the Manager singleton instance.
     // This results in some redundancy, but no runtime performance penalty.
+    // Despite its name, the Manager depth buffer is the effects Camera's
+    // second color buffer. Its red channel is the normalized distance to
+    // the focal plane (see gl2/glow-transform.vs), not window depth, so
+    // the upsample is guided by the focal distance term.
     backdropFX::Manager& mgr = *( backdropFX::Manager::instance() );
-    ( _subEffects[ 1 ] )->addInput( 2, mgr.getDepthBuffer() );
+    ( _subEffects[ 2 ] )->addInput( 1, mgr.getDepthBuffer() );
+    ( _subEffects[ 3 ] )->addInput( 2, mgr.getDepthBuffer() );
+}
+
+void EffectDOF::setTextureWidthHeight( unsigned int texW, unsigned int texH )
+{
+    _width = texW;
+    _height = texH;
+
+    // Resample applies its own factor. The blur runs at the reduced size.
+    ( _subEffects[ 0 ] )->setTextureWidthHeight( texW, texH );
+    ( _subEffects[ 1 ] )->setTextureWidthHeight( texW * _resolution, texH * _resolution );
+    ( _subEffects[ 2 ] )->setTextureWidthHeight( texW, texH );
+    ( _subEffects[ 3 ] )->setTextureWidthHeight( texW, texH );
+}
+
+void EffectDOF::addGraphNodes( EffectGraph* graph )
+{
+    unsigned int idx;
+    for( idx = 0; idx < _subEffects.size(); idx++ )
+    {
+        // The Resample and BilateralUpsample only run at reduced resolution.
+        if( ( ( idx == 0 ) || ( idx == 2 ) ) && ( _resolution >= 1.f ) )
+            continue;
+        _subEffects[ idx ]->addGraphNodes( graph );
+    }
+}
+
+void EffectDOF::setResolution( float resolution )
+{
+    if( ( resolution <= 0.f ) || ( resolution > 1.f ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EffectDOF: Resolution must be in the range (0,1]." << std::endl;
+        return;
+    }
+    _resolution = resolution;
+
+    static_cast< Resample* >( _subEffects[ 0 ].get() )->setFactor( _resolution, _resolution );
+    static_cast< EffectSeperableBlur* >( _subEffects[ 1 ].get() )->setResolution( _resolution );
+    static_cast< BilateralUpsample* >( _subEffects[ 2 ].get() )->setInputResolution( _resolution );
+    internalAttach();
+    if( _width > 0 )
+        setTextureWidthHeight( _width, _height );
+}
+
+void EffectDOF::internalAttach()
+{
+    Effect* effectResample = _subEffects[ 0 ].get();
+    Effect* effectBlur = _subEffects[ 1 ].get();
+    Effect* effectUpsample = _subEffects[ 2 ].get();
+    Effect* effectBlend = _subEffects[ 3 ].get();
+    if( _resolution < 1.f )
+    {
+        effectResample->attachOutputTo( effectBlur, 0 );
+        effectBlur->attachOutputTo( effectUpsample, 0 );
+        effectUpsample->attachOutputTo( effectBlend, 0 );
+    }
+    else
+    {
+        if( _source.valid() )
+            effectBlur->addInput( 0, _source.get() );
+        effectBlur->attachOutputTo( effectBlend, 0 );
+    }
 }
 
 void EffectDOF::setFocalDistance( float distance )
@@ -922,5 +1203,239 @@ void EffectHeatDistortion::setHeatRange( const osg::Vec2f& range )
 
 
 
+/** \cond */
+// Luminance reduction levels, each a quarter the size of the last, down to
+// ToneMapLastLevel by ToneMapLastLevel.
+static const unsigned int ToneMapFirstLevel( 256 );
+static const unsigned int ToneMapLastLevel( 4 );
+
+static osg::Texture2D*
+createToneMapTexture( unsigned int size, const std::string& name )
+{
+    osg::Texture2D* tex = new osg::Texture2D;
+    UTIL_MEMORY_CHECK( tex, "EffectToneMapping texture", NULL );
+    tex->setName( name );
+    // Log luminance is negative below 1.0.
+    tex->setInternalFormat( GL_RGBA16F_ARB );
+    tex->setSourceFormat( GL_RGBA );
+    tex->setSourceType( GL_FLOAT );
+    tex->setBorderWidth( 0 );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    tex->setTextureSize( size, size );
+    return( tex );
+}
+/** \endcond */
+
+
+EffectToneMapping::EffectToneMapping()
+  : Effect(),
+    _key( .18f ),
+    _adaptationRate( 1.5f )
+{
+    setProgram( createEffectProgram( "toneMap" ) );
+    _reduceProgram = createEffectProgram( "toneMapReduce" );
+    UTIL_MEMORY_CHECK( _reduceProgram.get(), "EffectToneMapping _reduceProgram", );
+
+    _keyUniform = new osg::Uniform( "toneMapKey", _key );
+    UTIL_MEMORY_CHECK( _keyUniform.get(), "EffectToneMapping _keyUniform", );
+    _uniforms.push_back( _keyUniform );
+    osg::Uniform* adaptedUniform = new osg::Uniform( osg::Uniform::SAMPLER_2D, "adaptedLuminance" );
+    UTIL_MEMORY_CHECK( adaptedUniform, "EffectToneMapping adaptedLuminance uniform", );
+    adaptedUniform->set( 1 );
+    _uniforms.push_back( adaptedUniform );
+
+    _reduceMode = new osg::Uniform( "reduceMode", 0 );
+    UTIL_MEMORY_CHECK( _reduceMode.get(), "EffectToneMapping _reduceMode", );
+    _reduceSize = new osg::Uniform( "reduceSize", osg::Vec2( 1.f, 1.f ) );
+    UTIL_MEMORY_CHECK( _reduceSize.get(), "EffectToneMapping _reduceSize", );
+    _adaptBlend = new osg::Uniform( "adaptBlend", 1.f );
+    UTIL_MEMORY_CHECK( _adaptBlend.get(), "EffectToneMapping _adaptBlend", );
+    _previousUniform = new osg::Uniform( osg::Uniform::SAMPLER_2D, "previousLuminance" );
+    UTIL_MEMORY_CHECK( _previousUniform.get(), "EffectToneMapping _previousUniform", );
+    _previousUniform->set( 1 );
+
+    unsigned int size;
+    for( size = ToneMapFirstLevel; size >= ToneMapLastLevel; size /= 4 )
+    {
+        std::ostringstream ostr;
+        ostr << "EffectToneMapping " << size << "x" << size;
+        osg::Texture2D* tex = createToneMapTexture( size, ostr.str() );
+        _reduce.push_back( tex );
+
+        osg::FrameBufferObject* fbo = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( fbo, "EffectToneMapping reduce FBO", );
+        fbo->setAttachment( osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment( tex ) );
+        _reduceFBO.push_back( fbo );
+        _reduceViewport.push_back( new osg::Viewport( 0., 0., size, size ) );
+    }
+
+    unsigned int idx;
+    for( idx=0; idx<2; idx++ )
+    {
+        _adapted[ idx ] = createToneMapTexture( 1, "EffectToneMapping adapted" );
+        _adaptedFBO[ idx ] = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( _adaptedFBO[ idx ].get(), "EffectToneMapping _adaptedFBO", );
+        _adaptedFBO[ idx ]->setAttachment( osg::Camera::COLOR_BUFFER0,
+            osg::FrameBufferAttachment( _adapted[ idx ].get() ) );
+    }
+    _adaptedViewport = new osg::Viewport( 0., 0., 1., 1. );
+}
+EffectToneMapping::EffectToneMapping( const EffectToneMapping& rhs, const osg::CopyOp& copyop )
+  : Effect( rhs, copyop ),
+    _key( rhs._key ),
+    _adaptationRate( rhs._adaptationRate ),
+    _keyUniform( rhs._keyUniform ),
+    _reduceProgram( rhs._reduceProgram ),
+    _reduceMode( rhs._reduceMode ),
+    _reduceSize( rhs._reduceSize ),
+    _adaptBlend( rhs._adaptBlend ),
+    _previousUniform( rhs._previousUniform ),
+    _reduce( rhs._reduce ),
+    _reduceFBO( rhs._reduceFBO ),
+    _reduceViewport( rhs._reduceViewport ),
+    _adaptedViewport( rhs._adaptedViewport )
+{
+    osg::notify( osg::NOTICE ) << "BDFX: EffectToneMapping: Unexcepted copy operator invocation." << std::endl;
+    _adapted[ 0 ] = rhs._adapted[ 0 ];
+    _adapted[ 1 ] = rhs._adapted[ 1 ];
+    _adaptedFBO[ 0 ] = rhs._adaptedFBO[ 0 ];
+    _adaptedFBO[ 1 ] = rhs._adaptedFBO[ 1 ];
+}
+EffectToneMapping::~EffectToneMapping()
+{
+}
+
+void
+EffectToneMapping::draw( RenderingEffectsStage* rfxs, osg::RenderInfo& renderInfo, bool last )
+{
+    osg::State& state = *( renderInfo.getState() );
+    const unsigned int contextID( state.getContextID() );
+    osg::FBOExtensions* fboExt( osg::FBOExtensions::instance( contextID, true ) );
+    osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( contextID, true ) );
+
+    // Adapt over the time since this context last drew. The first frame
+    // has nothing to adapt from.
+    const double time( state.getFrameStamp()->getReferenceTime() );
+    double& lastTime( _lastTime[ contextID ] );
+    float blend( 1.f );
+    if( ( lastTime > 0. ) && ( _adaptationRate > 0.f ) )
+    {
+        const double elapsed( osg::clampBetween( time - lastTime, 0., 1. ) );
+        blend = (float)( 1. - exp( -elapsed * _adaptationRate ) );
+    }
+    lastTime = time;
+
+    unsigned int& index( _adaptedIndex[ contextID ] );
+    index = 1 - index;
+    osg::Texture2D* adapted( _adapted[ index ].get() );
+
+    // The reduction program has its own cache, so both programs keep their
+    // locations.
+    _reduceLocations.applyProgram( state, _reduceProgram.get() );
+    _reduceLocations.apply( state, gl2Ext, ReduceTexturePercentSlot, rfxs->getTexturePercentUniform() );
+    _reduceLocations.apply( state, gl2Ext, ReduceInputSlot, _textureUniform[ 0 ].get() );
+    _reduceLocations.apply( state, gl2Ext, ReducePreviousSlot, _previousUniform.get() );
+
+    // Contexts draw with their own blend, mode, and size at the same time,
+    // so these values go straight to GL. The uniforms only name them.
+    const GLint blendLocation( _reduceLocations.getLocation( state, ReduceBlendSlot, _adaptBlend.get() ) );
+    if( blendLocation >= 0 )
+        gl2Ext->glUniform1f( blendLocation, blend );
+    const GLint modeLocation( _reduceLocations.getLocation( state, ReduceModeSlot, _reduceMode.get() ) );
+    const GLint sizeLocation( _reduceLocations.getLocation( state, ReduceSizeSlot, _reduceSize.get() ) );
+
+    // The last reduction also reads the previous adapted luminance.
+    state.setActiveTextureUnit( 1 );
+    state.applyTextureAttribute( 1, _adapted[ 1 - index ].get() );
+
+    IntTextureMap::const_iterator inItr = _inputs.find( 0 );
+    osg::Texture* source( getGraphTexture( rfxs, state, inItr->second.get() ) );
+    unsigned int size( ToneMapFirstLevel );
+    unsigned int idx;
+    for( idx=0; idx<=_reduce.size(); idx++ )
+    {
+        // Mode 0 writes log luminance, mode 1 reduces, and mode 2 reduces
+        // to 1x1 and adapts.
+        int mode;
+        if( idx < _reduce.size() )
+        {
+            mode = ( idx == 0 ) ? 0 : 1;
+            getGraphFBO( rfxs, state, _reduceFBO[ idx ].get() )->apply( state );
+            state.applyAttribute( _reduceViewport[ idx ].get() );
+        }
+        else
+        {
+            mode = 2;
+            _adaptedFBO[ index ]->apply( state );
+            state.applyAttribute( _adaptedViewport.get() );
+        }
+        UTIL_GL_FBO_ERROR_CHECK( "EffectToneMapping reduce", fboExt );
+
+        // Mode 0 takes the size it renders, the others the size they read.
+        if( modeLocation >= 0 )
+            gl2Ext->glUniform1i( modeLocation, mode );
+        if( sizeLocation >= 0 )
+            gl2Ext->glUniform2f( sizeLocation, (float)size, (float)size );
+        if( idx > 0 )
+            size /= 4;
+
+        state.setActiveTextureUnit( 0 );
+        state.applyTextureAttribute( 0, source );
+        internalDraw( renderInfo );
+
+        if( idx < _reduce.size() )
+            source = getGraphTexture( rfxs, state, _reduce[ idx ].get() );
+    }
+
+    // Tone map into the output, with the adapted luminance on unit 1.
+    state.setActiveTextureUnit( 1 );
+    state.applyTextureAttribute( 1, adapted );
+    Effect::draw( rfxs, renderInfo, last );
+}
+
+void
+EffectToneMapping::addGraphNodes( EffectGraph* graph )
+{
+    graph->addNode( this, _reduce.size() + 2 );
+    graph->addRead( getInput( 0 ) );
+    unsigned int idx;
+    for( idx=0; idx<_reduce.size(); idx++ )
+        graph->addTemporary( _reduce[ idx ].get() );
+    graph->addWrite( getOutputTexture(), _transientOutput );
+}
+
+void
+EffectToneMapping::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    Effect::resizeGLObjectBuffers( maxSize );
+    _reduceProgram->resizeGLObjectBuffers( maxSize );
+    _reduceLocations.resizeGLObjectBuffers( maxSize );
+}
+void
+EffectToneMapping::releaseGLObjects( osg::State* state ) const
+{
+    Effect::releaseGLObjects( state );
+    _reduceProgram->releaseGLObjects( state );
+    _reduceLocations.releaseGLObjects( state );
+}
+
+void
+EffectToneMapping::setKey( float key )
+{
+    _key = key;
+    _keyUniform->set( _key );
+}
+
+void
+EffectToneMapping::setAdaptationRate( float rate )
+{
+    _adaptationRate = rate;
+}
+
+
+
 // namespace backdropFX
 }
@@ -51,6 +51,21 @@ createEffectProgram( const std::string& baseName )
     return( program.release() );
 }
 
+osg::Shader*
+createEffectPointwiseShader( const std::string& baseName )
+{
+    std::string fileName;
+    {
+        std::ostringstream ostr;
+        ostr << "shaders/effects/" << baseName << std::string( "-pointwise.fs" );
+        fileName = std::string( ostr.str() );
+    }
+
+    osg::ref_ptr< osg::Shader > shader;
+    __LOAD_SHADER( shader, osg::Shader::FRAGMENT, fileName );
+    return( shader.release() );
+}
+
 
 // namespace backdropFX
 }
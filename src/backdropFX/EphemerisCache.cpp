@@ -0,0 +1,463 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/EphemerisCache.h>
+#include <osgEphemeris/EphemerisEngine.h>
+#include <OpenThreads/ScopedLock>
+#include <osg/Math>
+#include <osg/Notify>
+
+#include <backdropFX/Utils.h>
+#include <cmath>
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+// Low priority worker that computes EphemerisCache tables. Each thread
+// has its own osgEphemeris bodies, which aren't thread safe.
+class EphemerisCacheThread : public OpenThreads::Thread
+{
+public:
+    EphemerisCacheThread( EphemerisCache* cache )
+      : _cache( cache ),
+        _sun( new osgEphemeris::Sun ),
+        _moon( new osgEphemeris::Moon )
+    {}
+
+    virtual void run()
+    {
+        EphemerisCache::Request req;
+        while( _cache->waitForRequest( req ) )
+        {
+            osg::ref_ptr< EphemerisCache::Table > table(
+                EphemerisCache::computeTable( req, _sun.get(), _moon.get() ) );
+            _cache->storeTable( table.get() );
+        }
+    }
+
+protected:
+    // The cache owns and joins this thread, so no ref_ptr.
+    EphemerisCache* _cache;
+
+    osg::ref_ptr< osgEphemeris::Sun > _sun;
+    osg::ref_ptr< osgEphemeris::Moon > _moon;
+};
+
+// Interpolates between two angles in hours, taking the shorter way
+// around the 24 hour wrap.
+static double interpolateHours( double a, double b, double t )
+{
+    double delta( b - a );
+    if( delta > 12. )
+        delta -= 24.;
+    else if( delta < -12. )
+        delta += 24.;
+    return( a + delta * t );
+}
+
+// Mean orbital elements of the planets, from Paul Schlyter, "How to
+// compute planetary positions". Each angle is a linear function of d,
+// the days since 1999 December 31 0:00 UT: { value at d=0, rate }.
+// Magnitudes are at 1 AU from the Sun and the Earth, with phase angle
+// terms in degrees to the first, third, and sixth powers.
+struct PlanetElements
+{
+    double _node[ 2 ], _inclination[ 2 ], _perihelion[ 2 ];
+    double _axis, _eccentricity[ 2 ], _anomaly[ 2 ];
+    double _magnitude, _phase1, _phase3, _phase6;
+};
+static const PlanetElements s_planetElements[ EphemerisCache::NUM_PLANETS ] = {
+    // Mercury
+    { { 48.3313, 3.24587e-5 }, { 7.0047, 5.00e-8 }, { 29.1241, 1.01444e-5 },
+        0.387098, { 0.205635, 5.59e-10 }, { 168.6562, 4.0923344368 },
+        -0.36, 0.027, 0., 2.2e-13 },
+    // Venus
+    { { 76.6799, 2.46590e-5 }, { 3.3946, 2.75e-8 }, { 54.8910, 1.38374e-5 },
+        0.723330, { 0.006773, -1.302e-9 }, { 48.0052, 1.6021302244 },
+        -4.34, 0.013, 4.2e-7, 0. },
+    // Mars
+    { { 49.5574, 2.11081e-5 }, { 1.8497, -1.78e-8 }, { 286.5016, 2.92961e-5 },
+        1.523688, { 0.093405, 2.516e-9 }, { 18.6021, 0.5240207766 },
+        -1.51, 0.016, 0., 0. },
+    // Jupiter
+    { { 100.4542, 2.76854e-5 }, { 1.3030, -1.557e-7 }, { 273.8777, 1.64505e-5 },
+        5.20256, { 0.048498, 4.469e-9 }, { 19.8950, 0.0830853001 },
+        -9.25, 0.014, 0., 0. },
+    // Saturn
+    { { 113.6634, 2.38980e-5 }, { 2.4886, -1.081e-7 }, { 339.3939, 2.97661e-5 },
+        9.55475, { 0.055546, -9.499e-9 }, { 316.9670, 0.0334442282 },
+        -9.0, 0.044, 0., 0. }
+};
+
+static double elementRadians( const double element[ 2 ], double d )
+{
+    const double degrees( element[ 0 ] + element[ 1 ] * d );
+    return( osg::DegreesToRadians( degrees - 360. * floor( degrees / 360. ) ) );
+}
+
+// Solves Kepler's equation for mean anomaly \c m (radians), and returns
+// the true anomaly \c v (radians) and the distance \c r from the focus.
+static void solveOrbit( double axis, double e, double m, double& v, double& r )
+{
+    double ea( m + e * sin( m ) * ( 1. + e * cos( m ) ) );
+    unsigned int iter;
+    for( iter=0; iter<5; iter++ )
+        ea -= ( ea - e * sin( ea ) - m ) / ( 1. - e * cos( ea ) );
+    const double xv( axis * ( cos( ea ) - e ) );
+    const double yv( axis * sqrt( 1. - e * e ) * sin( ea ) );
+    v = atan2( yv, xv );
+    r = sqrt( xv * xv + yv * yv );
+}
+/** \endcond */
+
+
+
+EphemerisCache::EphemerisCache()
+  : _stepMinutes( 10. ),
+    _windowHours( 48. ),
+    _locationTolerance( .01 ),
+    _requestPending( false ),
+    _requestInFlight( false ),
+    _generation( 0 ),
+    _done( false ),
+    _thread( NULL )
+{
+}
+EphemerisCache::~EphemerisCache()
+{
+    if( _thread != NULL )
+    {
+        {
+            OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+            _done = true;
+            _condition.broadcast();
+        }
+        _thread->join();
+        delete _thread;
+    }
+}
+
+void EphemerisCache::setStep( double minutes )
+{
+    if( minutes <= 0. )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EphemerisCache: Step must be positive." << std::endl;
+        return;
+    }
+    _stepMinutes = minutes;
+    invalidate();
+}
+void EphemerisCache::setWindow( double hours )
+{
+    if( hours <= 0. )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EphemerisCache: Window must be positive." << std::endl;
+        return;
+    }
+    _windowHours = hours;
+    invalidate();
+}
+void EphemerisCache::setLocationTolerance( double degrees )
+{
+    if( degrees < 0. )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: EphemerisCache: Location tolerance must not be negative." << std::endl;
+        return;
+    }
+    _locationTolerance = degrees;
+}
+
+bool EphemerisCache::matchLocation( double latitude, double longitude,
+    double tableLatitude, double tableLongitude ) const
+{
+    double deltaLong( fabs( longitude - tableLongitude ) );
+    if( deltaLong > 180. )
+        deltaLong = 360. - deltaLong;
+    return( ( fabs( latitude - tableLatitude ) <= _locationTolerance ) &&
+        ( deltaLong <= _locationTolerance ) );
+}
+
+
+bool EphemerisCache::getSample( double mjd, double latitude, double longitude, Sample& sample )
+{
+    osg::ref_ptr< Table > table;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        table = _table;
+    }
+
+    if( !( table.valid() ) ||
+        !( matchLocation( latitude, longitude, table->_latitude, table->_longitude ) ) ||
+        ( mjd < table->_startMJD ) || ( mjd > table->getEndMJD() ) )
+    {
+        // Table is missing, or doesn't cover this time and place.
+        computeSample( mjd, latitude, longitude, sample );
+        request( mjd, latitude, longitude );
+        return( false );
+    }
+
+    const unsigned int lastIdx( table->_samples.size() - 1 );
+    const double f( ( mjd - table->_startMJD ) / table->_stepDays );
+    const unsigned int idx( osg::minimum< unsigned int >( (unsigned int)f, lastIdx - 1 ) );
+    const double t( f - (double)idx );
+    const Sample& a( table->_samples[ idx ] );
+    const Sample& b( table->_samples[ idx + 1 ] );
+    sample._sunRA = interpolateHours( a._sunRA, b._sunRA, t );
+    sample._sunDec = a._sunDec + ( b._sunDec - a._sunDec ) * t;
+    sample._moonRA = interpolateHours( a._moonRA, b._moonRA, t );
+    sample._moonDec = a._moonDec + ( b._moonDec - a._moonDec ) * t;
+    if( longitude == table->_longitude )
+        sample._lst = interpolateHours( a._lst, b._lst, t );
+    else
+        // Nearby location. The sidereal time is cheap compared to the
+        // Moon, and one second of error is 15 arc seconds of sky.
+        sample._lst = osgEphemeris::EphemerisEngine::getLocalSiderealTimePrecise( mjd, -longitude );
+
+    // Compute the next table before time runs off either end of this one,
+    // extending in the direction time is running. The thresholds mirror
+    // for a backward table, so a new table never starts past one of them.
+    // Keep the table's location, so that a slowly moving viewer doesn't
+    // request a new table every frame.
+    const double span( table->getEndMJD() - table->_startMJD );
+    const double where( ( mjd - table->_startMJD ) / span );
+    if( where > ( table->_backward ? .95 : .75 ) )
+        request( mjd, table->_latitude, table->_longitude );
+    else if( where < ( table->_backward ? .25 : .05 ) )
+        request( mjd, table->_latitude, table->_longitude, true );
+
+    return( true );
+}
+
+void EphemerisCache::fill( double mjd, double latitude, double longitude )
+{
+    Request req;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        initRequest( req, mjd, latitude, longitude );
+    }
+
+    if( !( _cSun.valid() ) )
+    {
+        _cSun = new osgEphemeris::Sun;
+        UTIL_MEMORY_CHECK( _cSun.get(), "EphemerisCache _cSun", );
+        _cMoon = new osgEphemeris::Moon;
+        UTIL_MEMORY_CHECK( _cMoon.get(), "EphemerisCache _cMoon", );
+    }
+    osg::ref_ptr< Table > table( computeTable( req, _cSun.get(), _cMoon.get() ) );
+    storeTable( table.get() );
+}
+
+void EphemerisCache::invalidate()
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    _table = NULL;
+    _generation++;
+}
+
+
+void EphemerisCache::computeSample( double mjd, double latitude, double longitude, Sample& sample )
+{
+    if( !( _cSun.valid() ) )
+    {
+        _cSun = new osgEphemeris::Sun;
+        UTIL_MEMORY_CHECK( _cSun.get(), "EphemerisCache _cSun", );
+        _cMoon = new osgEphemeris::Moon;
+        UTIL_MEMORY_CHECK( _cMoon.get(), "EphemerisCache _cMoon", );
+    }
+    computeSample( _cSun.get(), _cMoon.get(), mjd, latitude, longitude, sample );
+}
+void EphemerisCache::computeSample( osgEphemeris::Sun* sun, osgEphemeris::Moon* moon,
+    double mjd, double latitude, double longitude, Sample& sample )
+{
+    double ra, dec;
+    sun->updatePosition( mjd );
+    sun->getPos( &ra, &dec );
+    sample._sunRA = ra / osg::PI * 12.0;
+    sample._sunDec = osg::RadiansToDegrees( dec );
+
+    // The Moon position is topocentric, and depends on the Sun.
+    const double lst( osgEphemeris::EphemerisEngine::getLocalSiderealTimePrecise( mjd, -longitude ) );
+    moon->updatePosition( mjd, lst, latitude, sun );
+    moon->getPos( &ra, &dec );
+    sample._moonRA = ra / osg::PI * 12.0;
+    sample._moonDec = osg::RadiansToDegrees( dec );
+
+    sample._lst = lst;
+}
+
+
+osgEphemeris::DateTime EphemerisCache::toDateTime( double mjd )
+{
+    // See Meeus, "Astronomical Algorithms", ch. 7. The XEphem epoch is
+    // JD 2415020.0, and Julian days begin at noon, so add .5 to start
+    // the day at midnight.
+    const double jd( mjd + 2415020.5 );
+    double z( floor( jd ) );
+    // A small bias keeps whole seconds from truncating to the one before.
+    double secs( floor( ( jd - z ) * 86400. + 1e-4 ) );
+    if( secs >= 86400. )
+    {
+        z += 1.;
+        secs -= 86400.;
+    }
+
+    double a( z );
+    if( z >= 2299161. )
+    {
+        const double alpha( floor( ( z - 1867216.25 ) / 36524.25 ) );
+        a = z + 1. + alpha - floor( alpha / 4. );
+    }
+    const double b( a + 1524. );
+    const double c( floor( ( b - 122.1 ) / 365.25 ) );
+    const double d( floor( 365.25 * c ) );
+    const double e( floor( ( b - d ) / 30.6001 ) );
+
+    const int day( (int)( b - d - floor( 30.6001 * e ) ) );
+    const int month( (int)( ( e < 14. ) ? ( e - 1. ) : ( e - 13. ) ) );
+    const int year( (int)( ( month > 2 ) ? ( c - 4716. ) : ( c - 4715. ) ) );
+    const int hour( (int)( secs / 3600. ) );
+    secs -= hour * 3600.;
+    const int minute( (int)( secs / 60. ) );
+    secs -= minute * 60.;
+    return( osgEphemeris::DateTime( year, month, day, hour, minute, (int)secs ) );
+}
+
+void EphemerisCache::computePlanet( Planet planet, double mjd,
+    double& ra, double& dec, double& magnitude )
+{
+    // Schlyter's day number. The XEphem epoch is JD 2415020.0, and
+    // Schlyter's is JD 2451543.5.
+    const double d( mjd - 36523.5 );
+
+    // Geocentric ecliptic position of the Sun.
+    const double sunPerihelion[ 2 ] = { 282.9404, 4.70935e-5 };
+    const double sunAnomaly[ 2 ] = { 356.0470, 0.9856002585 };
+    double v, sunDistance;
+    solveOrbit( 1., 0.016709 - 1.151e-9 * d, elementRadians( sunAnomaly, d ), v, sunDistance );
+    const double sunLongitude( v + elementRadians( sunPerihelion, d ) );
+    const double xs( sunDistance * cos( sunLongitude ) );
+    const double ys( sunDistance * sin( sunLongitude ) );
+
+    // Heliocentric ecliptic position of the planet.
+    const PlanetElements& el( s_planetElements[ planet ] );
+    const double node( elementRadians( el._node, d ) );
+    const double inclination( elementRadians( el._inclination, d ) );
+    double r;
+    solveOrbit( el._axis, el._eccentricity[ 0 ] + el._eccentricity[ 1 ] * d,
+        elementRadians( el._anomaly, d ), v, r );
+    const double u( v + elementRadians( el._perihelion, d ) );
+    const double xh( r * ( cos( node ) * cos( u ) - sin( node ) * sin( u ) * cos( inclination ) ) );
+    const double yh( r * ( sin( node ) * cos( u ) + cos( node ) * sin( u ) * cos( inclination ) ) );
+    const double zh( r * sin( u ) * sin( inclination ) );
+
+    // Geocentric, then equatorial.
+    const double xg( xh + xs ), yg( yh + ys ), zg( zh );
+    const double obliquity( osg::DegreesToRadians( 23.4393 - 3.563e-7 * d ) );
+    const double xe( xg );
+    const double ye( yg * cos( obliquity ) - zg * sin( obliquity ) );
+    const double ze( yg * sin( obliquity ) + zg * cos( obliquity ) );
+    double raRadians( atan2( ye, xe ) );
+    if( raRadians < 0. )
+        raRadians += 2. * osg::PI;
+    ra = raRadians / osg::PI * 12.;
+    dec = osg::RadiansToDegrees( atan2( ze, sqrt( xe * xe + ye * ye ) ) );
+
+    // Magnitude from the distances and the phase angle (Sun-planet-Earth).
+    const double distance( sqrt( xg * xg + yg * yg + zg * zg ) );
+    const double cosPhase( ( r * r + distance * distance - sunDistance * sunDistance ) / ( 2. * r * distance ) );
+    const double phase( osg::RadiansToDegrees( acos( osg::clampBetween( cosPhase, -1., 1. ) ) ) );
+    magnitude = el._magnitude + 5. * log10( r * distance ) + el._phase1 * phase +
+        el._phase3 * phase * phase * phase + el._phase6 * pow( phase, 6. );
+}
+
+
+void EphemerisCache::request( double mjd, double latitude, double longitude, bool backward )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+
+    // If a table for this location covering this time is already
+    // on its way, wait for it.
+    const double span( _request._stepDays * ( _request._numSamples - 1 ) );
+    if( ( _requestPending || _requestInFlight ) && ( _request._generation == _generation ) &&
+        matchLocation( latitude, longitude, _request._latitude, _request._longitude ) &&
+        ( mjd >= _request._startMJD ) && ( mjd <= _request._startMJD + span ) )
+        return;
+
+    initRequest( _request, mjd, latitude, longitude, backward );
+    _requestPending = true;
+
+    if( _thread == NULL )
+    {
+        _thread = new EphemerisCacheThread( this );
+        UTIL_MEMORY_CHECK( _thread, "EphemerisCache _thread", );
+        _thread->setSchedulePriority( OpenThreads::Thread::THREAD_PRIORITY_LOW );
+        _thread->start();
+    }
+    _condition.signal();
+}
+
+void EphemerisCache::initRequest( Request& req, double mjd, double latitude, double longitude,
+    bool backward ) const
+{
+    // Start the table a little before the requested time, so that
+    // small steps backwards in time don't miss. Time running backwards
+    // gets the mirror image: the table ends a little after it.
+    req._stepDays = _stepMinutes / ( 24. * 60. );
+    req._numSamples = osg::maximum< unsigned int >(
+        (unsigned int)( _windowHours * 60. / _stepMinutes ) + 1, 2 );
+    req._startMJD = mjd - req._stepDays * ( req._numSamples - 1 ) * ( backward ? .9 : .1 );
+    req._latitude = latitude;
+    req._longitude = longitude;
+    req._generation = _generation;
+    req._backward = backward;
+}
+
+EphemerisCache::Table* EphemerisCache::computeTable( const Request& req,
+    osgEphemeris::Sun* sun, osgEphemeris::Moon* moon )
+{
+    Table* table = new Table;
+    UTIL_MEMORY_CHECK( table, "EphemerisCache Table", NULL );
+    table->_startMJD = req._startMJD;
+    table->_stepDays = req._stepDays;
+    table->_latitude = req._latitude;
+    table->_longitude = req._longitude;
+    table->_generation = req._generation;
+    table->_backward = req._backward;
+    table->_samples.resize( req._numSamples );
+
+    unsigned int idx;
+    for( idx=0; idx<req._numSamples; idx++ )
+        computeSample( sun, moon, req._startMJD + req._stepDays * idx,
+            req._latitude, req._longitude, table->_samples[ idx ] );
+
+    return( table );
+}
+
+bool EphemerisCache::waitForRequest( Request& req )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    _requestInFlight = false;
+    while( !_requestPending && !_done )
+        _condition.wait( &_mutex );
+    if( _done )
+        return( false );
+
+    req = _request;
+    _requestPending = false;
+    _requestInFlight = true;
+    return( true );
+}
+
+void EphemerisCache::storeTable( Table* table )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    // Discard tables requested before the last invalidate().
+    if( ( table != NULL ) && ( table->_generation == _generation ) )
+        _table = table;
+}
+
+
+// namespace backdropFX
+}
@@ -0,0 +1,217 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/GaussianKernel.h>
+#include <backdropFX/ShaderModuleUtils.h>
+#include <osg/Math>
+#include <osg/Notify>
+#include <osgDB/FileUtils>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <backdropFX/Utils.h>
+#include <map>
+#include <sstream>
+#include <cmath>
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+// Below this, the kernel is a single tap.
+static const float MinSigma( .1f );
+
+// Generated programs, by tap count, shared by all GaussianKernels.
+typedef std::map< unsigned int, osg::ref_ptr< osg::Program > > TapProgramMap;
+static TapProgramMap s_programs;
+static osg::ref_ptr< osg::Shader > s_vertexShader;
+static osg::ref_ptr< osg::Shader > s_fragmentTemplate;
+static OpenThreads::Mutex s_programMutex;
+/** \endcond */
+
+
+float
+computeGaussianKernel( float sigma, unsigned int maxTaps, std::vector< osg::Vec2 >& kernel )
+{
+    kernel.clear();
+    maxTaps = osg::clampBetween< unsigned int >( maxTaps, 1, GaussianKernel::MaxTaps );
+    if( ( sigma < MinSigma ) || ( maxTaps == 1 ) )
+    {
+        kernel.push_back( osg::Vec2( 0.f, 1.f ) );
+        return( 1.f );
+    }
+
+    // maxTaps covers the center texel and 2 * ( maxTaps - 1 ) texels on
+    // each side. Spread the taps if 3 sigma doesn't fit.
+    const unsigned int maxRadius( 2 * ( maxTaps - 1 ) );
+    float spacing( 1.f );
+    unsigned int radius( (unsigned int)( ceilf( 3.f * sigma ) ) );
+    if( radius > maxRadius )
+    {
+        spacing = 3.f * sigma / (float)maxRadius;
+        sigma /= spacing;
+        radius = maxRadius;
+    }
+
+    // Discrete weights for texels 0 through radius.
+    std::vector< float > weights( radius + 2, 0.f );
+    const float denom( 2.f * sigma * sigma );
+    float sum( 0.f );
+    unsigned int idx;
+    for( idx = 0; idx <= radius; idx++ )
+    {
+        weights[ idx ] = expf( -(float)( idx * idx ) / denom );
+        sum += ( idx == 0 ) ? weights[ idx ] : 2.f * weights[ idx ];
+    }
+
+    // Merge texel pairs ( 1, 2 ), ( 3, 4 ), ... into one bilinear tap each.
+    // weights[ radius + 1 ] is zero, for an odd radius.
+    kernel.push_back( osg::Vec2( 0.f, weights[ 0 ] / sum ) );
+    for( idx = 1; idx <= radius; idx += 2 )
+    {
+        const float weight( weights[ idx ] + weights[ idx + 1 ] );
+        const float offset( ( idx * weights[ idx ] + ( idx + 1 ) * weights[ idx + 1 ] ) / weight );
+        kernel.push_back( osg::Vec2( offset * spacing, weight / sum ) );
+    }
+    return( spacing );
+}
+
+osg::Program*
+getGaussianBlurProgram( unsigned int numTaps )
+{
+    numTaps = osg::clampBetween< unsigned int >( numTaps, 1, GaussianKernel::MaxTaps );
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( s_programMutex );
+    TapProgramMap::const_iterator it( s_programs.find( numTaps ) );
+    if( it != s_programs.end() )
+        return( it->second.get() );
+
+    if( !( s_vertexShader.valid() ) )
+    {
+        __LOAD_SHADER( s_vertexShader, osg::Shader::VERTEX, "shaders/effects/none.vs" );
+        __LOAD_SHADER( s_fragmentTemplate, osg::Shader::FRAGMENT, "shaders/effects/gaussBlur.fs" );
+    }
+
+    std::ostringstream ostr;
+    ostr << "#define GAUSS_TAPS " << numTaps << "\n" <<
+        "#define GAUSS_MAX_TAPS " << GaussianKernel::MaxTaps << "\n" <<
+        s_fragmentTemplate->getShaderSource();
+
+    osg::ref_ptr< osg::Shader > fragment( new osg::Shader( osg::Shader::FRAGMENT ) );
+    UTIL_MEMORY_CHECK( fragment.get(), "getGaussianBlurProgram Shader", NULL );
+    {
+        std::ostringstream name;
+        name << "gaussBlur" << numTaps << ".fs";
+        fragment->setName( name.str() );
+    }
+    fragment->setShaderSource( ostr.str() );
+    backdropFX::shaderPreProcess( fragment.get() );
+
+    osg::ref_ptr< osg::Program > program( new osg::Program );
+    UTIL_MEMORY_CHECK( program.get(), "getGaussianBlurProgram Program", NULL );
+    {
+        std::ostringstream name;
+        name << "Effect gaussBlur " << numTaps;
+        program->setName( name.str() );
+    }
+    program->addShader( s_vertexShader.get() );
+    program->addShader( fragment.get() );
+    s_programs[ numTaps ] = program;
+
+    osg::notify( osg::INFO ) << "backdropFX: Generated " << program->getName() << " program." << std::endl;
+    return( program.get() );
+}
+
+
+
+const unsigned int GaussianKernel::MaxTaps;
+
+GaussianKernel::GaussianKernel( float sigma, unsigned int maxTaps )
+  : _sigma( sigma ),
+    _maxTaps( maxTaps ),
+    _numTaps( 0 ),
+    _spacing( 1.f )
+{
+    _kernel = new osg::Uniform( osg::Uniform::FLOAT_VEC2, "gaussKernel", MaxTaps );
+    UTIL_MEMORY_CHECK( _kernel.get(), "GaussianKernel _kernel", )
+    _step = new osg::Uniform( "gaussStep", osg::Vec2( 0.f, 0.f ) );
+    UTIL_MEMORY_CHECK( _step.get(), "GaussianKernel _step", )
+
+    internalUpdate();
+}
+GaussianKernel::~GaussianKernel()
+{
+}
+
+void
+GaussianKernel::setSigma( float sigma )
+{
+    if( sigma == _sigma )
+        return;
+    _sigma = sigma;
+    internalUpdate();
+}
+
+void
+GaussianKernel::setMaxTaps( unsigned int maxTaps )
+{
+    if( ( maxTaps < 1 ) || ( maxTaps > MaxTaps ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: GaussianKernel: Max taps must be in the range [1," <<
+            MaxTaps << "]." << std::endl;
+        return;
+    }
+    _maxTaps = maxTaps;
+    internalUpdate();
+}
+
+void
+GaussianKernel::apply( osg::State& state, const osg::Vec2& step ) const
+{
+    _locations.applyProgram( state, _program.get() );
+
+    osg::GL2Extensions* gl2Ext( osg::GL2Extensions::Get( state.getContextID(), true ) );
+    _locations.apply( state, gl2Ext, 0, _kernel.get() );
+
+    // Contexts draw the same kernel with different steps at the same time,
+    // so the step goes straight to GL. _step only names the uniform.
+    const GLint location( _locations.getLocation( state, 1, _step.get() ) );
+    if( location >= 0 )
+        gl2Ext->glUniform2f( location, step.x(), step.y() );
+}
+
+void
+GaussianKernel::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    _program->resizeGLObjectBuffers( maxSize );
+    _locations.resizeGLObjectBuffers( maxSize );
+}
+void
+GaussianKernel::releaseGLObjects( osg::State* state ) const
+{
+    _program->releaseGLObjects( state );
+    _locations.releaseGLObjects( state );
+}
+
+void
+GaussianKernel::internalUpdate()
+{
+    std::vector< osg::Vec2 > kernel;
+    _spacing = computeGaussianKernel( _sigma, _maxTaps, kernel );
+
+    // Unused elements stay zero; the program doesn't read them.
+    unsigned int idx;
+    for( idx = 0; idx < MaxTaps; idx++ )
+        _kernel->setElement( idx, ( idx < kernel.size() ) ? kernel[ idx ] : osg::Vec2( 0.f, 0.f ) );
+
+    if( kernel.size() != _numTaps )
+    {
+        _numTaps = kernel.size();
+        _program = getGaussianBlurProgram( _numTaps );
+    }
+}
+
+
+// namespace backdropFX
+}
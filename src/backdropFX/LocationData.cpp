@@ -6,6 +6,7 @@
 #include <OpenThreads/ScopedLock>
 
 #include <osg/io_utils>
+#include <algorithm>
 
 
 namespace backdropFX
@@ -30,11 +31,19 @@ LocationData::s_instance()
     {
         _s_instance = new LocationData;
         UTIL_MEMORY_CHECK( _s_instance, "LocationData instance", NULL );
+        // The default context lives for the life of the process.
+        _s_instance->ref();
     }
     return( _s_instance );
 }
 LocationData::LocationData()
+  : _latitude( 0. ),
+    _longitude( 0. ),
+    _updateDepth( 0 ),
+    _pendingChanges( 0 )
 {
+    internalInit( 0 );
+
     // Default time is noon on 1/1/2011. Note time is specified in absolute GMT.
     int year( 2011 ), month( 1 ), day( 1 );
     int hour( 6 ), min( 0 ), sec( 0 );
@@ -92,8 +101,9 @@ LocationData::getEastUp( osg::Vec3& east, osg::Vec3& up ) const
 void
 LocationData::setDateTime( const osgEphemeris::DateTime& dateTime )
 {
-    // TBD
-    //if( _dateTime != dateTime )
+    // DateTime has no comparison operator, and its accessors aren't const.
+    osgEphemeris::DateTime newDateTime( dateTime );
+    if( _dateTime.getModifiedJulianDate() != newDateTime.getModifiedJulianDate() )
     {
         _dateTime = dateTime;
         internalInit( DateTimeChanged );
@@ -145,14 +155,58 @@ LocationData::internalInit( unsigned int changed )
     {
         _uSunPosition = new osg::Uniform( "bdfx_sunPosition", _pos );
         UTIL_MEMORY_CHECK( _uSunPosition.get(), "LocationData Sun position uniform", );
+        // Changes during update, while the previous frame might be drawing.
+        _uSunPosition->setDataVariance( osg::Object::DYNAMIC );
     }
 
     if( changed != 0 )
     {
-        CallbackList::iterator it;
-        for( it=_cbList.begin(); it!=_cbList.end(); it++ )
-            (*(*it))( changed );
+        if( _updateDepth > 0 )
+            _pendingChanges |= changed;
+        else
+            executeCallbacks( changed );
+    }
+}
+
+/** \cond */
+static bool isDeleted( const LocationData::CallbackList::value_type& cb )
+{
+    return( !( cb.valid() ) );
+}
+/** \endcond */
+
+void
+LocationData::pruneCallbacks()
+{
+    _cbList.erase( std::remove_if( _cbList.begin(), _cbList.end(), isDeleted ), _cbList.end() );
+}
+
+void
+LocationData::executeCallbacks( unsigned int changed )
+{
+    // Iterate over strong references, in case a callback adds or removes
+    // callbacks, or releases the last other reference to one.
+    pruneCallbacks();
+    std::vector< osg::ref_ptr< Callback > > cbList;
+    cbList.reserve( _cbList.size() );
+    CallbackList::const_iterator it;
+    for( it=_cbList.begin(); it!=_cbList.end(); it++ )
+    {
+        osg::ref_ptr< Callback > cb;
+#if OSG_SUPPORTS_OBSERVER_LOCK
+        // Skip a callback that another thread is deleting.
+        if( !( it->lock( cb ) ) )
+            continue;
+#else
+        cb = it->get();
+#endif
+        if( cb.valid() )
+            cbList.push_back( cb );
     }
+
+    std::vector< osg::ref_ptr< Callback > >::const_iterator cbit;
+    for( cbit=cbList.begin(); cbit!=cbList.end(); cbit++ )
+        (*(*cbit))( changed );
 }
 
 
@@ -161,12 +215,49 @@ LocationData::Callback::Callback()
 {
 }
 
+void
+LocationData::addCallback( Callback* cb )
+{
+    // A new callback might reuse the address of a deleted one.
+    pruneCallbacks();
+    if( std::find( _cbList.begin(), _cbList.end(), cb ) == _cbList.end() )
+        _cbList.push_back( cb );
+}
+void
+LocationData::removeCallback( Callback* cb )
+{
+    CallbackList::iterator it( std::find( _cbList.begin(), _cbList.end(), cb ) );
+    if( it != _cbList.end() )
+        _cbList.erase( it );
+}
 LocationData::CallbackList&
 LocationData::getCallbackList()
 {
     return( _cbList );
 }
 
+void
+LocationData::beginUpdate()
+{
+    _updateDepth++;
+}
+void
+LocationData::endUpdate()
+{
+    if( _updateDepth == 0 )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: LocationData::endUpdate without beginUpdate." << std::endl;
+        return;
+    }
+    if( --_updateDepth > 0 )
+        return;
+
+    const unsigned int changed( _pendingChanges );
+    _pendingChanges = 0;
+    if( changed != 0 )
+        executeCallbacks( changed );
+}
+
 
 
 // namespace backdropFX
@@ -127,10 +127,96 @@ protected:
 };
 /** \endcond */
 
+/** \cond */
+// Pushes the Sun position of the LocationData assigned to the current
+// view above the whole scene. Views using the default context get the
+// default Sun position uniform from the managed root StateSet.
+class LocationDataCullCB : public osg::NodeCallback
+{
+public:
+    LocationDataCullCB( Manager* mgr )
+      : _mgr( mgr )
+    {}
+
+    virtual void operator()( osg::Node* node, osg::NodeVisitor* nv )
+    {
+        osgUtil::CullVisitor* cv = static_cast< osgUtil::CullVisitor* >( nv );
+        const osg::Camera* camera( cv->getCurrentRenderBin()->getStage()->getCamera() );
+
+        osg::ref_ptr< osg::StateSet > ss;
+        {
+            OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mgr->_locationContextLock );
+            Manager::LocationContextMap::const_iterator it( _mgr->_locationContexts.find( camera ) );
+            if( it != _mgr->_locationContexts.end() )
+                ss = it->second._stateSet;
+        }
+
+        if( ss.valid() )
+            cv->pushStateSet( ss.get() );
+        traverse( node, nv );
+        if( ss.valid() )
+            cv->popStateSet();
+    }
+
+protected:
+    // The Manager owns the managed root, which owns this callback.
+    Manager* _mgr;
+};
+
+// Polls for shader module changes that nodes in the managed scene graph
+// make during update, and rebuilds the shader modules once they're done.
+class ManagerUpdateCB : public osg::NodeCallback
+{
+public:
+    ManagerUpdateCB( Manager* mgr )
+      : _mgr( mgr )
+    {}
+
+    virtual void operator()( osg::Node* node, osg::NodeVisitor* nv )
+    {
+        traverse( node, nv );
+
+        DepthPartition& dp( _mgr->getDepthPartition() );
+        if( dp.getShaderModulesDirty() )
+        {
+            _mgr->rebuildShaderModules();
+            dp.setShaderModulesDirty( false );
+        }
+    }
+
+protected:
+    // The Manager owns the managed root, which owns this callback.
+    Manager* _mgr;
+};
+/** \endcond */
+
+
+/** \cond */
+// Color buffer A is 8-bit, or 16-bit float for the hdr feature flag.
+static void
+setColorBufferAFormat( osg::Texture2D* colorBufferA, bool hdr )
+{
+    if( hdr )
+    {
+        colorBufferA->setInternalFormat( GL_RGBA16F_ARB );
+        colorBufferA->setSourceFormat( GL_RGBA );
+        colorBufferA->setSourceType( GL_FLOAT );
+    }
+    else
+    {
+        colorBufferA->setInternalFormat( GL_RGBA );
+        colorBufferA->setSourceFormat( GL_RGBA );
+        colorBufferA->setSourceType( GL_UNSIGNED_BYTE );
+    }
+    colorBufferA->dirtyTextureObject();
+}
+/** \endcond */
+
 
 unsigned int Manager::skyDome           ( 1u <<  0 );
 unsigned int Manager::shadowMap         ( 1u <<  1 );
 unsigned int Manager::depthPeel         ( 1u <<  2 );
+unsigned int Manager::hdr               ( 1u <<  3 );
 unsigned int Manager::defaultFeatures   (
     Manager::skyDome |
     Manager::shadowMap |
@@ -153,7 +239,8 @@ Manager::Manager()
     _lightModelAmbient( osg::Vec4( 0.2, 0.2, 0.2, 1.0 ) ),
     _dm( 0 ),
     _texW( 1280 ),
-    _texH( 1024 )
+    _texH( 1024 ),
+    _hdr( false )
 {
     // DepthPeelBin should be created when the Manager is invoked, not
     // as a static during library load/init.
@@ -163,6 +250,11 @@ Manager::Manager()
 Manager::~Manager()
 {
     osgUtil::RenderBin::removeRenderBinPrototype( _depthPeelBinProxy.get() );
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _locationContextLock );
+    LocationContextMap::const_iterator it;
+    for( it=_locationContexts.begin(); it!=_locationContexts.end(); it++ )
+        const_cast< osg::Camera* >( it->first )->removeObserver( this );
 }
 
 void
@@ -172,8 +264,11 @@ Manager::internalInit()
     UTIL_MEMORY_CHECK( _rootNode.get(), "Manager constructor _rootNode", )
     _rootNode->setName( "backdropFX Managed Root" );
 
-    // Set the Sun position for shader lighting
+    // Set the Sun position for shader lighting. Views with their own
+    // LocationData override it during cull.
     _rootNode->getOrCreateStateSet()->addUniform( LocationData::s_instance()->getSunPositionUniform() );
+    _rootNode->setCullCallback( new LocationDataCullCB( this ) );
+    addUpdateCallback( *_rootNode, new ManagerUpdateCB( this ) );
 
     _skyDome = new backdropFX::SkyDome;
     UTIL_MEMORY_CHECK( _skyDome.get(), "Manager constructor _skyDome", )
@@ -206,7 +301,7 @@ Manager::internalInit()
     _colorBufferA = new osg::Texture2D;
     UTIL_MEMORY_CHECK( _colorBufferA.get(), "Manager constructor _colorBufferA", );
     _colorBufferA->setName( "Color buffer A" );
-    _colorBufferA->setInternalFormat( GL_RGBA );
+    setColorBufferAFormat( _colorBufferA.get(), _hdr );
     _colorBufferA->setBorderWidth( 0 );
     _colorBufferA->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
     _colorBufferA->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
@@ -428,8 +523,20 @@ Manager::internalInit()
 
 void Manager::rebuild( unsigned int featureFlags )
 {
+    const bool hdrChanged( _hdr != ( ( featureFlags & hdr ) != 0 ) );
+    _hdr = ( ( featureFlags & hdr ) != 0 );
     if( !_rootNode.valid() )
         internalInit();
+    else if( hdrChanged )
+        setColorBufferAFormat( _colorBufferA.get(), _hdr );
+    if( hdrChanged )
+    {
+        // Effect outputs that already exist follow color buffer A.
+        EffectVector& ev( _renderFX->getEffectVector() );
+        EffectVector::iterator it;
+        for( it = ev.begin(); it != ev.end(); it++ )
+            (*it)->setHDR( _hdr );
+    }
 
     // Debug info.
     osg::notify( osg::INFO ) << "BDFX: rebuilding with flags: " << std::hex << featureFlags << std::dec << std::endl;
@@ -439,6 +546,8 @@ void Manager::rebuild( unsigned int featureFlags )
         osg::notify( osg::INFO ) << "BDFX:\tshadowMap" << std::endl;
     if( ( featureFlags & depthPeel ) != 0 )
         osg::notify( osg::INFO ) << "BDFX:\tdepthPeel" << std::endl;
+    if( ( featureFlags & hdr ) != 0 )
+        osg::notify( osg::INFO ) << "BDFX:\thdr" << std::endl;
 
     _rootNode->removeChildren( 0, _rootNode->getNumChildren() );
     _depthPart->removeChildren( 0, _depthPart->getNumChildren() );
@@ -540,21 +649,27 @@ void Manager::rebuild( unsigned int featureFlags )
     _renderFX->setFBO( _fbo.get() );
 
 
-    // Rebuild shader modules.
-    {
-        // Need to save the effects camera's current node mask, and enable the glow
-        // camera for this traversal so that shaders are built and ready to go
-        // when the app (RenderingEffects) enables the effects camera.
-        osg::Node::NodeMask mask = _effectsCamera->getNodeMask();
-        _effectsCamera->setNodeMask( 0xffffffff );
+    rebuildShaderModules();
+
+    resize();
+}
 
-        backdropFX::RebuildShaderModules rsm;
-        _rootNode->accept( rsm );
+void
+Manager::rebuildShaderModules()
+{
+    // Need to save the effects camera's current node mask, and enable the glow
+    // camera for this traversal so that shaders are built and ready to go
+    // when the app (RenderingEffects) enables the effects camera.
+    osg::Node::NodeMask mask = _effectsCamera->getNodeMask();
+    _effectsCamera->setNodeMask( 0xffffffff );
 
-        _effectsCamera->setNodeMask( mask );
-    }
+    backdropFX::RebuildShaderModules rsm;
+    _rootNode->accept( rsm );
 
-    resize();
+    _effectsCamera->setNodeMask( mask );
+
+    // Single pass DepthPartition checks the geometry shader output limit.
+    _depthPart->setGeometryOutputComponents( rsm.getGeometryOutputComponents() );
 }
 
 
@@ -618,9 +733,11 @@ void Manager::setSceneFogState( osg::Node* node )
 void Manager::setSceneShadowState( bool shadowsEnabled )
 {
     // Set the shadow shaders and uniforms.
-    std::string vFileName, fFileName;
+    std::string vFileName, fFileName, cFileName, kFileName;
     osg::ref_ptr< osg::Shader >* vShader;
     osg::ref_ptr< osg::Shader >* fShader;
+    osg::ref_ptr< osg::Shader >* cShader;
+    osg::ref_ptr< osg::Shader >* kShader;
     if( shadowsEnabled )
     {
         vFileName = "shaders/gl2/shadowmap-texcoords-on.vs";
@@ -635,6 +752,33 @@ void Manager::setSceneShadowState( bool shadowsEnabled )
         fFileName = "shaders/gl2/shadowmap-depthtest-off.fs";
         fShader = &_shadowsOffFragment;
     }
+    if( shadowsEnabled && ( _shadowMap->getNumSunCascades() > 0 ) )
+    {
+        cFileName = "shaders/gl2/shadowmap-cascade-on.fs";
+        cShader = &_shadowsCascadeOnFragment;
+    }
+    else
+    {
+        cFileName = "shaders/gl2/shadowmap-cascade-off.fs";
+        cShader = &_shadowsCascadeOffFragment;
+    }
+    const ShadowMap::SoftShadowMode softMode( shadowsEnabled ?
+        _shadowMap->getSoftShadowMode() : ShadowMap::SHADOW_HARD );
+    if( softMode == ShadowMap::SHADOW_PCF_KERNEL )
+    {
+        kFileName = "shaders/gl2/shadowmap-filter-kernel.fs";
+        kShader = &_shadowsFilterKernelFragment;
+    }
+    else if( softMode == ShadowMap::SHADOW_PCF )
+    {
+        kFileName = "shaders/gl2/shadowmap-filter-pcf.fs";
+        kShader = &_shadowsFilterPCFFragment;
+    }
+    else
+    {
+        kFileName = "shaders/gl2/shadowmap-filter-hard.fs";
+        kShader = &_shadowsFilterHardFragment;
+    }
 
     if( !( vShader->valid() ) )
     {
@@ -646,10 +790,22 @@ void Manager::setSceneShadowState( bool shadowsEnabled )
         __LOAD_SHADER( (*fShader), osg::Shader::FRAGMENT, fFileName );
         UTIL_MEMORY_CHECK( (*fShader), "Manager setShadowShaders fragment", );
     }
+    if( !( cShader->valid() ) )
+    {
+        __LOAD_SHADER( (*cShader), osg::Shader::FRAGMENT, cFileName );
+        UTIL_MEMORY_CHECK( (*cShader), "Manager setShadowShaders cascade fragment", );
+    }
+    if( !( kShader->valid() ) )
+    {
+        __LOAD_SHADER( (*kShader), osg::Shader::FRAGMENT, kFileName );
+        UTIL_MEMORY_CHECK( (*kShader), "Manager setShadowShaders filter fragment", );
+    }
 
     ShaderModuleCullCallback* smccb = getOrCreateShaderModuleCullCallback( *_depthPart );
     smccb->setShader( getShaderSemantic( vFileName ), vShader->get() );
     smccb->setShader( getShaderSemantic( fFileName ), fShader->get() );
+    smccb->setShader( getShaderSemantic( cFileName ), cShader->get() );
+    smccb->setShader( getShaderSemantic( kFileName ), kShader->get() );
 }
 void Manager::setSceneLightState()
 {
@@ -914,6 +1070,66 @@ Manager::getFBO() const
 }
 
 
+void
+Manager::setLocationData( osg::Camera* camera, LocationData* locationData )
+{
+    if( !_rootNode.valid() )
+        internalInit();
+
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _locationContextLock );
+        LocationContextMap::iterator it( _locationContexts.find( camera ) );
+        if( ( locationData == NULL ) || ( locationData == LocationData::s_instance() ) )
+        {
+            if( it != _locationContexts.end() )
+            {
+                camera->removeObserver( this );
+                _locationContexts.erase( it );
+            }
+            return;
+        }
+
+        osg::ref_ptr< osg::StateSet > ss( new osg::StateSet );
+        UTIL_MEMORY_CHECK( ss.get(), "Manager LocationData StateSet", );
+        ss->addUniform( locationData->getSunPositionUniform() );
+
+        if( it == _locationContexts.end() )
+            camera->addObserver( this );
+        LocationContext& lc( _locationContexts[ camera ] );
+        lc._locationData = locationData;
+        lc._stateSet = ss;
+    }
+
+    // Position this location's sky now, rather than during cull.
+    _skyDome->addLocationData( locationData );
+}
+void
+Manager::objectDeleted( void* object )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _locationContextLock );
+    LocationContextMap::iterator it;
+    for( it=_locationContexts.begin(); it!=_locationContexts.end(); it++ )
+    {
+        if( static_cast< const osg::Referenced* >( it->first ) == object )
+        {
+            _locationContexts.erase( it );
+            return;
+        }
+    }
+}
+
+osg::ref_ptr< LocationData >
+Manager::getLocationData( const osg::Camera* camera ) const
+{
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _locationContextLock );
+        LocationContextMap::const_iterator it( _locationContexts.find( camera ) );
+        if( it != _locationContexts.end() )
+            return( it->second._locationData );
+    }
+    return( LocationData::s_instance() );
+}
+
 SkyDome& Manager::getSkyDome()
 {
     if( !_rootNode.valid() )
@@ -1026,6 +1242,11 @@ bool Manager::getFogEnable() const
     return( _fogEnable );
 }
 
+bool Manager::getHDR() const
+{
+    return( _hdr );
+}
+
 
 
 void Manager::setLightingEnable( bool enable )
@@ -1123,6 +1344,16 @@ bool Manager::getLightEnable( unsigned int lightNum ) const
 
     return( _lightInfoVec[ lightNum ]->_enable );
 }
+const osg::Light* Manager::getLight( unsigned int lightNum ) const
+{
+    if( _lightInfoVec.size() <= lightNum )
+        return( NULL );
+
+    if( !( _lightInfoVec[ lightNum ].valid() ) )
+        return( NULL );
+
+    return( _lightInfoVec[ lightNum ]->_light.get() );
+}
 
 void Manager::setLightModelSimplified( bool enable )
 {
@@ -1,19 +1,230 @@
 // Copyright (c) 2010 Skew Matrix Software. All rights reserved.
 
 #include <backdropFX/MoonBody.h>
+#include <backdropFX/AssetLoader.h>
 #include <osgwTools/Shapes.h>
 #include <osgDB/ReadFile>
 #include <osgDB/FileUtils>
 #include <osg/CullFace>
 #include <osg/Texture2D>
+#include <osg/Timer>
+#include <osg/observer_ptr>
 #include <backdropFX/Utils.h>
 
 #include <osg/io_utils>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
 
 
 namespace backdropFX {
 
 
+/** \cond */
+static std::string s_textureCacheFileName;
+
+static const char CacheMagic[ 8 ] = { 'B', 'D', 'F', 'X', 'M', 'O', 'N', 0 };
+static const unsigned int CacheVersion( 3 );
+
+// Normal map bumpiness: the slope, in texels, of a height change from 0 to 1.
+static const float NormalMapScale( 2.f );
+
+
+// FNV-1a hash of the source image pixels, so that an edited source image
+// with the same dimensions and format doesn't match a stale cache.
+static unsigned int hashImage( const osg::Image* source )
+{
+    unsigned int hash( 2166136261u );
+    const unsigned char* data( source->data() );
+    const unsigned int size( source->getImageSizeInBytes() );
+    unsigned int idx;
+    for( idx=0; idx<size; idx++ )
+        hash = ( hash ^ data[ idx ] ) * 16777619u;
+    return( hash );
+}
+
+// The cache holds the mipmapped texture and normal map for a source
+// image with the given dimensions, format, and pixel hash.
+static bool readCache( const osg::Image* source, unsigned int sourceHash,
+    osg::ref_ptr< osg::Image >& color, osg::ref_ptr< osg::Image >& normal )
+{
+    if( s_textureCacheFileName.empty() )
+        return( false );
+    std::ifstream istr( s_textureCacheFileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if( !istr.good() )
+        return( false );
+
+    char magic[ 8 ];
+    unsigned int header[ 5 ];
+    istr.read( magic, sizeof( magic ) );
+    istr.read( (char*)header, sizeof( header ) );
+    if( !istr.good() || ( memcmp( magic, CacheMagic, sizeof( magic ) ) != 0 ) ||
+        ( header[ 0 ] != CacheVersion ) ||
+        ( header[ 1 ] != (unsigned int)( source->s() ) ) || ( header[ 2 ] != (unsigned int)( source->t() ) ) ||
+        ( header[ 3 ] != (unsigned int)( source->getPixelFormat() ) ) ||
+        ( header[ 4 ] != sourceHash ) )
+    {
+        osg::notify( osg::INFO ) << "backdropFX: MoonBody: Ignoring out of date cache file \"" <<
+            s_textureCacheFileName << "\"." << std::endl;
+        return( false );
+    }
+
+    color = AssetLoader::readContainer( istr );
+    normal = AssetLoader::readContainer( istr );
+    if( !( color.valid() ) || !( normal.valid() ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: MoonBody: Can't read cache file \"" <<
+            s_textureCacheFileName << "\"." << std::endl;
+        return( false );
+    }
+    return( true );
+}
+
+// Writes a temporary file and renames it, so that readers never see a
+// partial cache.
+static void writeCache( const osg::Image* source, unsigned int sourceHash,
+    const osg::Image* color, const osg::Image* normal )
+{
+    if( s_textureCacheFileName.empty() )
+        return;
+    const std::string tempName( s_textureCacheFileName + ".tmp" );
+    {
+        std::ofstream ostr( tempName.c_str(), std::ios_base::out | std::ios_base::binary );
+        if( ostr.good() )
+        {
+            const unsigned int header[ 5 ] = { CacheVersion,
+                (unsigned int)( source->s() ), (unsigned int)( source->t() ),
+                (unsigned int)( source->getPixelFormat() ), sourceHash };
+            ostr.write( CacheMagic, sizeof( CacheMagic ) );
+            ostr.write( (const char*)header, sizeof( header ) );
+            AssetLoader::writeContainer( color, ostr );
+            AssetLoader::writeContainer( normal, ostr );
+            ostr.close();
+        }
+        if( !ostr.good() )
+        {
+            osg::notify( osg::WARN ) << "backdropFX: MoonBody: Can't write cache file \"" <<
+                tempName << "\"." << std::endl;
+            std::remove( tempName.c_str() );
+            return;
+        }
+    }
+
+#ifdef _WIN32
+    // rename() doesn't replace an existing file on Windows.
+    std::remove( s_textureCacheFileName.c_str() );
+#endif
+    if( std::rename( tempName.c_str(), s_textureCacheFileName.c_str() ) != 0 )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: MoonBody: Can't rename \"" << tempName <<
+            "\" to cache file \"" << s_textureCacheFileName << "\"." << std::endl;
+        std::remove( tempName.c_str() );
+    }
+}
+
+static osg::Texture2D* createTexture( const std::string& name )
+{
+    osg::Texture2D* tex = new osg::Texture2D;
+    UTIL_MEMORY_CHECK( tex, "MoonBody Texture2D", NULL );
+    tex->setName( name );
+    // The image arrives during a later update.
+    tex->setDataVariance( osg::Object::DYNAMIC );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::REPEAT );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    return( tex );
+}
+
+// Loads the Moon texture and normal map on the AssetLoader thread.
+// Converted containers ("moon.bdfxtex" and "moon-normal.bdfxtex", see the
+// assetconvert app) load without decoding. Otherwise, the texture is
+// decoded, and the mipmaps and normal map come from the cache file or are
+// computed.
+class MoonTextureRequest : public AssetLoader::Request
+{
+public:
+    MoonTextureRequest( osg::Texture2D* colorTex, osg::Texture2D* normalTex, osg::Uniform* useNormalMap )
+      : _fileName( "moon.jpg" ),
+        _colorTex( colorTex ),
+        _normalTex( normalTex ),
+        _useNormalMap( useNormalMap )
+    {}
+
+    virtual void load()
+    {
+        osg::Timer timer;
+        timer.setStartTick();
+
+        const std::string colorName( osgDB::findDataFile( AssetLoader::getContainerFileName( _fileName ) ) );
+        if( !( colorName.empty() ) )
+        {
+            _color = AssetLoader::readContainer( colorName );
+            const std::string normalName( osgDB::findDataFile( "moon-normal.bdfxtex" ) );
+            if( !( normalName.empty() ) )
+                _normal = AssetLoader::readContainer( normalName );
+            else
+                osg::notify( osg::INFO ) << "backdropFX: Moon: No moon-normal.bdfxtex. Not using a normal map." << std::endl;
+            if( _color.valid() )
+            {
+                osg::notify( osg::INFO ) << "backdropFX: Moon: Loaded textures in " <<
+                    timer.time_m() << " ms." << std::endl;
+                return;
+            }
+            _normal = NULL;
+        }
+
+        osg::ref_ptr< osg::Image > source( osgDB::readImageFile( _fileName ) );
+        if( source == NULL )
+        {
+            osg::notify( osg::WARN ) << "backdropFX: Moon: Can't open data file " << _fileName << std::endl;
+            return;
+        }
+        const unsigned int sourceHash( s_textureCacheFileName.empty() ? 0 : hashImage( source.get() ) );
+        if( readCache( source.get(), sourceHash, _color, _normal ) )
+            return;
+
+        _color = AssetLoader::convertImage( source.get(), false );
+        if( !( _color.valid() ) || !( _color->isMipmap() ) )
+        {
+            // Let OSG mipmap it, and do without the normal map.
+            osg::notify( osg::INFO ) << "backdropFX: Moon: " << _fileName <<
+                " isn't a power of two 8-bit image. Not precomputing mipmaps." << std::endl;
+            _color = source;
+            return;
+        }
+        _normal = AssetLoader::createNormalMap( _color.get(), NormalMapScale );
+        if( !( _normal.valid() ) )
+            return;
+        osg::notify( osg::INFO ) << "backdropFX: Moon: Computed texture mipmaps in " <<
+            timer.time_m() << " ms." << std::endl;
+        writeCache( source.get(), sourceHash, _color.get(), _normal.get() );
+    }
+
+    virtual void apply()
+    {
+        // The MoonBodys that own the textures might be gone.
+        if( _color.valid() && _colorTex.valid() )
+            _colorTex->setImage( _color.get() );
+        if( _normal.valid() && _normalTex.valid() && _useNormalMap.valid() )
+        {
+            _normalTex->setImage( _normal.get() );
+            _useNormalMap->set( true );
+        }
+    }
+
+protected:
+    std::string _fileName;
+    osg::ref_ptr< osg::Image > _color, _normal;
+
+    osg::observer_ptr< osg::Texture2D > _colorTex, _normalTex;
+    osg::observer_ptr< osg::Uniform > _useNormalMap;
+};
+/** \endcond */
+
+
+
 MoonBody::MoonBody( float radius )
   : _dirty( true ),
     _radius( radius ),
@@ -23,6 +234,14 @@ MoonBody::MoonBody( float radius )
     _dec( 0.f ),
     _distance( 384403.f )
 {
+    const osg::Vec3 dir( computeDirection( _ra, _dec ) );
+    _moonDirection0 = new osg::Uniform( "bdfx_moonDirection0", dir );
+    _moonDirection1 = new osg::Uniform( "bdfx_moonDirection1", dir );
+    _sunDirection0 = new osg::Uniform( "bdfx_sunDirection0", -dir );
+    _sunDirection1 = new osg::Uniform( "bdfx_sunDirection1", -dir );
+    _ephemerisFraction = new osg::Uniform( "bdfx_ephemerisFraction", 0.f );
+    _moonDistance = new osg::Uniform( "bdfx_moonDistance", _distance );
+    _earthshine = new osg::Uniform( "bdfx_earthshine", .12f );
 }
 
 MoonBody::MoonBody( const MoonBody& moon, const osg::CopyOp& copyop )
@@ -34,6 +253,14 @@ MoonBody::MoonBody( const MoonBody& moon, const osg::CopyOp& copyop )
     _dec( moon._dec ),
     _distance( moon._distance )
 {
+    _moonDirection0 = new osg::Uniform( *( moon._moonDirection0 ) );
+    _moonDirection1 = new osg::Uniform( *( moon._moonDirection1 ) );
+    _sunDirection0 = new osg::Uniform( *( moon._sunDirection0 ) );
+    _sunDirection1 = new osg::Uniform( *( moon._sunDirection1 ) );
+    _ephemerisFraction = new osg::Uniform( *( moon._ephemerisFraction ) );
+    _moonDistance = new osg::Uniform( *( moon._moonDistance ) );
+    _earthshine = new osg::Uniform( *( moon._earthshine ) );
+    shareTextures( moon );
 }
 
 MoonBody::~MoonBody()
@@ -41,6 +268,59 @@ MoonBody::~MoonBody()
 }
 
 
+bool
+MoonBody::initTextures()
+{
+    if( _colorTex.valid() )
+        return( true );
+
+    _colorTex = createTexture( "Moon" );
+    UTIL_MEMORY_CHECK( _colorTex.get(), "MoonBody color texture", false );
+    _normalTex = createTexture( "Moon normal map" );
+    UTIL_MEMORY_CHECK( _normalTex.get(), "MoonBody normal map", false );
+    _useNormalMap = new osg::Uniform( "bdfx_moonUseNormalMap", false );
+    UTIL_MEMORY_CHECK( _useNormalMap.get(), "MoonBody normal map uniform", false );
+    _useNormalMap->setDataVariance( osg::Object::DYNAMIC );
+
+    osg::ref_ptr< MoonTextureRequest > req( new MoonTextureRequest(
+        _colorTex.get(), _normalTex.get(), _useNormalMap.get() ) );
+    UTIL_MEMORY_CHECK( req.get(), "MoonBody MoonTextureRequest", false );
+    AssetLoader::instance()->request( req.get() );
+    return( true );
+}
+
+void
+MoonBody::shareTextures( const MoonBody& moon )
+{
+    _colorTex = moon._colorTex;
+    _normalTex = moon._normalTex;
+    _useNormalMap = moon._useNormalMap;
+    _dirty = true;
+}
+
+void
+MoonBody::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    if( _colorTex.valid() )
+        _colorTex->resizeGLObjectBuffers( maxSize );
+    if( _normalTex.valid() )
+        _normalTex->resizeGLObjectBuffers( maxSize );
+
+    osg::Geometry::resizeGLObjectBuffers( maxSize );
+}
+
+void
+MoonBody::releaseGLObjects( osg::State* state ) const
+{
+    if( _colorTex.valid() )
+        _colorTex->releaseGLObjects( state );
+    if( _normalTex.valid() )
+        _normalTex->releaseGLObjects( state );
+
+    osg::Geometry::releaseGLObjects( state );
+}
+
+
 void
 MoonBody::update()
 {
@@ -51,6 +331,11 @@ MoonBody::update()
     }
 }
 
+float
+MoonBody::getRadius() const
+{
+    return( _radius );
+}
 void
 MoonBody::setScale( float scale )
 {
@@ -90,32 +375,42 @@ MoonBody::setRADecDistance( float ra, float dec, float distance )
         _distance = distance;
         osg::notify( osg::INFO ) << "backdropFX: Moon " << _ra << "h " << dec << ", " << distance << std::endl;
 
-        double moonRotateZ = (12. - _ra) / -12. * osg::PI;
-        double moonRotateX = _dec / 180. * osg::PI;
-        osg::Matrix m( osg::Matrix::rotate( moonRotateX, osg::Vec3( 1., 0., 0. ) ) *
-            osg::Matrix::rotate( moonRotateZ, osg::Vec3( 0., 0., 1. ) ) );
-
-        osg::Matrix3 moonOrient( m(0,0), m(0,1), m(0,2),
-            m(1,0), m(1,1), m(1,2),
-            m(2,0), m(2,1), m(2,2) );
-        if( _moonOrient == NULL )
-        {
-            _moonOrient = new osg::Uniform( "moonOrientation", moonOrient );
-            UTIL_MEMORY_CHECK( _moonOrient.get(), "MoonBody moon orientation", );
-        }
-        else
-            _moonOrient->set( moonOrient );
-
-        osg::Matrix moonMatrix( osg::Matrix::translate( osg::Vec3( 0., _distance, 0. ) ) * m );
-        if( _moonTransform == NULL )
-        {
-            _moonTransform = new osg::Uniform( "moonTransform", moonMatrix );
-            UTIL_MEMORY_CHECK( _moonTransform.get(), "MoonBody moon transform", );
-        }
-        else
-            _moonTransform->set( moonMatrix );
+        const osg::Vec3 dir( computeDirection( _ra, _dec ) );
+        _moonDirection0->set( dir );
+        _moonDirection1->set( dir );
+        _moonDistance->set( _distance );
     }
 }
+void
+MoonBody::setSunRADec( float ra, float dec )
+{
+    const osg::Vec3 dir( computeDirection( ra, dec ) );
+    _sunDirection0->set( dir );
+    _sunDirection1->set( dir );
+}
+void
+MoonBody::computeMoonMatrices( float ra, float dec, float distance,
+    osg::Matrix3& orient, osg::Matrix& transform )
+{
+    double moonRotateZ = (12. - ra) / -12. * osg::PI;
+    double moonRotateX = dec / 180. * osg::PI;
+    osg::Matrix m( osg::Matrix::rotate( moonRotateX, osg::Vec3( 1., 0., 0. ) ) *
+        osg::Matrix::rotate( moonRotateZ, osg::Vec3( 0., 0., 1. ) ) );
+
+    orient.set( m(0,0), m(0,1), m(0,2),
+        m(1,0), m(1,1), m(1,2),
+        m(2,0), m(2,1), m(2,2) );
+    transform = osg::Matrix::translate( osg::Vec3( 0., distance, 0. ) ) * m;
+}
+osg::Vec3
+MoonBody::computeDirection( float ra, float dec )
+{
+    // Same as rotating +y by dec about x, then by ra-12h about z.
+    const double raRad( ra / 12. * osg::PI );
+    const double decRad( osg::DegreesToRadians( (double)dec ) );
+    return( osg::Vec3( cos( decRad ) * sin( raRad ),
+        -cos( decRad ) * cos( raRad ), sin( decRad ) ) );
+}
 float
 MoonBody::getRA() const
 {
@@ -132,6 +427,30 @@ MoonBody::getDistance() const
     return( _distance );
 }
 
+void
+MoonBody::setEarthshine( float earthshine )
+{
+    _earthshine->set( earthshine );
+}
+float
+MoonBody::getEarthshine() const
+{
+    float earthshine;
+    _earthshine->get( earthshine );
+    return( earthshine );
+}
+
+void
+MoonBody::setTextureCacheFileName( const std::string& fileName )
+{
+    s_textureCacheFileName = fileName;
+}
+const std::string&
+MoonBody::getTextureCacheFileName()
+{
+    return( s_textureCacheFileName );
+}
+
 
 void
 MoonBody::internalInit()
@@ -204,31 +523,30 @@ MoonBody::internalInit()
         ss->setAttribute( program.get(), osg::StateAttribute::ON |
             osg::StateAttribute::PROTECTED );
 
-        // Add texture map
-        const std::string fileName( "moon.jpg" );
-        osg::ref_ptr< osg::Image > image( osgDB::readImageFile( fileName ) );
-        UTIL_MEMORY_CHECK( image.get(), "MoonBody texture Image", );
-        if( image == NULL )
-        {
-            osg::notify( osg::WARN ) << "backdropFX: Moon: Can't open data file " << fileName << std::endl;
+        // Moon position, phase, and earthshine uniforms
+        ss->addUniform( _moonDirection0.get() );
+        ss->addUniform( _moonDirection1.get() );
+        ss->addUniform( _sunDirection0.get() );
+        ss->addUniform( _sunDirection1.get() );
+        ss->addUniform( _ephemerisFraction.get() );
+        ss->addUniform( _moonDistance.get() );
+        ss->addUniform( _earthshine.get() );
+
+        // Add texture maps. Until the AssetLoader delivers them, the
+        // textures have no images, and the Moon draws black.
+        if( !( initTextures() ) )
             return;
-        }
-
-        osg::ref_ptr< osg::Texture2D > tex( new osg::Texture2D() );
-        UTIL_MEMORY_CHECK( tex.get(), "MoonBody", );
-        tex->setImage( image.get() );
-        ss->setTextureAttributeAndModes( 0, tex.get(), osg::StateAttribute::ON );
-
-        // Uniform for texture
+        ss->setTextureAttributeAndModes( 0, _colorTex.get(), osg::StateAttribute::ON );
         osg::ref_ptr< osg::Uniform > texUniform( new osg::Uniform( "tex", 0 ) );
         UTIL_MEMORY_CHECK( texUniform.get(), "MoonBody", );
         ss->addUniform( texUniform.get() );
 
-        // Moon transform uniforms
-        if( _moonTransform == NULL )
-            setRADecDistance( 0., 0., 0. );
-        ss->addUniform( _moonTransform.get() );
-        ss->addUniform( _moonOrient.get() );
+        // Without a normal map, the shader uses the sphere normal.
+        ss->setTextureAttributeAndModes( 1, _normalTex.get(), osg::StateAttribute::ON );
+        osg::ref_ptr< osg::Uniform > normalUniform( new osg::Uniform( "bdfx_moonNormalMap", 1 ) );
+        UTIL_MEMORY_CHECK( normalUniform.get(), "MoonBody", );
+        ss->addUniform( normalUniform.get() );
+        ss->addUniform( _useNormalMap.get() );
     }
 }
 
@@ -3,6 +3,7 @@
 #include <backdropFX/RenderingEffects.h>
 #include <backdropFX/Manager.h>
 #include <backdropFX/EffectLibrary.h>
+#include <backdropFX/RenderStageCache.h>
 #include <osgUtil/CullVisitor>
 #include <osgDB/FileUtils>
 #include <osg/Geode>
@@ -25,32 +26,7 @@ const unsigned int RenderingEffects::effectLensFlare      ( 1u <<  4 );
 
 
 /** \cond */
-// Lifted directly from CullVisitor
-class RenderStageCache : public osg::Object
-{
-public:
-    RenderStageCache() {}
-    RenderStageCache(const RenderStageCache&, const osg::CopyOp&) {}
-
-    META_Object(myLib,RenderStageCache);
-
-    void setRenderStage( osgUtil::CullVisitor* cv, RenderingEffectsStage* rs)
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        _renderStageMap[cv] = rs;
-    }        
-
-    RenderingEffectsStage* getRenderStage( osgUtil::CullVisitor* cv )
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        return _renderStageMap[cv].get();
-    }
-
-    typedef std::map< osgUtil::CullVisitor*, osg::ref_ptr< RenderingEffectsStage > > RenderStageMap;
-
-    OpenThreads::Mutex  _mutex;
-    RenderStageMap      _renderStageMap;
-};
+typedef RenderStageCache< RenderingEffectsStage > RenderingEffectsStageCache;
 
 class RenderingEffectsUpdate : public osg::NodeCallback
 {
@@ -108,6 +84,9 @@ RenderingEffects::internalInit()
     simTimeUniform->set( 0.f );
     getGlobalUniformVector().push_back( simTimeUniform );
 
+    _effectGraph = new EffectGraph;
+    UTIL_MEMORY_CHECK( _effectGraph, "RenderFX EffectGraph", );
+
     setUpdateCallback( new RenderingEffectsUpdate() );
 }
 
@@ -175,7 +154,9 @@ void RenderingEffects::setEffectSet( unsigned int effectSet )
                 insertEffect->setName( "EffectDOF" );
                 break;
             case effectToneMapping:
-                osg::notify( osg::WARN ) << "backdropFX: setEffectSet: effectLensFlare is TBD" << testBit << std::endl;
+                insertEffect = new backdropFX::EffectToneMapping();
+                UTIL_MEMORY_CHECK( insertEffect, "setEffectSet EffectToneMapping", );
+                insertEffect->setName( "EffectToneMapping" );
                 break;
             case effectHeatDistortion:
                 insertEffect = new backdropFX::EffectHeatDistortion();
@@ -251,6 +232,8 @@ void RenderingEffects::attachAllEffects()
 
     if( prevIt != ev.end() )
         (*prevIt)->setOutput( getFBO() );
+
+    _effectGraph->dirty();
 }
 
 
@@ -295,12 +278,18 @@ bool RenderingEffects::removeGlobalUniform( const std::string& objectName )
 }
 
 
-void RenderingEffects::applyAllGlobalUniforms( osg::State& state, osg::GL2Extensions* gl2Ext )
+void RenderingEffects::applyAllGlobalUniforms( osg::State& state, osg::GL2Extensions* gl2Ext,
+    UniformLocationCache* cache, unsigned int firstSlot )
 {
     UniformVector::iterator it;
     for( it = _globalUniformVector.begin(); it != _globalUniformVector.end(); it++ )
     {
         osg::Uniform* uniform = (*it).get();
+        if( cache != NULL )
+        {
+            cache->apply( state, gl2Ext, firstSlot++, uniform );
+            continue;
+        }
 #if OSG_SUPPORTS_UNIFORM_ID
         GLint location = state.getUniformLocation( uniform->getNameID() );
 #else
@@ -336,10 +325,10 @@ RenderingEffects::traverse( osg::NodeVisitor& nv )
     osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
     osg::Camera* camera = previousStage->getCamera();
 
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< RenderingEffectsStageCache > rsCache = dynamic_cast< RenderingEffectsStageCache* >( getRenderingCache() );
     if( !rsCache )
     {
-        rsCache = new RenderStageCache;
+        rsCache = new RenderingEffectsStageCache;
         UTIL_MEMORY_CHECK( rsCache, "RenderFX RenderingEffectsStage Cache", );
         setRenderingCache( rsCache.get() );
     }
@@ -400,6 +389,8 @@ RenderingEffects::setTextureWidthHeight( unsigned int texW, unsigned int texH )
         backdropFX::EffectVector::iterator it;
         for( it = ev.begin(); it != ev.end(); it++ )
             (*it)->setTextureWidthHeight( _texW, _texH );
+
+        _effectGraph->dirty();
     }
 }
 void
@@ -417,6 +408,13 @@ RenderingEffects::resizeGLObjectBuffers( unsigned int maxSize )
 {
     if( _renderingCache.valid() )
         const_cast< RenderingEffects* >( this )->_renderingCache->resizeGLObjectBuffers( maxSize );
+    _effectGraph->resizeGLObjectBuffers( maxSize );
+    EffectVector::iterator it;
+    for( it = _effectVector.begin(); it != _effectVector.end(); it++ )
+        (*it)->resizeGLObjectBuffers( maxSize );
+    if( _defaultEffect.valid() )
+        _defaultEffect->resizeGLObjectBuffers( maxSize );
+    _uniformLocations.resizeGLObjectBuffers( maxSize );
 
     osg::Group::resizeGLObjectBuffers(maxSize);
 }
@@ -426,6 +424,13 @@ RenderingEffects::releaseGLObjects( osg::State* state ) const
 {
     if( _renderingCache.valid() )
         const_cast< RenderingEffects* >( this )->_renderingCache->releaseGLObjects( state );
+    _effectGraph->releaseGLObjects( state );
+    EffectVector::const_iterator it;
+    for( it = _effectVector.begin(); it != _effectVector.end(); it++ )
+        (*it)->releaseGLObjects( state );
+    if( _defaultEffect.valid() )
+        _defaultEffect->releaseGLObjects( state );
+    _uniformLocations.releaseGLObjects( state );
 
     osg::Group::releaseGLObjects(state);
 }
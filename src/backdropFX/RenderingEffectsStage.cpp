@@ -3,6 +3,7 @@
 #include <backdropFX/RenderingEffectsStage.h>
 #include <backdropFX/RenderingEffects.h>
 #include <backdropFX/Effect.h>
+#include <backdropFX/EffectGraph.h>
 #include <osgUtil/RenderStage>
 #include <osg/GLExtensions>
 #include <osg/FrameBufferObject>
@@ -121,10 +122,9 @@ RenderingEffectsStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*&
     }
     else
     {
-        // Iterate over and render all effects in the EffectVector.
-        EffectVector::iterator itr;
-        for( itr=effectVector.begin(); itr != effectVector.end(); itr++ )
-            (*itr)->draw( this, renderInfo, (*itr) == effectVector.back() );
+        // Compile the EffectVector if it changed, then render the Effects
+        // that contribute to the output.
+        _renderingEffects->getEffectGraph()->draw( effectVector, this, renderInfo );
     }
 
 
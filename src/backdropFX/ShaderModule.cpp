@@ -2,9 +2,11 @@
 
 #include <backdropFX/ShaderModule.h>
 #include <backdropFX/ShaderModuleUtils.h>
+#include <backdropFX/ShaderLibraryConstants.h>
 #include <osgDB/FileUtils>
 #include <osg/State>
 #include <osg/Program>
+#include <osg/GL2Extensions>
 #include <osg/Shader>
 #include <osg/NodeVisitor>
 #include <OpenThreads/ScopedLock>
@@ -12,6 +14,10 @@
 
 #include <backdropFX/Utils.h>
 
+#include <sstream>
+#include <cctype>
+#include <boost/algorithm/string/trim.hpp>
+
 
 namespace backdropFX
 {
@@ -175,13 +181,107 @@ public:
         traverse( node );
     }
 };
+
+
+// Support for varying passthrough when a program contains a geometry
+// shader module. See the sm-geom section of the shader module documentation.
+
+// Varying name and type.
+typedef std::map< std::string, std::string > VaryingMap;
+
+static bool isIdentifierChar( const char c )
+{
+    return( ( ( c >= 'a' ) && ( c <= 'z' ) ) ||
+        ( ( c >= 'A' ) && ( c <= 'Z' ) ) ||
+        ( ( c >= '0' ) && ( c <= '9' ) ) ||
+        ( c == '_' ) );
+}
+
+static void collectVaryings( const std::string& source, VaryingMap& varyings )
+{
+    const std::string token( "varying" );
+    std::string::size_type pos( 0 );
+    while( ( pos = source.find( token, pos ) ) != std::string::npos )
+    {
+        const std::string::size_type start( pos );
+        pos += token.length();
+        if( ( pos < source.length() ) && !( isspace( source[ pos ] ) ) )
+            continue;
+
+        // Only whitespace may precede the declaration on its line. This
+        // skips declarations that are commented out.
+        std::string::size_type eolPos( source.find_last_of( "\r\n", start ) );
+        eolPos = ( eolPos == std::string::npos ) ? 0 : eolPos+1;
+        if( !( boost::algorithm::trim_left_copy( source.substr( eolPos, start-eolPos ) ).empty() ) )
+            continue;
+
+        const std::string::size_type semiPos( source.find( ";", pos ) );
+        if( semiPos == std::string::npos )
+            break;
+        std::istringstream istr( source.substr( pos, semiPos-pos ) );
+        std::string type, name;
+        istr >> type >> name;
+        pos = semiPos;
+
+        // "varying in" and "varying out" only occur in geometry shaders.
+        // Arrays aren't supported.
+        if( name.empty() || ( type == "in" ) || ( type == "out" ) ||
+            ( name.find( "[" ) != std::string::npos ) )
+            continue;
+        varyings[ name ] = type;
+    }
+}
+
+static std::string renameIdentifier( const std::string& source, const std::string& name, const std::string& newName )
+{
+    std::string result;
+    std::string::size_type lastPos( 0 ), pos( 0 );
+    while( ( pos = source.find( name, pos ) ) != std::string::npos )
+    {
+        const std::string::size_type endPos( pos + name.length() );
+        if( ( ( pos > 0 ) && isIdentifierChar( source[ pos-1 ] ) ) ||
+            ( ( endPos < source.length() ) && isIdentifierChar( source[ endPos ] ) ) )
+        {
+            // Part of a longer identifier.
+            pos = endPos;
+            continue;
+        }
+        result += source.substr( lastPos, pos-lastPos ) + newName;
+        pos = lastPos = endPos;
+    }
+    return( result + source.substr( lastPos ) );
+}
+
+static std::string geometryInputName( const std::string& name )
+{
+    return( name + std::string( "_gsIn" ) );
+}
+
+// Number of components a varying of the given type occupies in the
+// geometry shader output.
+static unsigned int componentCount( const std::string& type )
+{
+    if( ( type == "float" ) || ( type == "int" ) || ( type == "bool" ) )
+        return( 1 );
+    if( ( type == "vec2" ) || ( type == "ivec2" ) || ( type == "bvec2" ) )
+        return( 2 );
+    if( ( type == "vec3" ) || ( type == "ivec3" ) || ( type == "bvec3" ) )
+        return( 3 );
+    if( type == "mat3" )
+        return( 9 );
+    if( type == "mat4" )
+        return( 16 );
+    // vec4, ivec4, bvec4, mat2.
+    return( 4 );
+}
 /** \endcond */
 
 
 
 RebuildShaderModules::RebuildShaderModules( osg::NodeVisitor::TraversalMode tm )
   : osg::NodeVisitor( tm ),
-    _depth( 0 )
+    _depth( 0 ),
+    _geometryOutputComponents( 0 )
 {
 }
 RebuildShaderModules::~RebuildShaderModules()
@@ -192,8 +292,12 @@ void
 RebuildShaderModules::reset()
 {
     _shaderStateSetMap.clear();
+    _geometryInputMap.clear();
+    _partitionPassMap.clear();
+    _passthroughMap.clear();
 
     _depth = 0;
+    _geometryOutputComponents = 0;
 }
 
 void
@@ -275,15 +379,34 @@ RebuildShaderModules::rebuildSource( ShaderModuleCullCallback* smccb, osg::NodeP
     osg::ref_ptr< osg::StateSet >& ss( _shaderStateSetMap[ sl ] );
     if( !( ss.valid() ) )
     {
+        ShaderList programShaders( sl );
+        bool hasGeometry( false );
+        for( ShaderList::iterator slitr = sl.begin(); slitr != sl.end(); slitr++ )
+            hasGeometry |= ( (*slitr)->getType() == osg::Shader::GEOMETRY );
+        if( hasGeometry )
+            addGeometryPassthrough( programShaders );
+
         osg::Program* prog = new osg::Program;
         UTIL_MEMORY_CHECK( prog, "RebuildShaderModules new Program", );
-        for( ShaderList::iterator slitr = sl.begin(); slitr != sl.end(); slitr++ )
+        for( ShaderList::iterator slitr = programShaders.begin(); slitr != programShaders.end(); slitr++ )
         {
             osg::Shader* shader = *slitr;
             prog->addShader( shader );
             prog->setName( prog->getName() + shader->getName() + std::string( " " ) );
         }
 
+        if( hasGeometry )
+        {
+            // All geometry shader modules share the same primitive types
+            // and maximum output. See the sm-geom documentation.
+            prog->setParameter( GL_GEOMETRY_VERTICES_OUT_EXT, 3 * BDFX_MAX_PARTITIONS );
+            prog->setParameter( GL_GEOMETRY_INPUT_TYPE_EXT, GL_TRIANGLES );
+            prog->setParameter( GL_GEOMETRY_OUTPUT_TYPE_EXT, GL_TRIANGLE_STRIP );
+
+            // Points and lines need a program without the geometry shader.
+            addPartitionPassProgram( prog, sl );
+        }
+
         // TBD Double hack! This is to support bump mapping for complex surfaces.
         // a) We need a way to communicate vertex attribute locations to a program.
         // b) The locations below are hardcoded; see SurfaceUtils.cpp.
@@ -298,6 +421,113 @@ RebuildShaderModules::rebuildSource( ShaderModuleCullCallback* smccb, osg::NodeP
     smccb->insertStateSet( np, ss.get() );
 }
 
+void
+RebuildShaderModules::addGeometryPassthrough( ShaderList& sl )
+{
+    VaryingMap allVaryings;
+    for( ShaderList::iterator slitr = sl.begin(); slitr != sl.end(); slitr++ )
+    {
+        osg::Shader* shader = *slitr;
+        if( shader->getType() != osg::Shader::VERTEX )
+            continue;
+
+        osg::ref_ptr< osg::Shader >& renamed( _geometryInputMap[ shader ] );
+        VaryingMap varyings;
+        collectVaryings( shader->getShaderSource(), varyings );
+        if( !( renamed.valid() ) )
+        {
+            std::string source( shader->getShaderSource() );
+            for( VaryingMap::const_iterator vitr = varyings.begin(); vitr != varyings.end(); vitr++ )
+                source = renameIdentifier( source, vitr->first, geometryInputName( vitr->first ) );
+
+            renamed = new osg::Shader( osg::Shader::VERTEX, source );
+            UTIL_MEMORY_CHECK( renamed.get(), "RebuildShaderModules geometry input Shader", );
+            renamed->setName( shader->getName() );
+        }
+        *slitr = renamed.get();
+        allVaryings.insert( varyings.begin(), varyings.end() );
+    }
+
+    // Per vertex outputs: gl_Position, gl_Layer, the texture coordinates,
+    // and bdfx_depthTC (unless a vertex shader module declares it).
+    unsigned int components( 4 + 1 + 4 * BDFX_MAX_TEXTURE_COORDS );
+    if( allVaryings.find( "bdfx_depthTC" ) == allVaryings.end() )
+        components += 4;
+
+    std::ostringstream decls;
+    std::ostringstream copies;
+    VaryingMap::const_iterator vitr;
+    for( vitr = allVaryings.begin(); vitr != allVaryings.end(); vitr++ )
+    {
+        components += componentCount( vitr->second );
+        decls << "varying in " << vitr->second << " " << geometryInputName( vitr->first ) << "[];\n";
+        decls << "varying out " << vitr->second << " " << vitr->first << ";\n";
+        copies << "    " << vitr->first << " = " << geometryInputName( vitr->first ) << "[ idx ];\n";
+    }
+
+    osg::ref_ptr< osg::Shader >& passthrough( _passthroughMap[ decls.str() ] );
+    if( !( passthrough.valid() ) )
+    {
+        std::ostringstream ostr;
+        ostr << "#extension GL_EXT_geometry_shader4 : enable\n\n";
+        ostr << "// Generated by backdropFX RebuildShaderModules.\n\n";
+        ostr << decls.str() << "\n";
+        ostr << "void bdfx_copyVaryings( in int idx )\n{\n";
+        ostr << copies.str();
+        unsigned int unit;
+        for( unit=0; unit<BDFX_MAX_TEXTURE_COORDS; unit++ )
+            ostr << "    gl_TexCoord[ " << unit << " ] = gl_TexCoordIn[ idx ][ " << unit << " ];\n";
+        ostr << "}\n";
+
+        passthrough = new osg::Shader( osg::Shader::GEOMETRY, ostr.str() );
+        UTIL_MEMORY_CHECK( passthrough.get(), "RebuildShaderModules passthrough Shader", );
+        passthrough->setName( "bdfx-varyings-passthrough.gs" );
+    }
+    sl.push_back( passthrough.get() );
+
+    _geometryOutputComponents = osg::maximum< unsigned int >( _geometryOutputComponents, components );
+}
+
+void
+RebuildShaderModules::addPartitionPassProgram( osg::Program* prog, const ShaderList& sl )
+{
+    const std::string token( "BDFX_PARTITION_PASS" );
+
+    osg::Program* partitionProg = new osg::Program;
+    UTIL_MEMORY_CHECK( partitionProg, "RebuildShaderModules new partition pass Program", );
+    partitionProg->setName( prog->getName() + std::string( "(partition pass)" ) );
+
+    for( ShaderList::const_iterator slitr = sl.begin(); slitr != sl.end(); slitr++ )
+    {
+        osg::Shader* shader = *slitr;
+        if( shader->getType() == osg::Shader::GEOMETRY )
+            continue;
+
+        if( ( shader->getType() == osg::Shader::VERTEX ) &&
+            ( shader->getShaderSource().find( token ) != std::string::npos ) )
+        {
+            osg::ref_ptr< osg::Shader >& defined( _partitionPassMap[ shader ] );
+            if( !( defined.valid() ) )
+            {
+                defined = new osg::Shader( osg::Shader::VERTEX,
+                    std::string( "#define " ) + token + std::string( " 1\n" ) + shader->getShaderSource() );
+                UTIL_MEMORY_CHECK( defined.get(), "RebuildShaderModules partition pass Shader", );
+                defined->setName( shader->getName() );
+            }
+            shader = defined.get();
+        }
+        partitionProg->addShader( shader );
+    }
+
+    partitionProg->addBindAttribLocation( "rm_Tangent", 6 );
+    partitionProg->addBindAttribLocation( "rm_Binormal", 7 );
+
+    osg::StateSet* partitionSS = new osg::StateSet;
+    UTIL_MEMORY_CHECK( partitionSS, "RebuildShaderModules partition pass StateSet", );
+    partitionSS->setAttributeAndModes( partitionProg, osg::StateAttribute::ON );
+    prog->setUserData( partitionSS );
+}
+
 
 
 RemoveShaderModules::RemoveShaderModules( osg::NodeVisitor::TraversalMode tm )
@@ -3,6 +3,7 @@
 #include <backdropFX/ShaderModuleUtils.h>
 #include <backdropFX/ShaderModule.h>
 #include <backdropFX/ShaderModuleVisitor.h>
+#include <backdropFX/ShaderLibraryConstants.h>
 #include <backdropFX/Manager.h>
 #include <osgwTools/CountsVisitor.h>
 #include <osgwTools/RemoveData.h>
@@ -171,6 +172,42 @@ dumpShaderSource( std::ostream& ostr, const std::string& preamble, const std::st
         << sourceWithLineNumbers << std::endl;
 }
 
+/** \cond */
+// Defines the library constants that size shader arrays, so the shaders
+// follow the values in ShaderLibraryConstants.h. Only constants that the
+// source uses are defined. The defines go after #version, which must be first.
+static void
+defineLibraryConstants( osg::Shader* shader )
+{
+    static const struct { const char* _name; unsigned int _value; } constants[] = {
+        { "BDFX_MAX_PARTITIONS", BDFX_MAX_PARTITIONS },
+        { "BDFX_MAX_SHADOW_CASCADES", BDFX_MAX_SHADOW_CASCADES },
+        { "BDFX_MAX_SHADOW_LIGHTS", BDFX_MAX_SHADOW_LIGHTS }
+    };
+
+    const std::string& source( shader->getShaderSource() );
+    std::ostringstream ostr;
+    unsigned int idx;
+    for( idx=0; idx<sizeof( constants ) / sizeof( constants[ 0 ] ); idx++ )
+    {
+        if( source.find( constants[ idx ]._name ) != std::string::npos )
+            ostr << "#define " << constants[ idx ]._name << " " << constants[ idx ]._value << "\n";
+    }
+    if( ostr.str().empty() )
+        return;
+
+    std::string::size_type pos( 0 );
+    const std::string::size_type versionPos( source.find( "#version" ) );
+    if( ( versionPos != std::string::npos ) &&
+        ( source.find_first_not_of( " \t\r\n" ) == versionPos ) )
+    {
+        pos = source.find( "\n", versionPos );
+        pos = ( pos == std::string::npos ) ? source.length() : pos + 1;
+    }
+    shader->setShaderSource( source.substr( 0, pos ) + ostr.str() + source.substr( pos ) );
+}
+/** \endcond */
+
 void
 shaderPreProcess( osg::Shader* shader )
 {
@@ -305,6 +342,8 @@ shaderPreProcess( osg::Shader* shader )
         }
     }
 
+    defineLibraryConstants( shader );
+
     if( debugDump )
     {
         dumpShaderSource( osg::notify( osg::DEBUG_FP ), "processed", shader->getShaderSource() );
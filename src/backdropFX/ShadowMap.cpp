@@ -1,7 +1,11 @@
 // Copyright (c) 2011 Skew Matrix Software. All rights reserved.
 
 #include <backdropFX/ShadowMap.h>
+#include <backdropFX/RenderStageCache.h>
 #include <backdropFX/ShaderModuleUtils.h>
+#include <backdropFX/Manager.h>
+#include <backdropFX/LocationData.h>
+#include <backdropFX/ShaderLibraryConstants.h>
 #include <osgDB/FileUtils>
 #include <osgUtil/CullVisitor>
 #include <osgwTools/Shapes.h>
@@ -9,8 +13,11 @@
 #include <osg/Depth>
 #include <osg/PolygonOffset>
 #include <osg/Texture2D>
+#include <osg/Transform>
 
 #include <backdropFX/Utils.h>
+#include <algorithm>
+#include <functional>
 
 
 namespace backdropFX
@@ -18,56 +25,121 @@ namespace backdropFX
 
 
 
-// Lifted directly from CullVisitor
-class RenderStageCache : public osg::Object
+typedef RenderStageCache< ShadowMapStage > ShadowMapStageCache;
+
+
+/** \cond */
+// Returns a value in the range (0,1] indicating how much of the shadow
+// atlas a light deserves. See ShadowMap::setShadowAtlasSize().
+static float computeLightImportance( const osg::Light* light, const osg::Vec4& pos, const osg::Vec3& eye )
 {
-public:
-    RenderStageCache() {}
-    RenderStageCache(const RenderStageCache&, const osg::CopyOp&) {}
+    if( ( light == NULL ) || ( pos[ 3 ] == 0. ) )
+        // Directional lights shadow everything in view.
+        return( 1.f );
+
+    // Distance at which attenuation reduces the light to 1/256 of its
+    // intensity, solving c + l*d + q*d*d = 256.
+    const double c( light->getConstantAttenuation() );
+    const double l( light->getLinearAttenuation() );
+    const double q( light->getQuadraticAttenuation() );
+    double range;
+    if( q > 0. )
+        range = ( -l + sqrt( l * l - 4. * q * ( c - 256. ) ) ) / ( 2. * q );
+    else if( l > 0. )
+        range = ( 256. - c ) / l;
+    else
+        // No attenuation.
+        return( 1.f );
 
-    META_Object(myLib,RenderStageCache);
+    const osg::Vec3 lightPos( pos[ 0 ] / pos[ 3 ], pos[ 1 ] / pos[ 3 ], pos[ 2 ] / pos[ 3 ] );
+    const double distance( ( lightPos - eye ).length() );
+    if( distance <= range )
+        return( 1.f );
 
-    void setRenderStage( osgUtil::CullVisitor* cv, ShadowMapStage* rs)
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        _renderStageMap[cv] = rs;
-    }        
-    ShadowMapStage* getRenderStage( osgUtil::CullVisitor* cv )
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        return _renderStageMap[cv].get();
-    }
+    // Approximate screen-space size of the lit volume.
+    return( (float)( range / distance ) );
+}
 
-    void resizeGLObjectBuffers( unsigned int maxSize )
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        RenderStageMap::iterator itr;
-        for( itr=_renderStageMap.begin(); itr != _renderStageMap.end(); itr++ )
-            itr->second->resizeGLObjectBuffers( maxSize );
-    }
-    void releaseGLObjects( osg::State* state ) const
+// Poisson disk in the unit circle; minimum distance between taps is
+// roughly .3. See ShadowMap::setSoftShadowMode().
+static const float s_poissonDisk[ BDFX_SHADOW_KERNEL_TAPS ][ 2 ] = {
+    { -.94201624f, -.39906216f },
+    { .94558609f, -.76890725f },
+    { -.09418410f, -.92938870f },
+    { .34495938f, .29387760f },
+    { -.91588581f, .45771432f },
+    { -.81544232f, -.87912464f },
+    { -.38277543f, .27676845f },
+    { .97484398f, .75648379f },
+    { .44323325f, -.97511554f },
+    { .53742981f, -.47373420f },
+    { -.26496911f, -.41893023f },
+    { .79197514f, .19090188f },
+    { -.24188840f, .99706507f },
+    { -.81409955f, .91437590f },
+    { .19984126f, .78641367f },
+    { .14383161f, -.14100790f }
+};
+
+static osg::Texture2D* createShadowKernelTexture()
+{
+    const unsigned int width( BDFX_SHADOW_KERNEL_TAPS / 2 );
+    osg::ref_ptr< osg::Image > image = new osg::Image;
+    image->allocateImage( width, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+    unsigned char* data = image->data();
+    unsigned int idx;
+    for( idx=0; idx<BDFX_SHADOW_KERNEL_TAPS; idx++ )
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        RenderStageMap::const_iterator itr;
-        for( itr=_renderStageMap.begin(); itr != _renderStageMap.end(); itr++ )
-            itr->second->releaseGLObjects( state );
+        // Two taps per texel, [-1,1] mapped to [0,255].
+        data[ idx * 2 ] = (unsigned char)( ( s_poissonDisk[ idx ][ 0 ] * .5f + .5f ) * 255.f + .5f );
+        data[ idx * 2 + 1 ] = (unsigned char)( ( s_poissonDisk[ idx ][ 1 ] * .5f + .5f ) * 255.f + .5f );
     }
 
-    typedef std::map< osgUtil::CullVisitor*, osg::ref_ptr< ShadowMapStage > > RenderStageMap;
-
-    mutable OpenThreads::Mutex  _mutex;
-    RenderStageMap      _renderStageMap;
-};
+    osg::Texture2D* tex = new osg::Texture2D( image.get() );
+    tex->setName( "Shadow Kernel" );
+    tex->setInternalFormat( GL_RGBA8 );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    tex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    tex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    tex->setResizeNonPowerOfTwoHint( false );
+    return( tex );
+}
+/** \endcond */
 
 
 
 ShadowMap::ShadowMap()
+  : _casterMask( 0xffffffff ),
+    _cacheEnable( false ),
+    _dynamicMask( 0 ),
+    _cacheAngle( osg::DegreesToRadians( .25 ) ),
+    _cacheDistance( .1 ),
+    _atlasSize( 2048 ),
+    _minTileSize( 128 ),
+    _numSunCascades( 0 ),
+    _cascadeResolution( 1024 ),
+    _sunShadowDistance( 5000. ),
+    _softShadowMode( SHADOW_HARD ),
+    _softShadowRadius( 1.5f )
 {
     internalInit();
 }
 ShadowMap::ShadowMap( const ShadowMap& shadowMap, const osg::CopyOp& copyop )
   : osg::Group( shadowMap, copyop ),
-    backdropFX::BackdropCommon( shadowMap, copyop )
+    backdropFX::BackdropCommon( shadowMap, copyop ),
+    _casterMask( shadowMap._casterMask ),
+    _cacheEnable( shadowMap._cacheEnable ),
+    _dynamicMask( shadowMap._dynamicMask ),
+    _cacheAngle( shadowMap._cacheAngle ),
+    _cacheDistance( shadowMap._cacheDistance ),
+    _atlasSize( shadowMap._atlasSize ),
+    _minTileSize( shadowMap._minTileSize ),
+    _numSunCascades( shadowMap._numSunCascades ),
+    _cascadeResolution( shadowMap._cascadeResolution ),
+    _sunShadowDistance( shadowMap._sunShadowDistance ),
+    _softShadowMode( shadowMap._softShadowMode ),
+    _softShadowRadius( shadowMap._softShadowRadius )
 {
     internalInit();
 }
@@ -95,12 +167,55 @@ void ShadowMap::internalInit()
     UTIL_MEMORY_CHECK( shader, "ShadowMap internalInit shadowmap-main.fs", );
     smccb->setShader( backdropFX::getShaderSemantic( shader->getName() ), shader.get(),
         ShaderModuleCullCallback::InheritanceOverride );
+
+    // The kernel is constant and shared by all views.
+    _kernelTex = createShadowKernelTexture();
+    UTIL_MEMORY_CHECK( _kernelTex.get(), "ShadowMap internalInit _kernelTex", );
 }
 
 ShadowMap::~ShadowMap()
 {
 }
 
+void ShadowMap::childInserted( unsigned int pos )
+{
+    dirtyStaticCasters();
+}
+void ShadowMap::childRemoved( unsigned int pos, unsigned int numChildrenToRemove )
+{
+    dirtyStaticCasters();
+}
+
+void ShadowMap::setShadowAtlasSize( unsigned int size )
+{
+    unsigned int pow2( 1 );
+    while( ( pow2 << 1 ) <= size )
+        pow2 <<= 1;
+    _atlasSize = pow2;
+}
+
+void ShadowMap::setMinShadowTileSize( unsigned int size )
+{
+    unsigned int pow2( 1 );
+    while( pow2 < size )
+        pow2 <<= 1;
+    if( pow2 != size )
+        osg::notify( osg::WARN ) << "backdropFX: ShadowMap: Minimum shadow tile size " << size <<
+            " isn't a power of two, using " << pow2 << "." << std::endl;
+    _minTileSize = pow2;
+}
+
+void ShadowMap::setNumSunCascades( unsigned int numCascades )
+{
+    if( numCascades > BDFX_MAX_SHADOW_CASCADES )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: ShadowMap: " << numCascades <<
+            " cascades exceeds maximum, using " << BDFX_MAX_SHADOW_CASCADES << "." << std::endl;
+        numCascades = BDFX_MAX_SHADOW_CASCADES;
+    }
+    _numSunCascades = numCascades;
+}
+
 
 void ShadowMap::traverse( osg::NodeVisitor& nv )
 {
@@ -125,10 +240,10 @@ void ShadowMap::traverse( osg::NodeVisitor& nv )
     osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
     osg::Camera* camera = previousStage->getCamera();
 
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< ShadowMapStageCache > rsCache = dynamic_cast< ShadowMapStageCache* >( getRenderingCache() );
     if( !rsCache )
     {
-        rsCache = new RenderStageCache;
+        rsCache = new ShadowMapStageCache;
         UTIL_MEMORY_CHECK( rsCache, "ShadowMap ShadowMapStage Cache", );
         setRenderingCache( rsCache.get() );
     }
@@ -161,14 +276,127 @@ void ShadowMap::traverse( osg::NodeVisitor& nv )
 
 
     {
-        // Save RenderBin
+        // Save RenderBin, traversal mask, and near/far computation.
         osgUtil::RenderBin* previousRenderBin = cv->getCurrentRenderBin();
-        cv->setCurrentRenderBin( sms.get() );
-
-        // Traverse
-        osg::Group::traverse( nv );
-
-        // Restore RenderBin
+        const osg::Node::NodeMask previousMask = cv->getTraversalMask();
+        const osg::CullSettings::ComputeNearFarMode previousNearFar = cv->getComputeNearFarMode();
+
+        // Only cull shadow casters. Light space depth must not contribute
+        // to the camera near and far planes, and the light projection
+        // must not be clamped.
+        cv->setTraversalMask( previousMask & _casterMask );
+        cv->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+
+        // Choose the lights to shadow. The scene shaders sample at most
+        // BDFX_MAX_SHADOW_LIGHTS shadow maps, so don't cull or render more
+        // than that; keep the most important ones.
+        Manager& mgr = *( Manager::instance() );
+        const osg::Matrix& view = camera->getViewMatrix();
+        const osg::Vec3 eye( osg::Vec3( 0., 0., 0. ) * osg::Matrix::inverse( view ) );
+        typedef std::vector< std::pair< float, unsigned int > > LightList;
+        LightList lights;
+        unsigned int idx;
+        for( idx=0; idx<mgr.getNumLights(); idx++ )
+        {
+            if( !( mgr.getLightEnable( idx ) ) )
+                continue;
+            // The Sun is handled by the cascades, below.
+            if( ( idx == 8 ) && ( _numSunCascades > 0 ) ) // TBD hardcoded 8 for Sun.
+                continue;
+
+            lights.push_back( LightList::value_type( computeLightImportance(
+                mgr.getLight( idx ), mgr.getLightPosition( idx ), eye ), idx ) );
+        }
+        if( lights.size() > BDFX_MAX_SHADOW_LIGHTS )
+        {
+            std::sort( lights.begin(), lights.end(), std::greater< LightList::value_type >() );
+            lights.resize( BDFX_MAX_SHADOW_LIGHTS );
+        }
+
+        // Compute each light's matrices, using the cached light position
+        // if the light hasn't moved enough to invalidate its cached depth.
+        LightList::const_iterator litr;
+        for( litr=lights.begin(); litr != lights.end(); litr++ )
+        {
+            idx = litr->second;
+
+            osg::BoundingSphere casterBound( getBound() );
+            const osg::Vec4 pos( sms->updateLightCache( idx, mgr.getLightPosition( idx ), casterBound ) );
+            osg::Matrix lightView, lightProj;
+            ShadowMapStage::computeLightMatrices( pos, casterBound, lightView, lightProj );
+            sms->setLightCull( idx, view, lightView, lightProj, litr->first );
+        }
+
+        // Assign each light a tile of the shadow atlas. This might drop
+        // lights, or invalidate their cached depth.
+        sms->layoutAtlas();
+
+        // Cull once per light, against the light view and projection.
+        // When caching, cull the dynamic casters every frame, and the
+        // static casters only when the light's cached depth is invalid.
+        const osg::Node::NodeMask dynamicMask( _cacheEnable ? _dynamicMask : 0xffffffff );
+        for( litr=lights.begin(); litr != lights.end(); litr++ )
+        {
+            idx = litr->second;
+            if( !( sms->getLightShadowed( idx ) ) )
+                continue;
+
+            osg::Matrix lightView, lightProj;
+            sms->getLightMatrices( idx, lightView, lightProj );
+            cv->pushProjectionMatrix( new osg::RefMatrix( lightProj ) );
+            cv->pushModelViewMatrix( new osg::RefMatrix( lightView ), osg::Transform::ABSOLUTE_RF );
+
+            if( ( previousMask & _casterMask & dynamicMask ) != 0 )
+            {
+                cv->setTraversalMask( previousMask & _casterMask & dynamicMask );
+                cv->setCurrentRenderBin( sms->getLightBin( idx ) );
+                cv->pushStateSet( sms->getLightStateSet( idx ) );
+                osg::Group::traverse( nv );
+                cv->popStateSet();
+            }
+            if( _cacheEnable && sms->requestStaticCull( idx ) )
+            {
+                cv->setTraversalMask( previousMask & _casterMask & ~_dynamicMask );
+                cv->setCurrentRenderBin( sms->getLightStaticBin( idx ) );
+                cv->pushStateSet( sms->getLightStaticStateSet( idx ) );
+                osg::Group::traverse( nv );
+                cv->popStateSet();
+            }
+
+            cv->popModelViewMatrix();
+            cv->popProjectionMatrix();
+        }
+        cv->setTraversalMask( previousMask & _casterMask );
+
+        // Cull once per Sun cascade.
+        unsigned int numCascades( 0 );
+        if( ( _numSunCascades > 0 ) && ( mgr.getNumLights() > 8 ) && mgr.getLightEnable( 8 ) )
+        {
+            // The Sun direction for this view's location and time.
+            const osg::Vec3 sunDir( mgr.getLocationData( camera )->getSunPositionVector() );
+            numCascades = sms->setCascadeCull( sunDir, view,
+                camera->getProjectionMatrix(), getBound() );
+        }
+        for( idx=0; idx<numCascades; idx++ )
+        {
+            osg::Matrix lightView, lightProj;
+            sms->getCascadeMatrices( idx, lightView, lightProj );
+
+            cv->setCurrentRenderBin( sms->getCascadeBin( idx ) );
+            cv->pushStateSet( sms->getCascadeStateSet( idx ) );
+            cv->pushProjectionMatrix( new osg::RefMatrix( lightProj ) );
+            cv->pushModelViewMatrix( new osg::RefMatrix( lightView ), osg::Transform::ABSOLUTE_RF );
+
+            osg::Group::traverse( nv );
+
+            cv->popModelViewMatrix();
+            cv->popProjectionMatrix();
+            cv->popStateSet();
+        }
+
+        // Restore
+        cv->setComputeNearFarMode( previousNearFar );
+        cv->setTraversalMask( previousMask );
         cv->setCurrentRenderBin( previousRenderBin );
     }
 
@@ -181,7 +409,7 @@ void ShadowMap::traverse( osg::NodeVisitor& nv )
 
 osg::StateSet* ShadowMap::getViewProjStateSet( osgUtil::CullVisitor* cv )
 {
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< ShadowMapStageCache > rsCache = dynamic_cast< ShadowMapStageCache* >( getRenderingCache() );
     if( !rsCache )
         return( NULL );
     osg::ref_ptr< ShadowMapStage > sms = rsCache->getRenderStage( cv );
@@ -190,17 +418,10 @@ osg::StateSet* ShadowMap::getViewProjStateSet( osgUtil::CullVisitor* cv )
 
     return( sms->getViewProjStateSet() );
 }
-osg::Uniform* ShadowMap::getViewProjUniform( osgUtil::CullVisitor* cv )
-{
-    osg::StateSet* stateSet = getViewProjStateSet( cv );
-
-    const std::string viewProjName( "bdfx_shadowViewProj" );
-    return( stateSet->getUniform( viewProjName ) );
-}
 
 osg::StateSet* ShadowMap::getDepthTexStateSet( osgUtil::CullVisitor* cv )
 {
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< ShadowMapStageCache > rsCache = dynamic_cast< ShadowMapStageCache* >( getRenderingCache() );
     if( !rsCache )
         return( NULL );
     osg::ref_ptr< ShadowMapStage > sms = rsCache->getRenderStage( cv );
@@ -212,10 +433,49 @@ osg::StateSet* ShadowMap::getDepthTexStateSet( osgUtil::CullVisitor* cv )
 
 
 
+ShadowCasterCallback::ShadowCasterCallback( ShadowMap* shadowMap )
+  : _shadowMap( shadowMap ),
+    _useManager( shadowMap == NULL ),
+    _dirty( 0 ),
+    _first( true )
+{
+}
+ShadowCasterCallback::~ShadowCasterCallback()
+{
+}
+
+void ShadowCasterCallback::operator()( osg::Node* node, osg::NodeVisitor* nv )
+{
+    // The node path includes the node, so this also covers a Transform's
+    // own matrix, as well as any transform above it moving.
+    const osg::BoundingSphere& bound( node->getBound() );
+    const osg::Matrix matrix( osg::computeLocalToWorld( nv->getNodePath() ) );
+
+    bool changed( _dirty.exchange( 0 ) != 0 );
+    if( !_first )
+        changed |= ( ( bound != _bound ) || ( matrix != _matrix ) );
+    _first = false;
+    _bound = bound;
+    _matrix = matrix;
+
+    if( changed )
+    {
+        if( _useManager )
+            Manager::instance()->getShadowMap().dirtyStaticCasters();
+        else if( _shadowMap.valid() )
+            _shadowMap->dirtyStaticCasters();
+    }
+
+    traverse( node, nv );
+}
+
+
 void ShadowMap::resizeGLObjectBuffers( unsigned int maxSize )
 {
     if( _renderingCache.valid() )
         const_cast< ShadowMap* >( this )->_renderingCache->resizeGLObjectBuffers( maxSize );
+    if( _kernelTex.valid() )
+        _kernelTex->resizeGLObjectBuffers( maxSize );
 
     osg::Group::resizeGLObjectBuffers(maxSize);
 }
@@ -224,6 +484,8 @@ void ShadowMap::releaseGLObjects( osg::State* state ) const
 {
     if( _renderingCache.valid() )
         const_cast< ShadowMap* >( this )->_renderingCache->releaseGLObjects( state );
+    if( _kernelTex.valid() )
+        _kernelTex->releaseGLObjects( state );
 
     osg::Group::releaseGLObjects(state);
 }
@@ -2,8 +2,10 @@
 
 #include <backdropFX/ShadowMapStage.h>
 #include <backdropFX/ShadowMap.h>
-#include <backdropFX/Manager.h>
 #include <backdropFX/ShaderLibraryConstants.h>
+#include <backdropFX/StageRenderBin.h>
+#include <backdropFX/Manager.h>
+#include <backdropFX/DepthPartition.h>
 #include <osgUtil/RenderStage>
 #include <osg/GLExtensions>
 #include <osg/FrameBufferObject>
@@ -13,6 +15,9 @@
 #include <backdropFX/Utils.h>
 #include <osg/io_utils>
 #include <string>
+#include <cmath>
+#include <algorithm>
+#include <functional>
 
 
 
@@ -21,64 +26,68 @@ namespace backdropFX
 
 
 
+/** \cond */
+static osg::Texture2D* createAtlasTexture( unsigned int size, const std::string& name )
+{
+    osg::Texture2D* tex = new osg::Texture2D;
+    tex->setName( name );
+    tex->setInternalFormat( GL_DEPTH_COMPONENT );
+    tex->setShadowComparison( true );
+    tex->setShadowCompareFunc( osg::Texture::LEQUAL ); // if in R <= texR, result is 1.0
+    // Same mode as the cascade texture, so the shaders read .r from both.
+    tex->setShadowTextureMode( osg::Texture::LUMINANCE );
+    tex->setBorderWidth( 0 );
+    tex->setTextureSize( size, size );
+    tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+    tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+    return( tex );
+}
+
+// LINEAR filtering on a depth compare texture enables hardware PCF.
+// Only dirties the texture parameters if the filter actually changes.
+static void setShadowFilter( osg::Texture* tex, bool linear )
+{
+    const osg::Texture::FilterMode mode( linear ? osg::Texture::LINEAR : osg::Texture::NEAREST );
+    if( tex->getFilter( osg::Texture::MIN_FILTER ) != mode )
+    {
+        tex->setFilter( osg::Texture::MIN_FILTER, mode );
+        tex->setFilter( osg::Texture::MAG_FILTER, mode );
+    }
+}
+/** \endcond */
+
+
 ShadowMapStage::ShadowInfo::ShadowInfo()
+  : _importance( 1.f ),
+    _culled( false ),
+    _cachedGeneration( 0 ),
+    _cacheValid( false ),
+    _staticCulled( false )
 {
     internalInit();
 }
 ShadowMapStage::ShadowInfo::ShadowInfo( const ShadowInfo& rhs, const osg::CopyOp& copyop )
-  : _depthTex( rhs._depthTex ),
-    _depthFBO( rhs._depthFBO ),
-    _viewport( rhs._viewport )
+  : _viewport( rhs._viewport ),
+    _tileRect( rhs._tileRect ),
+    _importance( rhs._importance ),
+    _culled( false ),
+    _cachedGeneration( 0 ),
+    _cacheValid( false ),
+    _staticCulled( false )
 {
 }
 void ShadowMapStage::ShadowInfo::internalInit()
 {
-    // TBD size is a temporary hack. Eventually we want this to be view-dependent;
-    // lights that are far away with attenuation will cast shadows over a small
-    // area and therefore need a smaller texture size.
-    const unsigned int dim( 1024 );
-
-    _depthTex = new osg::Texture2D;
-    UTIL_MEMORY_CHECK( _depthTex.get(), "ShadowMap LightInfo _depthTex", );
-    _depthTex->setName( "Shadow Depth Map" );
-    _depthTex->setInternalFormat( GL_DEPTH_COMPONENT );
-    _depthTex->setShadowComparison( true );
-    _depthTex->setShadowCompareFunc( osg::Texture::LEQUAL ); // if in R <= texR, alpha set to 1.0
-    _depthTex->setShadowTextureMode( osg::Texture::ALPHA );
-    _depthTex->setBorderWidth( 0 );
-    _depthTex->setTextureSize( dim, dim );
-    _depthTex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
-    _depthTex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
-
-    // TBD make this a RenderBuffer.
-    osg::ref_ptr< osg::Texture2D > scrachColorBuffer = new osg::Texture2D;
-    UTIL_MEMORY_CHECK( scrachColorBuffer.get(), "Manager rebuild scrachColorBuffer", );
-    scrachColorBuffer->setName( "Shadow Depth Map scrachColorBuffer" );
-    scrachColorBuffer->setInternalFormat( GL_RGBA );
-    scrachColorBuffer->setBorderWidth( 0 );
-    scrachColorBuffer->setTextureSize( dim, dim );
-    scrachColorBuffer->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
-    scrachColorBuffer->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
-
-    _depthFBO = new osg::FrameBufferObject;
-    UTIL_MEMORY_CHECK( _depthFBO.get(), "ShadowMap LightInfo _depthFBO", );
-    _depthFBO->setAttachment( osg::Camera::DEPTH_BUFFER,
-        osg::FrameBufferAttachment( _depthTex.get() ) );
-    _depthFBO->setAttachment( osg::Camera::COLOR_BUFFER0,
-        osg::FrameBufferAttachment( scrachColorBuffer.get() ) );
-
-    _viewport = new osg::Viewport( 0., 0., dim, dim );
+    // Position and size are assigned by ShadowMapStage::layoutAtlas().
+    _viewport = new osg::Viewport;
+    UTIL_MEMORY_CHECK( _viewport.get(), "ShadowMap LightInfo _viewport", );
 }
 void ShadowMapStage::ShadowInfo::resizeGLObjectBuffers( unsigned int maxSize )
 {
-    _depthTex->resizeGLObjectBuffers( maxSize );
-    _depthFBO->resizeGLObjectBuffers( maxSize );
     _viewport->resizeGLObjectBuffers( maxSize );
 }
 void ShadowMapStage::ShadowInfo::releaseGLObjects( osg::State* state )
 {
-    _depthTex->releaseGLObjects( state );
-    _depthFBO->releaseGLObjects( state );
     _viewport->releaseGLObjects( state );
 }
 
@@ -86,20 +95,23 @@ void ShadowMapStage::ShadowInfo::releaseGLObjects( osg::State* state )
 
 ShadowMapStage::ShadowMapStage()
   : osgUtil::RenderStage(),
-    _shadowMapNode( NULL )
+    _shadowMapNode( NULL ),
+    _numCascadesCulled( 0 )
 {
     internalInit();
 }
 
 ShadowMapStage::ShadowMapStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop )
   : osgUtil::RenderStage( rhs ),
-    _shadowMapNode( NULL )
+    _shadowMapNode( NULL ),
+    _numCascadesCulled( 0 )
 {
     internalInit();
 }
 ShadowMapStage::ShadowMapStage( const ShadowMapStage& rhs, const osg::CopyOp& copyop )
   : osgUtil::RenderStage( rhs ),
-    _shadowMapNode( rhs._shadowMapNode)
+    _shadowMapNode( rhs._shadowMapNode),
+    _numCascadesCulled( 0 )
 {
     internalInit();
 }
@@ -112,16 +124,49 @@ ShadowMapStage::~ShadowMapStage()
 
 void ShadowMapStage::internalInit()
 {
+    // Pushed during the depth map cull. The shadow lookup uses the
+    // per-light bdfx_shadowMatrices below, so this has no uniforms.
     _viewProjStateSet = new osg::StateSet();
-    osg::Uniform* vpu = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "bdfx_shadowViewProj" );
-    _viewProjStateSet->addUniform( vpu );
 
     _depthTexStateSet = new osg::StateSet();
-    _depthTexStateSet->addUniform( vpu );
     // Texture state sttribute will be set during draw.
     osg::Uniform* su = new osg::Uniform( osg::Uniform::SAMPLER_2D_SHADOW, "bdfx_shadowDepthMap" );
     su->set( BDFX_TEX_UNIT_SHADOW_MAP );
     _depthTexStateSet->addUniform( su );
+
+    // Per-light shadow lookup. Values are set during draw.
+    _shadowMatrices = new osg::Uniform( osg::Uniform::FLOAT_MAT4,
+        "bdfx_shadowMatrices", BDFX_MAX_SHADOW_LIGHTS );
+    _depthTexStateSet->addUniform( _shadowMatrices.get() );
+    _shadowTiles = new osg::Uniform( osg::Uniform::FLOAT_VEC4,
+        "bdfx_shadowTiles", BDFX_MAX_SHADOW_LIGHTS );
+    _depthTexStateSet->addUniform( _shadowTiles.get() );
+    _shadowCount = new osg::Uniform( "bdfx_shadowCount", 0 );
+    _depthTexStateSet->addUniform( _shadowCount.get() );
+
+    // Sun cascade uniforms. Values and the texture array are set during draw.
+    _cascadeMatrices = new osg::Uniform( osg::Uniform::FLOAT_MAT4,
+        "bdfx_shadowCascadeMatrices", BDFX_MAX_SHADOW_CASCADES );
+    _depthTexStateSet->addUniform( _cascadeMatrices.get() );
+    _cascadeSplits = new osg::Uniform( "bdfx_shadowCascadeSplits", osg::Vec4f( 0.f, 0.f, 0.f, 0.f ) );
+    _depthTexStateSet->addUniform( _cascadeSplits.get() );
+    _cascadeCount = new osg::Uniform( "bdfx_shadowCascadeCount", 0 );
+    _depthTexStateSet->addUniform( _cascadeCount.get() );
+    osg::Uniform* csu = new osg::Uniform( osg::Uniform::SAMPLER_2D_ARRAY_SHADOW, "bdfx_shadowCascadeMap" );
+    csu->set( BDFX_TEX_UNIT_SHADOW_CASCADES );
+    _depthTexStateSet->addUniform( csu );
+
+    // Soft shadow filtering (see ShadowMap::setSoftShadowMode()).
+    // Values and the kernel texture are set during draw.
+    osg::Uniform* ksu = new osg::Uniform( osg::Uniform::SAMPLER_2D, "bdfx_shadowKernelMap" );
+    ksu->set( BDFX_TEX_UNIT_SHADOW_KERNEL );
+    _depthTexStateSet->addUniform( ksu );
+    _shadowTexelSize = new osg::Uniform( "bdfx_shadowTexelSize", osg::Vec2f( 0.f, 0.f ) );
+    _depthTexStateSet->addUniform( _shadowTexelSize.get() );
+    _shadowFilterRadius = new osg::Uniform( "bdfx_shadowFilterRadius", 0.f );
+    _depthTexStateSet->addUniform( _shadowFilterRadius.get() );
+    _shadowKernelTaps = new osg::Uniform( "bdfx_shadowKernelTaps", 0 );
+    _depthTexStateSet->addUniform( _shadowKernelTaps.get() );
 }
 
 
@@ -163,47 +208,118 @@ void ShadowMapStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& pr
     state.applyAttribute( getViewport() );
 
 
-    Manager& mgr = *( Manager::instance() );
-    if( _shadowInfoVec.size() < mgr.getNumLights() )
-        _shadowInfoVec.resize( mgr.getNumLights() );
+    const bool cacheEnable( _shadowMapNode->getShadowCacheEnable() );
+    const bool dynamic( !cacheEnable || ( _shadowMapNode->getDynamicCasterTraversalMask() != 0 ) );
 
+    // Render each light into its tile. Without caching, clear the entire
+    // shadow atlas once first. With caching, re-render invalid static
+    // tiles into the static atlas, then copy each static tile into the
+    // live atlas and render dynamic casters on top. With no dynamic
+    // casters, the static atlas is sampled directly.
+    unsigned int count( 0 );
     ShadowInfoVec::iterator itr;
-    unsigned int idx;
-    for( itr=_shadowInfoVec.begin(), idx=0; itr!=_shadowInfoVec.end(); itr++, idx++ )
+    for( itr=_shadowInfoVec.begin(); itr!=_shadowInfoVec.end(); itr++ )
     {
-        if( !( mgr.getLightEnable( idx ) ) )
+        // Only lights that ShadowMap culled have a depth map.
+        if( !( itr->valid() ) || !( (*itr)->_culled ) )
             continue;
-        if( !itr->valid() )
-            *itr = new ShadowInfo;
 
-        const ShadowInfo* si = itr->get();
-        osg::Vec4 lightPos = mgr.getLightPosition( idx );
+        ShadowInfo* si = itr->get();
+        const osg::Viewport* vp( si->_viewport.get() );
 
-        // TBD need to support multiple lights/shadows
-        if( idx == 0 )
-            _depthTexStateSet->setTextureAttribute( BDFX_TEX_UNIT_SHADOW_MAP, si->_depthTex.get() );
+        if( si->_staticCulled )
+        {
+            _staticAtlasFBO->apply( state );
+            glDrawBuffer( GL_NONE );
+            glReadBuffer( GL_NONE );
+            UTIL_GL_FBO_ERROR_CHECK( "SMS Post static atlas FBO bind", fboExt );
+
+            // Clear just this light's tile.
+            vp->apply( state );
+            glEnable( GL_SCISSOR_TEST );
+            glScissor( (GLint)vp->x(), (GLint)vp->y(), (GLsizei)vp->width(), (GLsizei)vp->height() );
+            _shadowMapNode->performClear( renderInfo );
+            glDisable( GL_SCISSOR_TEST );
 
-        osg::Matrixf lightViewProj = computeLightMatrix( lightPos, getCamera()->getViewMatrix() );
-        osg::Uniform* vpu = _depthTexStateSet->getUniform( "bdfx_shadowViewProj" );
-        vpu->set( lightViewProj );
+            si->_staticBin->draw( renderInfo, previous );
+            si->_cacheValid = true;
+        }
 
-        // Bind the FBO.
-        si->_depthFBO->apply( state );
-        UTIL_GL_FBO_ERROR_CHECK( "SMS Post ShadowInfo FBO bind", fboExt );
+        if( dynamic )
+        {
+            if( cacheEnable )
+            {
+                // Composite: copy the cached static depth into the live tile.
+                const GLint x0( (GLint)vp->x() ), y0( (GLint)vp->y() );
+                const GLint x1( x0 + (GLint)vp->width() ), y1( y0 + (GLint)vp->height() );
+                _staticAtlasFBO->apply( state, osg::FrameBufferObject::READ_FRAMEBUFFER );
+                _atlasFBO->apply( state, osg::FrameBufferObject::DRAW_FRAMEBUFFER );
+                fboExt->glBlitFramebuffer( x0, y0, x1, y1, x0, y0, x1, y1,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST );
+            }
+
+            _atlasFBO->apply( state );
+            glDrawBuffer( GL_NONE );
+            glReadBuffer( GL_NONE );
+            UTIL_GL_FBO_ERROR_CHECK( "SMS Post atlas FBO bind", fboExt );
+
+            if( !cacheEnable && ( count == 0 ) )
+            {
+                UTIL_GL_ERROR_CHECK( "SMS pre performClear()" );
+                _atlasViewport->apply( state );
+                _shadowMapNode->performClear( renderInfo );
+            }
+
+            // Draw the (dynamic) casters culled against this light.
+            vp->apply( state );
+            si->_bin->draw( renderInfo, previous );
+        }
 
-        // Apply the viewport for this specific shadow depth map.
-        si->_viewport->apply( state );
+        // ShadowMap culls at most BDFX_MAX_SHADOW_LIGHTS lights.
+        _shadowMatrices->setElement( count, si->_eyeToLight );
+        _shadowTiles->setElement( count, si->_tileRect );
+        count++;
+    }
+    _shadowCount->set( (int)count );
+    if( count > 0 )
+        _depthTexStateSet->setTextureAttribute( BDFX_TEX_UNIT_SHADOW_MAP,
+            dynamic ? _atlasTex.get() : _staticAtlasTex.get() );
 
-        // Draw
-        {
-            UTIL_GL_ERROR_CHECK( "SMS pre performClear()" );
-            _shadowMapNode->performClear( renderInfo );
-            
-            RenderBin::drawImplementation( renderInfo, previous );
+    // Render each Sun cascade into its own depth texture array layer.
+    unsigned int idx;
+    for( idx=0; idx<_numCascadesCulled; idx++ )
+    {
+        const CascadeInfo& ci( _cascadeInfoVec[ idx ] );
 
-            //state.apply();
-        }
+        ci._fbo->apply( state );
+        // Depth only, no color attachment.
+        glDrawBuffer( GL_NONE );
+        glReadBuffer( GL_NONE );
+        UTIL_GL_FBO_ERROR_CHECK( "SMS Post cascade FBO bind", fboExt );
+
+        _cascadeViewport->apply( state );
+
+        _shadowMapNode->performClear( renderInfo );
+        ci._bin->draw( renderInfo, previous );
+
+        _cascadeMatrices->setElement( idx, ci._eyeToShadow );
     }
+    if( _numCascadesCulled > 0 )
+        _depthTexStateSet->setTextureAttribute( BDFX_TEX_UNIT_SHADOW_CASCADES, _cascadeTex.get() );
+    _cascadeSplits->set( _cascadeSplitValues );
+    _cascadeCount->set( (int)_numCascadesCulled );
+
+    // Soft shadow filter parameters. The atlas and cascade filtering
+    // was set to match the mode during cull.
+    const bool kernel( _shadowMapNode->getSoftShadowMode() == ShadowMap::SHADOW_PCF_KERNEL );
+    _shadowTexelSize->set( osg::Vec2f(
+        1.f / (float)( _shadowMapNode->getShadowAtlasSize() ),
+        1.f / (float)( _shadowMapNode->getCascadeResolution() ) ) );
+    _shadowFilterRadius->set( _shadowMapNode->getSoftShadowRadius() );
+    _shadowKernelTaps->set( kernel ? BDFX_SHADOW_KERNEL_TAPS : 0 );
+    if( kernel )
+        _depthTexStateSet->setTextureAttribute( BDFX_TEX_UNIT_SHADOW_KERNEL,
+            _shadowMapNode->getShadowKernelTexture() );
 
     // TBD dump image
 
@@ -222,30 +338,562 @@ void ShadowMapStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& pr
         renderInfo.popCamera();
 }
 
-osg::Matrixf ShadowMapStage::computeLightMatrix( const osg::Vec4 pos, const osg::Matrix& view )
+void ShadowMapStage::reset()
+{
+    osgUtil::RenderStage::reset();
+
+    ShadowInfoVec::iterator itr;
+    for( itr=_shadowInfoVec.begin(); itr != _shadowInfoVec.end(); itr++ )
+    {
+        if( !( itr->valid() ) || !( (*itr)->_culled ) )
+            continue;
+        (*itr)->_bin->reset();
+        (*itr)->_culled = false;
+        if( (*itr)->_staticCulled )
+        {
+            (*itr)->_staticBin->reset();
+            (*itr)->_staticCulled = false;
+        }
+    }
+
+    unsigned int idx;
+    for( idx=0; idx<_numCascadesCulled; idx++ )
+        _cascadeInfoVec[ idx ]._bin->reset();
+    _numCascadesCulled = 0;
+}
+
+ShadowMapStage::ShadowInfo* ShadowMapStage::getOrCreateShadowInfo( unsigned int idx )
+{
+    if( _shadowInfoVec.size() <= idx )
+        _shadowInfoVec.resize( idx+1 );
+    osg::ref_ptr< ShadowInfo >& si( _shadowInfoVec[ idx ] );
+    if( !( si.valid() ) )
+    {
+        si = new ShadowInfo;
+        UTIL_MEMORY_CHECK( si.get(), "ShadowMapStage ShadowInfo", NULL );
+
+        // Otherwise empty StateSets, unique to this light.
+        // See StageRenderBin.
+        si->_bin = new StageRenderBin( this );
+        UTIL_MEMORY_CHECK( si->_bin.get(), "ShadowMapStage ShadowInfo _bin", NULL );
+        si->_stateSet = new osg::StateSet;
+        UTIL_MEMORY_CHECK( si->_stateSet.get(), "ShadowMapStage ShadowInfo _stateSet", NULL );
+        si->_stateSet->setDataVariance( osg::Object::DYNAMIC );
+
+        si->_staticBin = new StageRenderBin( this );
+        UTIL_MEMORY_CHECK( si->_staticBin.get(), "ShadowMapStage ShadowInfo _staticBin", NULL );
+        si->_staticStateSet = new osg::StateSet;
+        UTIL_MEMORY_CHECK( si->_staticStateSet.get(), "ShadowMapStage ShadowInfo _staticStateSet", NULL );
+        si->_staticStateSet->setDataVariance( osg::Object::DYNAMIC );
+    }
+    return( si.get() );
+}
+
+void ShadowMapStage::setLightCull( unsigned int idx, const osg::Matrix& view,
+    const osg::Matrix& lightView, const osg::Matrix& lightProj, float importance )
+{
+    ShadowInfo* si( getOrCreateShadowInfo( idx ) );
+    if( si == NULL )
+        return;
+
+    si->_lightView = lightView;
+    si->_lightProj = lightProj;
+    si->_eyeToLight = osg::Matrix::inverse( view ) * lightView * lightProj;
+    si->_importance = importance;
+    si->_culled = true;
+}
+bool ShadowMapStage::getLightShadowed( unsigned int idx ) const
+{
+    return( ( _shadowInfoVec.size() > idx ) && _shadowInfoVec[ idx ].valid() &&
+        _shadowInfoVec[ idx ]->_culled );
+}
+void ShadowMapStage::getLightMatrices( unsigned int idx, osg::Matrix& lightView, osg::Matrix& lightProj ) const
+{
+    lightView = _shadowInfoVec[ idx ]->_lightView;
+    lightProj = _shadowInfoVec[ idx ]->_lightProj;
+}
+osgUtil::RenderBin* ShadowMapStage::getLightBin( unsigned int idx )
+{
+    return( _shadowInfoVec[ idx ]->_bin.get() );
+}
+osg::StateSet* ShadowMapStage::getLightStateSet( unsigned int idx )
+{
+    return( _shadowInfoVec[ idx ]->_stateSet.get() );
+}
+
+osg::Vec4 ShadowMapStage::updateLightCache( unsigned int idx, const osg::Vec4& pos, osg::BoundingSphere& casterBound )
+{
+    ShadowInfo* si( getOrCreateShadowInfo( idx ) );
+    if( ( si == NULL ) || ( _shadowMapNode == NULL ) )
+        return( pos );
+    if( !( _shadowMapNode->getShadowCacheEnable() ) )
+    {
+        si->_cacheValid = false;
+        return( pos );
+    }
+
+    bool moved( true );
+    if( ( pos[ 3 ] == 0. ) && ( si->_cachedPos[ 3 ] == 0. ) )
+    {
+        // Directional: compare angle.
+        osg::Vec3 dir( pos[ 0 ], pos[ 1 ], pos[ 2 ] );
+        osg::Vec3 cachedDir( si->_cachedPos[ 0 ], si->_cachedPos[ 1 ], si->_cachedPos[ 2 ] );
+        dir.normalize();
+        cachedDir.normalize();
+        const double cosAngle( osg::clampBetween< double >( dir * cachedDir, -1., 1. ) );
+        moved = ( acos( cosAngle ) > _shadowMapNode->getCacheAngleThreshold() );
+    }
+    else if( ( pos[ 3 ] != 0. ) && ( si->_cachedPos[ 3 ] != 0. ) )
+    {
+        // Positional: compare distance.
+        const osg::Vec3 p( pos[ 0 ] / pos[ 3 ], pos[ 1 ] / pos[ 3 ], pos[ 2 ] / pos[ 3 ] );
+        const osg::Vec4& c( si->_cachedPos );
+        const osg::Vec3 cachedP( c[ 0 ] / c[ 3 ], c[ 1 ] / c[ 3 ], c[ 2 ] / c[ 3 ] );
+        moved = ( ( p - cachedP ).length() > _shadowMapNode->getCacheDistanceThreshold() );
+    }
+
+    // The light volume is fitted to the caster bound. Keep the cached fit
+    // while the casters stay inside it.
+    const osg::BoundingSphere& cb( si->_cachedBound );
+    const bool outside( !( cb.valid() ) || !( casterBound.valid() ) ||
+        ( ( casterBound.center() - cb.center() ).length() + casterBound.radius() > cb.radius() ) );
+
+    const unsigned int generation( _shadowMapNode->getStaticCasterGeneration() );
+    if( moved || outside || ( generation != si->_cachedGeneration ) )
+        si->_cacheValid = false;
+
+    if( !( si->_cacheValid ) )
+    {
+        si->_cachedPos = pos;
+        si->_cachedGeneration = generation;
+        // Pad the fitted bound, so that small dynamic caster motion
+        // doesn't invalidate the cache every frame.
+        si->_cachedBound = casterBound;
+        si->_cachedBound.radius() *= 1.1f;
+    }
+    casterBound = si->_cachedBound;
+    return( si->_cachedPos );
+}
+bool ShadowMapStage::requestStaticCull( unsigned int idx )
+{
+    ShadowInfo* si( _shadowInfoVec[ idx ].get() );
+    si->_staticCulled = !( si->_cacheValid );
+    return( si->_staticCulled );
+}
+osgUtil::RenderBin* ShadowMapStage::getLightStaticBin( unsigned int idx )
+{
+    return( _shadowInfoVec[ idx ]->_staticBin.get() );
+}
+osg::StateSet* ShadowMapStage::getLightStaticStateSet( unsigned int idx )
+{
+    return( _shadowInfoVec[ idx ]->_staticStateSet.get() );
+}
+void ShadowMapStage::invalidateLightCaches()
+{
+    ShadowInfoVec::iterator itr;
+    for( itr=_shadowInfoVec.begin(); itr != _shadowInfoVec.end(); itr++ )
+    {
+        if( itr->valid() )
+            (*itr)->_cacheValid = false;
+    }
+}
+
+void ShadowMapStage::layoutAtlas()
+{
+    if( _shadowMapNode == NULL )
+        return;
+    const unsigned int atlasSize( _shadowMapNode->getShadowAtlasSize() );
+    const unsigned int minTile( osg::minimum< unsigned int >(
+        _shadowMapNode->getMinShadowTileSize(), atlasSize ) );
+
+    // The live atlas isn't needed when caching with no dynamic casters.
+    const bool cacheEnable( _shadowMapNode->getShadowCacheEnable() );
+    const bool dynamic( !cacheEnable || ( _shadowMapNode->getDynamicCasterTraversalMask() != 0 ) );
+    if( dynamic && ( !( _atlasTex.valid() ) || ( _atlasTex->getTextureWidth() != (int)atlasSize ) ) )
+    {
+        _atlasTex = createAtlasTexture( atlasSize, "Shadow Atlas" );
+        UTIL_MEMORY_CHECK( _atlasTex.get(), "ShadowMapStage _atlasTex", );
+
+        _atlasFBO = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( _atlasFBO.get(), "ShadowMapStage _atlasFBO", );
+        _atlasFBO->setAttachment( osg::Camera::DEPTH_BUFFER,
+            osg::FrameBufferAttachment( _atlasTex.get() ) );
+    }
+    if( cacheEnable && ( !( _staticAtlasTex.valid() ) || ( _staticAtlasTex->getTextureWidth() != (int)atlasSize ) ) )
+    {
+        _staticAtlasTex = createAtlasTexture( atlasSize, "Shadow Atlas Static Cache" );
+        UTIL_MEMORY_CHECK( _staticAtlasTex.get(), "ShadowMapStage _staticAtlasTex", );
+
+        _staticAtlasFBO = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( _staticAtlasFBO.get(), "ShadowMapStage _staticAtlasFBO", );
+        _staticAtlasFBO->setAttachment( osg::Camera::DEPTH_BUFFER,
+            osg::FrameBufferAttachment( _staticAtlasTex.get() ) );
+
+        invalidateLightCaches();
+    }
+
+    // Free an atlas that's no longer needed, for example after caching is
+    // disabled, so that only one atlas uses memory without caching.
+    if( !dynamic )
+    {
+        _atlasTex = NULL;
+        _atlasFBO = NULL;
+    }
+    if( !cacheEnable )
+    {
+        _staticAtlasTex = NULL;
+        _staticAtlasFBO = NULL;
+    }
+
+    const bool linear( _shadowMapNode->getSoftShadowMode() != ShadowMap::SHADOW_HARD );
+    if( _atlasTex.valid() )
+        setShadowFilter( _atlasTex.get(), linear );
+    if( _staticAtlasTex.valid() )
+        setShadowFilter( _staticAtlasTex.get(), linear );
+
+    if( !( _atlasViewport.valid() ) || ( _atlasViewport->width() != atlasSize ) )
+        _atlasViewport = new osg::Viewport( 0., 0., atlasSize, atlasSize );
+
+    // Desired tile sizes: a power of two proportional to importance.
+    typedef std::vector< std::pair< unsigned int, ShadowInfo* > > TileList;
+    TileList tiles;
+    ShadowInfoVec::iterator itr;
+    for( itr=_shadowInfoVec.begin(); itr != _shadowInfoVec.end(); itr++ )
+    {
+        if( !( itr->valid() ) || !( (*itr)->_culled ) )
+            continue;
+        const unsigned int desired( (unsigned int)( atlasSize * (*itr)->_importance ) );
+        unsigned int size( minTile );
+        while( ( size < atlasSize ) && ( ( size << 1 ) <= desired ) )
+            size <<= 1;
+        tiles.push_back( TileList::value_type( size, itr->get() ) );
+    }
+    if( tiles.empty() )
+        return;
+
+    // Tiles are placed largest first, along a Z-order curve of minimum-size
+    // cells. Power of two tiles placed in decreasing size stay aligned, so
+    // they fit whenever their total area fits. Halve the largest tiles
+    // until that's true.
+    const unsigned int atlasCells( ( atlasSize / minTile ) * ( atlasSize / minTile ) );
+    while( true )
+    {
+        std::sort( tiles.begin(), tiles.end(), std::greater< TileList::value_type >() );
+        unsigned int cells( 0 );
+        TileList::const_iterator titr;
+        for( titr=tiles.begin(); titr != tiles.end(); titr++ )
+            cells += ( titr->first / minTile ) * ( titr->first / minTile );
+        if( ( cells <= atlasCells ) || ( tiles.front().first == minTile ) )
+            break;
+
+        const unsigned int largest( tiles.front().first );
+        TileList::iterator titr2;
+        for( titr2=tiles.begin(); ( titr2 != tiles.end() ) && ( titr2->first == largest ); titr2++ )
+            titr2->first >>= 1;
+    }
+
+    unsigned int cursor( 0 );
+    TileList::const_iterator titr;
+    for( titr=tiles.begin(); titr != tiles.end(); titr++ )
+    {
+        const unsigned int size( titr->first );
+        ShadowInfo* si( titr->second );
+        const unsigned int tileCells( ( size / minTile ) * ( size / minTile ) );
+        if( cursor + tileCells > atlasCells )
+        {
+            osg::notify( osg::WARN ) << "backdropFX: ShadowMapStage: Shadow atlas is full, dropping a light. Increase ShadowMap::setShadowAtlasSize()." << std::endl;
+            si->_culled = false;
+            si->_cacheValid = false;
+            continue;
+        }
+
+        // De-interleave the cursor bits into cell x and y.
+        unsigned int x( 0 ), y( 0 ), bit;
+        for( bit=0; ( 1u << ( 2 * bit ) ) < atlasCells; bit++ )
+        {
+            x |= ( ( cursor >> ( 2 * bit ) ) & 1 ) << bit;
+            y |= ( ( cursor >> ( 2 * bit + 1 ) ) & 1 ) << bit;
+        }
+        cursor += tileCells;
+
+        x *= minTile;
+        y *= minTile;
+        si->_viewport->setViewport( x, y, size, size );
+        const float invAtlas( 1.f / (float)atlasSize );
+        const osg::Vec4f tileRect( x * invAtlas, y * invAtlas, size * invAtlas, size * invAtlas );
+        if( tileRect != si->_tileRect )
+            // Cached static depth is in the old tile.
+            si->_cacheValid = false;
+        si->_tileRect = tileRect;
+    }
+}
+
+unsigned int ShadowMapStage::setCascadeCull( const osg::Vec3& sunDir, const osg::Matrix& view,
+    const osg::Matrix& proj, const osg::BoundingSphere& casterBound )
+{
+    _numCascadesCulled = 0;
+    if( ( _shadowMapNode == NULL ) || !( casterBound.valid() ) || ( sunDir.length2() == 0. ) )
+        return( 0 );
+    const unsigned int numCascades( osg::minimum< unsigned int >(
+        _shadowMapNode->getNumSunCascades(), BDFX_MAX_SHADOW_CASCADES ) );
+    if( numCascades == 0 )
+        return( 0 );
+
+    // Eye space corners of the view volume, near plane first. Works for
+    // both perspective and orthographic projections.
+    const osg::Matrix invProj( osg::Matrix::inverse( proj ) );
+    osg::Vec3 nearCorners[ 4 ], farCorners[ 4 ];
+    unsigned int idx;
+    for( idx=0; idx<4; idx++ )
+    {
+        const double x( ( idx & 1 ) ? 1. : -1. );
+        const double y( ( idx & 2 ) ? 1. : -1. );
+        nearCorners[ idx ] = osg::Vec3( x, y, -1. ) * invProj;
+        farCorners[ idx ] = osg::Vec3( x, y, 1. ) * invProj;
+    }
+    const double camNear( -nearCorners[ 0 ].z() );
+    const double camFar( -farCorners[ 0 ].z() );
+
+    // Only shadow the part of the view volume that contains casters, and
+    // no further than the Sun shadow distance.
+    const osg::Vec3 boundEye( casterBound.center() * view );
+    const double shadowNear( osg::maximum< double >( camNear, -boundEye.z() - casterBound.radius() ) );
+    const double shadowFar( osg::minimum< double >( osg::minimum< double >( camFar,
+        -boundEye.z() + casterBound.radius() ), _shadowMapNode->getSunShadowDistance() ) );
+    if( shadowFar <= shadowNear )
+        return( 0 );
+
+    std::vector< double > splits;
+    computeCascadeSplits( splits, camFar, shadowNear, shadowFar, numCascades );
+
+    configureCascades( splits.size(), _shadowMapNode->getCascadeResolution() );
+
+
+    // Light space rotation, looking down the Sun direction.
+    osg::Vec3 lightDir( sunDir );
+    lightDir.normalize();
+    osg::Vec3 up( 0., 0., 1. );
+    if( osg::absolute( lightDir * up ) > .99 )
+        up.set( 0., 1., 0. );
+    const osg::Matrix lightRot( osg::Matrix::lookAt( osg::Vec3( 0., 0., 0. ), -lightDir, up ) );
+    const osg::Vec3 boundLight( casterBound.center() * lightRot );
+
+    const osg::Matrix invView( osg::Matrix::inverse( view ) );
+    const osg::Matrix bias( osg::Matrix::translate( 1., 1., 1. ) * osg::Matrix::scale( .5, .5, .5 ) );
+    const double resolution( _shadowMapNode->getCascadeResolution() );
+
+    _cascadeSplitValues.set( 0.f, 0.f, 0.f, 0.f );
+    for( idx=0; idx<splits.size(); idx++ )
+    {
+        CascadeInfo& ci( _cascadeInfoVec[ idx ] );
+
+        // World space corners of this slice of the view volume.
+        const double sliceNear( ( idx == 0 ) ? shadowNear : splits[ idx-1 ] );
+        const double sliceFar( splits[ idx ] );
+        osg::Vec3 corners[ 8 ];
+        osg::Vec3 center( 0., 0., 0. );
+        unsigned int cdx;
+        for( cdx=0; cdx<4; cdx++ )
+        {
+            const osg::Vec3& nc( nearCorners[ cdx ] );
+            const osg::Vec3 edge( farCorners[ cdx ] - nc );
+            corners[ cdx ] = ( nc + edge * ( ( sliceNear - camNear ) / ( camFar - camNear ) ) ) * invView;
+            corners[ cdx+4 ] = ( nc + edge * ( ( sliceFar - camNear ) / ( camFar - camNear ) ) ) * invView;
+            center += corners[ cdx ] + corners[ cdx+4 ];
+        }
+        center /= 8.;
+
+        // Bounding sphere of the slice. Its radius doesn't change as the
+        // camera rotates, so the light volume size is constant from frame
+        // to frame. Round it up so floating point noise doesn't change it either.
+        double radius( 0. );
+        for( cdx=0; cdx<8; cdx++ )
+            radius = osg::maximum< double >( radius, ( corners[ cdx ] - center ).length() );
+        radius = ceil( radius * 16. ) / 16.;
+
+        // Snap the light volume to whole texels, so that shadow edges
+        // don't swim as the camera translates.
+        osg::Vec3d centerLight( center * lightRot );
+        const double texel( 2. * radius / resolution );
+        centerLight[ 0 ] = floor( centerLight[ 0 ] / texel ) * texel;
+        centerLight[ 1 ] = floor( centerLight[ 1 ] / texel ) * texel;
+
+        // Depth range: from the casters nearest the Sun to the far side of the slice.
+        const double zNear( -boundLight.z() - casterBound.radius() );
+        double zFar( -centerLight.z() + radius );
+        if( zFar <= zNear )
+            zFar = zNear + 2. * radius;
+
+        ci._lightView = lightRot * osg::Matrix::translate( -centerLight[ 0 ], -centerLight[ 1 ], 0. );
+        ci._lightProj = osg::Matrix::ortho( -radius, radius, -radius, radius, zNear, zFar );
+        ci._eyeToShadow = invView * ci._lightView * ci._lightProj * bias;
+
+        _cascadeSplitValues[ idx ] = sliceFar;
+    }
+
+    _numCascadesCulled = splits.size();
+    return( _numCascadesCulled );
+}
+void ShadowMapStage::getCascadeMatrices( unsigned int idx, osg::Matrix& lightView, osg::Matrix& lightProj ) const
+{
+    lightView = _cascadeInfoVec[ idx ]._lightView;
+    lightProj = _cascadeInfoVec[ idx ]._lightProj;
+}
+osgUtil::RenderBin* ShadowMapStage::getCascadeBin( unsigned int idx )
+{
+    return( _cascadeInfoVec[ idx ]._bin.get() );
+}
+osg::StateSet* ShadowMapStage::getCascadeStateSet( unsigned int idx )
+{
+    return( _cascadeInfoVec[ idx ]._stateSet.get() );
+}
+
+void ShadowMapStage::computeCascadeSplits( std::vector< double >& splits, double camFar,
+    double inNear, double inFar, unsigned int numCascades ) const
 {
-    osg::Vec3 look, at, up;
-    view.getLookAt( look, at, up );
-    at -= look;
-    at.normalize();
-    at = osg::Vec3( 0., 0., 0. );
-    up = osg::Vec3( 0., 0., 1. );
+    splits.clear();
+
+    // If the DepthPartition slice boundaries within the shadowed range fit in
+    // the available cascades, use them. Each partition then reads a single
+    // cascade, and cascade resolution tracks partition depth precision.
+    const DepthPartition& dp( Manager::instance()->getDepthPartition() );
+    const double ratio( dp.getRatio() );
+    const unsigned int numPartitions( dp.getNumPartitions() );
+    if( ( ratio > 0. ) && ( ratio < 1. ) && ( numPartitions != 1 ) )
+    {
+        // Partition near planes, far to near. See DepthPartitionStage::computePartitions().
+        double boundary( camFar * ratio );
+        unsigned int count( 1 );
+        while( ( boundary > inNear ) && ( ( numPartitions == 0 ) || ( count < numPartitions ) ) )
+        {
+            if( boundary < inFar )
+                splits.insert( splits.begin(), boundary );
+            boundary *= ratio;
+            count++;
+        }
+        splits.push_back( inFar );
+        if( splits.size() <= numCascades )
+            return;
+        splits.clear();
+    }
 
-    osg::Matrixf lightView, lightProj;
-    if( pos[3] == 1.0 )
+    // Otherwise, blend logarithmic and uniform split distributions.
+    const double lambda( .75 );
+    unsigned int idx;
+    for( idx=1; idx<=numCascades; idx++ )
     {
-        // Positional
-        lightView = osg::Matrixf::lookAt( osg::Vec3( pos[0], pos[1], pos[2] ), at, up );
-        lightProj = osg::Matrixf::perspective( 40., 1., 10., 150. );
+        const double frac( (double)idx / (double)numCascades );
+        const double logSplit( inNear * pow( inFar / inNear, frac ) );
+        const double uniSplit( inNear + ( inFar - inNear ) * frac );
+        splits.push_back( lambda * logSplit + ( 1. - lambda ) * uniSplit );
+    }
+    splits.back() = inFar;
+}
+
+void ShadowMapStage::configureCascades( unsigned int numCascades, unsigned int resolution )
+{
+    if( _cascadeInfoVec.size() < numCascades )
+        _cascadeInfoVec.resize( numCascades );
+
+    const bool texChanged( !( _cascadeTex.valid() ) ||
+        ( _cascadeTex->getTextureWidth() != (int)resolution ) );
+    if( texChanged )
+    {
+        // Always allocate the maximum number of layers, so that changing
+        // the cascade count doesn't reallocate the texture.
+        _cascadeTex = new osg::Texture2DArray;
+        UTIL_MEMORY_CHECK( _cascadeTex.get(), "ShadowMapStage _cascadeTex", );
+        _cascadeTex->setName( "Shadow Cascade Depth Maps" );
+        _cascadeTex->setInternalFormat( GL_DEPTH_COMPONENT );
+        _cascadeTex->setSourceFormat( GL_DEPTH_COMPONENT );
+        _cascadeTex->setSourceType( GL_FLOAT );
+        _cascadeTex->setShadowComparison( true );
+        _cascadeTex->setShadowCompareFunc( osg::Texture::LEQUAL );
+        _cascadeTex->setShadowTextureMode( osg::Texture::LUMINANCE );
+        _cascadeTex->setBorderWidth( 0 );
+        _cascadeTex->setTextureSize( resolution, resolution, BDFX_MAX_SHADOW_CASCADES );
+        _cascadeTex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+        _cascadeTex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+        _cascadeTex->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+        _cascadeTex->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+
+        _cascadeViewport = new osg::Viewport( 0., 0., resolution, resolution );
+    }
+    setShadowFilter( _cascadeTex.get(),
+        ( _shadowMapNode->getSoftShadowMode() != ShadowMap::SHADOW_HARD ) );
+
+    unsigned int idx;
+    for( idx=0; idx<numCascades; idx++ )
+    {
+        CascadeInfo& ci( _cascadeInfoVec[ idx ] );
+        if( !( ci._bin.valid() ) )
+        {
+            ci._bin = new StageRenderBin( this );
+            UTIL_MEMORY_CHECK( ci._bin.get(), "ShadowMapStage CascadeInfo _bin", );
+
+            // See StageRenderBin.
+            ci._stateSet = new osg::StateSet;
+            UTIL_MEMORY_CHECK( ci._stateSet.get(), "ShadowMapStage CascadeInfo _stateSet", );
+            ci._stateSet->setDataVariance( osg::Object::DYNAMIC );
+        }
+        if( texChanged || !( ci._fbo.valid() ) )
+        {
+            ci._fbo = new osg::FrameBufferObject;
+            UTIL_MEMORY_CHECK( ci._fbo.get(), "ShadowMapStage CascadeInfo _fbo", );
+            ci._fbo->setAttachment( osg::Camera::DEPTH_BUFFER,
+                osg::FrameBufferAttachment( _cascadeTex.get(), idx ) );
+        }
+    }
+}
+
+void ShadowMapStage::computeLightMatrices( const osg::Vec4& pos, const osg::BoundingSphere& casterBound,
+    osg::Matrix& lightView, osg::Matrix& lightProj )
+{
+    osg::BoundingSphere bound( casterBound );
+    if( !( bound.valid() ) || ( bound.radius() <= 0.f ) )
+        bound = osg::BoundingSphere( osg::Vec3( 0., 0., 0. ), 1.f );
+    const osg::Vec3 center( bound.center() );
+    const double radius( bound.radius() );
+
+    if( pos[3] != 0. )
+    {
+        // Positional. Look from the light at the center of the bound.
+        const osg::Vec3 lightPos( pos[0] / pos[3], pos[1] / pos[3], pos[2] / pos[3] );
+        osg::Vec3 dir( center - lightPos );
+        const double distance( dir.length() );
+        if( distance > 0. )
+            dir /= distance;
+        else
+            dir.set( 0., 0., -1. );
+        osg::Vec3 up( 0., 0., 1. );
+        if( osg::absolute( dir * up ) > .99 )
+            up.set( 0., 1., 0. );
+        lightView = osg::Matrix::lookAt( lightPos, lightPos + dir, up );
+
+        // Outside the bound, the frustum just encloses it. A light inside
+        // the bound can't see all of it with one frustum; use a wide angle,
+        // and clamp the near plane so depth precision stays usable.
+        double fovy( 120. );
+        double zNear( radius * .01 );
+        if( distance > radius * 1.01 )
+        {
+            fovy = osg::minimum< double >( fovy, 2. * osg::RadiansToDegrees( asin( radius / distance ) ) );
+            zNear = osg::maximum< double >( zNear, distance - radius );
+        }
+        lightProj = osg::Matrix::perspective( fovy, 1., zNear, distance + radius );
     }
     else
     {
-        // Directional
-        at *= 30.;
-        lightView = osg::Matrixf::lookAt( at + osg::Vec3( pos[0], pos[1], pos[2] ), at, up );
-        lightProj = osg::Matrixf::ortho( -30., 30., -30., 30., -100., 100. );
+        // Directional. An orthographic box around the bound, looking
+        // down the light direction.
+        osg::Vec3 dir( -pos[0], -pos[1], -pos[2] );
+        dir.normalize();
+        osg::Vec3 up( 0., 0., 1. );
+        if( osg::absolute( dir * up ) > .99 )
+            up.set( 0., 1., 0. );
+        lightView = osg::Matrix::lookAt( center - dir * radius, center, up );
+        lightProj = osg::Matrix::ortho( -radius, radius, -radius, radius, 0., 2. * radius );
     }
-    return( lightView * lightProj );
 }
 
 
@@ -280,6 +928,24 @@ void ShadowMapStage::resizeGLObjectBuffers( unsigned int maxSize )
         if( itr->valid() )
             (*itr)->resizeGLObjectBuffers( maxSize );
     }
+    if( _atlasTex.valid() )
+    {
+        _atlasTex->resizeGLObjectBuffers( maxSize );
+        _atlasFBO->resizeGLObjectBuffers( maxSize );
+    }
+    if( _staticAtlasTex.valid() )
+    {
+        _staticAtlasTex->resizeGLObjectBuffers( maxSize );
+        _staticAtlasFBO->resizeGLObjectBuffers( maxSize );
+    }
+    if( _cascadeTex.valid() )
+        _cascadeTex->resizeGLObjectBuffers( maxSize );
+    CascadeInfoVec::iterator citr;
+    for( citr=_cascadeInfoVec.begin(); citr != _cascadeInfoVec.end(); citr++ )
+    {
+        if( citr->_fbo.valid() )
+            citr->_fbo->resizeGLObjectBuffers( maxSize );
+    }
 
     osg::Object::resizeGLObjectBuffers( maxSize );
 }
@@ -292,6 +958,24 @@ void ShadowMapStage::releaseGLObjects( osg::State* state ) const
         if( itr->valid() )
             (*itr)->releaseGLObjects( state );
     }
+    if( _atlasTex.valid() )
+    {
+        _atlasTex->releaseGLObjects( state );
+        _atlasFBO->releaseGLObjects( state );
+    }
+    if( _staticAtlasTex.valid() )
+    {
+        _staticAtlasTex->releaseGLObjects( state );
+        _staticAtlasFBO->releaseGLObjects( state );
+    }
+    if( _cascadeTex.valid() )
+        _cascadeTex->releaseGLObjects( state );
+    CascadeInfoVec::const_iterator citr;
+    for( citr=_cascadeInfoVec.begin(); citr != _cascadeInfoVec.end(); citr++ )
+    {
+        if( citr->_fbo.valid() )
+            citr->_fbo->releaseGLObjects( state );
+    }
 
     osg::Object::releaseGLObjects( state );
 }
@@ -0,0 +1,248 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/SkyCubeStage.h>
+#include <osgUtil/RenderStage>
+#include <osgUtil/StateGraph>
+#include <osg/GLExtensions>
+#include <osg/FrameBufferObject>
+#include <osgwTools/FBOUtils.h>
+
+#include <backdropFX/Utils.h>
+
+
+
+namespace backdropFX
+{
+
+
+SkyCubeMap::SkyCubeMap( unsigned int size )
+  : _size( size ),
+    _generation( 1 )
+{
+    _texture = new osg::TextureCubeMap;
+    UTIL_MEMORY_CHECK( _texture.get(), "SkyCubeMap texture", );
+    _texture->setName( "SkyCubeMap" );
+    _texture->setInternalFormat( GL_RGBA );
+    _texture->setSourceFormat( GL_RGBA );
+    _texture->setSourceType( GL_UNSIGNED_BYTE );
+    _texture->setTextureSize( size, size );
+    _texture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    _texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    _texture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    _texture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    _texture->setWrap( osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE );
+
+    unsigned int face;
+    for( face=0; face<6; face++ )
+    {
+        _fbo[ face ] = new osg::FrameBufferObject;
+        UTIL_MEMORY_CHECK( _fbo[ face ].get(), "SkyCubeMap FBO", );
+        _fbo[ face ]->setAttachment( osg::Camera::COLOR_BUFFER0,
+            osg::FrameBufferAttachment( _texture.get(), face ) );
+    }
+}
+SkyCubeMap::~SkyCubeMap()
+{
+}
+
+bool
+SkyCubeMap::needsRender( unsigned int contextID ) const
+{
+    return( ( contextID >= _renderedGeneration.size() ) ||
+        ( _renderedGeneration[ contextID ] != _generation ) );
+}
+void
+SkyCubeMap::rendered( unsigned int contextID )
+{
+    _renderedGeneration[ contextID ] = _generation;
+}
+
+void
+SkyCubeMap::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    _texture->resizeGLObjectBuffers( maxSize );
+    unsigned int face;
+    for( face=0; face<6; face++ )
+        _fbo[ face ]->resizeGLObjectBuffers( maxSize );
+    _renderedGeneration.resize( maxSize );
+}
+void
+SkyCubeMap::releaseGLObjects( osg::State* state ) const
+{
+    _texture->releaseGLObjects( state );
+    unsigned int face;
+    for( face=0; face<6; face++ )
+        _fbo[ face ]->releaseGLObjects( state );
+
+    // The faces must be rendered again.
+    if( state == NULL )
+        _renderedGeneration.setAllElementsTo( 0 );
+    else if( state->getContextID() < _renderedGeneration.size() )
+        _renderedGeneration[ state->getContextID() ] = 0;
+}
+
+
+
+SkyCubeStage::SkyCubeStage()
+  : osgUtil::RenderStage(),
+    _zNear( 1. ),
+    _zFar( 1000. )
+{
+    internalInit();
+}
+SkyCubeStage::SkyCubeStage( const osgUtil::RenderStage& rhs, const osg::CopyOp& copyop )
+  : osgUtil::RenderStage( rhs ),
+    _zNear( 1. ),
+    _zFar( 1000. )
+{
+    internalInit();
+}
+SkyCubeStage::SkyCubeStage( const SkyCubeStage& rhs, const osg::CopyOp& copyop )
+  : osgUtil::RenderStage( rhs ),
+    _skyCube( rhs._skyCube ),
+    _zNear( rhs._zNear ),
+    _zFar( rhs._zFar )
+{
+    internalInit();
+}
+
+SkyCubeStage::~SkyCubeStage()
+{
+}
+
+
+void
+SkyCubeStage::internalInit()
+{
+    _cubeViewport = new osg::Viewport;
+    UTIL_MEMORY_CHECK( _cubeViewport.get(), "SkyCubeStage::internalInit Viewport", )
+
+    _stateSet = new osg::StateSet;
+    UTIL_MEMORY_CHECK( _stateSet.get(), "SkyCubeStage::internalInit StateSet", )
+
+    _viewProj = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "viewProj" );
+    UTIL_MEMORY_CHECK( _viewProj.get(), "SkyCubeStage::internalInit _viewProj", )
+    _viewProj->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _viewProj.get() );
+
+    _invViewProj = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "invViewProj" );
+    UTIL_MEMORY_CHECK( _invViewProj.get(), "SkyCubeStage::internalInit _invViewProj", )
+    _invViewProj->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _invViewProj.get() );
+}
+
+
+void
+SkyCubeStage::setNearFar( double zNear, double zFar )
+{
+    _zNear = zNear;
+    _zFar = zFar;
+}
+
+osg::StateSet*
+SkyCubeStage::getPerCullStateSet()
+{
+    return( _stateSet.get() );
+}
+
+osg::Matrix
+SkyCubeStage::getFaceViewMatrix( unsigned int face )
+{
+    // OpenGL cube map face orientations.
+    const osg::Vec3 eye( 0., 0., 0. );
+    switch( face )
+    {
+    case osg::TextureCubeMap::POSITIVE_X:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( 1., 0., 0. ), osg::Vec3( 0., -1., 0. ) ) );
+    case osg::TextureCubeMap::NEGATIVE_X:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( -1., 0., 0. ), osg::Vec3( 0., -1., 0. ) ) );
+    case osg::TextureCubeMap::POSITIVE_Y:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( 0., 1., 0. ), osg::Vec3( 0., 0., 1. ) ) );
+    case osg::TextureCubeMap::NEGATIVE_Y:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( 0., -1., 0. ), osg::Vec3( 0., 0., -1. ) ) );
+    case osg::TextureCubeMap::POSITIVE_Z:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( 0., 0., 1. ), osg::Vec3( 0., -1., 0. ) ) );
+    default:
+    case osg::TextureCubeMap::NEGATIVE_Z:
+        return( osg::Matrix::lookAt( eye, osg::Vec3( 0., 0., -1. ), osg::Vec3( 0., -1., 0. ) ) );
+    }
+}
+
+
+
+void
+SkyCubeStage::draw( osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous )
+{
+    if( _stageDrawnThisFrame )
+        return;
+    _stageDrawnThisFrame = true;
+
+    osg::State& state( *renderInfo.getState() );
+    const unsigned int contextID( state.getContextID() );
+
+    // Another view in this context might have already rendered the sky.
+    if( !( _skyCube.valid() ) || !( _skyCube->needsRender( contextID ) ) )
+        return;
+
+    osg::notify( osg::DEBUG_INFO ) << "backdropFX: SkyCubeStage::draw" << std::endl;
+
+    osg::FBOExtensions* fboExt( osg::FBOExtensions::instance( contextID, true ) );
+    if( fboExt == NULL )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SCS: FBOExtensions == NULL." << std::endl;
+        return;
+    }
+
+    // See SkyDomeStage::draw(), redmine 434.
+    if( _camera )
+        renderInfo.pushCamera( _camera );
+
+    const unsigned int size( _skyCube->getSize() );
+    _cubeViewport->setViewport( 0, 0, size, size );
+    const osg::Matrix proj( osg::Matrix::perspective( 90., 1., _zNear, _zFar ) );
+
+    unsigned int face;
+    for( face=0; face<6; face++ )
+    {
+        _skyCube->getFBO( face )->apply( state );
+        state.applyAttribute( _cubeViewport.get() );
+
+        glClearColor( 0.f, 0.f, 0.f, 0.f );
+        glClear( GL_COLOR_BUFFER_BIT );
+
+        const osg::Matrix viewProj( getFaceViewMatrix( face ) * proj );
+        _viewProj->set( viewProj );
+        _invViewProj->set( osg::Matrix::inverse( viewProj ) );
+
+        UTIL_GL_ERROR_CHECK( "SCS pre drawImplementation()" );
+        RenderBin::drawImplementation( renderInfo, previous );
+
+        // Return to the root StateGraph, so that the next face
+        // applies the full state, including the new uniform values.
+        if( previous != NULL )
+        {
+            osgUtil::StateGraph::moveToRootStateGraph( state, previous->_parent );
+            state.apply();
+            previous = NULL;
+        }
+    }
+    _skyCube->rendered( contextID );
+
+    if( state.getCheckForGLErrors() != osg::State::NEVER_CHECK_GL_ERRORS )
+    {
+        std::string msg( "at SCS draw end" );
+        UTIL_GL_ERROR_CHECK( msg );
+        UTIL_GL_FBO_ERROR_CHECK( msg, fboExt );
+    }
+
+    // Unbind the cube map FBO. SkyDomeStage binds its own.
+    osgwTools::glBindFramebuffer( fboExt, GL_DRAW_FRAMEBUFFER_EXT, 0 );
+    osgwTools::glBindFramebuffer( fboExt, GL_READ_FRAMEBUFFER_EXT, 0 );
+
+    if( _camera )
+        renderInfo.popCamera();
+}
+
+
+// namespace backdropFX
+}
@@ -4,6 +4,9 @@
 #include <backdropFX/SunBody.h>
 #include <backdropFX/MoonBody.h>
 #include <backdropFX/LocationData.h>
+#include <backdropFX/Manager.h>
+#include <backdropFX/RenderStageCache.h>
+#include <backdropFX/AssetLoader.h>
 
 #include <osgwTools/Shapes.h>
 #include <osgDB/ReadFile>
@@ -15,8 +18,8 @@
 #include <osg/Geode>
 #include <osg/NodeCallback>
 #include <osgText/Text>
+#include <OpenThreads/ScopedLock>
 
-#include <osgEphemeris/EphemerisEngine.h>
 #include <osgEphemeris/DateTime.h>
 #include <osgEphemeris/CelestialBodies.h>
 
@@ -25,17 +28,113 @@
 #include <osg/CullFace>
 #include <osg/AlphaFunc>
 #include <osg/TextureCubeMap>
+#include <osg/PointSprite>
 
 #include <backdropFX/Utils.h>
 #include <osg/Config>
 #include <osg/io_utils>
 #include <sstream>
+#include <vector>
+#include <cmath>
 
 
 namespace backdropFX
 {
 
 
+/** \cond */
+// MoonBody ephemeris samples are one simulated minute apart.
+static const double MinutesPerDay( 1440. );
+
+// Angle in degrees between two sky positions: the larger of the rotation
+// of the celestial sphere (local sidereal time) and the motion of the Moon,
+// the fastest moving body.
+static double skyAngle( const EphemerisCache::Sample& sample,
+    double lst, double moonRA, double moonDec )
+{
+    double lstDelta( osg::absolute( sample._lst - lst ) );
+    if( lstDelta > 12. )
+        lstDelta = 24. - lstDelta;
+    double raDelta( osg::absolute( sample._moonRA - moonRA ) );
+    if( raDelta > 12. )
+        raDelta = 24. - raDelta;
+    return( osg::maximum( lstDelta * 15.,
+        osg::maximum( raDelta * 15. * cos( osg::DegreesToRadians( sample._moonDec ) ),
+            osg::absolute( sample._moonDec - moonDec ) ) ) );
+}
+
+// Fullscreen quad in normalized device coordinates.
+static osg::Geometry* createScreenQuad()
+{
+    osg::Geometry* quad( new osg::Geometry );
+    UTIL_MEMORY_CHECK( quad, "SkyDome screen quad Geometry", NULL );
+    osg::Vec3Array* v( new osg::Vec3Array );
+    UTIL_MEMORY_CHECK( v, "SkyDome screen quad vertices", NULL );
+    v->push_back( osg::Vec3( -1., -1., 0. ) );
+    v->push_back( osg::Vec3( 1., -1., 0. ) );
+    v->push_back( osg::Vec3( 1., 1., 0. ) );
+    v->push_back( osg::Vec3( -1., 1., 0. ) );
+    quad->setVertexArray( v );
+    quad->addPrimitiveSet( new osg::DrawArrays( GL_QUADS, 0, 4 ) );
+    return( quad );
+}
+
+// B-V color index of each EphemerisCache::Planet.
+static const float s_planetColorIndex[ EphemerisCache::NUM_PLANETS ] = {
+    .97f, .82f, 1.36f, .83f, 1.04f };
+/** \endcond */
+
+
+// Sky state for one LocationData: the clock, the ephemeris, and the
+// uniforms pushed during cull of the views that use it.
+class SkyDomeContext : public osg::Referenced
+{
+public:
+    SkyDomeContext( SkyDome* sd, LocationData* ld, const EphemerisCache* cacheSettings );
+
+    osg::observer_ptr< LocationData > _locationData;
+    osg::ref_ptr< LocationCB > _locationCB;
+    unsigned int _dirty;
+
+    double _simMJD;
+    bool _publishingDateTime;
+    // Sky position when the clock was last published to LocationData.
+    double _publishedLST, _publishedMoonRA, _publishedMoonDec;
+    EphemerisCache::Sample _currentSample;
+    osg::ref_ptr< EphemerisCache > _ephemerisCache;
+
+    osg::ref_ptr< osg::StateSet > _stateSet;
+    osg::ref_ptr< osg::Uniform > _orientation, _up;
+    // Local horizontal axes, for the cloud plane.
+    osg::ref_ptr< osg::Uniform > _east, _north;
+    osg::ref_ptr< osg::Uniform > _sunTransform;
+
+    /** Gets the ephemeris sample at \c mjd for this context's location,
+    from the cache if \c useCache is true, otherwise computed directly. */
+    void computeSample( double mjd, bool useCache, EphemerisCache::Sample& sample );
+
+    // Moon and Sun directions at the start and end of the current
+    // ephemeris minute. MoonBody interpolates between them on the GPU.
+    double _moonKeyMJD;
+    osg::ref_ptr< osg::Uniform > _moonDirection0, _moonDirection1;
+    osg::ref_ptr< osg::Uniform > _sunDirection0, _sunDirection1;
+    osg::ref_ptr< osg::Uniform > _ephemerisFraction;
+    // Planet directions (xyz) and magnitudes (w) at the start of the
+    // current ephemeris minute.
+    osg::ref_ptr< osg::Uniform > _planets;
+
+    // Sky cache. Views push _skyCacheStateSet to draw from the cube map.
+    void createSkyCube( unsigned int size );
+    osg::ref_ptr< SkyCubeMap > _skyCube;
+    osg::ref_ptr< osg::StateSet > _skyCacheStateSet;
+    // Sky position when the sky cache was last marked out of date.
+    double _cachedLST, _cachedMoonRA, _cachedMoonDec;
+
+protected:
+    ~SkyDomeContext();
+};
+
+
 // There is *always* a SkyDomeUpdateCB attached
 // to the SkyDome node.
 class SkyDomeUpdateCB : public osg::NodeCallback
@@ -44,59 +143,49 @@ public:
     SkyDomeUpdateCB( SkyDome* sd )
       : NodeCallback(),
         _sd( sd ),
-        _simTime( 0 )
+        _simTime( -1. ),
+        _cloudTime( -1. )
     {}
 
     virtual void operator()( osg::Node* node, osg::NodeVisitor* nv )
     {
+        // Attach textures that finished loading, including those
+        // requested by the last rebuild.
+        AssetLoader::instance()->update();
+
         if( _sd->_dirty != 0 )
         {
             if( _sd->_dirty & SkyDome::RebuildDirty )
                 _sd->rebuild();
             if( _sd->_dirty & SkyDome::DebugDirty )
+            {
                 _sd->updateDebug();
-            if( _sd->_dirty & SkyDome::LocationDataDirty )
-                _sd->updateLocationData();
+                _sd->dirtySkyCaches();
+            }
             _sd->_dirty = 0;
         }
 
+        double seconds( 0. );
         float scale;
         if( _sd->getAutoAdvanceTime( scale ) )
         {
-            double currentTime = nv->getFrameStamp()->getSimulationTime();
-            double elapsed = currentTime - _simTime;
-            if( elapsed * scale > 1.0 )
-            {
-                int elapsedInt = (int)( elapsed * scale );
-                _simTime += (double) elapsed;
-
-                osgEphemeris::DateTime dateTime = backdropFX::LocationData::s_instance()->getDateTime();
-                int sec = dateTime.getSecond() + elapsedInt;
-                if( sec > 59 )
-                {
-                    int incMinutes = sec / 60;
-                    sec = sec % 60;
-                    int minute = dateTime.getMinute() + incMinutes;
-                    if( minute > 59 )
-                    {
-                        int incHours = minute / 60;
-                        minute = minute % 60;
-                        int hour = dateTime.getHour() + incHours;
-
-                        if( hour > 24 )
-                        {
-                            hour -= 24;
-                            int day = dateTime.getDayOfMonth() + 1;
-                            dateTime.setDayOfMonth( day );
-                        }
-                        dateTime.setHour( hour );
-                    }
-                    dateTime.setMinute( minute );
-                }
-                dateTime.setSecond( sec );
-                backdropFX::LocationData::s_instance()->setDateTime( dateTime );
-            }
+            // Advance the continuous clocks by the scaled frame time.
+            // The first frame after enabling only records the time.
+            const double currentTime( nv->getFrameStamp()->getSimulationTime() );
+            if( _simTime >= 0. )
+                seconds = ( currentTime - _simTime ) * scale;
+            _simTime = currentTime;
         }
+        else
+            _simTime = -1.;
+
+        _sd->updateContexts( seconds );
+
+        // Wind moves the clouds in frame time, whatever the clock scale.
+        const double frameTime( nv->getFrameStamp()->getSimulationTime() );
+        if( _cloudTime >= 0. )
+            _sd->updateClouds( frameTime - _cloudTime );
+        _cloudTime = frameTime;
 
         traverse( node, nv );
     }
@@ -105,6 +194,7 @@ protected:
     SkyDome* _sd;
 
     double _simTime;
+    double _cloudTime;
 };
 
 
@@ -138,8 +228,9 @@ protected:
 class LocationCB : public backdropFX::LocationData::Callback
 {
 public:
-    LocationCB( SkyDome* sd )
-      : _sd( sd )
+    LocationCB( SkyDome* sd, SkyDomeContext* ctx )
+      : _sd( sd ),
+        _ctx( ctx )
     {}
     ~LocationCB()
     {}
@@ -151,44 +242,140 @@ public:
             backdropFX::LocationData::EastUpChanged |
             backdropFX::LocationData::DateTimeChanged );
 
-        if( changeMask & quickBitmaskValues  )
-            _sd->_dirty |= SkyDome::LocationDataDirty;
+        // SkyDome ignores the date/time changes it publishes itself;
+        // its own clock is more precise than LocationData's.
+        if( ( changeMask & backdropFX::LocationData::DateTimeChanged ) && !( _ctx->_publishingDateTime ) )
+            _ctx->_dirty |= SkyDome::DateTimeDirty;
+        if( changeMask & ( quickBitmaskValues & ~backdropFX::LocationData::DateTimeChanged ) )
+            _ctx->_dirty |= SkyDome::LocationDataDirty;
         if( changeMask & ~quickBitmaskValues  )
             _sd->_dirty |= SkyDome::RebuildDirty;
     }
 
 protected:
     SkyDome* _sd;
+    // The context owns this callback.
+    SkyDomeContext* _ctx;
 };
 
 
 
-// Lifted directly from CullVisitor
-class RenderStageCache : public osg::Object
+SkyDomeContext::SkyDomeContext( SkyDome* sd, LocationData* ld, const EphemerisCache* cacheSettings )
+  : _locationData( ld ),
+    _dirty( SkyDome::LocationDataDirty | SkyDome::DateTimeDirty ),
+    _simMJD( 0. ),
+    _publishingDateTime( false ),
+    _publishedLST( 0. ),
+    _publishedMoonRA( 0. ),
+    _publishedMoonDec( 0. ),
+    _moonKeyMJD( -1. ),
+    _cachedLST( 0. ),
+    _cachedMoonRA( 0. ),
+    _cachedMoonDec( 0. )
 {
-public:
-    RenderStageCache() {}
-    RenderStageCache(const RenderStageCache&, const osg::CopyOp&) {}
+    _ephemerisCache = new EphemerisCache;
+    UTIL_MEMORY_CHECK( _ephemerisCache.get(), "SkyDomeContext EphemerisCache", );
+    if( cacheSettings != NULL )
+    {
+        _ephemerisCache->setStep( cacheSettings->getStep() );
+        _ephemerisCache->setWindow( cacheSettings->getWindow() );
+    }
 
-    META_Object(myLib,RenderStageCache);
+    _stateSet = new osg::StateSet;
+    UTIL_MEMORY_CHECK( _stateSet.get(), "SkyDomeContext StateSet", );
+
+    _orientation = new osg::Uniform( "celestialOrientation", osg::Matrix::identity() );
+    UTIL_MEMORY_CHECK( _orientation.get(), "SkyDomeContext orient uniform", );
+    _orientation->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _orientation.get() );
+    _up = new osg::Uniform( "up", osg::Vec3( 0., 0., 1. ) );
+    UTIL_MEMORY_CHECK( _up.get(), "SkyDomeContext up uniform", );
+    _up->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _up.get() );
+    _east = new osg::Uniform( "bdfx_east", osg::Vec3( 1., 0., 0. ) );
+    UTIL_MEMORY_CHECK( _east.get(), "SkyDomeContext east uniform", );
+    _east->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _east.get() );
+    _north = new osg::Uniform( "bdfx_north", osg::Vec3( 0., 1., 0. ) );
+    UTIL_MEMORY_CHECK( _north.get(), "SkyDomeContext north uniform", );
+    _north->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _north.get() );
+    _stateSet->addUniform( ld->getSunPositionUniform() );
+
+    // SunBody and MoonBody have their own position uniforms, shared
+    // by all views. Override them with this context's.
+    const unsigned int overrideMode( osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE );
+    _sunTransform = new osg::Uniform( "sunTransform", osg::Matrix::identity() );
+    UTIL_MEMORY_CHECK( _sunTransform.get(), "SkyDomeContext sun transform uniform", );
+    _sunTransform->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _sunTransform.get(), overrideMode );
+    _moonDirection0 = new osg::Uniform( "bdfx_moonDirection0", osg::Vec3( 0., -1., 0. ) );
+    UTIL_MEMORY_CHECK( _moonDirection0.get(), "SkyDomeContext moon direction uniform", );
+    _moonDirection0->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _moonDirection0.get(), overrideMode );
+    _moonDirection1 = new osg::Uniform( "bdfx_moonDirection1", osg::Vec3( 0., -1., 0. ) );
+    UTIL_MEMORY_CHECK( _moonDirection1.get(), "SkyDomeContext moon direction uniform", );
+    _moonDirection1->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _moonDirection1.get(), overrideMode );
+    _sunDirection0 = new osg::Uniform( "bdfx_sunDirection0", osg::Vec3( 0., 1., 0. ) );
+    UTIL_MEMORY_CHECK( _sunDirection0.get(), "SkyDomeContext sun direction uniform", );
+    _sunDirection0->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _sunDirection0.get(), overrideMode );
+    _sunDirection1 = new osg::Uniform( "bdfx_sunDirection1", osg::Vec3( 0., 1., 0. ) );
+    UTIL_MEMORY_CHECK( _sunDirection1.get(), "SkyDomeContext sun direction uniform", );
+    _sunDirection1->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _sunDirection1.get(), overrideMode );
+    _ephemerisFraction = new osg::Uniform( "bdfx_ephemerisFraction", 0.f );
+    UTIL_MEMORY_CHECK( _ephemerisFraction.get(), "SkyDomeContext ephemeris fraction uniform", );
+    _ephemerisFraction->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _ephemerisFraction.get(), overrideMode );
+    _planets = new osg::Uniform( osg::Uniform::FLOAT_VEC4, "bdfx_planets", EphemerisCache::NUM_PLANETS );
+    UTIL_MEMORY_CHECK( _planets.get(), "SkyDomeContext planets uniform", );
+    _planets->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _planets.get() );
+
+    _skyCacheStateSet = new osg::StateSet;
+    UTIL_MEMORY_CHECK( _skyCacheStateSet.get(), "SkyDomeContext sky cache StateSet", );
+    // The cube map changes if the sky cache resolution changes.
+    _skyCacheStateSet->setDataVariance( osg::Object::DYNAMIC );
+    osg::ref_ptr< osg::Uniform > cubeUniform( new osg::Uniform( "bdfx_skyCubeMap", 0 ) );
+    UTIL_MEMORY_CHECK( cubeUniform.get(), "SkyDomeContext sky cube map uniform", );
+    _skyCacheStateSet->addUniform( cubeUniform.get() );
+    createSkyCube( sd->getSkyCacheResolution() );
+
+    _locationCB = new LocationCB( sd, this );
+    UTIL_MEMORY_CHECK( _locationCB.get(), "SkyDomeContext LocationCB", );
+    ld->addCallback( _locationCB.get() );
+}
+void
+SkyDomeContext::computeSample( double mjd, bool useCache, EphemerisCache::Sample& sample )
+{
+    double latitude, longitude;
+    _locationData->getLatitudeLongitude( latitude, longitude );
+    if( useCache )
+        _ephemerisCache->getSample( mjd, latitude, longitude, sample );
+    else
+        _ephemerisCache->computeSample( mjd, latitude, longitude, sample );
+}
+SkyDomeContext::~SkyDomeContext()
+{
+    if( _locationData.valid() )
+        _locationData->removeCallback( _locationCB.get() );
+}
 
-    void setRenderStage( osgUtil::CullVisitor* cv, SkyDomeStage* rs)
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        _renderStageMap[cv] = rs;
-    }        
+void
+SkyDomeContext::createSkyCube( unsigned int size )
+{
+    _skyCube = new SkyCubeMap( size );
+    UTIL_MEMORY_CHECK( _skyCube.get(), "SkyDomeContext SkyCubeMap", );
+    _skyCacheStateSet->setTextureAttributeAndModes( 0, _skyCube->getTexture(), osg::StateAttribute::ON );
+}
 
-    SkyDomeStage* getRenderStage( osgUtil::CullVisitor* cv )
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-        return _renderStageMap[cv].get();
-    }
 
-    typedef std::map< osgUtil::CullVisitor*, osg::ref_ptr< SkyDomeStage > > RenderStageMap;
 
-    OpenThreads::Mutex  _mutex;
-    RenderStageMap      _renderStageMap;
-};
+typedef RenderStageCache< SkyDomeStage > SkyDomeStageCache;
+typedef RenderStageCache< SkyCubeStage > SkyCubeStageCache;
+typedef RenderStageCache< CloudStage > CloudStageCache;
 
 
 
@@ -197,6 +384,7 @@ public:
 const unsigned int SkyDome::RebuildDirty( 1 << 0 );
 const unsigned int SkyDome::LocationDataDirty( 1 << 1 );
 const unsigned int SkyDome::DebugDirty( 1 << 2 );
+const unsigned int SkyDome::DateTimeDirty( 1 << 3 );
 const unsigned int SkyDome::AllDirty( 0xffffffff );
 
 
@@ -210,8 +398,36 @@ SkyDome::SkyDome()
     _sunSub( 1 ),
     _moonScale( 1.f ),
     _moonSub( 1 ),
-    _enable( true )
+    _dateTimeThreshold( .25 ),
+    _ephemerisCacheEnable( true ),
+    _enable( true ),
+    _skyModel( SKY_GRADIENT ),
+    _starCatalogFileName( "bdfx-stars.cat" ),
+    _starMagnitudeLimit( 6.5f ),
+    _skyCacheEnable( false ),
+    _skyCacheResolution( 512 ),
+    _skyCacheThreshold( .1 ),
+    _cloudEnable( false ),
+    _cloudAltitude( 2000.f ),
+    _cloudTileSize( 10000.f ),
+    _cloudWindHeading( 90.f ),
+    _cloudWindSpeed( 10.f ),
+    _cloudDownsample( 4 ),
+    _cloudOffsetX( 0. ),
+    _cloudOffsetY( 0. )
 {
+    _atmosphere = new AtmosphereLUT;
+    UTIL_MEMORY_CHECK( _atmosphere.get(), "SkyDome AtmosphereLUT", );
+    _skyExposure = new osg::Uniform( "bdfx_skyExposure", 1.f );
+    UTIL_MEMORY_CHECK( _skyExposure.get(), "SkyDome sky exposure uniform", );
+    createCloudUniforms( .5f );
+
+    // The default context is updated starting with the first frame.
+    // Others are created as views that use them are culled.
+    _defaultContext = new SkyDomeContext( this, LocationData::s_instance(), NULL );
+    UTIL_MEMORY_CHECK( _defaultContext.get(), "SkyDome default context", );
+    _contexts[ LocationData::s_instance() ] = _defaultContext;
+
     // Disable culling -- we're always visible.
     setCullingActive( false );
 
@@ -219,9 +435,6 @@ SkyDome::SkyDome()
     _updateCB = new SkyDomeUpdateCB( this );
     UTIL_MEMORY_CHECK( _updateCB.get(), "SkyDomeUpdateCB", );
     setUpdateCallback( _updateCB.get() );
-
-    backdropFX::LocationData::s_instance()->getCallbackList().push_back(
-        new LocationCB( this ) );
 }
 
 SkyDome::SkyDome( const SkyDome& skydome, const osg::CopyOp& copyop )
@@ -235,10 +448,33 @@ SkyDome::SkyDome( const SkyDome& skydome, const osg::CopyOp& copyop )
     _sunSub( skydome._sunSub ),
     _moonScale( skydome._moonScale ),
     _moonSub( skydome._moonSub ),
-    _enable( skydome._enable )
+    _dateTimeThreshold( skydome._dateTimeThreshold ),
+    _ephemerisCacheEnable( skydome._ephemerisCacheEnable ),
+    _enable( skydome._enable ),
+    _skyModel( skydome._skyModel ),
+    _atmosphere( skydome._atmosphere ),
+    _starCatalogFileName( skydome._starCatalogFileName ),
+    _starMagnitudeLimit( skydome._starMagnitudeLimit ),
+    _skyCacheEnable( skydome._skyCacheEnable ),
+    _skyCacheResolution( skydome._skyCacheResolution ),
+    _skyCacheThreshold( skydome._skyCacheThreshold ),
+    _cloudEnable( skydome._cloudEnable ),
+    _cloudAltitude( skydome._cloudAltitude ),
+    _cloudTileSize( skydome._cloudTileSize ),
+    _cloudWindHeading( skydome._cloudWindHeading ),
+    _cloudWindSpeed( skydome._cloudWindSpeed ),
+    _cloudDownsample( skydome._cloudDownsample ),
+    _cloudOffsetX( skydome._cloudOffsetX ),
+    _cloudOffsetY( skydome._cloudOffsetY )
 {
-    backdropFX::LocationData::s_instance()->getCallbackList().push_back(
-        new LocationCB( this ) );
+    _skyExposure = new osg::Uniform( "bdfx_skyExposure", skydome.getSkyExposure() );
+    UTIL_MEMORY_CHECK( _skyExposure.get(), "SkyDome sky exposure uniform", );
+    createCloudUniforms( skydome.getCloudCoverage() );
+
+    _defaultContext = new SkyDomeContext( this, LocationData::s_instance(),
+        skydome.getEphemerisCache() );
+    UTIL_MEMORY_CHECK( _defaultContext.get(), "SkyDome default context", );
+    _contexts[ LocationData::s_instance() ] = _defaultContext;
 }
 
 SkyDome::~SkyDome()
@@ -248,12 +484,6 @@ SkyDome::~SkyDome()
 
 void SkyDome::setAutoAdvanceTime( bool advance, float scale )
 {
-    if( scale < 0.f )
-    {
-        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Negative time advance is not supported." << std::endl;
-        return;
-    }
-
     _timeAdvance = advance;
     _timeAdvanceScale = scale;
 }
@@ -358,6 +588,182 @@ SkyDome::useTexture( osg::TextureCubeMap* texture )
     _dirty |= RebuildDirty;
 }
 
+void
+SkyDome::setSkyModel( SkyModel skyModel )
+{
+    if( _skyModel != skyModel )
+    {
+        _skyModel = skyModel;
+        _dirty |= RebuildDirty;
+    }
+}
+void
+SkyDome::setAtmosphereCacheFileName( const std::string& fileName )
+{
+    _atmosphere->setCacheFileName( fileName );
+}
+const std::string&
+SkyDome::getAtmosphereCacheFileName() const
+{
+    return( _atmosphere->getCacheFileName() );
+}
+void
+SkyDome::setSkyExposure( float exposure )
+{
+    _skyExposure->set( exposure );
+    dirtySkyCaches();
+}
+float
+SkyDome::getSkyExposure() const
+{
+    float exposure;
+    _skyExposure->get( exposure );
+    return( exposure );
+}
+
+void
+SkyDome::setStarCatalogFileName( const std::string& fileName )
+{
+    if( _starCatalogFileName != fileName )
+    {
+        _starCatalogFileName = fileName;
+        _dirty |= RebuildDirty;
+    }
+}
+void
+SkyDome::setStarMagnitudeLimit( float magnitude )
+{
+    if( _starMagnitudeLimit == magnitude )
+        return;
+    _starMagnitudeLimit = magnitude;
+
+    // The catalog is sorted brightest first, so the stars to draw
+    // are a prefix of the vertex arrays, after the planets.
+    if( _starPrimitives.valid() )
+    {
+        _starPrimitives->setCount( EphemerisCache::NUM_PLANETS + ( _starCatalog.valid() ?
+            _starCatalog->getNumStarsBrighterThan( magnitude ) : 0 ) );
+        dirtySkyCaches();
+    }
+}
+unsigned int
+SkyDome::getNumStarsDrawn() const
+{
+    return( _starPrimitives.valid() ?
+        _starPrimitives->getCount() - EphemerisCache::NUM_PLANETS : 0 );
+}
+StarCatalog*
+SkyDome::getStarCatalog() const
+{
+    return( _starPrimitives.valid() ? _starCatalog.get() : NULL );
+}
+
+void
+SkyDome::setSkyCacheEnable( bool enable )
+{
+    if( _skyCacheEnable != enable )
+    {
+        _skyCacheEnable = enable;
+        // The cube maps weren't kept up to date while disabled.
+        if( enable )
+            dirtySkyCaches();
+    }
+}
+void
+SkyDome::setSkyCacheResolution( unsigned int size )
+{
+    if( size == 0 )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Sky cache resolution must be positive." << std::endl;
+        return;
+    }
+    if( _skyCacheResolution != size )
+    {
+        _skyCacheResolution = size;
+        _dirty |= RebuildDirty;
+    }
+}
+
+
+void
+SkyDome::createCloudUniforms( float coverage )
+{
+    _cloudCoverage = new osg::Uniform( "bdfx_cloudCoverage", coverage );
+    UTIL_MEMORY_CHECK( _cloudCoverage.get(), "SkyDome cloud coverage uniform", );
+    _cloudCoverage->setDataVariance( osg::Object::DYNAMIC );
+    _cloudHeight = new osg::Uniform( "bdfx_cloudHeight", _cloudAltitude / _cloudTileSize );
+    UTIL_MEMORY_CHECK( _cloudHeight.get(), "SkyDome cloud height uniform", );
+    _cloudHeight->setDataVariance( osg::Object::DYNAMIC );
+    _cloudOffset = new osg::Uniform( "bdfx_cloudOffset",
+        osg::Vec2( (float)_cloudOffsetX, (float)_cloudOffsetY ) );
+    UTIL_MEMORY_CHECK( _cloudOffset.get(), "SkyDome cloud offset uniform", );
+    _cloudOffset->setDataVariance( osg::Object::DYNAMIC );
+
+    _cloudStats = new CloudStats;
+    UTIL_MEMORY_CHECK( _cloudStats.get(), "SkyDome CloudStats", );
+}
+void
+SkyDome::setCloudCoverage( float coverage )
+{
+    _cloudCoverage->set( osg::clampBetween( coverage, 0.f, 1.f ) );
+}
+float
+SkyDome::getCloudCoverage() const
+{
+    float coverage;
+    _cloudCoverage->get( coverage );
+    return( coverage );
+}
+void
+SkyDome::setCloudAltitude( float altitude )
+{
+    if( altitude <= 0.f )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Cloud altitude must be positive." << std::endl;
+        return;
+    }
+    _cloudAltitude = altitude;
+    _cloudHeight->set( _cloudAltitude / _cloudTileSize );
+}
+void
+SkyDome::setCloudTileSize( float size )
+{
+    if( size <= 0.f )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Cloud tile size must be positive." << std::endl;
+        return;
+    }
+    _cloudTileSize = size;
+    _cloudHeight->set( _cloudAltitude / _cloudTileSize );
+}
+void
+SkyDome::setCloudWind( float heading, float speed )
+{
+    _cloudWindHeading = heading;
+    _cloudWindSpeed = speed;
+}
+void
+SkyDome::getCloudWind( float& heading, float& speed ) const
+{
+    heading = _cloudWindHeading;
+    speed = _cloudWindSpeed;
+}
+void
+SkyDome::setCloudDownsample( unsigned int downsample )
+{
+    if( downsample == 0 )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Cloud downsample must be positive." << std::endl;
+        return;
+    }
+    _cloudDownsample = downsample;
+}
+bool
+SkyDome::getCloudStats( unsigned int& frameNumber, unsigned int& pixels, double& gpuTime ) const
+{
+    return( _cloudStats->get( frameNumber, pixels, gpuTime ) );
+}
+
 
 
 void
@@ -365,10 +771,13 @@ SkyDome::rebuild()
 {
     osg::notify( osg::DEBUG_INFO ) << "backdropFX: SkyDome::rebuild: Enter" << std::endl;
 
-    // Delete everything.
+    // Delete everything. Keep the Moon until its replacement takes over
+    // its textures.
     removeChildren( 0, getNumChildren() );
     _sunBody = NULL;
+    osg::ref_ptr< backdropFX::MoonBody > previousMoon( _moonBody );
     _moonBody = NULL;
+    _starPrimitives = NULL;
 
 
     osg::ref_ptr< osg::Geode > geode( new osg::Geode );
@@ -411,33 +820,65 @@ SkyDome::rebuild()
         ss->setAttribute( program.get(), osg::StateAttribute::ON |
             osg::StateAttribute::PROTECTED );
 
-        _orientationUniform = new osg::Uniform( "celestialOrientation",
-            osg::Matrix::identity() );
-        UTIL_MEMORY_CHECK( _orientationUniform.get(), "SkyDome orient uniform", );
-        _orientationUniform->setDataVariance( osg::Object::DYNAMIC );
-        ss->addUniform( _orientationUniform.get() );
+        // The celestial orientation, up vector, and Sun position
+        // uniforms are per LocationData. See SkyDomeContext.
+    }
 
-        osg::Vec3 east, up;
-        backdropFX::LocationData::s_instance()->getEastUp( east, up );
-        up.normalize();
-        osg::notify( osg::DEBUG_INFO ) << "backdropFX: SkyDome::rebuild: up: " << up << std::endl;
-        osg::ref_ptr< osg::Uniform > uUp( new osg::Uniform( "up", up ) );
-        UTIL_MEMORY_CHECK( uUp.get(), "SkyDome up uniform", );
-        ss->addUniform( uUp.get() );
 
-        // Sun position vector
-        ss->addUniform( backdropFX::LocationData::s_instance()->getSunPositionUniform() );
+    bool scattering( _skyModel == SKY_SCATTERING );
+    if( scattering && !( _atmosphere->init() ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: SkyDome: Can't create atmosphere tables. Using SKY_GRADIENT." << std::endl;
+        scattering = false;
     }
 
+    if( scattering )
+    {
+        // Create the fullscreen scattering sky. Vertices are in normalized
+        // device coordinates; the Geode has culling disabled.
+        osg::notify( osg::DEBUG_INFO ) << "backdropFX: Making SkyDome scattering pass." << std::endl;
+        osg::ref_ptr< osg::Geometry > sky( createScreenQuad() );
+        UTIL_MEMORY_CHECK( sky.get(), "SkyDome scattering Geometry", );
+        geode->addDrawable( sky.get() );
+
+        osg::StateSet* ss = sky->getOrCreateStateSet();
+        UTIL_MEMORY_CHECK( ss, "SkyDome scattering StateSet", );
 
-    // Create the sky dome sphere.
-    osg::notify( osg::DEBUG_INFO ) << "backdropFX: Making SkyDome sphere with radius: " << _radius << std::endl;
-    osg::ref_ptr< osg::Geometry > dome( osgwTools::makeGeodesicSphere( _radius, 2 ) );
-    UTIL_MEMORY_CHECK( dome.get(), "SkyDome sphere", );
-    dome->setTexCoordArray( 0, NULL );
-    dome->setColorArray( NULL );
-    dome->setColorBinding( osg::Geometry::BIND_OFF );
-    geode->addDrawable( dome.get() );
+        osg::ref_ptr< osg::Shader > vertShader( osg::Shader::readShaderFile(
+            osg::Shader::VERTEX, osgDB::findDataFile( "shaders/skydomeScattering.vs" ) ) );
+        UTIL_MEMORY_CHECK( vertShader.get(), "SkyDome scattering vertex shader", );
+        osg::ref_ptr< osg::Shader > fragShader( osg::Shader::readShaderFile(
+            osg::Shader::FRAGMENT, osgDB::findDataFile( "shaders/skydomeScattering.fs" ) ) );
+        UTIL_MEMORY_CHECK( fragShader.get(), "SkyDome scattering fragment shader", );
+
+        osg::ref_ptr< osg::Program > program( new osg::Program() );
+        UTIL_MEMORY_CHECK( program.get(), "SkyDome scattering Program", );
+        program->addShader( vertShader.get() );
+        program->addShader( fragShader.get() );
+        ss->setAttribute( program.get(), osg::StateAttribute::ON |
+            osg::StateAttribute::PROTECTED );
+
+        ss->setTextureAttributeAndModes( 0, _atmosphere->getInscatterTexture(), osg::StateAttribute::ON );
+        osg::ref_ptr< osg::Uniform > mapUniform( new osg::Uniform( "bdfx_inscatterMap", 0 ) );
+        UTIL_MEMORY_CHECK( mapUniform.get(), "SkyDome inscatter map uniform", );
+        ss->addUniform( mapUniform.get() );
+        osg::ref_ptr< osg::Uniform > sizeUniform( new osg::Uniform( "bdfx_inscatterSize", osg::Vec3(
+            AtmosphereLUT::InscatterMuSize, AtmosphereLUT::InscatterMuSSize, AtmosphereLUT::InscatterNuSize ) ) );
+        UTIL_MEMORY_CHECK( sizeUniform.get(), "SkyDome inscatter size uniform", );
+        ss->addUniform( sizeUniform.get() );
+        ss->addUniform( _skyExposure.get() );
+    }
+    else
+    {
+        // Create the sky dome sphere.
+        osg::notify( osg::DEBUG_INFO ) << "backdropFX: Making SkyDome sphere with radius: " << _radius << std::endl;
+        osg::ref_ptr< osg::Geometry > dome( osgwTools::makeGeodesicSphere( _radius, 2 ) );
+        UTIL_MEMORY_CHECK( dome.get(), "SkyDome sphere", );
+        dome->setTexCoordArray( 0, NULL );
+        dome->setColorArray( NULL );
+        dome->setColorBinding( osg::Geometry::BIND_OFF );
+        geode->addDrawable( dome.get() );
+    }
 
 
     // Add the Sun
@@ -456,8 +897,18 @@ SkyDome::rebuild()
     if( _moonScale != 1.0 )
         _moonBody->setScale( _moonScale );
     _moonBody->setSubdivisions( _moonSub );
+    if( previousMoon.valid() )
+        _moonBody->shareTextures( *previousMoon );
+    previousMoon = NULL;
     geode->addDrawable( _moonBody.get() );
     _moonBody->update();
+    // Position the new Moon at the next update, for every context.
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::const_iterator it;
+        for( it=_contexts.begin(); it!=_contexts.end(); it++ )
+            it->second->_moonKeyMJD = -1.;
+    }
 
     {
         osg::StateSet* ss = _moonBody->getOrCreateStateSet();
@@ -470,7 +921,16 @@ SkyDome::rebuild()
     }
 
 
-    // TBD proto code for cloud cube map texture
+    // Add the stars and planets. After the Moon, which they need to
+    // find the Moon's angular size.
+    {
+        osg::ref_ptr< osg::Geometry > stars( createStars() );
+        if( stars.valid() )
+            geode->addDrawable( stars.get() );
+    }
+
+
+    // TBD proto code for cloud cube map texture. Deprecated; see useTexture().
     if( _texture != NULL )
     {
         osg::ref_ptr< osg::Geometry > clouds( osgwTools::makeGeodesicSphere( _radius, 2 ) );
@@ -514,6 +974,118 @@ SkyDome::rebuild()
     }
 
 
+    // Create the cloud passes. They aren't children; SkyDome culls
+    // them explicitly when clouds are enabled.
+    {
+        if( !( _cloudNoise.valid() ) )
+        {
+            _cloudNoise = new osg::Texture2D;
+            UTIL_MEMORY_CHECK( _cloudNoise.get(), "SkyDome cloud noise texture", );
+            AssetLoader::instance()->requestImage( _cloudNoise.get(), "noise.png" );
+            _cloudNoise->setWrap( osg::Texture::WRAP_S, osg::Texture::REPEAT );
+            _cloudNoise->setWrap( osg::Texture::WRAP_T, osg::Texture::REPEAT );
+            _cloudNoise->setUseHardwareMipMapGeneration( true );
+            _cloudNoise->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
+            _cloudNoise->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+        }
+
+        osg::ref_ptr< osg::Shader > vertShader( osg::Shader::readShaderFile(
+            osg::Shader::VERTEX, osgDB::findDataFile( "shaders/clouds.vs" ) ) );
+        UTIL_MEMORY_CHECK( vertShader.get(), "SkyDome cloud vertex shader", );
+
+        _cloudGeode = new osg::Geode;
+        UTIL_MEMORY_CHECK( _cloudGeode.get(), "SkyDome cloud Geode", );
+        _cloudGeode->setName( "SkyDome cloud Geode" );
+        _cloudGeode->setCullingActive( false );
+        osg::ref_ptr< osg::Geometry > quad( createScreenQuad() );
+        UTIL_MEMORY_CHECK( quad.get(), "SkyDome cloud Geometry", );
+        _cloudGeode->addDrawable( quad.get() );
+
+        osg::StateSet* ss = _cloudGeode->getOrCreateStateSet();
+        UTIL_MEMORY_CHECK( ss, "SkyDome cloud StateSet", );
+
+        osg::ref_ptr< osg::Shader > fragShader( osg::Shader::readShaderFile(
+            osg::Shader::FRAGMENT, osgDB::findDataFile( "shaders/clouds.fs" ) ) );
+        UTIL_MEMORY_CHECK( fragShader.get(), "SkyDome cloud fragment shader", );
+        osg::ref_ptr< osg::Program > program( new osg::Program() );
+        UTIL_MEMORY_CHECK( program.get(), "SkyDome cloud Program", );
+        program->addShader( vertShader.get() );
+        program->addShader( fragShader.get() );
+        ss->setAttribute( program.get(), osg::StateAttribute::ON |
+            osg::StateAttribute::PROTECTED );
+
+        ss->setTextureAttributeAndModes( 0, _cloudNoise.get(), osg::StateAttribute::ON );
+        osg::ref_ptr< osg::Uniform > noiseUniform( new osg::Uniform( "bdfx_cloudNoise", 0 ) );
+        UTIL_MEMORY_CHECK( noiseUniform.get(), "SkyDome cloud noise uniform", );
+        ss->addUniform( noiseUniform.get() );
+        ss->addUniform( _cloudCoverage.get() );
+        ss->addUniform( _cloudHeight.get() );
+        ss->addUniform( _cloudOffset.get() );
+
+
+        _cloudCompositeGeode = new osg::Geode;
+        UTIL_MEMORY_CHECK( _cloudCompositeGeode.get(), "SkyDome cloud composite Geode", );
+        _cloudCompositeGeode->setName( "SkyDome cloud composite Geode" );
+        _cloudCompositeGeode->setCullingActive( false );
+        quad = createScreenQuad();
+        UTIL_MEMORY_CHECK( quad.get(), "SkyDome cloud composite Geometry", );
+        _cloudCompositeGeode->addDrawable( quad.get() );
+
+        ss = _cloudCompositeGeode->getOrCreateStateSet();
+        UTIL_MEMORY_CHECK( ss, "SkyDome cloud composite StateSet", );
+
+        fragShader = osg::Shader::readShaderFile(
+            osg::Shader::FRAGMENT, osgDB::findDataFile( "shaders/cloudComposite.fs" ) );
+        UTIL_MEMORY_CHECK( fragShader.get(), "SkyDome cloud composite fragment shader", );
+        program = new osg::Program();
+        UTIL_MEMORY_CHECK( program.get(), "SkyDome cloud composite Program", );
+        program->addShader( vertShader.get() );
+        program->addShader( fragShader.get() );
+        ss->setAttribute( program.get(), osg::StateAttribute::ON |
+            osg::StateAttribute::PROTECTED );
+
+        // Premultiplied alpha. Draw after the sky, stars, Sun, and Moon.
+        osg::ref_ptr< osg::BlendFunc > bf( new osg::BlendFunc(
+            osg::BlendFunc::ONE, osg::BlendFunc::ONE_MINUS_SRC_ALPHA ) );
+        UTIL_MEMORY_CHECK( bf.get(), "SkyDome cloud composite BlendFunc", );
+        ss->setAttributeAndModes( bf.get(), osg::StateAttribute::ON |
+            osg::StateAttribute::PROTECTED );
+        ss->setRenderBinDetails( 10, "RenderBin" );
+        // The cloud texture and its size are per CloudStage.
+    }
+
+
+    // Create the sky cache pass. It isn't a child; SkyDome culls it
+    // explicitly when the sky cache is enabled.
+    {
+        _skyCacheGeode = new osg::Geode;
+        UTIL_MEMORY_CHECK( _skyCacheGeode.get(), "SkyDome sky cache Geode", );
+        _skyCacheGeode->setName( "SkyDome sky cache Geode" );
+        _skyCacheGeode->setCullingActive( false );
+        osg::ref_ptr< osg::Geometry > quad( createScreenQuad() );
+        UTIL_MEMORY_CHECK( quad.get(), "SkyDome sky cache Geometry", );
+        _skyCacheGeode->addDrawable( quad.get() );
+
+        osg::StateSet* ss = _skyCacheGeode->getOrCreateStateSet();
+        UTIL_MEMORY_CHECK( ss, "SkyDome sky cache StateSet", );
+
+        osg::ref_ptr< osg::Shader > vertShader( osg::Shader::readShaderFile(
+            osg::Shader::VERTEX, osgDB::findDataFile( "shaders/skydomeCube.vs" ) ) );
+        UTIL_MEMORY_CHECK( vertShader.get(), "SkyDome sky cache vertex shader", );
+        osg::ref_ptr< osg::Shader > fragShader( osg::Shader::readShaderFile(
+            osg::Shader::FRAGMENT, osgDB::findDataFile( "shaders/skydomeCube.fs" ) ) );
+        UTIL_MEMORY_CHECK( fragShader.get(), "SkyDome sky cache fragment shader", );
+
+        osg::ref_ptr< osg::Program > program( new osg::Program() );
+        UTIL_MEMORY_CHECK( program.get(), "SkyDome sky cache Program", );
+        program->addShader( vertShader.get() );
+        program->addShader( fragShader.get() );
+        ss->setAttribute( program.get(), osg::StateAttribute::ON |
+            osg::StateAttribute::PROTECTED );
+        // The cube map and its sampler uniform are per LocationData.
+    }
+
+
     // Cull callback to disable computation of near/far planes.
     if( _cullCB == NULL )
     {
@@ -527,29 +1099,230 @@ SkyDome::rebuild()
     // recreate the debug drawables.
     updateDebug();
 
+    // Reposition the new Sun and Moon, and every context's sky
+    // (the radius might have changed). Repositioning also marks
+    // the sky caches out of date.
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::const_iterator it;
+        for( it=_contexts.begin(); it!=_contexts.end(); it++ )
+        {
+            SkyDomeContext* ctx( it->second.get() );
+            ctx->_dirty |= LocationDataDirty;
+            if( ctx->_skyCube->getSize() != _skyCacheResolution )
+                ctx->createSkyCube( _skyCacheResolution );
+        }
+    }
+
     _dirty &= ~RebuildDirty;
 
     osg::notify( osg::DEBUG_INFO ) << "backdropFX: SkyDome::rebuild: numDrawables: " << geode->getNumDrawables() << std::endl;
 }
 
+SkyDomeContext*
+SkyDome::getContext( LocationData* locationData )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+    ContextMap::const_iterator it( _contexts.find( locationData ) );
+    // Compare the LocationData too, in case a deleted one's address was reused.
+    if( ( it != _contexts.end() ) && ( it->second->_locationData.get() == locationData ) )
+        return( it->second.get() );
+
+    // First lookup. Create and position the context now, so the view's
+    // first frame shows its own sky rather than the default one. Each
+    // context computes its ephemeris with its own EphemerisCache, and
+    // positioning executes no LocationData callbacks, so this is safe
+    // during cull. The lock serializes cull threads that look up the same
+    // LocationData.
+    osg::ref_ptr< SkyDomeContext > ctx( new SkyDomeContext( this, locationData, getEphemerisCache() ) );
+    UTIL_MEMORY_CHECK( ctx.get(), "SkyDome context", _defaultContext.get() );
+    _contexts[ locationData ] = ctx;
+    updateLocationData( ctx.get() );
+    return( ctx.get() );
+}
+
 void
-SkyDome::updateLocationData()
+SkyDome::addLocationData( LocationData* locationData )
 {
-    osgEphemeris::DateTime localDateTime(
-        backdropFX::LocationData::s_instance()->getDateTime() );
-    // TBD account for time zone.
-    //localDateTime.setHour( dateTime.getHour() - tz );
-    osg::notify( osg::INFO ) << "backdropFX: date/time: " <<
-        localDateTime.getYear() << "/" <<
-        localDateTime.getMonth() << "/" <<
-        localDateTime.getDayOfMonth() << " " <<
-        localDateTime.getHour() << ":" <<
-        localDateTime.getMinute() << ":" <<
-        localDateTime.getSecond() << std::endl;
+    if( !_defaultContext.valid() )
+        return;
 
-    // Position the Sun and Moon
-    setSunPosition( _sunBody.get(), localDateTime );
-    setMoonPosition( _moonBody.get(), localDateTime );
+    osg::ref_ptr< SkyDomeContext > ctx;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::const_iterator it( _contexts.find( locationData ) );
+        if( ( it != _contexts.end() ) && ( it->second->_locationData.get() == locationData ) )
+            return;
+
+        ctx = new SkyDomeContext( this, locationData, getEphemerisCache() );
+        UTIL_MEMORY_CHECK( ctx.get(), "SkyDome context", );
+        _contexts[ locationData ] = ctx;
+    }
+
+    // Position the sky now, so that the first frame is correct. Outside
+    // the lock, because this executes LocationData callbacks.
+    updateLocationData( ctx.get() );
+}
+
+void
+SkyDome::updateContexts( double seconds )
+{
+    // Work on a copy. Advancing time executes LocationData callbacks,
+    // which might call back into SkyDome.
+    std::vector< osg::ref_ptr< SkyDomeContext > > contexts;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::iterator it( _contexts.begin() );
+        while( it != _contexts.end() )
+        {
+            if( it->second->_locationData.valid() )
+                contexts.push_back( ( it++ )->second );
+            else
+                // The LocationData was deleted.
+                _contexts.erase( it++ );
+        }
+    }
+
+    std::vector< osg::ref_ptr< SkyDomeContext > >::const_iterator it;
+    for( it=contexts.begin(); it!=contexts.end(); it++ )
+    {
+        SkyDomeContext* ctx( it->get() );
+        if( ctx->_dirty != 0 )
+            updateLocationData( ctx );
+        advanceTime( ctx, seconds );
+    }
+}
+
+double
+SkyDome::getModifiedJulianDate( const LocationData* locationData ) const
+{
+    if( locationData == NULL )
+        locationData = LocationData::s_instance();
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+    ContextMap::const_iterator it( _contexts.find( locationData ) );
+    if( ( it == _contexts.end() ) || ( it->second->_locationData.get() != locationData ) )
+        return( 0. );
+    return( it->second->_simMJD );
+}
+
+EphemerisCache*
+SkyDome::getEphemerisCache() const
+{
+    return( _defaultContext->_ephemerisCache.get() );
+}
+
+void
+SkyDome::updateLocationData( SkyDomeContext* ctx )
+{
+    if( ctx->_dirty & DateTimeDirty )
+    {
+        // The app set the date and time. Restart the continuous clock there.
+        osgEphemeris::DateTime localDateTime( ctx->_locationData->getDateTime() );
+        // TBD account for time zone.
+        //localDateTime.setHour( dateTime.getHour() - tz );
+        osg::notify( osg::INFO ) << "backdropFX: date/time: " <<
+            localDateTime.getYear() << "/" <<
+            localDateTime.getMonth() << "/" <<
+            localDateTime.getDayOfMonth() << " " <<
+            localDateTime.getHour() << ":" <<
+            localDateTime.getMinute() << ":" <<
+            localDateTime.getSecond() << std::endl;
+        ctx->_simMJD = localDateTime.getModifiedJulianDate();
+    }
+    // The Moon position depends on location. Recompute the Moon keys.
+    ctx->_moonKeyMJD = -1.;
+
+    updateCelestial( ctx );
+
+    // Whatever LocationData holds now is current.
+    ctx->_publishedLST = ctx->_currentSample._lst;
+    ctx->_publishedMoonRA = ctx->_currentSample._moonRA;
+    ctx->_publishedMoonDec = ctx->_currentSample._moonDec;
+
+    updateSkyCache( ctx, true );
+
+    ctx->_dirty = 0;
+}
+
+void
+SkyDome::advanceTime( SkyDomeContext* ctx, double seconds )
+{
+    if( seconds == 0. )
+        return;
+    ctx->_simMJD += seconds / 86400.;
+    updateCelestial( ctx );
+    updateSkyCache( ctx, false );
+
+    // The sky is repositioned every frame. Publish the new date and time
+    // to LocationData (and trigger its callbacks) only when the sky has
+    // turned past the threshold since the last publication.
+    const EphemerisCache::Sample& sample( ctx->_currentSample );
+    if( skyAngle( sample, ctx->_publishedLST, ctx->_publishedMoonRA,
+            ctx->_publishedMoonDec ) < _dateTimeThreshold )
+        return;
+
+    ctx->_publishingDateTime = true;
+    ctx->_locationData->setDateTime( EphemerisCache::toDateTime( ctx->_simMJD ) );
+    ctx->_publishingDateTime = false;
+
+    ctx->_publishedLST = sample._lst;
+    ctx->_publishedMoonRA = sample._moonRA;
+    ctx->_publishedMoonDec = sample._moonDec;
+}
+
+void
+SkyDome::updateCelestial( SkyDomeContext* ctx )
+{
+    LocationData* ld( ctx->_locationData.get() );
+    const double mjd( ctx->_simMJD );
+    double latitude, longitude;
+    ld->getLatitudeLongitude( latitude, longitude );
+
+    // Get the Sun and Moon positions and local sidereal time, either
+    // interpolated from the cache or computed directly.
+    EphemerisCache::Sample& sample( ctx->_currentSample );
+    ctx->computeSample( mjd, _ephemerisCacheEnable, sample );
+
+    // Position the Sun for the views using this context.
+    osg::Matrix sunMatrix( SunBody::computeSunMatrix( sample._sunRA, sample._sunDec, _radius ) );
+    ctx->_sunTransform->set( sunMatrix );
+    ld->storeSunMatrix( sunMatrix );
+    const bool defaultContext( ( ld == LocationData::s_instance() ) && _sunBody.valid() );
+    if( defaultContext )
+        setSunPosition( _sunBody.get(), sample );
+
+    // The Moon shader interpolates the Moon and Sun directions between
+    // ephemeris samples at the start and end of the current minute, so
+    // the Moon uniforms change only once per simulated minute, except
+    // for the fraction.
+    const double keyMJD( floor( mjd * MinutesPerDay ) / MinutesPerDay );
+    if( keyMJD != ctx->_moonKeyMJD )
+    {
+        ctx->_moonKeyMJD = keyMJD;
+        EphemerisCache::Sample key0, key1;
+        ctx->computeSample( keyMJD, _ephemerisCacheEnable, key0 );
+        ctx->computeSample( keyMJD + 1. / MinutesPerDay, _ephemerisCacheEnable, key1 );
+        ctx->_moonDirection0->set( MoonBody::computeDirection( key0._moonRA, key0._moonDec ) );
+        ctx->_moonDirection1->set( MoonBody::computeDirection( key1._moonRA, key1._moonDec ) );
+        ctx->_sunDirection0->set( MoonBody::computeDirection( key0._sunRA, key0._sunDec ) );
+        ctx->_sunDirection1->set( MoonBody::computeDirection( key1._sunRA, key1._sunDec ) );
+
+        // The planets move less than ten arc seconds per minute.
+        unsigned int idx;
+        for( idx=0; idx<EphemerisCache::NUM_PLANETS; idx++ )
+        {
+            double ra, dec, magnitude;
+            EphemerisCache::computePlanet( (EphemerisCache::Planet)idx, keyMJD, ra, dec, magnitude );
+            const osg::Vec3 dir( MoonBody::computeDirection( ra, dec ) );
+            ctx->_planets->setElement( idx, osg::Vec4( dir, magnitude ) );
+        }
+
+        // The shared Moon drawable reports the default context's position.
+        if( defaultContext )
+            setMoonPosition( _moonBody.get(), key0 );
+    }
+    ctx->_ephemerisFraction->set( (float)( ( mjd - keyMJD ) * MinutesPerDay ) );
 
 
     // The default orientation of the celestial sphere is:
@@ -563,9 +1336,7 @@ SkyDome::updateLocationData()
     // Get ready to rotate the celestial sphere.
     // Get local orientation information.
     osg::Vec3 east, up;
-    backdropFX::LocationData::s_instance()->getEastUp( east, up );
-    double latitude, longitude;
-    backdropFX::LocationData::s_instance()->getLatitudeLongitude( latitude, longitude );
+    ld->getEastUp( east, up );
 
     // Rotate the celestial sphere.
     //   Part I: Rotate by latitude angle.
@@ -576,9 +1347,7 @@ SkyDome::updateLocationData()
 
     // Rotate the celestial sphere.
     //   Part II: Rotate by local sidereal time.
-    const double mjd( localDateTime.getModifiedJulianDate() );
-    const double lst( osgEphemeris::EphemerisEngine::getLocalSiderealTimePrecise( mjd, -longitude ) );
-    r = osg::Matrix::rotate( -lst / 12. * osg::PI, z );
+    r = osg::Matrix::rotate( -sample._lst / 12. * osg::PI, z );
     osg::Vec3 x( osg::Vec3( 1., 0., 0. ) * r );
     y = y * r;
 
@@ -599,13 +1368,146 @@ SkyDome::updateLocationData()
 
     // Store as Uniform for shader transformation.
     osg::Matrix m( orient * eastUp );
-    _orientationUniform->set( m );
+    ctx->_orientation->set( m );
+    ctx->_up->set( up );
+    ctx->_east->set( east );
+    ctx->_north->set( north );
 
-    // Store the celestial sphere matrix in the singleton LocationData.
+    // Store the celestial sphere matrix in the LocationData.
     // Used to compute Sun position (required for lighting, lens flare, etc).
-    backdropFX::LocationData::s_instance()->storeCelestialSphereMatrix( m );
+    ld->storeCelestialSphereMatrix( m );
+}
 
-    _dirty &= ~LocationDataDirty;
+osg::Geometry*
+SkyDome::createStars()
+{
+    // Without a catalog, the star field holds only the planets.
+    unsigned int numStars( 0 );
+    if( !( _starCatalogFileName.empty() ) )
+    {
+        if( !( _starCatalog.valid() ) )
+        {
+            _starCatalog = new StarCatalog;
+            UTIL_MEMORY_CHECK( _starCatalog.get(), "SkyDome StarCatalog", NULL );
+        }
+        if( _starCatalog->load( _starCatalogFileName ) )
+            numStars = _starCatalog->getNumStars();
+        else
+        {
+            osg::notify( osg::INFO ) << "backdropFX: SkyDome: No star catalog \"" <<
+                _starCatalogFileName << "\". Drawing no stars." << std::endl;
+            _starCatalog = NULL;
+        }
+    }
+    else
+        _starCatalog = NULL;
+    osg::notify( osg::DEBUG_INFO ) << "backdropFX: Making SkyDome star field with " << numStars << " stars." << std::endl;
+
+    // Copy the mapped catalog into the vertex arrays once. After that,
+    // the stars are static; they move only with the celestialOrientation
+    // uniform. The planets come first, so that they always draw. Their
+    // directions and magnitudes are per context uniforms (see
+    // updateCelestial()); their vertices hold only the radius, and texture
+    // coordinate p holds the planet index plus one (zero for stars).
+    const unsigned int numPlanets( EphemerisCache::NUM_PLANETS );
+    osg::ref_ptr< osg::Geometry > stars( new osg::Geometry );
+    UTIL_MEMORY_CHECK( stars.get(), "SkyDome star Geometry", NULL );
+    stars->setName( "SkyDome stars" );
+    osg::Vec3Array* v( new osg::Vec3Array( numPlanets + numStars ) );
+    UTIL_MEMORY_CHECK( v, "SkyDome star vertices", NULL );
+    osg::Vec3Array* tc( new osg::Vec3Array( numPlanets + numStars ) );
+    UTIL_MEMORY_CHECK( tc, "SkyDome star magnitudes", NULL );
+    // Just inside the dome.
+    const float radius( _radius * .99f );
+    unsigned int idx;
+    for( idx=0; idx<numPlanets; idx++ )
+    {
+        (*v)[ idx ].set( radius, 0.f, 0.f );
+        (*tc)[ idx ].set( 0.f, s_planetColorIndex[ idx ], (float)( idx + 1 ) );
+    }
+    if( numStars > 0 )
+    {
+        const StarCatalog::Star* star( _starCatalog->getStars() );
+        for( idx=numPlanets; idx<numPlanets+numStars; idx++, star++ )
+        {
+            (*v)[ idx ].set( star->_x * radius, star->_y * radius, star->_z * radius );
+            (*tc)[ idx ].set( star->_magnitude, star->_colorIndex, 0.f );
+        }
+    }
+    stars->setVertexArray( v );
+    stars->setTexCoordArray( 0, tc );
+    stars->setUseDisplayList( false );
+    stars->setUseVertexBufferObjects( true );
+    stars->setInitialBound( osg::BoundingBox( -radius, -radius, -radius, radius, radius, radius ) );
+
+    _starPrimitives = new osg::DrawArrays( GL_POINTS, 0, numPlanets + ( ( numStars > 0 ) ?
+        _starCatalog->getNumStarsBrighterThan( _starMagnitudeLimit ) : 0 ) );
+    UTIL_MEMORY_CHECK( _starPrimitives.get(), "SkyDome star DrawArrays", NULL );
+    stars->addPrimitiveSet( _starPrimitives.get() );
+
+    osg::StateSet* ss = stars->getOrCreateStateSet();
+    UTIL_MEMORY_CHECK( ss, "SkyDome star StateSet", NULL );
+
+    osg::ref_ptr< osg::Shader > vertShader( osg::Shader::readShaderFile(
+        osg::Shader::VERTEX, osgDB::findDataFile( "shaders/stars.vs" ) ) );
+    UTIL_MEMORY_CHECK( vertShader.get(), "SkyDome star vertex shader", NULL );
+    osg::ref_ptr< osg::Shader > fragShader( osg::Shader::readShaderFile(
+        osg::Shader::FRAGMENT, osgDB::findDataFile( "shaders/stars.fs" ) ) );
+    UTIL_MEMORY_CHECK( fragShader.get(), "SkyDome star fragment shader", NULL );
+
+    osg::ref_ptr< osg::Program > program( new osg::Program() );
+    UTIL_MEMORY_CHECK( program.get(), "SkyDome star Program", NULL );
+    program->addShader( vertShader.get() );
+    program->addShader( fragShader.get() );
+    ss->setAttribute( program.get(), osg::StateAttribute::ON |
+        osg::StateAttribute::PROTECTED );
+
+    osg::ref_ptr< osg::PointSprite > sprite( new osg::PointSprite );
+    UTIL_MEMORY_CHECK( sprite.get(), "SkyDome star PointSprite", NULL );
+    ss->setTextureAttributeAndModes( 0, sprite.get(), osg::StateAttribute::ON );
+    ss->setMode( GL_VERTEX_PROGRAM_POINT_SIZE, osg::StateAttribute::ON );
+
+    // The Moon is additive too, so neither draw order nor depth keeps the
+    // stars from showing through it. Instead, the vertex shader hides stars
+    // within the Moon's angular radius of the Moon direction.
+    const double moonSin( _moonBody->getRadius() * _moonBody->getScale() / _radius );
+    osg::ref_ptr< osg::Uniform > moonUniform( new osg::Uniform( "bdfx_moonCosRadius",
+        (float)sqrt( 1. - osg::minimum( moonSin * moonSin, 1. ) ) ) );
+    UTIL_MEMORY_CHECK( moonUniform.get(), "SkyDome star Moon radius uniform", NULL );
+    ss->addUniform( moonUniform.get() );
+
+    // Stars add to the sky behind them, so they draw after the dome
+    // (or scattering pass).
+    osg::ref_ptr< osg::BlendFunc > bf( new osg::BlendFunc( osg::BlendFunc::ONE, osg::BlendFunc::ONE ) );
+    UTIL_MEMORY_CHECK( bf.get(), "SkyDome star BlendFunc", NULL );
+    ss->setAttributeAndModes( bf.get(), osg::StateAttribute::ON |
+        osg::StateAttribute::PROTECTED );
+    ss->setRenderBinDetails( 1, "RenderBin" );
+
+    return( stars.release() );
+}
+
+void
+SkyDome::updateSkyCache( SkyDomeContext* ctx, bool force )
+{
+    const EphemerisCache::Sample& sample( ctx->_currentSample );
+    if( !force && ( skyAngle( sample, ctx->_cachedLST, ctx->_cachedMoonRA,
+            ctx->_cachedMoonDec ) < _skyCacheThreshold ) )
+        return;
+
+    ctx->_skyCube->dirty();
+    ctx->_cachedLST = sample._lst;
+    ctx->_cachedMoonRA = sample._moonRA;
+    ctx->_cachedMoonDec = sample._moonDec;
+}
+
+void
+SkyDome::dirtySkyCaches()
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+    ContextMap::const_iterator it;
+    for( it=_contexts.begin(); it!=_contexts.end(); it++ )
+        it->second->_skyCube->dirty();
 }
 
 void
@@ -745,39 +1647,15 @@ SkyDome::updateDebug()
 
 
 void
-SkyDome::setSunPosition( backdropFX::SunBody* sunBody, const osgEphemeris::DateTime& dateTime )
+SkyDome::setSunPosition( backdropFX::SunBody* sunBody, const EphemerisCache::Sample& sample )
 {
-    if( _cSun == NULL )
-    {
-        _cSun = new osgEphemeris::Sun;
-        UTIL_MEMORY_CHECK( _cSun.get(), "SkyDome", );
-    }
-
-    _cSun->updatePosition( dateTime.getModifiedJulianDate() );
-    double ra, dec;
-    _cSun->getPos( &ra, &dec );
-    sunBody->setRADecDistance( ra / osg::PI * 12.0,
-        osg::RadiansToDegrees( dec ), _radius );
+    sunBody->setRADecDistance( sample._sunRA, sample._sunDec, _radius );
 }
 void
-SkyDome::setMoonPosition( backdropFX::MoonBody* moonBody, const osgEphemeris::DateTime& dateTime )
+SkyDome::setMoonPosition( backdropFX::MoonBody* moonBody, const EphemerisCache::Sample& sample )
 {
-    if( _cMoon == NULL )
-    {
-        _cMoon = new osgEphemeris::Moon;
-        UTIL_MEMORY_CHECK( _cMoon.get(), "SkyDome", );
-    }
-
-    double latitude, longitude;
-    backdropFX::LocationData::s_instance()->getLatitudeLongitude( latitude, longitude );
-
-    const double mjd( dateTime.getModifiedJulianDate() );
-    const double lst( osgEphemeris::EphemerisEngine::getLocalSiderealTimePrecise( mjd, -longitude ) );
-    _cMoon->updatePosition( mjd, lst, latitude, _cSun.get() );
-    double ra, dec;
-    _cMoon->getPos( &ra, &dec );
-    moonBody->setRADecDistance( ra / osg::PI * 12.0,
-        osg::RadiansToDegrees( dec ), _radius );
+    moonBody->setRADecDistance( sample._moonRA, sample._moonDec, _radius );
+    moonBody->setSunRADec( sample._sunRA, sample._sunDec );
 }
 
 
@@ -797,12 +1675,6 @@ SkyDome::traverse( osg::NodeVisitor& nv )
     // BackdropCommon cull processing.
     processCull( cv );
 
-    // Get the updates view/proj UniformBundle.
-    // Push the StateSet (for this CullVisitor). It contains the
-    // updates viewProj matrix uniform.
-    UniformBundle* ub( updateViewProjUniforms( cv ) );
-    cv->pushStateSet( ub->first.get() );
-
 
     //
     // Basic idea of what follows was derived from CullVisitor::apply( Camera& ).
@@ -811,10 +1683,10 @@ SkyDome::traverse( osg::NodeVisitor& nv )
     osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
     osg::Camera* camera = previousStage->getCamera();
 
-    osg::ref_ptr< RenderStageCache > rsCache = dynamic_cast< RenderStageCache* >( getRenderingCache() );
+    osg::ref_ptr< SkyDomeStageCache > rsCache = dynamic_cast< SkyDomeStageCache* >( getRenderingCache() );
     if( !rsCache )
     {
-        rsCache = new RenderStageCache;
+        rsCache = new SkyDomeStageCache;
         UTIL_MEMORY_CHECK( rsCache, "SkyDome SkyDomeStage Cache", );
         setRenderingCache( rsCache.get() );
     }
@@ -834,6 +1706,18 @@ SkyDome::traverse( osg::NodeVisitor& nv )
     }
     sds->setEnable( getEnable() );
 
+    // Update the view/proj uniform owned by this CullVisitor's stage.
+    // Push the StateSet (for this CullVisitor). It contains the
+    // updated viewProj matrix uniform.
+    updateViewProjUniform( cv, sds->getViewProjUniform(), sds->getInvViewProjUniform() );
+    cv->pushStateSet( sds->getPerCullStateSet() );
+
+    // Push the sky for this view's location and time.
+    const osg::ref_ptr< LocationData > locationData( Manager::instance()->getLocationData( camera ) );
+    SkyDomeContext* ctx( getContext( locationData.get() ) );
+    if( ctx != NULL )
+        cv->pushStateSet( ctx->_stateSet.get() );
+
     sds->setViewport( cv->getCurrentCamera()->getViewport() );
     sds->setCamera( camera );
 
@@ -841,6 +1725,15 @@ SkyDome::traverse( osg::NodeVisitor& nv )
     //sds->setInheritedPositionalStateContainer( previousStage->getPositionalStateContainer() );
 
 
+    const bool skyCache( _skyCacheEnable && getEnable() &&
+        ( ctx != NULL ) && _skyCacheGeode.valid() );
+    if( skyCache )
+    {
+        // Render the sky into the cube map (if it's out of date) and draw
+        // this view's sky from it.
+        cullSkyCache( cv, ctx, sds.get() );
+    }
+    else
     {
         // Save RenderBin
         osgUtil::RenderBin* previousRenderBin = cv->getCurrentRenderBin();
@@ -853,12 +1746,142 @@ SkyDome::traverse( osg::NodeVisitor& nv )
         cv->setCurrentRenderBin( previousRenderBin );
     }
 
+    if( _cloudEnable && getEnable() && _cloudGeode.valid() )
+        cullClouds( cv, sds.get() );
+
 
     // Hook our RenderStage into the render graph.
     cv->getCurrentRenderBin()->getStage()->addPreRenderStage( sds.get(), camera->getRenderOrderNum() );
 
-    // Pop the StateSet (viewProj uniform)
+    // Pop the StateSets (location and time, and viewProj uniform)
+    if( ctx != NULL )
+        cv->popStateSet();
+    cv->popStateSet();
+}
+
+
+void
+SkyDome::cullSkyCache( osgUtil::CullVisitor* cv, SkyDomeContext* ctx, SkyDomeStage* sds )
+{
+    osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
+    osg::Camera* camera = previousStage->getCamera();
+
+    osg::ref_ptr< SkyCubeStageCache > rsCache = dynamic_cast< SkyCubeStageCache* >(
+        _skyCacheRenderingCache.get() );
+    if( !rsCache )
+    {
+        rsCache = new SkyCubeStageCache;
+        UTIL_MEMORY_CHECK( rsCache, "SkyDome SkyCubeStage Cache", );
+        _skyCacheRenderingCache = rsCache.get();
+    }
+
+    osg::ref_ptr< SkyCubeStage > scs = rsCache->getRenderStage( cv );
+    if( !scs )
+    {
+        scs = new SkyCubeStage( *previousStage );
+        UTIL_MEMORY_CHECK( scs, "SkyDome SkyCubeStage", );
+        rsCache->setRenderStage( cv, scs.get() );
+    }
+    else
+    {
+        // Reusing custom RenderStage. Reset it to clear previous cull's contents.
+        scs->reset();
+    }
+    scs->setSkyCubeMap( ctx->_skyCube.get() );
+    scs->setCamera( camera );
+    // Same near and far as updateViewProjUniform().
+    const double zFar( getRadius() * 1.2 );
+    scs->setNearFar( zFar / 2000., zFar );
+
+    // Every view culls the sky into its own SkyCubeStage; culling a few
+    // drawables is cheap. At draw time, only the first stage in each
+    // graphics context renders an out of date cube map.
+    osgUtil::RenderBin* previousRenderBin = cv->getCurrentRenderBin();
+    cv->pushStateSet( scs->getPerCullStateSet() );
+    cv->setCurrentRenderBin( scs.get() );
+    osg::Group::traverse( *cv );
+    cv->popStateSet();
+
+    // The view draws its sky from the cube map.
+    cv->pushStateSet( ctx->_skyCacheStateSet.get() );
+    cv->setCurrentRenderBin( sds );
+    _skyCacheGeode->accept( *cv );
     cv->popStateSet();
+
+    cv->setCurrentRenderBin( previousRenderBin );
+
+    // The cube map must be rendered before the SkyDomeStage, which
+    // SkyDome::traverse() adds next with the same order number.
+    previousStage->addPreRenderStage( scs.get(), camera->getRenderOrderNum() );
+}
+
+
+void
+SkyDome::updateClouds( double seconds )
+{
+    // Offset in noise tiles. The noise is periodic in whole tiles,
+    // so wrap the offset to keep float precision in the shader.
+    const double heading( osg::DegreesToRadians( (double)_cloudWindHeading ) );
+    const double distance( _cloudWindSpeed * seconds / _cloudTileSize );
+    _cloudOffsetX -= sin( heading ) * distance;
+    _cloudOffsetY -= cos( heading ) * distance;
+    _cloudOffsetX -= floor( _cloudOffsetX );
+    _cloudOffsetY -= floor( _cloudOffsetY );
+    _cloudOffset->set( osg::Vec2( (float)_cloudOffsetX, (float)_cloudOffsetY ) );
+}
+
+void
+SkyDome::cullClouds( osgUtil::CullVisitor* cv, SkyDomeStage* sds )
+{
+    const osg::Viewport* vp( cv->getCurrentCamera()->getViewport() );
+    if( vp == NULL )
+        return;
+
+    osgUtil::RenderStage* previousStage = cv->getCurrentRenderBin()->getStage();
+    osg::Camera* camera = previousStage->getCamera();
+
+    osg::ref_ptr< CloudStageCache > rsCache = dynamic_cast< CloudStageCache* >(
+        _cloudRenderingCache.get() );
+    if( !rsCache )
+    {
+        rsCache = new CloudStageCache;
+        UTIL_MEMORY_CHECK( rsCache, "SkyDome CloudStage Cache", );
+        _cloudRenderingCache = rsCache.get();
+    }
+
+    osg::ref_ptr< CloudStage > cs = rsCache->getRenderStage( cv );
+    if( !cs )
+    {
+        cs = new CloudStage( *previousStage );
+        UTIL_MEMORY_CHECK( cs, "SkyDome CloudStage", );
+        cs->setCloudStats( _cloudStats.get() );
+        rsCache->setRenderStage( cv, cs.get() );
+    }
+    else
+    {
+        // Reusing custom RenderStage. Reset it to clear previous cull's contents.
+        cs->reset();
+    }
+    cs->setCamera( camera );
+    cs->setSize( ( (unsigned int)( vp->width() ) + _cloudDownsample - 1 ) / _cloudDownsample,
+        ( (unsigned int)( vp->height() ) + _cloudDownsample - 1 ) / _cloudDownsample );
+
+    // The cloud pass renders at reduced resolution into the CloudStage,
+    // and the composite pass upsamples it over this view's sky.
+    osgUtil::RenderBin* previousRenderBin = cv->getCurrentRenderBin();
+    cv->setCurrentRenderBin( cs.get() );
+    _cloudGeode->accept( *cv );
+
+    cv->pushStateSet( cs->getCompositeStateSet() );
+    cv->setCurrentRenderBin( sds );
+    _cloudCompositeGeode->accept( *cv );
+    cv->popStateSet();
+
+    cv->setCurrentRenderBin( previousRenderBin );
+
+    // The clouds must be rendered before the SkyDomeStage, which
+    // SkyDome::traverse() adds next with the same order number.
+    previousStage->addPreRenderStage( cs.get(), camera->getRenderOrderNum() );
 }
 
 
@@ -867,6 +1890,17 @@ SkyDome::resizeGLObjectBuffers( unsigned int maxSize )
 {
     if( _renderingCache.valid() )
         const_cast< SkyDome* >( this )->_renderingCache->resizeGLObjectBuffers( maxSize );
+    if( _skyCacheRenderingCache.valid() )
+        _skyCacheRenderingCache->resizeGLObjectBuffers( maxSize );
+    if( _cloudRenderingCache.valid() )
+        _cloudRenderingCache->resizeGLObjectBuffers( maxSize );
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::const_iterator it;
+        for( it=_contexts.begin(); it!=_contexts.end(); it++ )
+            it->second->_skyCube->resizeGLObjectBuffers( maxSize );
+    }
+    _uniformLocations.resizeGLObjectBuffers( maxSize );
 
     osg::Group::resizeGLObjectBuffers(maxSize);
 }
@@ -876,32 +1910,26 @@ SkyDome::releaseGLObjects( osg::State* state ) const
 {
     if( _renderingCache.valid() )
         const_cast< SkyDome* >( this )->_renderingCache->releaseGLObjects( state );
+    if( _skyCacheRenderingCache.valid() )
+        _skyCacheRenderingCache->releaseGLObjects( state );
+    if( _cloudRenderingCache.valid() )
+        _cloudRenderingCache->releaseGLObjects( state );
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _contextLock );
+        ContextMap::const_iterator it;
+        for( it=_contexts.begin(); it!=_contexts.end(); it++ )
+            it->second->_skyCube->releaseGLObjects( state );
+    }
+    _uniformLocations.releaseGLObjects( state );
 
     osg::Group::releaseGLObjects(state);
 }
 
 
-SkyDome::UniformBundle*
-SkyDome::updateViewProjUniforms( osgUtil::CullVisitor* cv )
+void
+SkyDome::updateViewProjUniform( osgUtil::CullVisitor* cv, osg::Uniform* viewProj,
+    osg::Uniform* invViewProj )
 {
-    UniformBundle* ub;
-    {
-        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _stateSetMapLock );
-        StateSetPerCull::iterator it( _stateSetPerCull.find( cv ) );
-        if( it == _stateSetPerCull.end() )
-        {
-            ub = &( _stateSetPerCull[ cv ] );
-            ub->first = new osg::StateSet;
-            UTIL_MEMORY_CHECK( ub->first.get(), "SkyDome UniformBundle StateSet", ub );
-            ub->second = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "viewProj" );
-            UTIL_MEMORY_CHECK( ub->second, "SkyDome UniformBundle Uniform", ub );
-            ub->second->setDataVariance( osg::Object::DYNAMIC );
-            ub->first->addUniform( ub->second );
-        }
-        else
-            ub = &( it->second );
-    }
-
     // Set the matrices
     {
         // Create view matrix, discarding eye position.
@@ -921,10 +1949,10 @@ SkyDome::updateViewProjUniforms( osgUtil::CullVisitor* cv )
         top *= nearScale;
         proj = osg::Matrix::frustum( left, right, bottom, top, newNear, zfar );
 
-        ub->second->set( view * proj );
+        viewProj->set( view * proj );
+        if( invViewProj != NULL )
+            invViewProj->set( osg::Matrix::inverse( view * proj ) );
     }
-
-    return( ub );
 }
 
 
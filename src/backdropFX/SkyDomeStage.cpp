@@ -48,6 +48,20 @@ void
 SkyDomeStage::internalInit()
 {
     setClearMask( GL_DEPTH_BUFFER_BIT );
+
+    _stateSet = new osg::StateSet;
+    UTIL_MEMORY_CHECK( _stateSet.get(), "SkyDomeStage::internalInit StateSet", )
+
+    _viewProj = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "viewProj" );
+    UTIL_MEMORY_CHECK( _viewProj.get(), "SkyDomeStage::internalInit _viewProj", )
+    _viewProj->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _viewProj.get() );
+
+    // Used by the fullscreen SkyDome::SKY_SCATTERING pass.
+    _invViewProj = new osg::Uniform( osg::Uniform::FLOAT_MAT4, "invViewProj" );
+    UTIL_MEMORY_CHECK( _invViewProj.get(), "SkyDomeStage::internalInit _invViewProj", )
+    _invViewProj->setDataVariance( osg::Object::DYNAMIC );
+    _stateSet->addUniform( _invViewProj.get() );
 }
 
 
@@ -164,6 +178,22 @@ SkyDomeStage::setBackdropCommon( BackdropCommon* backdropCommon )
     _backdropCommon = backdropCommon;
 }
 
+osg::StateSet*
+SkyDomeStage::getPerCullStateSet()
+{
+    return( _stateSet.get() );
+}
+osg::Uniform*
+SkyDomeStage::getViewProjUniform()
+{
+    return( _viewProj.get() );
+}
+osg::Uniform*
+SkyDomeStage::getInvViewProjUniform()
+{
+    return( _invViewProj.get() );
+}
+
 std::string
 SkyDomeStage::createFileName( unsigned int contextID )
 {
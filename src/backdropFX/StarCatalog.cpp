@@ -0,0 +1,200 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/StarCatalog.h>
+#include <osgDB/FileUtils>
+#include <osg/Math>
+#include <osg/Notify>
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+namespace backdropFX
+{
+
+
+/** \cond */
+static const char CatalogMagic[ 8 ] = { 'B', 'D', 'F', 'X', 'S', 'T', 'R', 0 };
+static const unsigned int CatalogVersion( 1 );
+
+struct CatalogHeader
+{
+    char _magic[ 8 ];
+    unsigned int _version;
+    unsigned int _numStars;
+};
+
+static bool brighter( const StarCatalog::Star& a, const StarCatalog::Star& b )
+{
+    return( a._magnitude < b._magnitude );
+}
+static bool magnitudeLess( float magnitude, const StarCatalog::Star& star )
+{
+    return( magnitude < star._magnitude );
+}
+/** \endcond */
+
+
+
+StarCatalog::StarCatalog()
+  : _stars( NULL ),
+    _numStars( 0 ),
+    _mapAddress( NULL ),
+    _mapLength( 0 )
+#ifdef _WIN32
+    , _fileHandle( NULL ),
+    _mappingHandle( NULL )
+#endif
+{
+}
+StarCatalog::~StarCatalog()
+{
+    unload();
+}
+
+bool StarCatalog::load( const std::string& fileName )
+{
+    unload();
+
+    const std::string fullName( osgDB::findDataFile( fileName ) );
+    if( fullName.empty() )
+    {
+        osg::notify( osg::INFO ) << "backdropFX: StarCatalog: Can't find \"" << fileName << "\"." << std::endl;
+        return( false );
+    }
+
+#ifdef _WIN32
+    HANDLE file( CreateFileA( fullName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL ) );
+    if( file == INVALID_HANDLE_VALUE )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: Can't open \"" << fullName << "\"." << std::endl;
+        return( false );
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping( NULL );
+    if( GetFileSizeEx( file, &size ) && ( size.QuadPart >= (LONGLONG)sizeof( CatalogHeader ) ) )
+        mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+    if( mapping == NULL )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: Can't map \"" << fullName << "\"." << std::endl;
+        CloseHandle( file );
+        return( false );
+    }
+    _fileHandle = file;
+    _mappingHandle = mapping;
+    _mapLength = (size_t)( size.QuadPart );
+    _mapAddress = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+    const int fd( open( fullName.c_str(), O_RDONLY ) );
+    if( fd < 0 )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: Can't open \"" << fullName << "\"." << std::endl;
+        return( false );
+    }
+    struct stat st;
+    if( ( fstat( fd, &st ) == 0 ) && ( st.st_size >= (off_t)sizeof( CatalogHeader ) ) )
+    {
+        _mapLength = (size_t)( st.st_size );
+        _mapAddress = mmap( NULL, _mapLength, PROT_READ, MAP_SHARED, fd, 0 );
+        if( _mapAddress == MAP_FAILED )
+            _mapAddress = NULL;
+    }
+    // The mapping stays valid after the file is closed.
+    close( fd );
+#endif
+    if( _mapAddress == NULL )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: Can't map \"" << fullName << "\"." << std::endl;
+        unload();
+        return( false );
+    }
+
+    const CatalogHeader* header( (const CatalogHeader*)_mapAddress );
+    if( ( memcmp( header->_magic, CatalogMagic, sizeof( CatalogMagic ) ) != 0 ) ||
+        ( header->_version != CatalogVersion ) ||
+        ( _mapLength < sizeof( CatalogHeader ) + header->_numStars * sizeof( Star ) ) )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: \"" << fullName << "\" isn't a valid catalog." << std::endl;
+        unload();
+        return( false );
+    }
+
+    _numStars = header->_numStars;
+    _stars = (const Star*)( header + 1 );
+    return( true );
+}
+
+void StarCatalog::unload()
+{
+    _stars = NULL;
+    _numStars = 0;
+#ifdef _WIN32
+    if( _mapAddress != NULL )
+        UnmapViewOfFile( _mapAddress );
+    if( _mappingHandle != NULL )
+        CloseHandle( (HANDLE)_mappingHandle );
+    if( _fileHandle != NULL )
+        CloseHandle( (HANDLE)_fileHandle );
+    _mappingHandle = _fileHandle = NULL;
+#else
+    if( _mapAddress != NULL )
+        munmap( _mapAddress, _mapLength );
+#endif
+    _mapAddress = NULL;
+    _mapLength = 0;
+}
+
+unsigned int StarCatalog::getNumStarsBrighterThan( float magnitude ) const
+{
+    if( _stars == NULL )
+        return( 0 );
+    return( (unsigned int)( std::upper_bound( _stars, _stars + _numStars,
+        magnitude, magnitudeLess ) - _stars ) );
+}
+
+
+void StarCatalog::computeDirection( double ra, double dec, Star& star )
+{
+    const double raRad( ra / 12. * osg::PI );
+    const double decRad( osg::DegreesToRadians( dec ) );
+    star._x = (float)( cos( decRad ) * sin( raRad ) );
+    star._y = (float)( -cos( decRad ) * cos( raRad ) );
+    star._z = (float)( sin( decRad ) );
+}
+
+bool StarCatalog::write( const std::string& fileName, std::vector< Star >& stars )
+{
+    std::stable_sort( stars.begin(), stars.end(), brighter );
+
+    std::ofstream ostr( fileName.c_str(), std::ios_base::out | std::ios_base::binary );
+    if( !ostr.good() )
+    {
+        osg::notify( osg::WARN ) << "backdropFX: StarCatalog: Can't write \"" << fileName << "\"." << std::endl;
+        return( false );
+    }
+
+    CatalogHeader header;
+    memcpy( header._magic, CatalogMagic, sizeof( CatalogMagic ) );
+    header._version = CatalogVersion;
+    header._numStars = (unsigned int)( stars.size() );
+    ostr.write( (const char*)&header, sizeof( header ) );
+    if( !( stars.empty() ) )
+        ostr.write( (const char*)&( stars[ 0 ] ), stars.size() * sizeof( Star ) );
+    return( ostr.good() );
+}
+
+
+// namespace backdropFX
+}
@@ -7,8 +7,6 @@
 #include <osg/CullFace>
 #include <osg/Texture2D>
 
-#include <backdropFX/LocationData.h>
-
 #include <backdropFX/Utils.h>
 #include <osg/io_utils>
 
@@ -92,14 +90,7 @@ SunBody::setRADecDistance( float ra, float dec, float distance )
         _distance = distance;
         osg::notify( osg::INFO ) << "backdropFX: Sun " << _ra << "h " << dec << ", " << distance << std::endl;
 
-        double sunRotateZ = (12. - _ra) / -12. * osg::PI;
-        double sunRotateX = _dec / 180. * osg::PI;
-        osg::Matrix sunMatrix( osg::Matrix::translate( osg::Vec3( 0., _distance, 0. ) ) *
-            osg::Matrix::rotate( sunRotateX, osg::Vec3( 1., 0., 0. ) ) *
-            osg::Matrix::rotate( sunRotateZ, osg::Vec3( 0., 0., 1. ) ) );
-
-        // Set the LocationData singleton sun matrix.
-        backdropFX::LocationData::s_instance()->storeSunMatrix( sunMatrix );
+        osg::Matrix sunMatrix( computeSunMatrix( _ra, _dec, _distance ) );
 
         // Set the sunTransform uniform.
         if( _sunTransform == NULL )
@@ -111,6 +102,15 @@ SunBody::setRADecDistance( float ra, float dec, float distance )
         _sunTransform->set( sunMatrix );
     }
 }
+osg::Matrix
+SunBody::computeSunMatrix( float ra, float dec, float distance )
+{
+    double sunRotateZ = (12. - ra) / -12. * osg::PI;
+    double sunRotateX = dec / 180. * osg::PI;
+    return( osg::Matrix::translate( osg::Vec3( 0., distance, 0. ) ) *
+        osg::Matrix::rotate( sunRotateX, osg::Vec3( 1., 0., 0. ) ) *
+        osg::Matrix::rotate( sunRotateZ, osg::Vec3( 0., 0., 1. ) ) );
+}
 float
 SunBody::getRA() const
 {
@@ -2,10 +2,9 @@
 
 #include <backdropFX/SurfaceUtils.h>
 #include <backdropFX/ShaderModuleUtils.h>
+#include <backdropFX/AssetLoader.h>
 #include <backdropFX/Utils.h>
-#include <osgDB/ReadFile>
 #include <osgDB/FileUtils>
-#include <osg/Image>
 #include <osg/Texture2D>
 
 
@@ -23,29 +22,67 @@ namespace backdropFX
 #define BINORMAL_ATR_UNIT	7
 
 
+// Textures load on the AssetLoader thread. Attach an update callback
+// so that they arrive even if the node isn't under a SkyDome.
+static void addAssetLoaderCallback( osg::Node* node )
+{
+    osg::NodeCallback* cb( node->getUpdateCallback() );
+    while( cb != NULL )
+    {
+        if( dynamic_cast< AssetLoader::UpdateCallback* >( cb ) != NULL )
+            return;
+        cb = cb->getNestedCallback();
+    }
+    addUpdateCallback( *node, new AssetLoader::UpdateCallback );
+}
+
+// Requests \c fileName for a new texture, which samples \c placeholder
+// until the image arrives, rather than black.
+static osg::Texture2D* createSurfaceTexture( const std::string& fileName,
+    const osg::Vec4& placeholder, bool useContainer=true )
+{
+    osg::Texture2D* texture = new osg::Texture2D;
+    texture->setImage( AssetLoader::createPlaceholderImage( placeholder ) );
+    AssetLoader::instance()->requestImage( texture, fileName, 0, useContainer );
+    return( texture );
+}
+
+// The noise permutation table. The shaders look up exact texel values,
+// so never substitute a filtered or compressed container. Until it loads,
+// a constant table gives flat, untextured noise.
+static osg::Texture2D* createPermTexture()
+{
+    osg::Texture2D* permTexture = createSurfaceTexture( "permTexture.png",
+        osg::Vec4( .5f, .5f, .5f, .5f ), false );
+    permTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
+    permTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
+    return( permTexture );
+}
+
+
 void createConcrete( osg::Node* node )
 {
     if( node == NULL )
         return;
 
     osg::StateSet* stateSet = node->getOrCreateStateSet();
+    addAssetLoaderCallback( node );
 
-    osg::Image* concreteDarkenImage = osgDB::readImageFile( "ConcreteDarken.png" );
-    osg::Texture2D* darkenTexture = new osg::Texture2D( concreteDarkenImage );
+    // Until they load, the surface shows its unshaded base color and the
+    // noise normals: white doesn't darken, and a constant height is flat.
+    osg::Texture2D* darkenTexture = createSurfaceTexture( "ConcreteDarken.png",
+        osg::Vec4( 1.f, 1.f, 1.f, 1.f ) );
     darkenTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
     darkenTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
     stateSet->setTextureAttribute( TEXUNIT_DARK, darkenTexture );
 
-    osg::Image* concreteBumpImage   = osgDB::readImageFile( "ConcreteBump.png" );
-    osg::Texture2D* bumpTexture = new osg::Texture2D( concreteBumpImage );
+    osg::Texture2D* bumpTexture = createSurfaceTexture( "ConcreteBump.png",
+        osg::Vec4( .5f, .5f, .5f, 1.f ) );
     bumpTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
     bumpTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
     stateSet->setTextureAttribute( TEXUNIT_BUMP, bumpTexture );
 
-    osg::Image* permImage = osgDB::readImageFile( "permTexture.png" );
-    osg::Texture2D* permTexture = new osg::Texture2D( permImage );
-    permTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
-    permTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
+    osg::Texture2D* permTexture = createPermTexture();
     stateSet->setTextureAttribute( TEXUNIT_PERM, permTexture );
 
     stateSet->addUniform( new osg::Uniform("baseMap", TEXUNIT_DARK) );
@@ -106,11 +143,9 @@ void createDirt( osg::Node* node )
         return;
 
     osg::StateSet* stateSet = node->getOrCreateStateSet();
+    addAssetLoaderCallback( node );
 
-    osg::Image* permImage = osgDB::readImageFile( "permTexture.png" );
-    osg::Texture2D* permTexture = new osg::Texture2D( permImage );
-    permTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
-    permTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
+    osg::Texture2D* permTexture = createPermTexture();
     stateSet->setTextureAttribute( TEXUNIT_PERM, permTexture );
 
     stateSet->addUniform( new osg::Uniform( "permTexture", TEXUNIT_PERM ) );
@@ -172,11 +207,9 @@ void createGrass( osg::Node* node )
         return;
 
     osg::StateSet* stateSet = node->getOrCreateStateSet();
+    addAssetLoaderCallback( node );
 
-    osg::Image* permImage = osgDB::readImageFile( "permTexture.png" );
-    osg::Texture2D* permTexture = new osg::Texture2D( permImage );
-    permTexture->setWrap( osg::Texture2D::WRAP_S, osg::Texture2D::REPEAT );
-    permTexture->setWrap( osg::Texture2D::WRAP_T, osg::Texture2D::REPEAT );
+    osg::Texture2D* permTexture = createPermTexture();
     stateSet->setTextureAttribute( TEXUNIT_PERM, permTexture );
 
     stateSet->addUniform( new osg::Uniform( "permTexture", TEXUNIT_PERM) );
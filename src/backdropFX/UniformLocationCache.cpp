@@ -0,0 +1,88 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/UniformLocationCache.h>
+#include <backdropFX/Utils.h>
+
+
+namespace backdropFX
+{
+
+
+UniformLocationCache::UniformLocationCache()
+{
+}
+UniformLocationCache::~UniformLocationCache()
+{
+}
+
+void
+UniformLocationCache::applyProgram( osg::State& state, const osg::Program* program )
+{
+    const unsigned int contextID( state.getContextID() );
+    const osg::Program::PerContextProgram* pcp( program->getPCP( contextID ) );
+    if( ( pcp != NULL ) && pcp->needsLink() && ( contextID < _bindings.size() ) )
+    {
+        // Program::apply() links it, and the locations can move.
+        BindingVector& bindings( _bindings[ contextID ] );
+        BindingVector::iterator it;
+        for( it = bindings.begin(); it != bindings.end(); it++ )
+        {
+            if( it->_pcp.get() == pcp )
+                *it = Binding();
+        }
+    }
+    state.applyAttribute( program );
+}
+
+GLint
+UniformLocationCache::getLocation( osg::State& state, unsigned int slot, const osg::Uniform* uniform )
+{
+    const osg::Program::PerContextProgram* pcp( state.getLastAppliedProgramObject() );
+    if( pcp == NULL )
+        return( -1 );
+
+    BindingVector& bindings( _bindings[ state.getContextID() ] );
+    if( slot >= bindings.size() )
+        bindings.resize( slot + 1 );
+
+    Binding& binding( bindings[ slot ] );
+    if( ( binding._pcp.get() != pcp ) || ( binding._uniform.get() != uniform ) )
+    {
+        // The program links when it's applied, so its locations are final
+        // until applyProgram() sees it relink.
+        binding._pcp = pcp;
+        binding._uniform = uniform;
+#if OSG_SUPPORTS_UNIFORM_ID
+        binding._location = pcp->getUniformLocation( uniform->getNameID() );
+#else
+        binding._location = pcp->getUniformLocation( uniform->getName() );
+#endif
+    }
+    return( binding._location );
+}
+
+void
+UniformLocationCache::resizeGLObjectBuffers( unsigned int maxSize )
+{
+    _bindings.resize( maxSize );
+}
+
+void
+UniformLocationCache::releaseGLObjects( osg::State* state ) const
+{
+    if( state != NULL )
+    {
+        if( state->getContextID() < _bindings.size() )
+            _bindings[ state->getContextID() ].clear();
+    }
+    else
+    {
+        unsigned int idx;
+        for( idx = 0; idx < _bindings.size(); idx++ )
+            _bindings[ idx ].clear();
+    }
+}
+
+
+// namespace backdropFX
+}
@@ -222,6 +222,19 @@ std::string elementName( const std::string& prefix, int element, const std::stri
     return( ostr.str() );
 }
 
+void addUpdateCallback( osg::Node& node, osg::NodeCallback* cb )
+{
+#if OSG_SUPPORTS_ADD_UPDATE_CALLBACK
+    node.addUpdateCallback( cb );
+#else
+    osg::NodeCallback* nodecb( node.getUpdateCallback() );
+    if( nodecb == NULL )
+        node.setUpdateCallback( cb );
+    else
+        nodecb->addNestedCallback( cb );
+#endif
+}
+
 
 // namespace backdropFX
 }
@@ -0,0 +1,235 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Geode>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/RenderingEffects.h>
+#include <backdropFX/EffectLibrary.h>
+#include <backdropFX/GaussianKernel.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+
+
+// Checks computeGaussianKernel() over a range of sigmas and tap limits: the
+// weights of the center tap and both sides of the other taps sum to 1, a
+// kernel that fits takes 1 + ceil( ceil( 3 sigma ) / 2 ) taps at spacing 1,
+// and a kernel that doesn't fit takes exactly maxTaps spread taps.
+void
+testKernels( testUtils::Results& results )
+{
+    unsigned int maxTaps;
+    for( maxTaps=2; maxTaps<=backdropFX::GaussianKernel::MaxTaps; maxTaps++ )
+    {
+        float sigma;
+        for( sigma=.5f; sigma<=20.f; sigma+=.25f )
+        {
+            std::vector< osg::Vec2 > kernel;
+            const float spacing( backdropFX::computeGaussianKernel( sigma, maxTaps, kernel ) );
+
+            float sum( 0.f );
+            unsigned int idx;
+            for( idx=0; idx<kernel.size(); idx++ )
+                sum += ( idx == 0 ) ? kernel[ idx ].y() : 2.f * kernel[ idx ].y();
+
+            const unsigned int radius( (unsigned int)( ceilf( 3.f * sigma ) ) );
+            const unsigned int expected( 1 + ( radius + 1 ) / 2 );
+            const bool fits( expected <= maxTaps );
+            if( ( fabsf( sum - 1.f ) > 1e-5f ) ||
+                ( kernel.size() != ( fits ? expected : maxTaps ) ) ||
+                ( fits ? ( spacing != 1.f ) : ( spacing <= 1.f ) ) )
+                results.fail() << "sigma " << sigma << ", max taps " << maxTaps << ": " <<
+                    kernel.size() << " taps (expected " << ( fits ? expected : maxTaps ) <<
+                    "), spacing " << spacing << ", weights sum to " << sum << "." << std::endl;
+        }
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " checks the Gaussian kernels, then times chained GaussConvolution blurs at several sigmas." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "--width <width>", "Window width. Default: 1920." );
+    usage->addCommandLineOption( "--height <height>", "Window height. Default: 1080." );
+    usage->addCommandLineOption( "-s <sigma>", "Sigma, in texels, to time. Repeatable. Default: 1, 2, 4, 8, and 16." );
+    usage->addCommandLineOption( "-m <n>", "Maximum taps per pass. Default: 8." );
+    usage->addCommandLineOption( "-n <n>", "Chained blurs per frame. Default: 4." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 200." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    unsigned int width( 1920 ), height( 1080 );
+    arguments.read( "--width", width );
+    arguments.read( "--height", height );
+    unsigned int numFrames( 200 );
+    arguments.read( "-f", numFrames );
+    unsigned int numBlurs( 4 );
+    arguments.read( "-n", numBlurs );
+    unsigned int maxTaps( 8 );
+    arguments.read( "-m", maxTaps );
+    std::vector< float > sigmas;
+    float sigma;
+    while( arguments.read( "-s", sigma ) )
+        sigmas.push_back( sigma );
+    if( sigmas.empty() )
+    {
+        sigmas.push_back( 1.f );
+        sigmas.push_back( 2.f );
+        sigmas.push_back( 4.f );
+        sigmas.push_back( 8.f );
+        sigmas.push_back( 16.f );
+    }
+    if( numBlurs < 1 )
+        numBlurs = 1;
+
+    testUtils::Results results;
+    testKernels( results );
+    std::cout << "Kernels: " << ( results.passed() ? "PASS" : "FAIL" ) << std::endl;
+
+
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    root->addChild( new osg::Geode );
+
+    backdropFX::Manager* mgr( backdropFX::Manager::instance() );
+    mgr->setSceneData( root.get() );
+    mgr->setTextureWidthHeight( width, height );
+    mgr->rebuild( backdropFX::Manager::skyDome );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 20, 30, width, height );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix(
+        osg::Matrix::perspective( 35., (double)width/(double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( mgr->getManagedRoot() );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+
+    backdropFX::RenderingEffects& rfx( mgr->getRenderingEffects() );
+    rfx.setEffectSet( 0 );
+    const double withoutBlur( testUtils::timeFrames( viewer, numFrames ) );
+    std::cout << "No blur: " << withoutBlur << " ms/frame." << std::endl;
+
+    // A chain of full resolution blurs, each reading the previous output.
+    backdropFX::EffectVector& ev( rfx.getEffectVector() );
+    std::vector< backdropFX::GaussConvolution* > blurs;
+    unsigned int idx;
+    for( idx=0; idx<numBlurs; idx++ )
+    {
+        backdropFX::GaussConvolution* blur( new backdropFX::GaussConvolution );
+        blur->setName( "GaussConvolution" );
+        blur->getKernel()->setMaxTaps( maxTaps );
+        if( ev.empty() )
+            blur->addInput( 0, mgr->getColorBufferA() );
+        else
+            ev.back()->attachOutputTo( blur, 0 );
+        blur->setTextureWidthHeight( width, height );
+        ev.push_back( blur );
+        blurs.push_back( blur );
+    }
+
+    const double passPixels( (double)width * (double)height * 2. * numBlurs );
+    for( idx=0; idx<sigmas.size(); idx++ )
+    {
+        unsigned int bdx;
+        for( bdx=0; bdx<blurs.size(); bdx++ )
+            blurs[ bdx ]->setSigma( sigmas[ idx ] );
+        const double withBlur( testUtils::timeFrames( viewer, numFrames ) );
+        const double cost( withBlur - withoutBlur );
+
+        const backdropFX::GaussianKernel* kernel( blurs[ 0 ]->getKernel() );
+        const unsigned int discrete( 2 * (unsigned int)( ceilf( 3.f * sigmas[ idx ] ) ) + 1 );
+        std::cout << "Sigma " << sigmas[ idx ] << ": " << kernel->getNumTaps() << " taps, " <<
+            kernel->getNumFetches() << " fetches/pixel (" << discrete << " discrete), spacing " <<
+            kernel->getSpacing() << " texels, " << withBlur << " ms/frame, " <<
+            cost / ( 2. * numBlurs ) << " ms/pass";
+        if( cost > 0. )
+            std::cout << ", " << passPixels * kernel->getNumFetches() / ( cost * 1.e6 ) << " Gfetches/s";
+        std::cout << "." << std::endl;
+    }
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page blurbenchtest Test: blurbench
+
+The purpose of this test is to measure the fill-rate cost of each
+GaussianKernel program variant, as used by GaussConvolution.
+
+First, the test checks computeGaussianKernel() for sigmas from 0.5 to 20
+and every tap limit: the weights must sum to 1, a kernel that fits its tap
+limit must take 1 + ceil( ceil( 3 sigma ) / 2 ) taps at spacing 1.0, and a
+wider kernel must take exactly the tap limit, spread. These checks need no
+window, and decide the test's result; the timings that follow only inform.
+
+Then it opens a window, prints the average frame time without effects, then
+chains several full resolution GaussConvolution Effects and times them at
+each sigma. For each sigma, it prints the kernel's taps per pass, the texture
+fetches per pixel per pass (and the count a discrete kernel of the same
+radius would need), the tap spacing, the frame time, the cost per pass, and
+the resulting texture fetch rate. A spacing above 1.0 means the kernel hit the
+tap limit (-m) and spread its taps. The warm-up frames before each sigma let
+the new program variant compile outside the timed frames. See \ref testutils
+for how frames are timed and checks reported.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>--width <width> --height <height></b></td>
+    <td>Window size. Default: 1920 1080.</td>
+  </tr>
+  <tr>
+    <td><b>-s <sigma></b></td>
+    <td>Sigma, in texels, to time. Repeat to time several. Default: 1, 2, 4, 8, and 16.</td>
+  </tr>
+  <tr>
+    <td><b>-m <n></b></td>
+    <td>Maximum taps per pass (see GaussianKernel::setMaxTaps()). Default: 8.</td>
+  </tr>
+  <tr>
+    <td><b>-n <n></b></td>
+    <td>Number of chained blurs per frame. Default: 4.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time for each sigma. Default: 200.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}
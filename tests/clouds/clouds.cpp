@@ -0,0 +1,217 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Geode>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/SkyDome.h>
+#include <backdropFX/LocationData.h>
+#include <backdropFX/AssetLoader.h>
+#include <backdropFX/CloudStage.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <vector>
+
+
+
+// Averages the cloud GPU time that SkyDome::getCloudStats() reports for
+// each timed frame. The warm-up frames let the timer queries start returning.
+class CloudTimeCallback : public testUtils::FrameCallback
+{
+public:
+    CloudTimeCallback()
+      : _gpuSum( 0. ),
+        _gpuCount( 0 ),
+        _lastFrame( 0 )
+    {}
+
+    virtual void operator()( osgViewer::Viewer& )
+    {
+        backdropFX::SkyDome& sd = backdropFX::Manager::instance()->getSkyDome();
+        unsigned int frameNumber, pixels;
+        double gpuTime;
+        if( sd.getCloudStats( frameNumber, pixels, gpuTime ) &&
+            ( frameNumber != _lastFrame ) && ( gpuTime >= 0. ) )
+        {
+            _gpuSum += gpuTime;
+            _gpuCount++;
+            _lastFrame = frameNumber;
+        }
+    }
+
+    // Average cloud GPU time, or a negative value if it isn't available.
+    double getCloudTime() const
+    {
+        return( ( _gpuCount > 0 ) ? _gpuSum / _gpuCount : -1. );
+    }
+
+protected:
+    double _gpuSum;
+    unsigned int _gpuCount, _lastFrame;
+};
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " times the SkyDome cloud layer at several downsample factors." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "-c <coverage>", "Cloud coverage, 0.0 to 1.0. Default: 0.5." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 500." );
+    usage->addCommandLineOption( "-d <n>", "Downsample to time. Repeatable. Default: 1, 2, 4, and 8." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    float coverage( .5f );
+    arguments.read( "-c", coverage );
+    unsigned int numFrames( 500 );
+    arguments.read( "-f", numFrames );
+    std::vector< unsigned int > downsamples;
+    unsigned int downsample;
+    while( arguments.read( "-d", downsample ) )
+        downsamples.push_back( downsample );
+    if( downsamples.empty() )
+    {
+        downsamples.push_back( 1 );
+        downsamples.push_back( 2 );
+        downsamples.push_back( 4 );
+        downsamples.push_back( 8 );
+    }
+
+
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    root->addChild( new osg::Geode );
+
+    const unsigned int width( 800 ), height( 600 );
+    backdropFX::Manager::instance()->setSceneData( root.get() );
+    backdropFX::Manager::instance()->setTextureWidthHeight( width, height );
+    backdropFX::SkyDome& sd = backdropFX::Manager::instance()->getSkyDome();
+    sd.setCloudCoverage( coverage );
+    sd.setCloudWind( 45.f, 40.f );
+    backdropFX::Manager::instance()->rebuild( backdropFX::Manager::skyDome );
+
+    // Mid-morning.
+    backdropFX::LocationData::s_instance()->setDateTime( osgEphemeris::DateTime( 2011, 6, 21, 16, 0, 0 ) );
+    backdropFX::LocationData::s_instance()->setLatitudeLongitude( 39.86, -104.68 );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 30, 30, width, height );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix(
+        osg::Matrix::perspective( 60., (double)width/(double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( backdropFX::Manager::instance()->getManagedRoot() );
+    // Look toward the horizon, where the clouds are densest.
+    viewer.getCamera()->setViewMatrixAsLookAt( osg::Vec3( 0., 0., 0. ),
+        osg::Vec3( 0., 1., .3 ), osg::Vec3( 0., 0., 1. ) );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+
+    // Render with the noise texture loaded.
+    backdropFX::AssetLoader::instance()->flush();
+
+    sd.setCloudEnable( false );
+    const double withoutClouds( testUtils::timeFrames( viewer, numFrames ) );
+    std::cout << "No clouds: " << withoutClouds << " ms/frame." << std::endl;
+
+    sd.setCloudEnable( true );
+    testUtils::Results results;
+    unsigned int idx;
+    for( idx=0; idx<downsamples.size(); idx++ )
+    {
+        const unsigned int d( downsamples[ idx ] );
+        sd.setCloudDownsample( d );
+        CloudTimeCallback cloudTimeCB;
+        const double withClouds( testUtils::timeFrames( viewer, numFrames, &cloudTimeCB ) );
+        const double cloudTime( cloudTimeCB.getCloudTime() );
+
+        unsigned int frameNumber( 0 ), pixels( 0 );
+        double gpuTime;
+        const bool measured( sd.getCloudStats( frameNumber, pixels, gpuTime ) );
+        std::cout << "Downsample " << d << ": " << pixels << " cloud pixels, " <<
+            withClouds << " ms/frame, cost " << withClouds - withoutClouds << " ms/frame";
+        if( cloudTime >= 0. )
+            std::cout << ", cloud pass GPU time " << cloudTime << " ms";
+        std::cout << "." << std::endl;
+
+        // One view, so the pixel count is the reduced viewport size. The
+        // statistics must keep up with the frames, however many timer
+        // queries are in flight.
+        const unsigned int expectedPixels( ( ( width + d - 1 ) / d ) * ( ( height + d - 1 ) / d ) );
+        const unsigned int currentFrame( viewer.getFrameStamp()->getFrameNumber() );
+        if( !measured || ( pixels != expectedPixels ) ||
+            ( frameNumber + backdropFX::CloudStats::MaxFrames + 1 < currentFrame ) )
+            results.fail() << "expected " << expectedPixels << " pixels at a frame after " <<
+                currentFrame - backdropFX::CloudStats::MaxFrames - 1 << ", got " << pixels <<
+                " at frame " << frameNumber << "." << std::endl;
+    }
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page cloudstest Test: clouds
+
+The purpose of this test is to measure the per-frame cost of the SkyDome cloud
+layer at different downsample factors (see SkyDome::setCloudDownsample()).
+
+The test opens a window looking toward the horizon on a summer morning, and
+prints the average frame time without clouds, then with clouds at each
+downsample factor. For each factor, it also prints the number of pixels that ran
+the cloud shader and, if GL_EXT_timer_query is supported, the average GPU time
+of the reduced resolution cloud pass, as reported by SkyDome::getCloudStats().
+The GPU time is the average over every timed frame whose statistics arrived,
+so it excludes the full resolution composite.
+
+The test checks that the reported pixel count matches the reduced viewport
+size, and that the reported frame is within CloudStats::MaxFrames of the
+current frame, so that the statistics keep up however many timer queries are
+in flight. See \ref testutils for how frames are timed and checks reported.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-c <coverage></b></td>
+    <td>Cloud coverage, from 0.0 to 1.0 (see SkyDome::setCloudCoverage()). Default: 0.5.</td>
+  </tr>
+  <tr>
+    <td><b>-d <n></b></td>
+    <td>Downsample factor to time. Repeat to time several. Default: 1, 2, 4, and 8.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time for each configuration. Default: 500.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __BACKDROPFX_TEST_UTILS_H__
+#define __BACKDROPFX_TEST_UTILS_H__ 1
+
+#include <osgViewer/Viewer>
+#include <osg/Stats>
+#include <osg/Timer>
+
+#include <iostream>
+#include <string>
+
+
+namespace testUtils
+{
+
+
+/** Called after each timed frame, for tests that gather their own
+per-frame statistics while timeFrames() runs. */
+class FrameCallback
+{
+public:
+    virtual ~FrameCallback() {}
+    virtual void operator()( osgViewer::Viewer& viewer ) = 0;
+};
+
+/** Frames rendered before timing starts, so that programs compile,
+textures are allocated, and caches fill before the clock runs. */
+const unsigned int WarmUpFrames( 10 );
+
+/** Renders WarmUpFrames frames, then \c numFrames timed frames, calling
+\c cb after each timed frame. Returns the average milliseconds per timed
+frame, or 0.0 if the viewer was closed before any frame was timed. */
+inline double
+timeFrames( osgViewer::Viewer& viewer, unsigned int numFrames, FrameCallback* cb=NULL )
+{
+    unsigned int idx;
+    for( idx=0; ( idx<WarmUpFrames ) && !viewer.done(); idx++ )
+        viewer.frame();
+
+    osg::Timer timer;
+    timer.setStartTick();
+    for( idx=0; ( idx<numFrames ) && !viewer.done(); idx++ )
+    {
+        viewer.frame();
+        if( cb != NULL )
+            (*cb)( viewer );
+    }
+    return( ( idx > 0 ) ? timer.time_m() / idx : 0. );
+}
+
+/** As timeFrames(), but returns the average CPU draw traversal time of
+the master Camera from the viewer statistics: the time the draw thread
+spends issuing GL calls, not the time the GPU spends executing them.
+Returns 0.0 if the statistics aren't available. */
+inline double
+timeDrawTraversal( osgViewer::Viewer& viewer, unsigned int numFrames )
+{
+    unsigned int idx;
+    for( idx=0; ( idx<WarmUpFrames ) && !viewer.done(); idx++ )
+        viewer.frame();
+
+    osg::Stats* stats( viewer.getCamera()->getStats() );
+    const unsigned int first( viewer.getFrameStamp()->getFrameNumber() + 1 );
+    for( idx=0; ( idx<numFrames ) && !viewer.done(); idx++ )
+        viewer.frame();
+    const unsigned int last( viewer.getFrameStamp()->getFrameNumber() );
+
+    double seconds( 0. );
+    if( ( stats == NULL ) || ( last < first ) ||
+        !( stats->getAveragedAttribute( first, last, "Draw traversal time taken", seconds ) ) )
+        return( 0. );
+    return( seconds * 1000. );
+}
+
+
+/** \class testUtils::Results TestUtils.h
+
+\brief Collects the checks of a test and reports the outcome.
+
+Each failed check prints a line starting with "  FAIL: ". report() prints
+PASS or FAIL, and returns the exit code for main(). */
+class Results
+{
+public:
+    Results()
+      : _pass( true )
+    {}
+
+    /** Records a failed check. Returns std::cout, after the "  FAIL: "
+    prefix, for the description. */
+    std::ostream& fail()
+    {
+        _pass = false;
+        return( std::cout << "  FAIL: " );
+    }
+
+    /** Records a failed check with \c message unless \c ok. Returns \c ok. */
+    bool check( bool ok, const std::string& message )
+    {
+        if( !ok )
+            fail() << message << std::endl;
+        return( ok );
+    }
+
+    /** Prints the cost \c ms of \c name, and fails if it exceeds
+    \c budget milliseconds. A \c budget of 0.0 or less only prints. */
+    bool checkBudget( const std::string& name, double ms, double budget )
+    {
+        std::cout << name << ": " << ms << " ms";
+        if( budget <= 0. )
+        {
+            std::cout << "." << std::endl;
+            return( true );
+        }
+        std::cout << ", budget " << budget << " ms." << std::endl;
+        return( check( ms <= budget, name + " exceeded its budget" ) );
+    }
+
+    bool passed() const { return( _pass ); }
+
+    /** Prints PASS or FAIL. Returns 0 if every check passed, 1 otherwise. */
+    int report() const
+    {
+        std::cout << ( _pass ? "PASS" : "FAIL" ) << std::endl;
+        return( _pass ? 0 : 1 );
+    }
+
+protected:
+    bool _pass;
+};
+
+
+// namespace testUtils
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page testutils Test Utilities
+
+The benchmark tests (\ref blurbenchtest "blurbench", \ref cloudstest "clouds",
+\ref effectdrawtest "effectdraw", \ref effectrestest "effectres",
+\ref shadowbench "shadowbench", \ref starfieldtest "starfield", and
+\ref tonemaptest "tonemap") share tests/common/TestUtils.h. The
+\ref locationdatatest "locationdata" test uses only its check reporting.
+
+testUtils::timeFrames() renders testUtils::WarmUpFrames frames before it
+starts the clock, then averages the wall clock time of the timed frames.
+The average includes waiting for vertical sync, so run the benchmarks with
+OSG_SYNC_TO_VBLANK=OFF. testUtils::timeDrawTraversal() averages the CPU draw
+traversal time from the viewer statistics instead.
+
+testUtils::Results collects each test's checks. A failed check prints a
+line starting with "FAIL:". At exit, the test prints PASS or FAIL, and
+returns 0 or 1 accordingly, so a script or CTest can run it. Budgets that a
+test asserts are checked with testUtils::Results::checkBudget().
+
+*/
+
+
+// backdropFX
+}
+
+
+// __BACKDROPFX_TEST_UTILS_H__
+#endif
@@ -0,0 +1,176 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Geode>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/RenderingEffects.h>
+#include <backdropFX/EffectGraph.h>
+#include <backdropFX/Effect.h>
+#include <backdropFX/EffectLibraryUtils.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <sstream>
+
+
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " measures the CPU draw cost of a chain of pass-through Effects." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "-n <n>", "Effects in the chain. Default: 64." );
+    usage->addCommandLineOption( "-u <n>", "Extra uniforms per Effect. Default: 4." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 500." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    unsigned int numEffects( 64 );
+    arguments.read( "-n", numEffects );
+    unsigned int numUniforms( 4 );
+    arguments.read( "-u", numUniforms );
+    unsigned int numFrames( 500 );
+    arguments.read( "-f", numFrames );
+    if( numEffects < 1 )
+        numEffects = 1;
+
+    // Small textures, so fill rate doesn't hide the CPU cost.
+    const unsigned int size( 64 );
+
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    root->addChild( new osg::Geode );
+
+    backdropFX::Manager* mgr( backdropFX::Manager::instance() );
+    mgr->setSceneData( root.get() );
+    mgr->setTextureWidthHeight( size, size );
+    mgr->rebuild( 0 );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 20, 30, size, size );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( mgr->getManagedRoot() );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+    viewer.getCamera()->getStats()->collectStats( "rendering", true );
+
+    backdropFX::RenderingEffects& rfx( mgr->getRenderingEffects() );
+    rfx.setEffectSet( 0 );
+    const double without( testUtils::timeDrawTraversal( viewer, numFrames ) );
+    std::cout << "No Effects: " << without << " ms draw/frame." << std::endl;
+
+    // A chain of pass-through Effects, each with a few uniforms the program
+    // doesn't use, as well as the inputs and texturePercent it does.
+    osg::ref_ptr< osg::Program > program( backdropFX::createEffectProgram( "none" ) );
+    backdropFX::EffectVector& ev( rfx.getEffectVector() );
+    unsigned int idx;
+    for( idx=0; idx<numEffects; idx++ )
+    {
+        backdropFX::Effect* effect( new backdropFX::Effect );
+        effect->setName( "Effect" );
+        effect->setProgram( program.get() );
+        unsigned int udx;
+        for( udx=0; udx<numUniforms; udx++ )
+        {
+            std::ostringstream ostr;
+            ostr << "effectDrawUniform" << udx;
+            effect->getUniforms().push_back( new osg::Uniform( ostr.str().c_str(), (float)udx ) );
+        }
+        if( ev.empty() )
+            effect->addInput( 0, mgr->getColorBufferA() );
+        else
+            ev.back()->attachOutputTo( effect, 0 );
+        effect->setTextureWidthHeight( size, size );
+        ev.push_back( effect );
+    }
+
+    const double with( testUtils::timeDrawTraversal( viewer, numFrames ) );
+    std::cout << numEffects << " Effects: " << with << " ms draw/frame, " <<
+        ( with - without ) * 1000. / numEffects << " us draw/Effect." << std::endl;
+
+    // Every Effect draws one pass, and nothing fuses. The transient outputs
+    // between them alternate between two textures.
+    const backdropFX::EffectGraph* graph( rfx.getEffectGraph() );
+    const unsigned int expectedTextures( ( numEffects > 2 ) ? 2 : numEffects - 1 );
+    testUtils::Results results;
+    if( ( graph->getNumDrawnNodes() != numEffects ) ||
+        ( graph->getNumDrawnPasses() != numEffects ) ||
+        ( graph->getNumAllocatedTextures() != expectedTextures ) )
+        results.fail() << "drew " << graph->getNumDrawnNodes() << " Effects in " <<
+            graph->getNumDrawnPasses() << " passes with " << graph->getNumAllocatedTextures() <<
+            " textures, expected " << numEffects << ", " << numEffects << ", and " <<
+            expectedTextures << "." << std::endl;
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page effectdrawtest Test: effectdraw
+
+The purpose of this test is to measure the CPU cost of drawing an Effect:
+binding its FBO, program, textures, and uniforms, and issuing the draw.
+
+The test opens a small window and collects OSG rendering stats. It prints
+the average draw traversal time with no Effects, then chains many
+pass-through Effects, each with a few extra uniforms, and prints the draw
+traversal time again, along with the cost per Effect. The textures are
+64x64, so the GPU time is negligible and the numbers reflect the work the
+draw thread does per Effect, such as finding uniform locations (see
+UniformLocationCache).
+
+The times come from testUtils::timeDrawTraversal(), so vertical sync doesn't
+affect them. For repeatable numbers without a GPU driver in the way, run the
+test on a Mesa software context, for example with LIBGL_ALWAYS_SOFTWARE=1.
+
+The test checks that the EffectGraph draws each Effect once, in one pass,
+and that the chain's intermediate outputs share two textures, so the per
+Effect cost isn't hiding extra passes or allocations. See \ref testutils for
+how checks are reported.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-n <n></b></td>
+    <td>Number of chained Effects. Default: 64.</td>
+  </tr>
+  <tr>
+    <td><b>-u <n></b></td>
+    <td>Extra uniforms per Effect. Default: 4.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time. Default: 500.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}
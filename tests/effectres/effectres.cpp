@@ -0,0 +1,280 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osgDB/ReadFile>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Camera>
+#include <osg/Image>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/RenderingEffects.h>
+#include <backdropFX/Effect.h>
+#include <backdropFX/EffectLibrary.h>
+#include <backdropFX/ShaderModuleVisitor.h>
+#include <backdropFX/ShaderModuleUtils.h>
+#include <osgwTools/ReadFile.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+
+
+/** \cond */
+// Reads back the framebuffer after the frame draws, when armed.
+class CaptureCallback : public osg::Camera::DrawCallback
+{
+public:
+    CaptureCallback()
+      : _armed( false )
+    {}
+
+    void arm( osg::Image* image )
+    {
+        _image = image;
+        _armed = true;
+    }
+
+    virtual void operator()( osg::RenderInfo& renderInfo ) const
+    {
+        if( !_armed )
+            return;
+        const osg::Viewport* vp( renderInfo.getCurrentCamera()->getViewport() );
+        _image->readPixels( (int)( vp->x() ), (int)( vp->y() ),
+            (int)( vp->width() ), (int)( vp->height() ), GL_RGB, GL_UNSIGNED_BYTE );
+        _armed = false;
+    }
+
+protected:
+    ~CaptureCallback() {}
+
+    mutable osg::ref_ptr< osg::Image > _image;
+    mutable bool _armed;
+};
+/** \endcond */
+
+
+// Peak signal to noise ratio, in dB, of two RGB images of the same size.
+// Returns a negative value if the images are identical or don't match.
+double
+psnr( const osg::Image* lhs, const osg::Image* rhs )
+{
+    if( ( lhs->s() != rhs->s() ) || ( lhs->t() != rhs->t() ) || ( lhs->s() == 0 ) )
+        return( -1. );
+
+    const unsigned int size( lhs->s() * lhs->t() * 3 );
+    const unsigned char* lhsData( lhs->data() );
+    const unsigned char* rhsData( rhs->data() );
+    double sum( 0. );
+    unsigned int idx;
+    for( idx=0; idx<size; idx++ )
+    {
+        const double diff( (double)( lhsData[ idx ] ) - (double)( rhsData[ idx ] ) );
+        sum += diff * diff;
+    }
+    if( sum == 0. )
+        return( -1. );
+    return( 10. * log10( 255. * 255. / ( sum / size ) ) );
+}
+
+void
+setResolution( float resolution )
+{
+    backdropFX::EffectVector& ev( backdropFX::Manager::instance()->getRenderingEffects().getEffectVector() );
+    backdropFX::Effect* effect;
+    if( ( effect = backdropFX::getEffect( "EffectImprovedGlow", ev ) ) != NULL )
+        static_cast< backdropFX::EffectImprovedGlow* >( effect )->setResolution( resolution );
+    if( ( effect = backdropFX::getEffect( "EffectDOF", ev ) ) != NULL )
+        static_cast< backdropFX::EffectDOF* >( effect )->setResolution( resolution );
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " times glow and depth of field at reduced resolutions, and compares each image with full resolution." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options] [<model> ...]" );
+    usage->addCommandLineOption( "--width <width>", "Window width. Default: 1920." );
+    usage->addCommandLineOption( "--height <height>", "Window height. Default: 1080." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 200." );
+    usage->addCommandLineOption( "-r <res>", "Effect resolution to time. Repeatable. Default: 1.0, 0.5, and 0.25." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    unsigned int width( 1920 ), height( 1080 );
+    arguments.read( "--width", width );
+    arguments.read( "--height", height );
+    unsigned int numFrames( 200 );
+    arguments.read( "-f", numFrames );
+    std::vector< float > resolutions;
+    float resolution;
+    while( arguments.read( "-r", resolution ) )
+        resolutions.push_back( resolution );
+    if( resolutions.empty() )
+    {
+        resolutions.push_back( 1.f );
+        resolutions.push_back( .5f );
+        resolutions.push_back( .25f );
+    }
+
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    osg::Node* loadedModels( osgDB::readNodeFiles( arguments ) );
+    if( loadedModels == NULL )
+        loadedModels = osgwTools::readNodeFiles( "teapot.osg.(10,0,0).trans cow.osg" );
+    if( loadedModels != NULL )
+        root->addChild( loadedModels );
+    {
+        backdropFX::ShaderModuleVisitor smv;
+        smv.setAttachMain( false );
+        smv.setAttachTransform( false );
+        backdropFX::convertFFPToShaderModules( root.get(), &smv );
+    }
+
+    backdropFX::Manager::instance()->setSceneData( root.get() );
+    backdropFX::Manager::instance()->rebuild(
+        backdropFX::Manager::skyDome | backdropFX::Manager::depthPeel );
+    backdropFX::Manager::instance()->setTextureWidthHeight( width, height );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 20, 30, width, height );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix(
+        osg::Matrix::perspective( 35., (double)width/(double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( backdropFX::Manager::instance()->getManagedRoot() );
+    osg::ref_ptr< CaptureCallback > capture( new CaptureCallback );
+    viewer.getCamera()->setFinalDrawCallback( capture.get() );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+    // A fixed view, so the captured images are comparable.
+    viewer.getCamera()->setViewMatrixAsLookAt( osg::Vec3( 5., -40., 5. ),
+        osg::Vec3( 5., 0., 0. ), osg::Vec3( 0., 0., 1. ) );
+
+    backdropFX::RenderingEffects& rfx( backdropFX::Manager::instance()->getRenderingEffects() );
+    rfx.setEffectSet( 0 );
+    const double withoutEffects( testUtils::timeFrames( viewer, numFrames ) );
+    std::cout << "No effects: " << withoutEffects << " ms/frame." << std::endl;
+
+    rfx.setEffectSet( backdropFX::RenderingEffects::effectGlow | backdropFX::RenderingEffects::effectDOF );
+    backdropFX::EffectVector& ev( rfx.getEffectVector() );
+    backdropFX::Effect* effect( backdropFX::getEffect( "EffectImprovedGlow", ev ) );
+    if( effect != NULL )
+        // Make everything glow, so the glow blur has work to show.
+        static_cast< backdropFX::EffectImprovedGlow* >( effect )->setDefaultGlowColor(
+            osg::Vec4f( .3f, .3f, .3f, 1.f ) );
+
+    // Reference image at full resolution.
+    osg::ref_ptr< osg::Image > reference( new osg::Image );
+    setResolution( 1.f );
+    // Warm up only, so the effects have compiled before the capture.
+    testUtils::timeFrames( viewer, 0 );
+    capture->arm( reference.get() );
+    viewer.frame();
+
+    testUtils::Results results;
+    if( ( reference->s() != (int)width ) || ( reference->t() != (int)height ) )
+        results.fail() << "reference image is " << reference->s() << "x" << reference->t() << "." << std::endl;
+
+    unsigned int idx;
+    for( idx=0; idx<resolutions.size(); idx++ )
+    {
+        setResolution( resolutions[ idx ] );
+        const double withEffects( testUtils::timeFrames( viewer, numFrames ) );
+
+        osg::ref_ptr< osg::Image > image( new osg::Image );
+        capture->arm( image.get() );
+        viewer.frame();
+        const double quality( psnr( reference.get(), image.get() ) );
+
+        std::cout << "Resolution " << resolutions[ idx ] << ": blur pixels " <<
+            resolutions[ idx ] * resolutions[ idx ] * 100. << "% of full, " <<
+            withEffects << " ms/frame, glow+DOF cost " << withEffects - withoutEffects << " ms/frame, ";
+        if( quality < 0. )
+            std::cout << "identical to full resolution." << std::endl;
+        else
+            std::cout << "PSNR " << quality << " dB against full resolution." << std::endl;
+
+        // The image must cover the whole window, and full resolution must
+        // reproduce the reference up to sky motion between the frames.
+        if( ( image->s() != reference->s() ) || ( image->t() != reference->t() ) )
+            results.fail() << "image is " << image->s() << "x" << image->t() << "." << std::endl;
+        else if( ( resolutions[ idx ] == 1.f ) && ( quality >= 0. ) && ( quality < 50. ) )
+            results.fail() << "full resolution differs from the reference, PSNR " <<
+                quality << " dB." << std::endl;
+    }
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page effectrestest Test: effectres
+
+The purpose of this test is to measure the cost and the quality of running
+the glow and depth of field blurs at reduced resolution (see
+EffectImprovedGlow::setResolution() and EffectDOF::setResolution()).
+
+The test opens a window with a fixed view, and prints the average frame time
+without effects, then with glow and depth of field at each resolution. For
+each resolution, it also prints the fraction of blur pixels shaded, and the
+peak signal to noise ratio of the final image against the full resolution
+image, as a quality measure. Higher is closer; above about 35 dB the
+difference is hard to see. Run at 3840x2160 (--width 3840 --height 2160)
+to see the 4K savings. Each captured frame follows the timed frames for its
+resolution, so the comparison sees the same warmed up render targets that were
+timed.
+
+The test checks that every captured image covers the window, and that
+resolution 1.0 reproduces the reference image (50 dB or better, allowing for
+sky motion between frames). See \ref testutils for how frames are timed and
+checks reported.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b><model> ...</b></td>
+    <td>Models to load. Default: a teapot and a cow.</td>
+  </tr>
+  <tr>
+    <td><b>--width <width> --height <height></b></td>
+    <td>Window size. Default: 1920 1080.</td>
+  </tr>
+  <tr>
+    <td><b>-r <res></b></td>
+    <td>Effect resolution to time. Repeat to time several. Default: 1.0, 0.5, and 0.25.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time for each configuration. Default: 200.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}
@@ -0,0 +1,273 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/EphemerisCache.h>
+#include <osgEphemeris/DateTime.h>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Vec3d>
+#include <osg/Math>
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+
+
+// Angle in arc seconds between two positions given as RA (hours), Dec (degrees).
+double
+separation( double ra0, double dec0, double ra1, double dec1 )
+{
+    const double r0( ra0 / 12. * osg::PI ), d0( osg::DegreesToRadians( dec0 ) );
+    const double r1( ra1 / 12. * osg::PI ), d1( osg::DegreesToRadians( dec1 ) );
+    const osg::Vec3d v0( cos( d0 ) * cos( r0 ), cos( d0 ) * sin( r0 ), sin( d0 ) );
+    const osg::Vec3d v1( cos( d1 ) * cos( r1 ), cos( d1 ) * sin( r1 ), sin( d1 ) );
+    // atan2 of cross and dot is accurate for tiny angles, unlike acos.
+    const double angle( atan2( ( v0 ^ v1 ).length(), v0 * v1 ) );
+    return( osg::RadiansToDegrees( angle ) * 3600. );
+}
+
+// Difference in seconds of time between two hour angles.
+double
+hoursDifference( double h0, double h1 )
+{
+    double delta( fmod( fabs( h0 - h1 ), 24. ) );
+    if( delta > 12. )
+        delta = 24. - delta;
+    return( delta * 3600. );
+}
+
+// Converts each DateTime to a modified Julian date and back, and
+// returns the number of mismatches.
+unsigned int
+testRoundTrip()
+{
+    const int dates[][ 6 ] = {
+        { 2011, 1, 1, 6, 0, 0 },
+        { 2011, 1, 1, 0, 0, 0 },
+        { 2011, 1, 1, 12, 0, 0 },
+        { 2011, 6, 30, 23, 59, 59 },
+        { 2000, 2, 29, 11, 59, 59 },
+        { 1999, 12, 31, 12, 0, 1 },
+        { 1970, 1, 1, 0, 0, 0 },
+        { 2038, 1, 19, 3, 14, 7 } };
+    const unsigned int numDates( sizeof( dates ) / sizeof( dates[ 0 ] ) );
+
+    unsigned int failures( 0 );
+    unsigned int idx;
+    for( idx=0; idx<numDates; idx++ )
+    {
+        const int* d( dates[ idx ] );
+        osgEphemeris::DateTime dt( d[ 0 ], d[ 1 ], d[ 2 ], d[ 3 ], d[ 4 ], d[ 5 ] );
+        osgEphemeris::DateTime result( backdropFX::EphemerisCache::toDateTime( dt.getModifiedJulianDate() ) );
+        if( ( result.getYear() != d[ 0 ] ) || ( result.getMonth() != d[ 1 ] ) ||
+            ( result.getDayOfMonth() != d[ 2 ] ) || ( result.getHour() != d[ 3 ] ) ||
+            ( result.getMinute() != d[ 4 ] ) || ( result.getSecond() != d[ 5 ] ) )
+        {
+            std::cout << "  Round trip " << d[ 0 ] << "/" << d[ 1 ] << "/" << d[ 2 ] << " " <<
+                d[ 3 ] << ":" << d[ 4 ] << ":" << d[ 5 ] << " returned " <<
+                result.getYear() << "/" << result.getMonth() << "/" << result.getDayOfMonth() << " " <<
+                result.getHour() << ":" << result.getMinute() << ":" << result.getSecond() << std::endl;
+            failures++;
+        }
+    }
+    std::cout << "DateTime round trip: " << numDates - failures << " of " << numDates << " match." << std::endl;
+    return( failures );
+}
+
+// Checks EphemerisCache::computePlanet() daily for a year against limits
+// any planet position must meet: the greatest elongations of Mercury and
+// Venus from the Sun, and the range of each planet's magnitude. Returns
+// the number of failures.
+unsigned int
+testPlanets( backdropFX::EphemerisCache* cache, double startMJD,
+    double latitude, double longitude )
+{
+    const char* names[ backdropFX::EphemerisCache::NUM_PLANETS ] = {
+        "Mercury", "Venus", "Mars", "Jupiter", "Saturn" };
+    // Greatest elongation in degrees, and brightest and faintest magnitude,
+    // each with a margin for the accuracy of the mean elements. Mercury is
+    // faintest near inferior conjunction, where the phase term dominates.
+    const double maxElongation[ backdropFX::EphemerisCache::NUM_PLANETS ] = {
+        28.5, 47.5, 180., 180., 180. };
+    const double magnitudeRange[ backdropFX::EphemerisCache::NUM_PLANETS ][ 2 ] = {
+        { -2.6, 8.0 }, { -4.9, -3.5 }, { -3.0, 2.0 }, { -3.0, -1.5 }, { -0.6, 1.6 } };
+
+    unsigned int failures( 0 );
+    unsigned int planet;
+    for( planet=0; planet<backdropFX::EphemerisCache::NUM_PLANETS; planet++ )
+    {
+        double greatest( 0. ), brightest( 100. ), faintest( -100. );
+        unsigned int day;
+        for( day=0; day<366; day++ )
+        {
+            const double mjd( startMJD + day );
+            backdropFX::EphemerisCache::Sample sun;
+            cache->computeSample( mjd, latitude, longitude, sun );
+            double ra, dec, magnitude;
+            backdropFX::EphemerisCache::computePlanet(
+                (backdropFX::EphemerisCache::Planet)planet, mjd, ra, dec, magnitude );
+            greatest = osg::maximum( greatest,
+                separation( ra, dec, sun._sunRA, sun._sunDec ) / 3600. );
+            brightest = osg::minimum( brightest, magnitude );
+            faintest = osg::maximum( faintest, magnitude );
+        }
+        const bool pass( ( greatest <= maxElongation[ planet ] ) &&
+            ( brightest >= magnitudeRange[ planet ][ 0 ] ) &&
+            ( faintest <= magnitudeRange[ planet ][ 1 ] ) );
+        std::cout << "  " << names[ planet ] << ": greatest elongation " << greatest <<
+            ", magnitude " << brightest << " to " << faintest <<
+            ( pass ? "" : " (out of range)" ) << std::endl;
+        if( !pass )
+            failures++;
+    }
+    std::cout << "Planets: " << backdropFX::EphemerisCache::NUM_PLANETS - failures << " of " <<
+        backdropFX::EphemerisCache::NUM_PLANETS << " within limits." << std::endl;
+    return( failures );
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " compares interpolated EphemerisCache samples against direct computation." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "-s <minutes>", "Cache step. Default: 10." );
+    usage->addCommandLineOption( "-n <n>", "Number of random times to test. Default: 10000." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    double step( 10. );
+    arguments.read( "-s", step );
+    unsigned int numTests( 10000 );
+    arguments.read( "-n", numTests );
+    // Tolerances: arc seconds for Sun and Moon, seconds of time for LST.
+    const double sunTolerance( 1. ), moonTolerance( 10. ), lstTolerance( .1 );
+
+    // Default backdropFX location (ISU campus) and date.
+    const double latitude( 42.04444 ), longitude( -93.65 );
+    const double startMJD( osgEphemeris::DateTime( 2011, 1, 1, 6, 0, 0 ).getModifiedJulianDate() );
+
+    osg::ref_ptr< backdropFX::EphemerisCache > cache( new backdropFX::EphemerisCache );
+    cache->setStep( step );
+
+    // Time the table computation.
+    osg::Timer timer;
+    timer.setStartTick();
+    cache->fill( startMJD, latitude, longitude );
+    std::cout << "Table: " << cache->getWindow() << " hours at " << step << " minute steps, " <<
+        timer.time_m() << " ms." << std::endl;
+
+    // Compare interpolated samples against direct computation, at random
+    // times within the part of the window that doesn't request a refill.
+    const double span( cache->getWindow() / 24. * .6 );
+    double maxSun( 0. ), maxMoon( 0. ), maxLST( 0. );
+    double cachedTime( 0. ), directTime( 0. );
+    unsigned int misses( 0 );
+    srand( 1 );
+    unsigned int idx;
+    for( idx=0; idx<numTests; idx++ )
+    {
+        const double mjd( startMJD + span * (double)rand() / (double)RAND_MAX );
+        // Every other sample, move within the location tolerance.
+        const double offset( ( idx & 1 ) ? cache->getLocationTolerance() *
+            ( 2. * (double)rand() / (double)RAND_MAX - 1. ) : 0. );
+        const double sampleLat( latitude + offset ), sampleLong( longitude - offset );
+
+        backdropFX::EphemerisCache::Sample cached, direct;
+        timer.setStartTick();
+        if( !( cache->getSample( mjd, sampleLat, sampleLong, cached ) ) )
+            misses++;
+        cachedTime += timer.time_u();
+
+        timer.setStartTick();
+        cache->computeSample( mjd, sampleLat, sampleLong, direct );
+        directTime += timer.time_u();
+
+        maxSun = osg::maximum( maxSun, separation(
+            cached._sunRA, cached._sunDec, direct._sunRA, direct._sunDec ) );
+        maxMoon = osg::maximum( maxMoon, separation(
+            cached._moonRA, cached._moonDec, direct._moonRA, direct._moonDec ) );
+        maxLST = osg::maximum( maxLST, hoursDifference( cached._lst, direct._lst ) );
+    }
+
+    std::cout << numTests << " samples, " << misses << " cache misses." << std::endl;
+    std::cout << "  Cached: " << cachedTime / numTests << " us/sample." << std::endl;
+    std::cout << "  Direct: " << directTime / numTests << " us/sample." << std::endl;
+    std::cout << "Maximum error:" << std::endl;
+    std::cout << "  Sun:  " << maxSun << " arc seconds (tolerance " << sunTolerance << ")" << std::endl;
+    std::cout << "  Moon: " << maxMoon << " arc seconds (tolerance " << moonTolerance << ")" << std::endl;
+    std::cout << "  LST:  " << maxLST << " seconds (tolerance " << lstTolerance << ")" << std::endl;
+
+    // Outside the location tolerance, the table must not be used.
+    backdropFX::EphemerisCache::Sample moved;
+    const bool movedMiss( !( cache->getSample( startMJD,
+        latitude + cache->getLocationTolerance() * 2., longitude, moved ) ) );
+    std::cout << "Sample outside location tolerance: " <<
+        ( movedMiss ? "computed directly" : "interpolated (error)" ) << std::endl;
+
+    const unsigned int roundTripFailures( testRoundTrip() );
+    const unsigned int planetFailures( testPlanets( cache.get(), startMJD, latitude, longitude ) );
+
+    const bool pass( ( misses == 0 ) && movedMiss && ( roundTripFailures == 0 ) &&
+        ( planetFailures == 0 ) && ( maxSun <= sunTolerance ) &&
+        ( maxMoon <= moonTolerance ) && ( maxLST <= lstTolerance ) );
+    std::cout << ( pass ? "PASS" : "FAIL" ) << std::endl;
+    return( pass ? 0 : 1 );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page ephemeriscachetest Test: ephemeriscache
+
+The purpose of this test is to verify the accuracy of EphemerisCache
+interpolation. It requires no window or OpenGL context.
+
+The test fills an EphemerisCache at the default backdropFX location and
+date, then compares interpolated samples at random times against direct
+osgEphemeris computation. Half of the samples are at random locations
+within the cache's location tolerance, and one sample outside the tolerance
+must be computed directly. It also converts several DateTimes to modified
+Julian dates and back with EphemerisCache::toDateTime(), and checks that
+they match to the second. Finally, it computes the planets daily for a
+year with EphemerisCache::computePlanet(), and checks that Mercury and
+Venus stay within their greatest elongations from the Sun, and that each
+planet's magnitude stays within its known range. It prints the maximum Sun and Moon position error
+in arc seconds, the maximum local sidereal time error in seconds, and the
+average time per sample for each method. It returns 0 if all errors are
+within tolerance (Sun 1 arc second, Moon 10 arc seconds, LST .1 second),
+every sample within the location tolerance came from the table, every
+DateTime round trip matched, and every planet stayed within its limits, and
+1 otherwise.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-s <minutes></b></td>
+    <td>Cache step (see EphemerisCache::setStep()). Default: 10.</td>
+  </tr>
+  <tr>
+    <td><b>-n <n></b></td>
+    <td>Number of random times to test. Default: 10000.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+*/
+
+
+// backdropFX
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <backdropFX/LocationData.h>
+#include <osgEphemeris/DateTime.h>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+
+#include "TestUtils.h"
+
+#include <iostream>
+
+
+
+// Counts its calls and accumulates the change masks it receives.
+class CountCB : public backdropFX::LocationData::Callback
+{
+public:
+    CountCB()
+      : _calls( 0 ),
+        _mask( 0 )
+    {}
+
+    virtual void operator()( unsigned int changeMask )
+    {
+        _calls++;
+        _mask |= changeMask;
+    }
+
+    void reset() { _calls = 0; _mask = 0; }
+
+    unsigned int _calls;
+    unsigned int _mask;
+};
+
+// Removes itself, and releases the only other reference to a victim, from
+// within the notification.
+class RemoveCB : public backdropFX::LocationData::Callback
+{
+public:
+    RemoveCB( backdropFX::LocationData* ld, osg::ref_ptr< CountCB >& victim )
+      : _ld( ld ),
+        _victim( victim )
+    {}
+
+    virtual void operator()( unsigned int )
+    {
+        _ld->removeCallback( this );
+        _victim = NULL;
+    }
+
+protected:
+    backdropFX::LocationData* _ld;
+    osg::ref_ptr< CountCB >& _victim;
+};
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " checks LocationData change notification." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    typedef backdropFX::LocationData LD;
+    testUtils::Results results;
+    osg::ref_ptr< LD > ld( new LD );
+    osg::ref_ptr< CountCB > cb( new CountCB );
+
+    // Adding twice registers once. Each change notifies once.
+    ld->addCallback( cb.get() );
+    ld->addCallback( cb.get() );
+    ld->setLatitudeLongitude( 39.86, -104.68 );
+    results.check( ( cb->_calls == 1 ) && ( cb->_mask == LD::LatLongChanged ),
+        "setLatitudeLongitude() didn't notify once" );
+
+    // Setting the current value notifies nothing.
+    cb->reset();
+    ld->setLatitudeLongitude( 39.86, -104.68 );
+    ld->setDateTime( ld->getDateTime() );
+    results.check( cb->_calls == 0, "unchanged values notified" );
+
+    // Nested updates notify once, from the outermost endUpdate().
+    ld->beginUpdate();
+    ld->setLatitudeLongitude( 42.04444, -93.65 );
+    ld->beginUpdate();
+    ld->setEastUp( osg::Vec3( 0., 1., 0. ), osg::Vec3( 1., 0., 0. ) );
+    ld->endUpdate();
+    results.check( cb->_calls == 0, "notified inside beginUpdate()" );
+    ld->setDateTime( osgEphemeris::DateTime( 2011, 6, 21, 16, 0, 0 ) );
+    ld->endUpdate();
+    results.check( ( cb->_calls == 1 ) &&
+        ( cb->_mask == ( LD::LatLongChanged | LD::EastUpChanged | LD::DateTimeChanged ) ),
+        "endUpdate() didn't notify once with every change" );
+
+    // A deleted callback is dropped, and a callback that might reuse its
+    // address can still register.
+    cb = NULL;
+    osg::ref_ptr< CountCB > cb2( new CountCB );
+    ld->addCallback( cb2.get() );
+    ld->setLatitudeLongitude( 0., 0. );
+    results.check( ( ld->getCallbackList().size() == 1 ) && ( cb2->_calls == 1 ),
+        "deleted callback wasn't dropped" );
+
+    // A callback may remove itself, and release the last other reference
+    // to a callback that hasn't executed yet, while the callbacks execute.
+    osg::ref_ptr< CountCB > victim( new CountCB );
+    osg::ref_ptr< RemoveCB > remover( new RemoveCB( ld.get(), victim ) );
+    ld->addCallback( remover.get() );
+    ld->addCallback( victim.get() );
+    cb2->reset();
+    ld->setLatitudeLongitude( 1., 1. );
+    results.check( !( victim.valid() ) && ( cb2->_calls == 1 ),
+        "removal during notification disturbed the other callbacks" );
+    cb2->reset();
+    ld->setLatitudeLongitude( 2., 2. );
+    results.check( ( ld->getCallbackList().size() == 1 ) && ( cb2->_calls == 1 ),
+        "removed callbacks still registered" );
+
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page locationdatatest Test: locationdata
+
+The purpose of this test is to verify LocationData change notification. It
+requires no window or OpenGL context.
+
+The test registers LocationData::Callback instances with a LocationData
+and checks that a callback added twice is called once per change, that
+setting a value to its current value calls nothing, and that nested
+beginUpdate() and endUpdate() calls defer the callbacks to one call, with
+every change bit set. It also checks that a deleted callback is dropped, and
+that a callback can remove itself, and release the last reference to another
+callback, while the callbacks execute. See \ref testutils for how checks are
+reported.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+*/
+
+
+// backdropFX
+}
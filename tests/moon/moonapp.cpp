@@ -6,6 +6,8 @@
 
 #include <backdropFX/MoonBody.h>
 
+#include <cmath>
+
 
 int
 main( int argc,
@@ -35,17 +37,6 @@ main( int argc,
         m = osg::Matrix::identity();
         osg::Uniform* orientUniform = new osg::Uniform( "celestialOrientation", m );
         ss->addUniform( orientUniform );
-
-        osg::Uniform* moonxformUniform = new osg::Uniform( "moonTransform", m );
-        ss->addUniform( moonxformUniform );
-
-        osg::Uniform* sunPosUniform = new osg::Uniform( "sunPosition",
-            osg::Vec3( -1., 0., 0. ) );
-        ss->addUniform( sunPosUniform );
-
-        osg::Matrix3 mo;
-        osg::Uniform* moonOrientation = new osg::Uniform( "moonOrientation", mo );
-        ss->addUniform( moonOrientation );
     }
     moon->update(); // must call before rendering.
 
@@ -56,6 +47,11 @@ main( int argc,
 
     while( !viewer.done() )
     {
+        // Move the Sun around the sky once every 10 seconds to show the
+        // full cycle of Moon phases.
+        const double sunRA( fmod( 12. + viewer.getFrameStamp()->getSimulationTime() * 2.4, 24. ) );
+        moon->setSunRADec( sunRA, 0. );
+
         viewProjUniform->set( viewer.getCamera()->getViewMatrix() * 
             viewer.getCamera()->getProjectionMatrix() );
         viewer.frame();
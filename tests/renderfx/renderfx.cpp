@@ -15,6 +15,7 @@
 #include <backdropFX/RenderingEffects.h>
 
 #include <backdropFX/Effect.h>
+#include <backdropFX/EffectGraph.h>
 #include <backdropFX/EffectLibrary.h>
 #include <backdropFX/EffectLibraryUtils.h>
 
@@ -79,6 +80,20 @@ public:
         osg::notify( osg::NOTICE ) << "  F1\tDecrease focal distance." << std::endl;
         osg::notify( osg::NOTICE ) << "  F2\tIncrease focal distance." << std::endl;
         osg::notify( osg::NOTICE ) << "  Del\tClear effects vector." << std::endl;
+        osg::notify( osg::NOTICE ) << "  o\tToggle EffectGraph culling, fusion, and texture aliasing." << std::endl;
+        osg::notify( osg::NOTICE ) << "  r\tReport EffectGraph passes and texture memory." << std::endl;
+    }
+
+    void report( const backdropFX::EffectGraph& graph )
+    {
+        osg::notify( osg::NOTICE ) << "EffectGraph (" << ( graph.getOptimize() ? "optimized" : "not optimized" ) << "):" << std::endl;
+        osg::notify( osg::NOTICE ) << "  Effects: " << graph.getNumDrawnNodes() << " of " << graph.getNumNodes() << " drawn." << std::endl;
+        osg::notify( osg::NOTICE ) << "  Passes: " << graph.getNumDrawnPasses() << " of " << graph.getNumPasses() << " drawn." << std::endl;
+        osg::notify( osg::NOTICE ) << "  Fused: " << graph.getNumFusedEffects() << " Effects in " <<
+            graph.getNumFusedPrograms() << " generated programs." << std::endl;
+        osg::notify( osg::NOTICE ) << "  Transient textures: " << graph.getNumAllocatedTextures() << " of " <<
+            graph.getNumTransientTextures() << " allocated, " << graph.getAllocatedBytes() / 1024 << " of " <<
+            graph.getTransientBytes() / 1024 << " KB." << std::endl;
     }
 
     virtual bool handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa )
@@ -188,6 +203,21 @@ public:
                 }
                 break;
             }
+            case 'o': // optimize
+            {
+                backdropFX::EffectGraph* graph = rfx.getEffectGraph();
+                graph->setOptimize( !( graph->getOptimize() ) );
+                osg::notify( osg::NOTICE ) << "EffectGraph optimization " << ( graph->getOptimize() ? "on." : "off." ) << std::endl;
+                handled = true;
+                break;
+            }
+            case 'r': // report
+            {
+                // Reflects the last compile, which happens during draw.
+                report( *( rfx.getEffectGraph() ) );
+                handled = true;
+                break;
+            }
             case osgGA::GUIEventAdapter::KEY_Delete: // delete, clear all effects
             {
                 _glow = false;
@@ -0,0 +1,233 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgDB/ReadFile>
+#include <osgViewer/Viewer>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/GraphicsContext>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/ShadowMap.h>
+#include <backdropFX/ShaderModule.h>
+#include <backdropFX/ShaderModuleVisitor.h>
+#include <backdropFX/ShaderModuleUtils.h>
+
+#include <osgwTools/ReadFile.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+
+
+/** \cond */
+struct BenchCase
+{
+    std::string _name;
+    bool _shadows;
+    backdropFX::ShadowMap::SoftShadowMode _mode;
+};
+/** \endcond */
+
+
+void
+backdropFXSetUp( osg::Node* root, unsigned int width, unsigned int height )
+{
+    osg::ref_ptr< osg::Light > light = new osg::Light;
+    light->setLightNum( 0 );
+    light->setPosition( osg::Vec4( 1.1, -30.0, 30.0, 1.0 ) );
+    backdropFX::Manager::instance()->setLight( light.get() );
+
+    backdropFX::Manager::instance()->setSceneData( root );
+    backdropFX::Manager::instance()->rebuild(
+        backdropFX::Manager::shadowMap );
+
+    // Must always explicitly set the width and height of the rendered area.
+    backdropFX::Manager::instance()->setTextureWidthHeight( width, height );
+}
+
+int
+main( int argc, char ** argv )
+{
+    osg::ref_ptr< osg::Group > root = new osg::Group;
+    root->setName( "shadowbench root" );
+
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " measures the per-pixel cost of each soft shadow mode." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options] [<model> ...]" );
+    usage->addCommandLineOption( "-f <n>", "Frames to time per mode. Default: 200." );
+    usage->addCommandLineOption( "-r <texels>", "Soft shadow kernel radius. Default: 1.5." );
+    usage->addCommandLineOption( "-c <n>", "Number of Sun cascades. Default: 0." );
+    usage->addCommandLineOption( "-w <w> <h>", "Window width and height. Default: 1280 720." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    unsigned int frames( 200 );
+    arguments.read( "-f", frames );
+    float radius( 1.5f );
+    arguments.read( "-r", radius );
+    unsigned int cascades( 0 );
+    arguments.read( "-c", cascades );
+    unsigned int width( 1280 ), height( 720 );
+    arguments.read( "-w", width, height );
+
+    osg::Node* loadedModels = osgDB::readNodeFiles( arguments );
+    if( loadedModels == NULL )
+        loadedModels = osgwTools::readNodeFiles( "dumptruck.osg.(0,0,7).trans" );
+    root->addChild( loadedModels );
+    osg::ref_ptr< osg::Node > ground = osgDB::readNodeFile( "lzground.osg" );
+    if( ground.valid() )
+        root->addChild( ground.get() );
+
+    // Convert loaded data to use shader composition.
+    {
+        backdropFX::ShaderModuleVisitor smv;
+        smv.setAttachMain( false ); // Use bdfx-main
+        smv.setAttachTransform( false ); // Use bdfx-transform
+        backdropFX::convertFFPToShaderModules( root.get(), &smv );
+    }
+
+    backdropFXSetUp( root.get(), width, height );
+    backdropFX::ShadowMap& sm = backdropFX::Manager::instance()->getShadowMap();
+    sm.setSoftShadowRadius( radius );
+    sm.setNumSunCascades( cascades );
+
+
+    // Swap interval must not limit the frame rate.
+    osg::ref_ptr< osg::GraphicsContext::Traits > traits = new osg::GraphicsContext::Traits;
+    traits->x = 20; traits->y = 30;
+    traits->width = width; traits->height = height;
+    traits->windowDecoration = true;
+    traits->doubleBuffer = true;
+    traits->vsync = false;
+    osg::ref_ptr< osg::GraphicsContext > gc = osg::GraphicsContext::createGraphicsContext( traits.get() );
+    if( !gc.valid() )
+    {
+        osg::notify( osg::FATAL ) << "shadowbench: Can't create graphics context." << std::endl;
+        return( 1 );
+    }
+
+    osgViewer::Viewer viewer;
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setGraphicsContext( gc.get() );
+    viewer.getCamera()->setViewport( new osg::Viewport( 0, 0, width, height ) );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix( osg::Matrix::perspective(
+        35., (double)width / (double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( backdropFX::Manager::instance()->getManagedRoot() );
+    viewer.realize();
+
+    // Fixed camera, looking at the model from above and to the side, so
+    // that most pixels receive shadow lookups.
+    const osg::BoundingSphere& bs( root->getBound() );
+    viewer.getCamera()->setViewMatrix( osg::Matrix::lookAt(
+        bs.center() + osg::Vec3( bs.radius() * .8, -bs.radius() * 1.6, bs.radius() * 1.2 ),
+        bs.center(), osg::Vec3( 0., 0., 1. ) ) );
+
+    BenchCase cases[] = {
+        { "no shadows", false, backdropFX::ShadowMap::SHADOW_HARD },
+        { "SHADOW_HARD", true, backdropFX::ShadowMap::SHADOW_HARD },
+        { "SHADOW_PCF", true, backdropFX::ShadowMap::SHADOW_PCF },
+        { "SHADOW_PCF_KERNEL", true, backdropFX::ShadowMap::SHADOW_PCF_KERNEL }
+    };
+    const unsigned int numCases( sizeof( cases ) / sizeof( BenchCase ) );
+
+    const double pixels( (double)width * (double)height );
+    double baseline( 0. );
+    testUtils::Results results;
+    std::cout << std::fixed << std::setprecision( 3 );
+    std::cout << "shadowbench: " << frames << " frames, " << width << "x" << height <<
+        ", radius " << radius << ", " << cascades << " cascades" << std::endl;
+    unsigned int idx;
+    for( idx=0; idx<numCases; idx++ )
+    {
+        const BenchCase& bc( cases[ idx ] );
+        sm.setSoftShadowMode( bc._mode );
+        unsigned int features( backdropFX::Manager::skyDome | backdropFX::Manager::depthPeel );
+        if( bc._shadows )
+            features |= backdropFX::Manager::shadowMap;
+        backdropFX::Manager::instance()->rebuild( features );
+        results.check( sm.getSoftShadowMode() == bc._mode, bc._name + " wasn't selected" );
+
+        const double ms( testUtils::timeFrames( viewer, frames ) );
+        if( !results.check( ms > 0., bc._name + " rendered no timed frames" ) )
+            break;
+        if( !bc._shadows )
+            baseline = ms;
+
+        // Shadow cost is relative to the unshadowed baseline.
+        const double shadowNs( ( ms - baseline ) * 1.e6 / pixels );
+        std::cout << "  " << std::setw( 20 ) << std::left << bc._name << std::right <<
+            std::setw( 10 ) << ms << " ms/frame" <<
+            std::setw( 10 ) << shadowNs << " ns/pixel shadow cost" << std::endl;
+    }
+
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page shadowbench Test: shadowbench
+
+The purpose of this test is to measure the per-pixel cost of each
+ShadowMap::SoftShadowMode (see ShadowMap::setSoftShadowMode()).
+
+The test renders the scene with a fixed camera, first without shadows to
+establish a baseline, then once per soft shadow mode, rebuilding the Manager
+for each. It prints the average frame time (see \ref testutils), and the
+difference from the baseline divided by the number of window pixels: the
+cost of the shadow lookups in each pixel. The test creates its window with
+vsync disabled itself. It fails if a mode isn't selected after the rebuild,
+or if the window closes before a mode is timed.
+
+Expected relative costs, per shadowed pixel per light:
+\li SHADOW_HARD: 1 NEAREST depth compare.
+\li SHADOW_PCF: 1 LINEAR depth compare (4 texels, filtered in hardware).
+Typically within a few percent of SHADOW_HARD.
+\li SHADOW_PCF_KERNEL: 16 LINEAR depth compares and 8 kernel texel fetches.
+
+The test loads the specified model, or \c dumptruck.osg if none is specified,
+and \c lzground.osg as a shadow receiver. It is lit by light 0.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time per mode. Default: 200.</td>
+  </tr>
+  <tr>
+    <td><b>-r <texels></b></td>
+    <td>Soft shadow kernel radius (see ShadowMap::setSoftShadowRadius()). Default: 1.5.</td>
+  </tr>
+  <tr>
+    <td><b>-c <n></b></td>
+    <td>Number of Sun cascades (see ShadowMap::setNumSunCascades()). Default: 0.</td>
+  </tr>
+  <tr>
+    <td><b>-w <w> <h></b></td>
+    <td>Window width and height. Default: 1280 720.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+*/
+
+
+// backdropFX
+}
@@ -0,0 +1,284 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osgGA/TrackballManipulator>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Math>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/SkyDome.h>
+#include <backdropFX/LocationData.h>
+#include <backdropFX/StarCatalog.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+
+
+// Reads "<ra hours> <dec degrees> <magnitude> [<B-V>]" lines.
+bool
+readTextCatalog( const std::string& fileName, std::vector< backdropFX::StarCatalog::Star >& stars )
+{
+    std::ifstream istr( fileName.c_str() );
+    if( !istr.good() )
+        return( false );
+    std::string line;
+    while( std::getline( istr, line ) )
+    {
+        if( line.empty() || ( line[ 0 ] == '#' ) )
+            continue;
+        std::istringstream lstr( line );
+        double ra, dec;
+        backdropFX::StarCatalog::Star star;
+        if( !( lstr >> ra >> dec >> star._magnitude ) )
+            continue;
+        if( !( lstr >> star._colorIndex ) )
+            star._colorIndex = .6f; // Sun-like
+        backdropFX::StarCatalog::computeDirection( ra, dec, star );
+        stars.push_back( star );
+    }
+    return( true );
+}
+
+// Random stars with a roughly realistic magnitude distribution: the number
+// of stars brighter than m grows by about 10^0.5 per magnitude, with about
+// 9000 stars brighter than 6.5.
+void
+createSyntheticCatalog( unsigned int numStars, std::vector< backdropFX::StarCatalog::Star >& stars )
+{
+    const double faintest( 6.5 + log10( numStars / 9000. ) / .5 );
+    srand( 1 );
+    stars.resize( numStars );
+    unsigned int idx;
+    for( idx=0; idx<numStars; idx++ )
+    {
+        const double u( ( rand() + 1. ) / ( RAND_MAX + 1. ) );
+        const double ra( 24. * rand() / RAND_MAX );
+        const double dec( osg::RadiansToDegrees( asin( 2. * rand() / RAND_MAX - 1. ) ) );
+        backdropFX::StarCatalog::Star& star( stars[ idx ] );
+        backdropFX::StarCatalog::computeDirection( ra, dec, star );
+        star._magnitude = (float)( faintest + log10( u ) / .5 );
+        star._colorIndex = (float)( -.3 + 2.1 * rand() / RAND_MAX );
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " writes a binary star catalog and times loading and drawing it." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options]" );
+    usage->addCommandLineOption( "-i <file>", "Text catalog to convert. Default: synthetic catalog." );
+    usage->addCommandLineOption( "-o <file>", "Binary catalog to write. Default: bdfx-stars.cat." );
+    usage->addCommandLineOption( "-n <n>", "Number of synthetic stars. Default: 120000." );
+    usage->addCommandLineOption( "-m <mag>", "Magnitude limit. Default: 6.5." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 500." );
+    usage->addCommandLineOption( "--nowindow", "Measure catalog load time only." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    std::string inFile;
+    arguments.read( "-i", inFile );
+    std::string outFile( "bdfx-stars.cat" );
+    arguments.read( "-o", outFile );
+    unsigned int numStars( 120000 );
+    arguments.read( "-n", numStars );
+    float limit( 6.5f );
+    arguments.read( "-m", limit );
+    unsigned int numFrames( 500 );
+    arguments.read( "-f", numFrames );
+    const bool noWindow( arguments.read( "--nowindow" ) );
+
+    // Create the binary catalog.
+    std::vector< backdropFX::StarCatalog::Star > stars;
+    if( !( inFile.empty() ) )
+    {
+        if( !( readTextCatalog( inFile, stars ) ) )
+        {
+            std::cerr << "Can't read " << inFile << std::endl;
+            return( 1 );
+        }
+    }
+    else
+        createSyntheticCatalog( numStars, stars );
+
+    osg::Timer timer;
+    timer.setStartTick();
+    if( !( backdropFX::StarCatalog::write( outFile, stars ) ) )
+    {
+        std::cerr << "Can't write " << outFile << std::endl;
+        return( 1 );
+    }
+    std::cout << "Wrote " << stars.size() << " stars to " << outFile << " in " <<
+        timer.time_m() << " ms." << std::endl;
+
+    // Time loading it.
+    osg::ref_ptr< backdropFX::StarCatalog > catalog( new backdropFX::StarCatalog );
+    timer.setStartTick();
+    if( !( catalog->load( outFile ) ) )
+    {
+        std::cerr << "Can't load " << outFile << std::endl;
+        return( 1 );
+    }
+    const double loadTime( timer.time_m() );
+    timer.setStartTick();
+    const unsigned int numDrawn( catalog->getNumStarsBrighterThan( limit ) );
+    const double limitTime( timer.time_u() );
+    std::cout << "Loaded " << catalog->getNumStars() << " stars in " << loadTime << " ms." << std::endl;
+    std::cout << "  " << numDrawn << " stars brighter than " << limit <<
+        " (" << limitTime << " us)." << std::endl;
+
+    // The catalog must hold every star, and the stars brighter than the
+    // limit must be exactly the ones a linear search finds.
+    testUtils::Results results;
+    unsigned int expectedDrawn( 0 );
+    unsigned int idx;
+    for( idx=0; idx<stars.size(); idx++ )
+    {
+        if( stars[ idx ]._magnitude <= limit )
+            expectedDrawn++;
+    }
+    if( ( catalog->getNumStars() != stars.size() ) || ( numDrawn != expectedDrawn ) )
+        results.fail() << "expected " << stars.size() << " stars, " <<
+            expectedDrawn << " brighter than " << limit << "." << std::endl;
+
+    if( noWindow || !( results.passed() ) )
+        return( results.report() );
+
+
+    // Measure the per-frame cost of drawing the stars.
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    root->addChild( new osg::Geode );
+
+    const unsigned int width( 800 ), height( 600 );
+    backdropFX::Manager::instance()->setSceneData( root.get() );
+    backdropFX::Manager::instance()->setTextureWidthHeight( width, height );
+    backdropFX::SkyDome& sd = backdropFX::Manager::instance()->getSkyDome();
+    sd.setStarCatalogFileName( outFile );
+    sd.setStarMagnitudeLimit( limit );
+    backdropFX::Manager::instance()->rebuild( backdropFX::Manager::skyDome );
+
+    // Night.
+    backdropFX::LocationData::s_instance()->setDateTime( osgEphemeris::DateTime( 2011, 1, 21, 5, 0, 0 ) );
+    backdropFX::LocationData::s_instance()->setLatitudeLongitude( 39.86, -104.68 );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 30, 30, width, height );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix(
+        osg::Matrix::perspective( 60., (double)width/(double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( backdropFX::Manager::instance()->getManagedRoot() );
+    // Look up at the sky.
+    viewer.getCamera()->setViewMatrixAsLookAt( osg::Vec3( 0., 0., 0. ),
+        osg::Vec3( 0., 1., 1. ), osg::Vec3( 0., 0., 1. ) );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+
+    const double withStars( testUtils::timeFrames( viewer, numFrames ) );
+    const unsigned int sdDrawn( sd.getNumStarsDrawn() );
+    std::cout << "  " << sdDrawn << " stars: " << withStars << " ms/frame." << std::endl;
+    // The planets still draw.
+    sd.setStarMagnitudeLimit( -100.f );
+    const double withoutStars( testUtils::timeFrames( viewer, numFrames ) );
+    const unsigned int sdNoneDrawn( sd.getNumStarsDrawn() );
+    std::cout << "  No stars: " << withoutStars << " ms/frame." << std::endl;
+    std::cout << "Star field cost: " << withStars - withoutStars << " ms/frame." << std::endl;
+
+    if( sdDrawn != numDrawn )
+        results.fail() << "SkyDome drew " << sdDrawn << " stars, expected " << numDrawn << "." << std::endl;
+    if( sdNoneDrawn != 0 )
+        results.fail() << "SkyDome drew " << sdNoneDrawn << " stars below every star's magnitude." << std::endl;
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( results.report() );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page starfieldtest Test: starfield
+
+The purpose of this test is to create a binary StarCatalog, and to measure
+catalog load time and the per-frame cost of the SkyDome star field.
+
+The test converts a text catalog (see -i), or creates a synthetic catalog of
+random stars, and writes it as a binary catalog. It then times loading the
+catalog and finding the stars brighter than the magnitude limit, and checks
+that the catalog holds every star and that the stars brighter than the limit
+match a linear search. Unless --nowindow is specified, it opens a window
+looking up at the night sky and prints the average frame time with the star
+field and without it (the magnitude limit set so that no stars draw; the
+planets still draw), and checks that SkyDome::getNumStarsDrawn() matches the
+catalog both times. The difference is the cost of the star field draw call,
+which has no per-frame CPU work beyond the magnitude limit lookup. See
+\ref testutils for how frames are timed and checks reported.
+
+Text catalogs have one star per line: right ascension in hours, declination in
+degrees, visual magnitude, and optionally the B-V color index, separated by
+white space. Lines starting with '#' are ignored. Extract these columns from a
+catalog such as HYG or Hipparcos, then convert it with this test and copy the
+output to bdfx-stars.cat in the data directory to use it as the SkyDome
+default catalog.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>-i <file></b></td>
+    <td>Text catalog to convert. Default: a synthetic catalog.</td>
+  </tr>
+  <tr>
+    <td><b>-o <file></b></td>
+    <td>Binary catalog to write. Default: bdfx-stars.cat.</td>
+  </tr>
+  <tr>
+    <td><b>-n <n></b></td>
+    <td>Number of stars in the synthetic catalog. Default: 120000.</td>
+  </tr>
+  <tr>
+    <td><b>-m <mag></b></td>
+    <td>Magnitude limit (see SkyDome::setStarMagnitudeLimit()). Default: 6.5.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time with and without stars. Default: 500.</td>
+  </tr>
+  <tr>
+    <td><b>--nowindow</b></td>
+    <td>Write and time loading the catalog, but don't render.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}
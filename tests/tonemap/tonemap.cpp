@@ -0,0 +1,191 @@
+// Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osgDB/ReadFile>
+
+#include <backdropFX/Manager.h>
+#include <backdropFX/RenderingEffects.h>
+#include <backdropFX/EffectLibrary.h>
+
+#include "TestUtils.h"
+
+#include <iostream>
+
+
+
+// Checks that the output texture of \c effect has the color buffer A format
+// for \c hdr.
+void
+checkOutputFormat( testUtils::Results& results, backdropFX::Effect* effect, bool hdr )
+{
+    osg::FrameBufferObject* fbo( effect->getOutput() );
+    const GLint expected( hdr ? GL_RGBA16F_ARB : GL_RGBA );
+    const osg::Texture* tex( ( fbo != NULL ) && fbo->hasAttachment( osg::Camera::COLOR_BUFFER0 ) ?
+        fbo->getAttachment( osg::Camera::COLOR_BUFFER0 ).getTexture() : NULL );
+    if( ( tex == NULL ) || ( tex->getInternalFormat() != expected ) )
+        results.fail() << effect->getName() << " output is not " <<
+            ( hdr ? "floating point" : "8-bit" ) << "." << std::endl;
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    osg::ApplicationUsage* usage( arguments.getApplicationUsage() );
+    usage->setDescription( arguments.getApplicationName() +
+        " times EffectToneMapping and shows it adapting to the scene." );
+    usage->setCommandLineUsage( arguments.getApplicationName() + " [options] [<model> ...]" );
+    usage->addCommandLineOption( "--width <width>", "Window width. Default: 1920." );
+    usage->addCommandLineOption( "--height <height>", "Window height. Default: 1080." );
+    usage->addCommandLineOption( "-k <key>", "Tone mapping key. Default: 0.18." );
+    usage->addCommandLineOption( "--ldr", "Use an 8-bit color buffer A." );
+    usage->addCommandLineOption( "-f <n>", "Frames to time. Default: 200." );
+    usage->addCommandLineOption( "-b <ms>", "Tone mapping budget per frame, 0 to disable. Default: 0.3." );
+    usage->addCommandLineOption( "-h or --help", "Display this information." );
+    if( arguments.read( "-h" ) || arguments.read( "--help" ) )
+    {
+        usage->write( std::cout );
+        return( 0 );
+    }
+
+    unsigned int width( 1920 ), height( 1080 );
+    arguments.read( "--width", width );
+    arguments.read( "--height", height );
+    unsigned int numFrames( 200 );
+    arguments.read( "-f", numFrames );
+    double budget( .3 );
+    arguments.read( "-b", budget );
+    float key( .18f );
+    arguments.read( "-k", key );
+    bool ldr( arguments.read( "--ldr" ) );
+
+    osg::ref_ptr< osg::Group > root( new osg::Group );
+    osg::Node* model( osgDB::readNodeFiles( arguments ) );
+    if( model != NULL )
+        root->addChild( model );
+
+    backdropFX::Manager* mgr( backdropFX::Manager::instance() );
+    mgr->setSceneData( root.get() );
+    mgr->setTextureWidthHeight( width, height );
+    unsigned int features( backdropFX::Manager::skyDome );
+    if( !ldr )
+        features |= backdropFX::Manager::hdr;
+    mgr->rebuild( features );
+
+    osgViewer::Viewer viewer;
+    viewer.setUpViewInWindow( 20, 30, width, height );
+    viewer.setThreadingModel( osgViewer::ViewerBase::SingleThreaded );
+    viewer.getCamera()->setComputeNearFarMode( osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR );
+    viewer.getCamera()->setProjectionMatrix(
+        osg::Matrix::perspective( 35., (double)width/(double)height, .01, 100000. ) );
+    viewer.getCamera()->setClearMask( 0 );
+    viewer.setSceneData( mgr->getManagedRoot() );
+    viewer.addEventHandler( new osgViewer::StatsHandler );
+    viewer.realize();
+
+    backdropFX::RenderingEffects& rfx( mgr->getRenderingEffects() );
+    rfx.setEffectSet( 0 );
+    const double without( testUtils::timeFrames( viewer, numFrames ) );
+    std::cout << "No tone mapping: " << without << " ms/frame." << std::endl;
+
+    rfx.setEffectSet( backdropFX::RenderingEffects::effectToneMapping );
+    backdropFX::EffectToneMapping* toneMap( dynamic_cast< backdropFX::EffectToneMapping* >(
+        rfx.getEffectVector().front().get() ) );
+    if( toneMap != NULL )
+        toneMap->setKey( key );
+    const double with( testUtils::timeFrames( viewer, numFrames ) );
+    std::cout << "Tone mapping: " << with << " ms/frame." << std::endl;
+
+    testUtils::Results results;
+    results.check( toneMap != NULL, "no EffectToneMapping" );
+    results.checkBudget( "Tone mapping cost", with - without, budget );
+
+    // Glow ahead of tone mapping gets an output that follows the hdr flag,
+    // even though it creates the output before its input is attached, and
+    // even after a rebuild changes the flag.
+    rfx.setEffectSet( backdropFX::RenderingEffects::effectGlow |
+        backdropFX::RenderingEffects::effectToneMapping );
+    backdropFX::Effect* glow( rfx.getEffectVector().front().get() );
+    checkOutputFormat( results, glow, !ldr );
+    mgr->rebuild( features ^ backdropFX::Manager::hdr );
+    checkOutputFormat( results, glow, ldr );
+    mgr->rebuild( features );
+    checkOutputFormat( results, glow, !ldr );
+    const int status( results.report() );
+
+    // Keep rendering, so the adaptation is visible.
+    rfx.setEffectSet( backdropFX::RenderingEffects::effectToneMapping );
+    viewer.run();
+
+    // Cleanup and exit.
+    backdropFX::Manager::instance( true );
+    return( status );
+}
+
+
+
+namespace backdropFX
+{
+
+
+/** \page tonemaptest Test: tonemap
+
+The purpose of this test is to measure the cost of EffectToneMapping, and to
+show it adapting to the scene.
+
+The test rebuilds the Manager with a floating point color buffer A (see
+Manager::hdr), times frames with no Effects, then enables
+RenderingEffects::effectToneMapping and times them again. The difference is
+the cost of tone mapping per frame, and the test fails if it exceeds the
+budget (-b, 0.3 ms by default). The luminance reduction shades a fixed number
+of pixels, so the cost should grow only with the full resolution tone mapping
+pass; raise the budget for large windows on slower GPUs rather than disabling
+it.
+
+The test then checks that an Effect ahead of tone mapping gets an output in
+the color buffer A format, and that a rebuild() that changes the hdr flag
+reformats it, and prints PASS or FAIL. Finally, it keeps rendering until you
+close the window, so the adaptation is visible, and then exits with the
+result. See \ref testutils for how frames are timed and checks reported.
+
+Load a model with the command line to tone map more than the sky dome.
+
+\section clp Command Line Parameters
+<table border="0">
+  <tr>
+    <td><b>--width <width> --height <height></b></td>
+    <td>Window size. Default: 1920 1080.</td>
+  </tr>
+  <tr>
+    <td><b>-k <key></b></td>
+    <td>Luminance the scene's average maps to (see EffectToneMapping::setKey()). Default: 0.18.</td>
+  </tr>
+  <tr>
+    <td><b>--ldr</b></td>
+    <td>Use an 8-bit color buffer A. Tone mapping then acts as auto exposure.</td>
+  </tr>
+  <tr>
+    <td><b>-f <n></b></td>
+    <td>Number of frames to time. Default: 200.</td>
+  </tr>
+  <tr>
+    <td><b>-b <ms></b></td>
+    <td>Tone mapping budget in milliseconds per frame. 0 disables the check. Default: 0.3.</td>
+  </tr>
+  <tr>
+    <td><b>-h or --help</b></td>
+    <td>Display command line usage.</td>
+  </tr>
+</table>
+
+\section handlers Supported OSG Event Handlers
+    \li osgViewer::StatsHandler
+
+*/
+
+
+// backdropFX
+}